@@ -57,10 +57,13 @@ int sblist_set(sblist* l, void* item, size_t pos) {
 
 int sblist_grow_if_needed(sblist* l) {
 	char* temp;
+	size_t grow;
 	if(l->count == l->capa) {
-		temp = realloc(l->items, (l->capa + l->blockitems) * l->itemsize);
+		/* grow geometrically, blockitems is the minimum step */
+		grow = l->capa / 2 > l->blockitems ? l->capa / 2 : l->blockitems;
+		temp = realloc(l->items, (l->capa + grow) * l->itemsize);
 		if(!temp) return 0;
-		l->capa += l->blockitems;
+		l->capa += grow;
 		l->items = temp;
 	}
 	return 1;
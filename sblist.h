@@ -10,7 +10,8 @@ extern "C" {
  * simple buffer list.
  * 
  * this thing here is basically a generic dynamic array
- * will realloc after every blockitems inserts
+ * will realloc when full, growing by half its capacity
+ * (but at least blockitems items), so appends are amortized O(1).
  * can store items of any size.
  * 
  * so think of it as a by-value list, as opposed to a typical by-ref list.
@@ -30,6 +31,8 @@ typedef struct {
 #define sblist_getsize(X) ((X)->count)
 #define sblist_get_count(X) ((X)->count)
 #define sblist_empty(X) ((X)->count == 0)
+/* drop all items, keeping the allocated storage for reuse */
+#define sblist_reset(X) ((X)->count = 0)
 
 /* --- for dynamic style --- */
 
@@ -29,13 +29,21 @@
  */
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/param.h> /* MAXNAMLEN */
 #include <sys/tree.h>
+#include <sys/file.h>
+#include <sys/wait.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <linux/fs.h> /* FICLONE */
+#include <sys/syscall.h> /* SYS_copy_file_range */
+#endif
 #include <openssl/ssl.h>
 #include <openssl/ssl3.h>
 #include <openssl/err.h>
@@ -46,6 +54,7 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -53,32 +62,205 @@
 #include <unistd.h>
 #include <libgen.h>
 #include <assert.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <time.h>
+#include <zlib.h>
 
-#include "stringlist.h"
+#include "sblist.h"
 
 #define SVNUP_VERSION "1.09"
 #define BUFFER_UNIT 4096
 #define COMMAND_BUFFER 32768
+#define SOCKET_BUFFER_MAX (16 * 1024 * 1024)
 #define COMMAND_BUFFER_THRESHOLD 32000
+#define POLL_TIMEOUT 30
 
 #define LIT_LEN(S) (sizeof(S)-1)
 #define starts_with_lit(S1, S2) \
 	(strncmp(S1, S2, LIT_LEN(S2)) == 0)
 
+typedef struct {
+	int       present;
+	uint32_t  revision;
+	uint64_t  item;
+	uint64_t  size;
+	uint64_t  expanded_size;
+	char      md5[33];
+} fsfs_rep;
+
+
+typedef struct {
+	int       dir;
+	fsfs_rep  text;
+	fsfs_rep  props;
+} fsfs_noderev;
+
+
+struct fsfs_rev_file {
+	RB_ENTRY(fsfs_rev_file)  link;
+	uint32_t                 first;
+	int                      packed;
+	char                    *map;
+	size_t                   size;
+	size_t                  *manifest;
+	uint32_t                 l2p_first;
+	uint32_t                 l2p_revisions;
+	uint32_t                 l2p_page_size;
+	size_t                  *l2p_rev_pages;
+	struct {
+		uint64_t  offset;
+		uint32_t  size;
+		uint32_t  entries;
+	}                       *l2p_pages;
+};
+
+
+typedef struct {
+	char     *path;
+	char     *uuid;
+	int       format;
+	int       shard_size;
+	int       logical;
+	uint32_t  youngest;
+	uint32_t  min_unpacked;
+	time_t   *dates;
+	RB_HEAD(tree_fsfs_rev_files, fsfs_rev_file) files;
+} fsfs_repo;
+
+
+struct dumpfile_node {
+	RB_ENTRY(dumpfile_node)  link;
+	char                    *path;
+	sblist                   versions;
+};
+
+
+typedef struct {
+	uint32_t  revision;
+	char      kind;
+	char      executable;
+	char      special;
+	uint64_t  offset;
+	uint64_t  length;
+} dumpfile_version;
+
+
+typedef struct {
+	FILE      *source;
+	FILE      *spill;
+	uint64_t   spill_size;
+	char      *map;
+	time_t    *dates;
+	uint32_t   dates_count;
+	RB_HEAD(tree_dumpfile_nodes, dumpfile_node) nodes;
+} dumpfile;
+
+
+struct tree_node {
+	RB_ENTRY(tree_node)  link;
+	char                *md5;
+	char                *path;
+};
+
+RB_HEAD(tree_known_files, tree_node);
+RB_HEAD(tree_local_files, tree_node);
+RB_HEAD(tree_local_directories, tree_node);
+
+
+enum fault_kind {
+	FAULT_DISCONNECT = 0,
+	FAULT_SHORT,
+	FAULT_STALL,
+	FAULT_CHUNK,
+	FAULT_TLS,
+	FAULT_KINDS,
+};
+
+
+typedef struct {
+	uint64_t  state;
+	uint64_t  every;
+	char      kinds[FAULT_KINDS];
+	uint64_t  offset;
+	int       kind;
+} fault_plan;
+
+
+typedef struct {
+	uint64_t         bytes_read;
+	uint64_t         bytes_written;
+	uint32_t         reconnects;
+	uint32_t         retries;
+	uint64_t         refetched;
+	uint32_t         faults[FAULT_KINDS];
+	double           recovery[FAULT_KINDS];
+	uint64_t         wasted[FAULT_KINDS];
+	int              pending;
+	struct timespec  pending_since;
+	int64_t          catch_up;
+	struct timespec  start;
+	double           rtt;
+	double           receiving;
+	uint64_t         received;
+	int              awaiting;
+	struct timespec  last_io;
+	uint32_t         connect_timeouts;
+	uint32_t         stalls;
+	uint32_t         slow;
+	uint32_t         resumes;
+	uint32_t         resumed;
+	double           rate_waited;
+	uint64_t         rate_bytes;
+	uint64_t         rate_written;
+	uint32_t         tcp_rtt;
+	uint32_t         tcp_rtt_min;
+	uint32_t         tcp_rcv_space;
+	int              rcvbuf;
+	int              sndbuf;
+} transport_stats;
+
+
+typedef struct {
+	char      md5[33];
+	char      md5_checked;
+	char      download;
+	char      executable;
+	char      special;
+	char      whole;
+	char     *href;
+	char     *path;
+	uint64_t  raw_size;
+	int64_t   size;
+	char      existed;
+	time_t    mtime;
+	fsfs_rep  text;
+} file_node;
+
+
 typedef struct {
 	int       socket_descriptor;
-	enum      { NONE, SVN, HTTP, HTTPS } protocol;
+	enum svn_protocol { NONE, LOCAL, DUMP, SVN, HTTP, HTTPS } protocol;
 	enum svn_job {
 		SVN_NONE = 0,
 		SVN_CO,
 		SVN_LOG,
 		SVN_INFO,
+		SVN_DUMP,
+		SVN_EXPORT,
+		SVN_PROXY,
+		SVN_POLL,
 	} job;
 	SSL      *ssl;
 	SSL_CTX  *ctx;
 	char     *address;
 	uint16_t  port;
 	uint32_t  revision;
+	uint32_t  revision_start;
+	char     *uuid;
 	char     *commit_author;
 	char     *commit_date;
 	char     *commit_msg;
@@ -93,45 +275,300 @@ typedef struct {
 	uint32_t  response_blocks;
 	uint32_t  response_groups;
 	char     *path_work;
-	char     *known_files;
+	char     *known_files_buffer;
 	char     *known_files_old;
 	char     *known_files_new;
 	long      known_files_size;
 	int       trim_tree;
 	int       extra_files;
+	int       incremental;
+	int       force;
 	int       verbosity;
+	char     *manifest;
+	int       jobs;
+	int       host_jobs;
+	char     *listen;
+	char     *cache;
+	int       latest_ttl;
+	char     *poll_list;
+	char     *poll_state;
+	int       interval;
+	int       watch;
+	char     *hook;
+	int       threads;
+	int       show_stats;
+	int       commit_times;
+	int       dry_run;
+	int       crawlers;
+	int       window;
+	int       dedup;
+	char     *reference;
+	int       adopt;
+	struct timespec                reference_time;
+	uint32_t  dry_directories;
+	uint32_t  dry_batches;
+	uint32_t  dry_duplicates;
+	uint32_t  dry_relocated;
+	uint32_t  dry_referenced;
+	uint32_t  dry_adopted;
+	char     *changes;
+	char     *content_manifest;
+	int       null_records;
+	FILE     *changes_out;
+	FILE     *content_out;
+	int       in_handshake;
+	fault_plan       faults;
+	transport_stats  stats;
+	int       connect_timeout;
+	int       idle_timeout;
+	int       total_timeout;
+	uint64_t  min_rate;
+	int       rate_window;
+	int       socket_buffer;
 	char      inline_props;
+	fsfs_repo *fsfs;
+	dumpfile  *dump;
+	file_node **files;
+	int       file_count;
+	int       file_max;
+	struct tree_known_files        known_files;
+	struct tree_known_files        watch_files;
+	struct tree_known_files        reference_files;
+	struct tree_local_files        local_files;
+	struct tree_local_directories  local_directories;
+	SSL_SESSION *tls_session;
+	int       tls_session_pipe;
+	int       keepalive_max;
+	int       requests_left;
+	int       requests_served;
+	int       standby_state;
+	pthread_t standby_thread;
+	int       standby_descriptor;
+	SSL      *standby_ssl;
+	SSL_CTX  *standby_ctx;
+	SSL_SESSION *standby_session;
 } connector;
 
 
+enum { DEDUP_OFF, DEDUP_COPY, DEDUP_REFLINK, DEDUP_HARDLINK };
+
+typedef struct {
+	file_node  *copy;
+	file_node  *source;
+} dedup_pair;
+
+
+typedef struct {
+	struct tree_node  *node;
+	char               kept;
+	char               claimed;
+} relocate_source;
+
+typedef struct {
+	file_node        *copy;
+	relocate_source  *source;
+	int               move;
+	int               staged;
+} relocate_pair;
+
+
+typedef struct {
+	pthread_mutex_t   lock;
+	connector        *connection;
+	file_node       **file;
+	int               file_count;
+	int               next;
+	int               adopted;
+} adopt_pool;
+
+
+typedef struct {
+	char     *data;
+	size_t    length;
+	size_t    capacity;
+	size_t    head;
+	size_t    chain_end;
+	char      chain_saved;
+	sblist    ends;
+} command_queue;
+
+
+typedef struct {
+	char     *data;
+	size_t    length;
+	size_t    capacity;
+} dump_buffer;
+
+
+enum { SVN_TOKEN_OPEN = 1, SVN_TOKEN_CLOSE, SVN_TOKEN_WORD, SVN_TOKEN_NUMBER, SVN_TOKEN_STRING };
+
+typedef struct {
+	int       socket_descriptor;
+	char     *buffer;
+	size_t    start;
+	size_t    end;
+	size_t    capacity;
+	int       type;
+	int       peeked;
+	char     *string;
+	size_t    length;
+	uint64_t  number;
+	dump_buffer *capture;
+} svn_reader;
+
+
 typedef struct {
-	char      md5[33];
-	char      md5_checked;
-	char      download;
-	char      executable;
-	char      special;
-	char     *href;
 	char     *path;
-	uint64_t  raw_size;
+	char     *copy_path;
+	uint32_t  copy_revision;
+	char      action;
+	int       dir;
+	char      text;
+	char      props;
 	int64_t   size;
-} file_node;
+} dump_node;
 
 
-struct tree_node {
-	RB_ENTRY(tree_node)  link;
-	char                *md5;
-	char                *path;
+typedef struct {
+	uint32_t  revision;
+	sblist   *changes;
+} dump_entry;
+
+
+typedef struct {
+	connector     upstream;
+	svn_reader    client_reader;
+	svn_reader    upstream_reader;
+	int           client;
+	char         *url;
+	char         *upstream_url;
+	char         *cache;
+	dump_buffer   request;
+	dump_buffer   response;
+} proxy_session;
+
+
+typedef struct {
+	char           *host;
+	int             running;
+	unsigned char  *session;
+	int             session_length;
+} manifest_host;
+
+
+typedef struct {
+	char           *url;
+	char           *path;
+	char           *revision;
+	manifest_host  *host;
+	pid_t           pid;
+	int             pipe;
+	int             state;
+	int             status;
+	struct timespec start;
+} manifest_entry;
+
+
+typedef struct {
+	pthread_mutex_t  lock;
+	pthread_cond_t   changed;
+	connector       *connection;
+	sblist          *entries;
+	size_t           started;
+} manifest_pool;
+
+
+typedef struct {
+	pthread_mutex_t  lock;
+	pthread_cond_t   changed;
+	connector       *connection;
+	file_node     ***file;
+	int             *file_count;
+	int             *file_max;
+	sblist          *queues;
+	int              crawlers;
+	int              busy;
+	int              failed;
+} crawl_pool;
+
+
+typedef struct {
+	crawl_pool      *pool;
+	connector       *session;
+	int              index;
+	int              locked;
+	pthread_t        thread;
+} crawl_worker;
+
+
+typedef struct poll_repo poll_repo;
+
+enum { POLL_CONNECTING, POLL_TLS, POLL_OPEN, POLL_CLOSED };
+enum { POLL_SKIP, POLL_REPOS_INFO, POLL_LATEST, POLL_OPTIONS };
+
+typedef struct {
+	int             kind;
+	poll_repo      *repo;
+} poll_expect;
+
+
+typedef struct {
+	int             descriptor;
+	int             state;
+	short           events;
+	int             answered;
+	SSL            *ssl;
+	dump_buffer     in;
+	dump_buffer     out;
+	size_t          out_sent;
+	sblist         *expect;
+} poll_connection;
+
+
+struct poll_repo {
+	char             *root;
+	uint32_t          youngest;
+	int               requested;
+	int               errors;
+	int               dead;
+	poll_connection  *connection;
 };
 
 
+typedef struct {
+	enum svn_protocol protocol;
+	char             *host;
+	char             *address;
+	uint16_t          port;
+	int               family;
+	struct addrinfo  *addresses;
+	SSL_CTX          *ctx;
+	sblist           *repos;
+	poll_connection  *connection;
+} poll_server;
+
+
+typedef struct {
+	char           *url;
+	char           *path;
+	poll_server    *server;
+	uint32_t        revision;
+	uint32_t        youngest;
+	int             errors;
+	poll_repo      *looking;
+} poll_target;
+
+
+
 /* Function Prototypes */
 
 static char		*md5sum(void*, size_t, char*);
 static int		 tree_node_compare(const struct tree_node *, const struct tree_node *);
 static void		 prune(connector *, char *);
 static char		*find_response_end(int, char *, char *);
-static void		 find_local_files_and_directories(char *, const char *, int);
+static void		 find_local_files_and_directories(connector *, char *, const char *, int);
 static void		 reset_connection(connector *);
+static double		 elapsed_since(const struct timespec *);
 static void		 send_command(connector *, const char *);
 static int		 check_command_success(int, char **, char **);
 static char		*process_command_svn(connector *, const char *, unsigned int);
@@ -140,14 +577,86 @@ static char		*parse_xml_value(char *, char *, const char *);
 static void		 parse_response_group(connector *, char **, char **);
 static int		 parse_response_item(connector *, char *, int *, char **, char **);
 static file_node	*new_file_node(file_node ***, int *, int *);
-static int		 save_file(char *, char *, char *, int, int);
+static int		 save_file(char *, char *, char *, int, int, time_t);
 static void		 save_known_file_list(connector *, file_node **, int);
 static void		 create_directory(char *);
-static void		 process_report_svn(connector *, char *, file_node ***, int *, int *);
+static void		 create_report_directory(connector *, char *);
+static void		 process_report_svn(connector *, const char *, file_node ***, int *, int *);
 static void		 process_report_http(connector *, file_node ***, int *file_count, int *);
 static void		 parse_additional_attributes(connector *, char *, char *, file_node *);
 static void		 get_files(connector *, char *, char *, file_node **, int, int);
 static void		 progress_indicator(connector *connection, char *, int, int);
+static void		 open_session_svn(connector *);
+static void		 connector_init(connector *);
+static void		 job_fail(void) __attribute__((noreturn));
+static void		 job_err(int, const char *, ...) __attribute__((noreturn, format(printf, 2, 3)));
+static void		 job_errx(int, const char *, ...) __attribute__((noreturn, format(printf, 2, 3)));
+
+/* the failure handler of the checkout running on this thread, NULL outside run_job */
+static __thread jmp_buf *job_failure;
+
+
+/*
+ * job_fail
+ *
+ * Procedure that abandons the checkout running on this thread so that run_job can
+ * clean it up and report it as failed.  Outside of a checkout it exits.
+ */
+
+static void
+job_fail(void)
+{
+	if (job_failure != NULL)
+		longjmp(*job_failure, 1);
+
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * job_err
+ *
+ * Procedure that prints a message with the errno description, like err(3), and
+ * fails the running checkout.
+ */
+
+static void
+job_err(int eval, const char *fmt, ...)
+{
+	va_list  ap;
+
+	va_start(ap, fmt);
+	vwarn(fmt, ap);
+	va_end(ap);
+
+	if (job_failure == NULL)
+		exit(eval);
+
+	job_fail();
+}
+
+
+/*
+ * job_errx
+ *
+ * Procedure that prints a message, like errx(3), and fails the running checkout.
+ */
+
+static void
+job_errx(int eval, const char *fmt, ...)
+{
+	va_list  ap;
+
+	va_start(ap, fmt);
+	vwarnx(fmt, ap);
+	va_end(ap);
+
+	if (job_failure == NULL)
+		exit(eval);
+
+	job_fail();
+}
+
 
 /* turn svn date string like "2020-11-10T09:23:51.711212Z" into "2020-11-10 09:23:51" */
 static char* sanitize_svn_date(char *date) {
@@ -160,6 +669,41 @@ static char* sanitize_svn_date(char *date) {
 	return temp;
 }
 
+/*
+ * parse_commit_time
+ *
+ * Function that turns an svn date ("2020-11-10T09:23:51.711212Z") or an http date
+ * ("Tue, 10 Nov 2020 09:23:51 GMT") into seconds since the epoch, 0 if it is neither.
+ */
+
+static time_t
+parse_commit_time(const char *value)
+{
+	const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec", *m;
+	char        month[4];
+	int         year, mon, day, hour, minute, second;
+	int64_t     era, years, days;
+
+	if (sscanf(value, "%4d-%2d-%2dT%2d:%2d:%2d", &year, &mon, &day, &hour, &minute, &second) != 6) {
+		if (sscanf(value, "%*3s, %2d %3s %4d %2d:%2d:%2d", &day, month, &year, &hour, &minute, &second) != 6)
+			return (0);
+
+		if ((m = strstr(months, month)) == NULL)
+			return (0);
+
+		mon = (m - months) / 3 + 1;
+	}
+
+	/* days from 1970-01-01 to a proleptic Gregorian date */
+	years = year - (mon <= 2);
+	era = (years >= 0 ? years : years - 399) / 400;
+	years -= era * 400;
+	days = era * 146097 + years * 365 + years / 4 - years / 100
+		+ (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1 - 719468;
+
+	return ((time_t)(days * 86400 + hour * 3600 + minute * 60 + second));
+}
+
 static char*
 http_extract_header_value(char* response, const char* name, char* buf, size_t buflen)
 {
@@ -248,15 +792,12 @@ tree_node_free(struct tree_node *node)
 }
 
 
-static RB_HEAD(tree_known_files, tree_node) known_files = RB_INITIALIZER(&known_files);
 RB_PROTOTYPE(tree_known_files, tree_node, link, tree_node_compare)
 RB_GENERATE(tree_known_files, tree_node, link, tree_node_compare)
 
-static RB_HEAD(tree_local_files, tree_node) local_files = RB_INITIALIZER(&local_files);
 RB_PROTOTYPE(tree_local_files, tree_node, link, tree_node_compare)
 RB_GENERATE(tree_local_files, tree_node, link, tree_node_compare)
 
-static RB_HEAD(tree_local_directories, tree_node) local_directories = RB_INITIALIZER(&local_directories);
 RB_PROTOTYPE(tree_local_directories, tree_node, link, tree_node_compare)
 RB_GENERATE(tree_local_directories, tree_node, link, tree_node_compare)
 
@@ -277,7 +818,7 @@ prune(connector *connection, char *path_target)
 	length = strlen(path_target) + strlen(connection->path_target) + 2;
 
 	if ((temp_file = (char *)malloc(length)) == NULL)
-		err(EXIT_FAILURE, "prune temp_file malloc");
+		job_err(EXIT_FAILURE, "prune temp_file malloc");
 
 	snprintf(temp_file, length, "%s%s", connection->path_target, path_target);
 
@@ -287,7 +828,7 @@ prune(connector *connection, char *path_target)
 
 		if ((S_ISREG(local.st_mode)) || (S_ISLNK(local.st_mode))) {
 			if (remove(temp_file) != 0) {
-				err(EXIT_FAILURE, "Cannot remove %s", temp_file);
+				job_err(EXIT_FAILURE, "Cannot remove %s", temp_file);
 			} else {
 				/* Isolate the parent directory in the path name
 				 * and try and remove it.  Failure is ok. */
@@ -315,7 +856,7 @@ prune(connector *connection, char *path_target)
  */
 
 static void
-find_local_files_and_directories(char *path_base, const char *path_target, int include_files)
+find_local_files_and_directories(connector *connection, char *path_base, const char *path_target, int include_files)
 {
 	DIR              *dp;
 	struct stat       local;
@@ -327,7 +868,7 @@ find_local_files_and_directories(char *path_base, const char *path_target, int i
 	length = strlen(path_base) + strlen(path_target) + MAXNAMLEN + 3;
 
 	if ((temp_file = (char *)malloc(length)) == NULL)
-		err(EXIT_FAILURE, "find_local_files_and_directories temp_file malloc");
+		job_err(EXIT_FAILURE, "find_local_files_and_directories temp_file malloc");
 
 	snprintf(temp_file, length, "%s%s", path_base, path_target);
 
@@ -341,7 +882,7 @@ find_local_files_and_directories(char *path_base, const char *path_target, int i
 				data->path = strdup(temp_file);
 				data->md5 = NULL;
 
-				RB_INSERT(tree_local_directories, &local_directories, data);
+				RB_INSERT(tree_local_directories, &connection->local_directories, data);
 			}
 
 			/* Recursively process the contents of the directory. */
@@ -362,7 +903,7 @@ find_local_files_and_directories(char *path_base, const char *path_target, int i
 						path_target,
 						de->d_name);
 
-					find_local_files_and_directories(path_base, temp_file, include_files);
+					find_local_files_and_directories(connection, path_base, temp_file, include_files);
 				}
 
 				closedir(dp);
@@ -373,7 +914,7 @@ find_local_files_and_directories(char *path_base, const char *path_target, int i
 				data->path = strdup(path_target);
 				data->md5 = NULL;
 
-				RB_INSERT(tree_local_files, &local_files, data);
+				RB_INSERT(tree_local_files, &connection->local_files, data);
 			}
 		}
 	}
@@ -408,6 +949,154 @@ find_response_end(int protocol, char *start, char *end)
 }
 
 
+/*
+ * tls_session_keep
+ *
+ * Procedure that remembers the session of the SSL connection so the next connection
+ * to the server can resume it instead of doing a full handshake.
+ */
+
+static void
+tls_session_keep(connector *connection)
+{
+	SSL_SESSION *session;
+
+	if ((connection->ssl == NULL) || ((session = SSL_get1_session(connection->ssl)) == NULL))
+		return;
+
+	if (connection->tls_session)
+		SSL_SESSION_free(connection->tls_session);
+
+	connection->tls_session = session;
+}
+
+
+/*
+ * tls_session_export
+ *
+ * Procedure that writes the remembered TLS session to the pipe of a batch checkout
+ * so that the following checkouts from the same server can resume it.
+ */
+
+static void
+tls_session_export(connector *connection)
+{
+	unsigned char *data, *p;
+	int            length;
+
+	if ((connection->tls_session_pipe < 0) || (connection->tls_session == NULL))
+		return;
+
+	if ((length = i2d_SSL_SESSION(connection->tls_session, NULL)) <= 0)
+		return;
+
+	if ((data = p = malloc(length)) == NULL)
+		job_err(EXIT_FAILURE, "tls_session_export malloc");
+
+	i2d_SSL_SESSION(connection->tls_session, &p);
+
+	if (write(connection->tls_session_pipe, data, length) != length)
+		warn("tls_session_export write");
+
+	free(data);
+	close(connection->tls_session_pipe);
+	connection->tls_session_pipe = -1;
+}
+
+
+/*
+ * socket_timeout
+ *
+ * Procedure that sets the SO_RCVTIMEO or SO_SNDTIMEO timeout of a socket in seconds
+ * (0: none).
+ */
+
+static void
+socket_timeout(int descriptor, int option, int seconds)
+{
+	struct timeval  timeout = { seconds, 0 };
+
+	if (setsockopt(descriptor, SOL_SOCKET, option, &timeout, sizeof(timeout)))
+		job_err(EXIT_FAILURE, "setsockopt SO_RCVTIMEO/SO_SNDTIMEO error");
+}
+
+
+/*
+ * connect_deadline
+ *
+ * Function that connects the socket of the connector like connect(2), giving up
+ * with ETIMEDOUT once the connect deadline has passed.
+ */
+
+static int
+connect_deadline(connector *connection, const struct sockaddr *address, socklen_t length)
+{
+	struct pollfd  wait;
+	socklen_t      size;
+	int            error, flags, ready;
+
+	if (!connection->connect_timeout)
+		return (connect(connection->socket_descriptor, address, length));
+
+	flags = fcntl(connection->socket_descriptor, F_GETFL);
+	fcntl(connection->socket_descriptor, F_SETFL, flags | O_NONBLOCK);
+
+	if (((ready = connect(connection->socket_descriptor, address, length)) == -1) && (errno == EINPROGRESS)) {
+		wait.fd = connection->socket_descriptor;
+		wait.events = POLLOUT;
+
+		while (((ready = poll(&wait, 1, connection->connect_timeout * 1000)) == -1) && (errno == EINTR))
+			;
+
+		size = sizeof(error);
+
+		if (ready == 0) {
+			connection->stats.connect_timeouts++;
+			errno = ETIMEDOUT;
+			ready = -1;
+		} else if ((ready > 0) && (getsockopt(connection->socket_descriptor, SOL_SOCKET, SO_ERROR, &error, &size) == 0)) {
+			errno = error;
+			ready = error ? -1 : 0;
+		} else
+			ready = -1;
+	}
+
+	error = errno;
+	fcntl(connection->socket_descriptor, F_SETFL, flags);
+	errno = error;
+
+	return (ready);
+}
+
+
+/*
+ * socket_buffer_size
+ *
+ * Function that returns the socket buffer size for a new connection: the one given
+ * with --socket-buffer, 0 (leave it to the kernel's autotuning) by default, or with
+ * --socket-buffer bdp twice the bandwidth-delay product measured on the previous
+ * connections of the checkout.
+ */
+
+static int
+socket_buffer_size(connector *connection)
+{
+	transport_stats *stats = &connection->stats;
+	double           bdp, elapsed;
+
+	if (connection->socket_buffer >= 0)
+		return (connection->socket_buffer);
+
+	if (stats->tcp_rtt == 0)
+		return (0);
+
+	elapsed = stats->start.tv_sec ? elapsed_since(&stats->start) : 0;
+	bdp = elapsed > 0 ? stats->bytes_read / elapsed * stats->tcp_rtt / 1e6 : 0;
+
+	return (MIN(MAX(2 * MAX(bdp, stats->tcp_rcv_space), COMMAND_BUFFER), SOCKET_BUFFER_MAX));
+}
+
+
 /*
  * reset_connection
  *
@@ -426,12 +1115,14 @@ reset_connection(connector *connection)
 
 	if (connection->socket_descriptor != -1)
 		if (close(connection->socket_descriptor) != 0)
-			if (errno != EBADF) err(EXIT_FAILURE, "close_connection");
+			if (errno != EBADF) job_err(EXIT_FAILURE, "close_connection");
+
+	tls_session_keep(connection);
 
 	snprintf(type, sizeof(type), "%d", connection->port);
 
 	if ((error = getaddrinfo(connection->address, type, &hints, &start)))
-		errx(EXIT_FAILURE, "%s", gai_strerror(error));
+		job_errx(EXIT_FAILURE, "%s", gai_strerror(error));
 
 	gai = start;
 
@@ -441,10 +1132,19 @@ reset_connection(connector *connection)
 
 		if (connection->socket_descriptor < 0) {
 			if ((connection->socket_descriptor = socket(temp->ai_family, temp->ai_socktype, temp->ai_protocol)) < 0)
-				err(EXIT_FAILURE, "socket failure");
+				job_err(EXIT_FAILURE, "socket failure");
 
-			if (connect(connection->socket_descriptor, temp->ai_addr, temp->ai_addrlen) < 0)
-				err(EXIT_FAILURE, "connect failure");
+			/* the buffers have to be sized before the window scale is agreed on */
+			if ((option = socket_buffer_size(connection))) {
+				if (setsockopt(connection->socket_descriptor, SOL_SOCKET, SO_SNDBUF, &option, sizeof(option)))
+					job_err(EXIT_FAILURE, "setsockopt SO_SNDBUF error");
+
+				if (setsockopt(connection->socket_descriptor, SOL_SOCKET, SO_RCVBUF, &option, sizeof(option)))
+					job_err(EXIT_FAILURE, "setsockopt SO_RCVBUF error");
+			}
+
+			if (connect_deadline(connection, temp->ai_addr, temp->ai_addrlen) < 0)
+				job_err(EXIT_FAILURE, "connect failure");
 		}
 
 		start = temp->ai_next;
@@ -454,2350 +1154,11120 @@ reset_connection(connector *connection)
 
 	if (connection->protocol == HTTPS) {
 		if (SSL_library_init() == 0)
-			err(EXIT_FAILURE, "reset_connection: SSL_library_init");
+			job_err(EXIT_FAILURE, "reset_connection: SSL_library_init");
 
 		SSL_load_error_strings();
 		connection->ctx = SSL_CTX_new(SSLv23_client_method());
 		SSL_CTX_set_mode(connection->ctx, SSL_MODE_AUTO_RETRY);
-		SSL_CTX_set_options(connection->ctx, SSL_OP_ALL | SSL_OP_NO_TICKET);
+		SSL_CTX_set_options(connection->ctx, SSL_OP_ALL);
 
 		if ((connection->ssl = SSL_new(connection->ctx)) == NULL)
-			err(EXIT_FAILURE, "reset_connection: SSL_new");
+			job_err(EXIT_FAILURE, "reset_connection: SSL_new");
+
+		if (connection->tls_session)
+			SSL_set_session(connection->ssl, connection->tls_session);
 
 		SSL_set_fd(connection->ssl, connection->socket_descriptor);
-		while ((error = SSL_connect(connection->ssl)) == -1)
-			fprintf(stderr, "SSL_connect error:%d\n", SSL_get_error(connection->ssl, error));
+
+		/* the handshake is bound by the connect deadline */
+		socket_timeout(connection->socket_descriptor, SO_RCVTIMEO, connection->connect_timeout);
+		socket_timeout(connection->socket_descriptor, SO_SNDTIMEO, connection->connect_timeout);
+
+		if ((error = SSL_connect(connection->ssl)) != 1)
+			job_errx(EXIT_FAILURE, "SSL_connect error:%d", SSL_get_error(connection->ssl, error));
 	}
 
+	/* a blocked read or write gives up after the idle deadline */
+	socket_timeout(connection->socket_descriptor, SO_RCVTIMEO, connection->idle_timeout);
+	socket_timeout(connection->socket_descriptor, SO_SNDTIMEO, connection->idle_timeout);
+
 	option = 1;
 
 	if (setsockopt(connection->socket_descriptor, SOL_SOCKET, SO_KEEPALIVE, &option, sizeof(option)))
-		err(EXIT_FAILURE, "setsockopt SO_KEEPALIVE error");
-
-	option = COMMAND_BUFFER;
+		job_err(EXIT_FAILURE, "setsockopt SO_KEEPALIVE error");
 
-	if (setsockopt(connection->socket_descriptor, SOL_SOCKET, SO_SNDBUF, &option, sizeof(option)))
-		err(EXIT_FAILURE, "setsockopt SO_SNDBUF error");
+	/* requests are corked into full segments by send_command, the last one goes out at once */
+	if (setsockopt(connection->socket_descriptor, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option)))
+		job_err(EXIT_FAILURE, "setsockopt TCP_NODELAY error");
 
-	if (setsockopt(connection->socket_descriptor, SOL_SOCKET, SO_RCVBUF, &option, sizeof(option)))
-		err(EXIT_FAILURE, "setsockopt SO_RCVBUF error");
+	connection->requests_left = connection->keepalive_max ? connection->keepalive_max : -1;
+	connection->requests_served = 0;
+	connection->stats.rate_waited = 0;
+	connection->stats.rate_bytes = 0;
 }
 
 
 /*
- * send_command
+ * elapsed_since
  *
- * Procedure that sends commands to the http/svn server.
+ * Function that returns the seconds passed since the given monotonic time.
  */
 
-static void
-send_command(connector *connection, const char *command)
+static double
+elapsed_since(const struct timespec *since)
 {
-	size_t  bytes_to_write, total_bytes_written;
-	ssize_t bytes_written;
+	struct timespec  now;
 
-	if (command) {
-		total_bytes_written = 0;
-		bytes_to_write = strlen(command);
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-		if (connection->verbosity > 2)
-			fprintf(stdout, "<< %zu bytes\n%s", bytes_to_write, command);
+	return ((now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9);
+}
 
-		while (total_bytes_written < bytes_to_write) {
-			if (connection->protocol == HTTPS)
-				bytes_written = SSL_write(
-					connection->ssl,
-					command + total_bytes_written,
-					bytes_to_write - total_bytes_written);
-			else
-				bytes_written = write(
-					connection->socket_descriptor,
-					command + total_bytes_written,
-					bytes_to_write - total_bytes_written);
 
-			if (bytes_written <= 0) {
-				if ((bytes_written < 0) && ((errno == EINTR) || (errno == 0))) {
-					continue;
-				} else {
-					err(EXIT_FAILURE, "send command");
-				}
-			}
+/*
+ * fault_random
+ *
+ * Function that returns the next number of the fault schedule (xorshift64*), so
+ * the same seed always injects the same faults at the same byte offsets.
+ */
 
-			total_bytes_written += bytes_written;
-		}
-	}
+static uint64_t
+fault_random(fault_plan *plan)
+{
+	plan->state ^= plan->state >> 12;
+	plan->state ^= plan->state << 25;
+	plan->state ^= plan->state >> 27;
+
+	return (plan->state * 0x2545F4914F6CDD1DULL);
 }
 
 
 /*
- * check_command_success
+ * fault_schedule
  *
- * Function that makes sure a failure response has not been sent from the svn server.
+ * Procedure that picks the byte offset and the kind of the next injected fault.
+ */
+
+static void
+fault_schedule(fault_plan *plan)
+{
+	int  kind, enabled;
+
+	plan->offset += 1 + fault_random(plan) % (2 * plan->every);
+
+	for (kind = enabled = 0; kind < FAULT_KINDS; kind++)
+		enabled += plan->kinds[kind];
+
+	enabled = fault_random(plan) % enabled;
+
+	for (kind = 0; !plan->kinds[kind] || enabled--; kind++)
+		;
+
+	plan->kind = kind;
+}
+
+
+/*
+ * fault_plan_init
+ *
+ * Function that sets up the fault schedule from a SEED[:BYTES[:KINDS]] option,
+ * BYTES being the mean distance between faults in bytes read (default: 262144) and
+ * KINDS any of d (disconnect), s (short read), p (stall), c (read ending inside a
+ * chunk header or string length) and t (TLS error).  Returns -1 if it is malformed.
  */
 
 static int
-check_command_success(int protocol, char **start, char **end)
+fault_plan_init(fault_plan *plan, const char *option)
 {
-	int   fail = 0;
-	char *response = *start;
+	const char *kinds = "dspct", *letter;
+	char       *end;
 
-	if (protocol == SVN) {
-		if (starts_with_lit(*start, "( success ( ( ) 0: ) ) ( failure"))
-			fail = 1;
+	memset(plan, 0, sizeof(*plan));
 
-		else if (starts_with_lit(*start, "( success ( ) ) ( failure"))
-			fail = 1;
+	plan->state = strtoull(option, &end, 10) * 2654435761ULL + 1;
+	plan->every = 262144;
 
-		if (!fail) {
-			while (**start == ' ') (*start)++;
+	if (*end == ':') {
+		plan->every = strtoull(end + 1, &end, 10);
 
-			if (starts_with_lit(*start, "( success ")) {
-				if (starts_with_lit(*start, "( success ( ( ) 0: ) )"))
-					*start += LIT_LEN("( success ( ( ) 0: ) )")+1;
-				*end = find_response_end(protocol, *start, *end) + 1;
-			}
-			else fail = 1;
-		}
-	}
+		if (*end == ':')
+			kinds = end + 1;
+		else if (*end != '\0')
+			return (-1);
+	} else if (*end != '\0')
+		return (-1);
 
-	if (protocol >= HTTP) {
-		if (!starts_with_lit(*start, "HTTP/1.1 "))
-			fail = 1;
-		else {
-			*start += LIT_LEN("HTTP/1.1 ");
-			if(**start != '2') fail = 1;
-			else {
-				*start = strstr(*start, "\r\n\r\n");
-				if (*start) *start += 4; else fail = 1;
-			}
-		}
-	}
+	for (; *kinds; kinds++) {
+		if ((letter = strchr("dspct", *kinds)) == NULL)
+			return (-1);
 
-	if (fail) {
-		if(protocol == SVN || !strstr(response, "xml version="))
-			fprintf(stderr, "\nCommand Failure: %s\n", response);
-		else {
-			char *ec = parse_xml_value(*start, *end, "m:human-readable");
-			if(ec) { fprintf(stderr, "\n%s\n", ec); free(ec); }
-			else fprintf(stderr, "\nCommand Failure: %s\n", response);
-		}
+		plan->kinds[letter - "dspct"] = 1;
 	}
 
-	return (fail);
+	if ((plan->every == 0) || (memchr(plan->kinds, 1, FAULT_KINDS) == NULL))
+		return (-1);
+
+	fault_schedule(plan);
+
+	return (0);
 }
 
 
 /*
- * process_command_svn
+ * fault_inject
  *
- * Function that sends a command set to the svn server and parses its response to make
- * sure that the expected number of response strings have been received.
+ * Function that injects the scheduled fault into a read of at most *length bytes
+ * and schedules the next one.  Short reads, stalls and cut chunk headers shrink
+ * *length, disconnects and TLS errors are returned for transport_read to act on.
  */
 
-static char *
-process_command_svn(connector *connection, const char *command, unsigned int expected_bytes)
+static int
+fault_inject(connector *connection, size_t *length)
 {
-	ssize_t       bytes_read;
-	int           count, ok;
-	unsigned int  group, position, try;
-	char         *check, input[BUFFER_UNIT + 1];
+	struct timespec  pause;
+	char             peek[256];
+	ssize_t          bytes;
+	size_t           cut;
+	int              kind;
 
-	try = 0;
-	retry:
+	kind = connection->faults.kind;
+	fault_schedule(&connection->faults);
 
-	send_command(connection, command);
+	connection->stats.faults[kind]++;
 
-	count = position = ok = group = connection->response_length = 0;
+	if (connection->verbosity > 2)
+		fprintf(stderr, "# fault %d at byte %" PRIu64 "\n", kind, connection->stats.bytes_read);
 
-	do {
-		bzero(input, BUFFER_UNIT + 1);
+	if (kind == FAULT_SHORT)
+		*length = 1 + fault_random(&connection->faults) % MIN(*length, 16);
 
-		bytes_read = read(connection->socket_descriptor, input, BUFFER_UNIT);
+	if (kind == FAULT_STALL) {
+		pause.tv_sec = 0;
+		pause.tv_nsec = (50 + fault_random(&connection->faults) % 450) * 1000000;
+		nanosleep(&pause, NULL);
+		connection->stats.recovery[kind] += pause.tv_nsec / 1e9;
+	}
 
-		if (bytes_read <= 0) {
-			if ((errno == EINTR) || (errno == 0)) continue;
+	if (kind == FAULT_CHUNK) {
+		if (connection->protocol == HTTPS)
+			bytes = SSL_peek(connection->ssl, peek, sizeof(peek) - 1);
+		else
+			bytes = recv(connection->socket_descriptor, peek, sizeof(peek) - 1, MSG_PEEK);
 
-			if (++try > 5)
-				errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
+		/* stop after the first digit of "\r\nHEX" (http) or " DIGITS:" (svn) */
+		for (cut = 0; bytes > 2 && cut < (size_t)bytes - 2; cut++)
+			if (((peek[cut] == '\r') && (peek[cut + 1] == '\n') && isxdigit((unsigned char)peek[cut + 2]))
+				|| ((peek[cut] == ' ') && isdigit((unsigned char)peek[cut + 1]) && isdigit((unsigned char)peek[cut + 2])))
+				break;
 
-			if (try > 1)
-				fprintf(stderr, "Error in svn stream, retry #%d\n", try);
+		if (bytes > 2 && cut < (size_t)bytes - 2)
+			*length = MIN(*length, cut + (peek[cut] == '\r' ? 3 : 2));
+		else if (bytes > 1)
+			*length = MIN(*length, (size_t)bytes / 2);
+	}
 
-			goto retry;
-		}
+	if ((kind == FAULT_DISCONNECT) || (kind == FAULT_TLS)) {
+		shutdown(connection->socket_descriptor, SHUT_RDWR);
 
-		input[bytes_read] = 0;
-		if (connection->verbosity > 3)
-			fprintf(stdout, "<< %s\n", input);
+		/* a fault hitting a retry ends the recovery from the one before */
+		if (connection->stats.pending)
+			connection->stats.recovery[connection->stats.pending - 1] +=
+				elapsed_since(&connection->stats.pending_since);
 
-		connection->response_length += bytes_read;
+		connection->stats.pending = kind + 1;
+		connection->stats.catch_up = -1;
+		clock_gettime(CLOCK_MONOTONIC, &connection->stats.pending_since);
+	}
 
-		/* always allocate at least BUFFER_UNIT bytes more than we actually need
-		   because there's some wacky code in get_files() - see FIXME comment
-		   before the memmove() there */
-		size_t max = connection->response_length + BUFFER_UNIT;
-		if(expected_bytes + BUFFER_UNIT > max) max = expected_bytes + BUFFER_UNIT;
-		if (max >= connection->response_blocks * BUFFER_UNIT) {
-			do connection->response_blocks += (connection->response_blocks/2);
-			while(max >= connection->response_blocks * BUFFER_UNIT);
+	return (kind);
+}
 
-			connection->response = realloc(
-				connection->response,
-				connection->response_blocks * BUFFER_UNIT + 1);
 
-			if (connection->response == NULL)
-				err(EXIT_FAILURE, "process_command_svn realloc");
-		}
+/*
+ * transport_wait
+ *
+ * Function that waits until the server connection has data, within the idle and
+ * total deadlines, and keeps the watch on the throughput.  A stall, or a response
+ * arriving slower than --min-rate, returns -1/ETIMEDOUT so that the caller
+ * reconnects and resumes.  Passing the total deadline fails the checkout.
+ */
 
-		if (expected_bytes == 0) {
-			if (input[1] == '\0') {
-				connection->response[position++] = input[0];
-				continue;
-			}
+static int
+transport_wait(connector *connection)
+{
+	transport_stats *stats = &connection->stats;
+	struct pollfd    wait;
+	struct timespec  before;
+	double           limit, remaining;
+	int              ready, slow;
 
-			if (connection->verbosity > 3)
-				fprintf(stdout, "==========\n>> Response Parse:\n");
+	if ((connection->min_rate) && (stats->rate_waited >= connection->rate_window)) {
+		slow = (stats->rate_bytes < connection->min_rate * stats->rate_waited);
+		stats->rate_waited = 0;
+		stats->rate_bytes = 0;
 
-			check = input;
-			if ((count == 0) && (input[0] == ' '))
-				*check++ = '\0';
+		if (slow) {
+			stats->slow++;
 
-			do {
+			if (connection->verbosity > 1)
+				fprintf(stderr, "# Transfer below %" PRIu64 " bytes/s\n", connection->min_rate);
 
-				if (*check == ')')
-					--count;
-				else if(*check == '(') {
-					/* trying to skip size-annotated block, which in case of
-					   a commit message may contain unbalanced parens */
-					int skip = 0;
-					char *q, *p = check+1, *e = input + bytes_read;
-					if(p+2 < e && p[0] == ' ' && isdigit(p[1])) {
-						q = p+1;
-						while(q < e && isdigit(*q)) ++q;
-						if(q < e && *q == ':') {
-							skip = atoi(p)+1;
-							check = q;
-						}
-					}
-					if(skip) {
-						if(check+skip < input + bytes_read) {
-							check += skip;
-						} else if (connection->verbosity > 3) {
-							fprintf(stderr, "couldn't skip %d bytes", skip);
-						}
-					}
-					++count;
-				}
+			errno = ETIMEDOUT;
+			return (-1);
+		}
+	}
 
-				if (connection->verbosity > 3)
-					fprintf(stderr, "%d", count);
+	if ((connection->protocol == HTTPS) && (connection->ssl) && (SSL_pending(connection->ssl) > 0))
+		return (0);
 
-				if (count == 0) {
-					group++;
-					check++;
-					if (check < input + bytes_read) {
-						if (*check == ' ')
-							*check = '\0';
+	limit = connection->idle_timeout ? connection->idle_timeout : -1;
 
-						if (*check != '\0')
-							fprintf(stderr, "oops: %d %c\n", *check, *check);
+	if (connection->total_timeout) {
+		if ((remaining = connection->total_timeout - elapsed_since(&stats->start)) <= 0)
+			job_errx(EXIT_FAILURE, "Deadline of %d seconds passed", connection->total_timeout);
 
-						char *q = check + 1;
-						while(q < input + bytes_read && *q != '(') ++q;
-						check = q-1;
-					}
-				}
-			}
-			while (++check < input + bytes_read);
-		}
+		if ((limit < 0) || (remaining < limit))
+			limit = remaining;
+	}
 
-		memcpy(connection->response + position, input, bytes_read + 1);
-		position += bytes_read;
+	if ((limit < 0) && (!connection->min_rate))
+		return (0);
 
-		if ((expected_bytes == 0) && (connection->verbosity > 3))
-			fprintf(stderr, ". = %d %d\n", group, connection->response_groups);
+	wait.fd = connection->socket_descriptor;
+	wait.events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &before);
 
-		if (group >= connection->response_groups)
-			ok = 1;
+	ready = poll(&wait, 1, limit < 0 ? -1 : (int)(limit * 1000) + 1);
 
-		if (position == expected_bytes)
-			ok = 1;
+	/* the wait for the answer to a request is the business of the idle deadline */
+	if (stats->rate_written == stats->bytes_written)
+		stats->rate_waited += elapsed_since(&before);
 
-		if ((expected_bytes > 0) && (connection->response[0] == ' ') && (position == expected_bytes + 1))
-			ok = 1;
-	}
-	while (!ok);
+	stats->rate_written = stats->bytes_written;
 
-	if ((expected_bytes == 0) && (connection->verbosity > 2))
-		fprintf(stdout, "==========\n>> Response:\n%s", connection->response);
+	if (ready != 0)
+		return (ready < 0 ? -1 : 0);
 
-	connection->response[position] = '\0';
+	if ((connection->total_timeout) && (elapsed_since(&stats->start) >= connection->total_timeout))
+		job_errx(EXIT_FAILURE, "Deadline of %d seconds passed", connection->total_timeout);
 
-	return (connection->response);
+	stats->stalls++;
+
+	if (connection->verbosity > 1)
+		fprintf(stderr, "# No data for %d seconds\n", connection->idle_timeout);
+
+	errno = ETIMEDOUT;
+
+	return (-1);
 }
 
 
 /*
- * process_command_http
+ * transport_read
  *
- * Function that sends a command set to the http server and parses its response to make
- * sure that the expected number of response bytes have been received.
+ * Function that reads from the server connection like read(2), injecting the faults
+ * of the schedule (if any) and turning TLS errors into -1/EPROTO.  It also keeps
+ * the byte counts and tells when a connection lost to a fault has caught up again.
  */
 
-static char *
-process_command_http(connector *connection, char *command)
+static ssize_t
+transport_read(connector *connection, char *buffer, size_t length)
 {
-	int           bytes_read, chunk, chunked_transfer, first_chunk, gap, read_more, spread;
-	unsigned int  groups, offset, try;
-	char         *begin, *end, input[BUFFER_UNIT + 1], *marker1, *marker2, *temp, hex_chunk[32];
+	transport_stats *stats = &connection->stats;
+	ssize_t          bytes;
+	double           wait;
+	int              error, kind;
 
-	try = 0;
-	retry:
+	kind = -1;
 
-	chunked_transfer = -1;
-	connection->response_length = chunk = groups = 0;
-	offset = read_more = 0;
-	first_chunk = 1;
-	begin = end = marker1 = marker2 = temp = NULL;
+	if ((connection->faults.every) && (!connection->in_handshake)) {
+		if (stats->bytes_read < connection->faults.offset)
+			length = MIN(length, connection->faults.offset - stats->bytes_read);
+		else
+			kind = fault_inject(connection, &length);
+	}
 
-	bzero(connection->response, connection->response_blocks * BUFFER_UNIT + 1);
-	bzero(input, BUFFER_UNIT + 1);
+	if (kind == FAULT_DISCONNECT)
+		return (0);
 
-	if (try || connection->socket_descriptor == -1)
-		reset_connection(connection);
-	send_command(connection, command);
+	if (kind == FAULT_TLS) {
+		errno = (connection->protocol == HTTPS) ? EPROTO : ECONNRESET;
+		return (-1);
+	}
 
-	while (groups < connection->response_groups) {
-		spread = connection->response_length - offset;
+	if (transport_wait(connection) == -1)
+		return (-1);
 
-		if (spread <= 0)
-			read_more = 1;
+	if (connection->protocol == HTTPS) {
+		ERR_clear_error();
 
-		/* Sometimes the read returns only part of the next offset, so
-		 * if there were less than five bytes read, keep reading to get
-		 * the remainder of the offset. */
+		if ((bytes = SSL_read(connection->ssl, buffer, length)) <= 0) {
+			error = SSL_get_error(connection->ssl, bytes);
 
-		if ((chunked_transfer == 1) && (spread <= 5))
-			read_more = 1;
+			if ((error == SSL_ERROR_WANT_READ) || (error == SSL_ERROR_WANT_WRITE)) {
+				errno = EINTR;
+				bytes = -1;
+			} else if ((error == SSL_ERROR_ZERO_RETURN) || ((error == SSL_ERROR_SYSCALL) && (errno == 0)))
+				bytes = 0;
+			else {
+				if ((error != SSL_ERROR_SYSCALL) || (errno == 0))
+					errno = EPROTO;
 
-		if ((chunked_transfer == 0) && (spread == 0) && (connection->response_groups - groups == 1))
-			break;
+				bytes = -1;
+			}
+		}
+	} else
+		bytes = read(connection->socket_descriptor, buffer, length);
 
-		if (read_more) {
-			if (connection->protocol == HTTPS)
-				bytes_read = SSL_read(
-					connection->ssl,
-					input,
-					BUFFER_UNIT);
-			else
-				bytes_read = read(
-					connection->socket_descriptor,
-					input,
-					BUFFER_UNIT);
+	if (bytes > 0) {
+		stats->bytes_read += bytes;
+		stats->rate_bytes += bytes;
 
-			if (connection->response_length + bytes_read > connection->response_blocks * BUFFER_UNIT) {
-				while(connection->response_length + bytes_read > connection->response_blocks * BUFFER_UNIT)
-					connection->response_blocks += (connection->response_blocks/2);
+		/* the first bytes after a command time the round trip, the rest the throughput */
+		if (!connection->in_handshake) {
+			wait = elapsed_since(&stats->last_io);
 
-			#define SAVE_VAR(X) \
-				intptr_t X ## _offset; \
-				int was_null_ ## X = 0; \
-				if(X) X ## _offset = X - connection->response; \
-				else was_null_ ## X = 1;
+			if (stats->awaiting) {
+				if ((stats->rtt == 0) || (wait < stats->rtt))
+					stats->rtt = wait;
 
-				SAVE_VAR(marker2);
-				SAVE_VAR(begin);
-				SAVE_VAR(end);
+				stats->awaiting = 0;
+			} else {
+				stats->receiving += wait;
+				stats->received += bytes;
+			}
+		}
 
-				connection->response = (char *)realloc(
-					connection->response,
-					connection->response_blocks * BUFFER_UNIT + 1);
+		clock_gettime(CLOCK_MONOTONIC, &stats->last_io);
 
-				if (connection->response == NULL)
-					err(EXIT_FAILURE, "process_command_http realloc");
+		/* the retried command is back where the fault interrupted it */
+		if ((stats->pending) && (stats->catch_up >= 0) && (!connection->in_handshake)
+			&& ((stats->catch_up -= bytes) <= 0)) {
+			stats->recovery[stats->pending - 1] += elapsed_since(&stats->pending_since);
+			stats->pending = 0;
+		}
+	}
 
-			#define RESTORE_VAR(X) \
-				if (!was_null_ ## X) \
-					X = connection->response + X ## _offset;
+	return (bytes);
+}
 
-				RESTORE_VAR(marker2);
-				RESTORE_VAR(begin);
-				RESTORE_VAR(end);
-			}
 
-			if (bytes_read < 0) {
-				if ((errno == EINTR) || (errno == 0))
-					continue;
+/*
+ * transport_sample
+ *
+ * Procedure that records the round trip time and the receive space the kernel has
+ * measured on the server connection, along with the socket buffer sizes in effect.
+ */
 
-			check_tries_and_retry:;
-				if (++try > 5)
-					errx(EXIT_FAILURE, "Error in http stream.  Quitting.");
+static void
+transport_sample(connector *connection)
+{
+	transport_stats *stats = &connection->stats;
+	socklen_t        size;
+#ifdef TCP_INFO
+	struct tcp_info  info;
+#endif
+
+	if (connection->socket_descriptor == -1)
+		return;
+
+#ifdef TCP_INFO
+	size = sizeof(info);
+
+	if ((getsockopt(connection->socket_descriptor, IPPROTO_TCP, TCP_INFO, &info, &size) == 0)
+		&& (info.tcpi_rtt)) {
+		stats->tcp_rtt = info.tcpi_rtt;
+		stats->tcp_rtt_min = stats->tcp_rtt_min ? MIN(stats->tcp_rtt_min, info.tcpi_rtt) : info.tcpi_rtt;
+		stats->tcp_rcv_space = MAX(stats->tcp_rcv_space, info.tcpi_rcv_space);
+	}
+#endif
 
-				if (try > 1)
-					fprintf(stderr, "Error in http stream, retry #%d\n", try);
+	size = sizeof(stats->rcvbuf);
+	getsockopt(connection->socket_descriptor, SOL_SOCKET, SO_RCVBUF, &stats->rcvbuf, &size);
 
-				goto retry;
-			}
+	size = sizeof(stats->sndbuf);
+	getsockopt(connection->socket_descriptor, SOL_SOCKET, SO_SNDBUF, &stats->sndbuf, &size);
+}
 
-			if (bytes_read == 0) {
-				if(connection->response_length == 0) goto check_tries_and_retry;
-				break;
-			}
 
-			memcpy(connection->response + connection->response_length, input, bytes_read + 1);
-			connection->response_length += bytes_read;
-			connection->response[connection->response_length] = '\0';
-			read_more = 0;
-			spread = connection->response_length - offset;
-		}
+/*
+ * transport_cork
+ *
+ * Procedure that holds back (1) or pushes out (0) partial segments on the server
+ * connection where TCP_CORK is available.
+ */
 
-		if ((chunked_transfer == 0) && (spread >= 0)) {
-			chunked_transfer = -1;
-			groups++;
-		}
+static void
+transport_cork(connector *connection, int cork)
+{
+#ifdef TCP_CORK
+	setsockopt(connection->socket_descriptor, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+#endif
+}
 
-		if (chunked_transfer == -1) {
-			begin = connection->response + offset;
 
-			if ((begin = strstr(begin, "HTTP/1.1 ")) == NULL) {
-				read_more = 1;
-				continue;
-			}
+/*
+ * transport_retry
+ *
+ * Procedure that records a command being sent again after discarding the given
+ * number of response bytes, which will have to be fetched a second time.
+ */
 
-			if ((end = strstr(begin, "\r\n\r\n")) == NULL) {
-				read_more = 1;
-				continue;
-			}
+static void
+transport_retry(connector *connection, size_t discarded)
+{
+	transport_stats *stats = &connection->stats;
 
-			if(strstr(begin, "DAV: http://subversion.tigris.org/xmlns/dav/svn/inline-props"))
-				connection->inline_props = 1;
+	stats->retries++;
+	stats->refetched += discarded;
 
-			end += 4;
+	if (stats->pending) {
+		stats->wasted[stats->pending - 1] += discarded;
+		stats->catch_up = discarded;
+	}
+}
 
-			offset += (end - begin);
-			groups++;
 
-			marker1 = strstr(begin, "Content-Length: ");
-			marker2 = strstr(begin, "Transfer-Encoding: chunked");
+/*
+ * transport_report
+ *
+ * Procedure that prints the transfer totals, the round trip time and socket buffers
+ * of the connection and, per kind of injected fault, how long it took to get back
+ * to where the fault hit and how many bytes were fetched twice because of it.
+ */
 
-			if (marker1) chunked_transfer = 0;
-			if (marker2) chunked_transfer = 1;
+static void
+transport_report(connector *connection)
+{
+	const char      *names[FAULT_KINDS] = { "disconnect", "short-read", "stall", "chunk-cut", "tls-error" };
+	transport_stats *stats = &connection->stats;
+	char             buffer[32];
+	double           elapsed;
+	int              kind;
+
+	printf("# %" PRIu64 " bytes read, %" PRIu64 " written, %u reconnects, %u retries, %" PRIu64 " bytes refetched, %.3fs\n",
+		stats->bytes_read,
+		stats->bytes_written,
+		stats->reconnects,
+		stats->retries,
+		stats->refetched,
+		elapsed_since(&stats->start));
+
+	if (stats->tcp_rtt) {
+		if (connection->socket_buffer > 0)
+			snprintf(buffer, sizeof(buffer), "set to %d", connection->socket_buffer);
+		else
+			snprintf(buffer, sizeof(buffer), "%s", connection->socket_buffer ? "bdp-sized" : "autotuned");
+
+		elapsed = elapsed_since(&stats->start);
+
+		printf("# rtt %.3fms (min %.3fms), socket buffers %s (receive %d, send %d), %.0f bytes/s, bandwidth-delay product %.0f bytes\n",
+			stats->tcp_rtt / 1e3,
+			stats->tcp_rtt_min / 1e3,
+			buffer,
+			stats->rcvbuf,
+			stats->sndbuf,
+			stats->bytes_read / elapsed,
+			stats->bytes_read / elapsed * stats->tcp_rtt_min / 1e6);
+	}
 
-			if ((marker1) && (marker2))
-				chunked_transfer = (marker1 < marker2) ? 0 : 1;
+	if (stats->connect_timeouts + stats->stalls + stats->slow + stats->resumes)
+		printf("# %u connect timeouts, %u stalls, %u transfers below the rate floor, %u resumes (%u requests sent again)\n",
+			stats->connect_timeouts,
+			stats->stalls,
+			stats->slow,
+			stats->resumes,
+			stats->resumed);
+
+	if (connection->faults.every == 0)
+		return;
+
+	printf("# %-10s %6s %16s %16s\n", "fault", "count", "recovery/fault", "refetched/fault");
+
+	for (kind = 0; kind < FAULT_KINDS; kind++)
+		if (stats->faults[kind])
+			printf("# %-10s %6u %15.4fs %16.0f\n",
+				names[kind],
+				stats->faults[kind],
+				stats->recovery[kind] / stats->faults[kind],
+				(double)stats->wasted[kind] / stats->faults[kind]);
+}
 
-			if (chunked_transfer == 0) {
-				chunk = strtol(marker1 + 16, (char **)NULL, 10);
 
-				if (chunk < 0)
-					errx(EXIT_FAILURE, "process_command_http: Bad stream data");
+/*
+ * reconnect
+ *
+ * Procedure that replaces a broken server connection, opening a new svn session on
+ * svn:// so that the interrupted command can be sent again.
+ */
 
-				offset += chunk;
-				if (connection->response_length > offset) {
-					chunked_transfer = -1;
-					groups++;
-				}
-			}
+static void
+reconnect(connector *connection)
+{
+	uint32_t  groups;
 
-			if (chunked_transfer == 1) {
-				chunk = 0;
-				marker2 = end;
-			}
-		}
+	connection->stats.reconnects++;
 
-		while ((chunked_transfer == 1) && ((end = strstr(marker2, "\r\n")) != NULL)) {
-			chunk = strtol(marker2, (char **)NULL, 16);
-			marker2 -= 2;
+	if (connection->verbosity > 1)
+		fprintf(stderr, "# Reconnecting to %s\n", connection->address);
 
-			if (chunk < 0)
-				errx(EXIT_FAILURE, "process_command_http: Bad stream data ");
+	if (connection->protocol == SVN) {
+		groups = connection->response_groups;
 
-			snprintf(hex_chunk, sizeof(hex_chunk), "\r\n%x\r\n", chunk);
-			gap = strlen(hex_chunk);
+		free(connection->uuid);
+		free(connection->root);
+		free(connection->trunk);
+		connection->uuid = connection->root = connection->trunk = NULL;
 
-			if (marker2 + chunk + gap > connection->response + connection->response_length) {
-				marker2 += 2;
-				read_more = 1;
-				break;
-			}
+		reset_connection(connection);
+		open_session_svn(connection);
 
-			if (first_chunk) {
-				first_chunk = 0;
-				chunk += gap;
-			}
-			else {
-				/* Remove the chunk from the buffer. */
+		connection->response_groups = groups;
+	} else {
+		if (connection->ssl) {
+			tls_session_keep(connection);
+			SSL_free(connection->ssl);
+			SSL_CTX_free(connection->ctx);
+			connection->ssl = NULL;
+			connection->ctx = NULL;
+		}
 
-				memmove(marker2,
-					marker2 + gap,
-					connection->response_length - (marker2 - connection->response));
+		reset_connection(connection);
+	}
+}
 
-				connection->response_length -= gap;
-			}
 
-			/* Move the offset to the end of the chunk. */
+/*
+ * standby_thread
+ *
+ * Function run by the thread that opens the standby http connection, doing the TCP
+ * and (resuming the session of the current connection) TLS handshakes while the
+ * current connection is still busy.  On failure the standby is left closed.
+ */
 
-			offset += chunk;
-			marker2 += chunk + 2;
+static void *
+standby_thread(void *data)
+{
+	connector  *connection = data, session;
+	jmp_buf     failure;
+	jmp_buf    *outer;
+
+	outer = job_failure;
+	job_failure = &failure;
+
+	connector_init(&session);
+	session.protocol = connection->protocol;
+	session.address = connection->address;
+	session.port = connection->port;
+	session.family = connection->family;
+	session.verbosity = connection->verbosity;
+	session.connect_timeout = connection->connect_timeout;
+	session.idle_timeout = connection->idle_timeout;
+	session.socket_buffer = connection->socket_buffer;
+	session.stats.start = connection->stats.start;
+	session.stats.bytes_read = connection->stats.bytes_read;
+	session.stats.tcp_rtt = connection->stats.tcp_rtt;
+	session.stats.tcp_rcv_space = connection->stats.tcp_rcv_space;
+	session.tls_session = connection->standby_session;
+
+	if (setjmp(failure) == 0)
+		reset_connection(&session);
+	else {
+		if (session.ssl)
+			SSL_free(session.ssl);
+
+		if (session.ctx)
+			SSL_CTX_free(session.ctx);
+
+		if (session.socket_descriptor != -1)
+			close(session.socket_descriptor);
+
+		session.ssl = NULL;
+		session.ctx = NULL;
+		session.socket_descriptor = -1;
+	}
 
-			if (chunk == 0) {
-				chunked_transfer = -1;
-				groups++;
-			}
-		}
+	connection->standby_descriptor = session.socket_descriptor;
+	connection->standby_ssl = session.ssl;
+	connection->standby_ctx = session.ctx;
 
-		if (connection->verbosity > 2)
-			fprintf(stderr, "\rBytes read: %zd, Bytes expected: %d, g:%d, rg:%d",
-				connection->response_length,
-				offset,
-				groups,
-				connection->response_groups);
-	}
+	job_failure = outer;
 
-	if (connection->verbosity > 2)
-		fprintf(stderr, "\rBytes read: %zd, Bytes expected: %d, g:%d, rg:%d",
-			connection->response_length,
-			offset,
-			groups,
-			connection->response_groups);
+	return (NULL);
+}
 
-	if (connection->verbosity > 2)
-		fprintf(stderr, "\n");
 
-	if (connection->verbosity > 3)
-		fprintf(stderr, "==========\n%s\n==========\n", connection->response);
+/*
+ * standby_start
+ *
+ * Procedure that starts opening a standby http connection in the background, unless
+ * one is already there.
+ */
 
-	if(!strstr(connection->response, "HTTP/1.1 "))
-		errx(EXIT_FAILURE, "unexpected response from HTTP server:\n%s", connection->response);
+static void
+standby_start(connector *connection)
+{
+	if ((connection->protocol < HTTP) || (connection->standby_state))
+		return;
 
-	return (connection->response);
+	if ((connection->standby_session = connection->tls_session) != NULL)
+		SSL_SESSION_up_ref(connection->standby_session);
+
+	if (pthread_create(&connection->standby_thread, NULL, standby_thread, connection) != 0) {
+		if (connection->standby_session)
+			SSL_SESSION_free(connection->standby_session);
+
+		connection->standby_session = NULL;
+		return;
+	}
+
+	connection->standby_state = 1;
 }
 
 
 /*
- * parse_xml_value
+ * standby_close
  *
- * Function that returns the text found between the opening and closing tags passed in.
+ * Procedure that waits for the standby connection to be opened and closes it.  If
+ * keep is set and it is still up, it is left in standby_descriptor instead and 1 is
+ * returned.
  */
 
-static char *
-parse_xml_value(char *start, char *end, const char *tag)
+static int
+standby_close(connector *connection, int keep)
 {
-	size_t  tag_length;
-	char   *data_end, *data_start, *end_tag, temp_end, *value;
+	char  peek;
 
-	value = NULL;
-	temp_end = *end;
-	*end = '\0';
+	if (!connection->standby_state)
+		return (0);
 
-	tag_length = strlen(tag) + 4;
-	if ((end_tag = (char *)malloc(tag_length)) == NULL)
-		err(EXIT_FAILURE, "parse_xml_value end_tag malloc");
+	pthread_join(connection->standby_thread, NULL);
+	connection->standby_state = 0;
 
-	snprintf(end_tag, tag_length, "</%s>", tag);
+	if (connection->standby_session)
+		SSL_SESSION_free(connection->standby_session);
 
-	if ((data_start = strstr(start, tag))) {
-		if ((data_start = strchr(data_start, '>'))) {
-			data_start++;
-			data_end = strstr(data_start, end_tag);
+	connection->standby_session = NULL;
 
-			if (data_end) {
-				if ((value = (char *)malloc(data_end - data_start + 1)) == NULL)
-					err(EXIT_FAILURE, "parse_xml_value value malloc");
+	if (connection->standby_descriptor == -1)
+		return (0);
 
-				memcpy(value, data_start, data_end - data_start);
-				value[data_end - data_start] = '\0';
-			}
-		}
-	}
+	/* the server may have closed it while it was waiting */
+	if ((keep) && (recv(connection->standby_descriptor, &peek, 1, MSG_PEEK | MSG_DONTWAIT) != 0))
+		return (1);
 
-	free(end_tag);
-	*end = temp_end;
+	if (connection->standby_ssl)
+		SSL_free(connection->standby_ssl);
 
-	return (value);
+	if (connection->standby_ctx)
+		SSL_CTX_free(connection->standby_ctx);
+
+	close(connection->standby_descriptor);
+
+	connection->standby_ssl = NULL;
+	connection->standby_ctx = NULL;
+	connection->standby_descriptor = -1;
+
+	return (0);
 }
 
 
 /*
- * parse_response_group
+ * rollover_http
  *
- * Procedure that isolates the next response group from the response stream.
+ * Procedure that replaces an http connection the server is done with by the standby
+ * connection, or by a new one if there is none, and starts opening the next standby
+ * if the server limits the requests per connection.
  */
 
 static void
-parse_response_group(connector *connection, char **start, char **end)
+rollover_http(connector *connection)
 {
-	if (connection->protocol == SVN)
-		*end = find_response_end(connection->protocol, *start, *end);
-
-	if (connection->protocol >= HTTP) {
-		*end = strstr(*start, "</D:multistatus>");
-		if (*end != NULL) *end += 16;
-		else errx(EXIT_FAILURE, "Error in http stream: %s\n", *start);
+	if (connection->verbosity > 1)
+		fprintf(stderr, "# Rolling over to a %s connection\n", connection->standby_state ? "standby" : "new");
+
+	if (connection->ssl) {
+		tls_session_keep(connection);
+		SSL_free(connection->ssl);
+		SSL_CTX_free(connection->ctx);
+		connection->ssl = NULL;
+		connection->ctx = NULL;
 	}
 
-	**end = '\0';
+	if (standby_close(connection, 1)) {
+		if (connection->socket_descriptor != -1)
+			close(connection->socket_descriptor);
+
+		connection->socket_descriptor = connection->standby_descriptor;
+		connection->ssl = connection->standby_ssl;
+		connection->ctx = connection->standby_ctx;
+		connection->standby_descriptor = -1;
+		connection->standby_ssl = NULL;
+		connection->standby_ctx = NULL;
+		connection->requests_left = connection->keepalive_max ? connection->keepalive_max : -1;
+		connection->requests_served = 0;
+		connection->stats.rate_waited = 0;
+		connection->stats.rate_bytes = 0;
+	} else
+		reset_connection(connection);
+
+	if (connection->keepalive_max)
+		standby_start(connection);
 }
 
 
 /*
- * parse_response_item
+ * send_command
  *
- * Function that isolates the next response from the current response group.
+ * Procedure that sends commands to the http/svn server.
  */
 
-static int
-parse_response_item(connector *connection, char *end, int *count, char **item_start, char **item_end)
+static void
+send_command(connector *connection, const char *command)
 {
-	int c, has_entries, ok;
+	size_t  bytes_to_write, total_bytes_written;
+	ssize_t bytes_written;
 
-	c = has_entries = 0;
-	ok = 1;
+	if (command) {
+		total_bytes_written = 0;
+		bytes_to_write = strlen(command);
 
-	if (connection->protocol == SVN) {
-		if (*count == '\0') {
-			while ((c < 3) && (*item_start < end)) {
-				c += (**item_start == '(' ? 1 : (**item_start == ')' ? -1 : 0));
-				if (**item_start == ':') has_entries++;
-				(*item_start)++;
-			}
+		if (connection->verbosity > 2)
+			fprintf(stdout, "<< %zu bytes\n%s", bytes_to_write, command);
 
-			(*item_start) += 5;
-			*item_end = *item_start;
-		}
+		/* a burst of pipelined requests leaves in full segments */
+		transport_cork(connection, 1);
 
-		c = 1;
-		(*item_end)++;
-
-		while ((c > 0) && (*item_end < end)) {
-			(*item_end)++;
-			c += (**item_end == '(' ? 1 : (**item_end == ')' ? -1 : 0));
-			if (**item_end == ':') has_entries++;
-		}
-
-		(*item_end)++;
-		**item_end = '\0';
-	}
-
-	if (connection->protocol >= HTTP) {
-		*item_end = strstr(*item_start, "</D:response>");
-
-		if (*item_end != NULL) {
-			*item_end += 13;
-			**item_end = '\0';
-			has_entries = 1;
-		} else ok = 0;
-	}
-
-	if (!has_entries) ok = 0;
-
-	(*count)++;
-
-	return (ok);
-}
-
-/* checking whether the md5 of file as retrieved from online repo
-   matches the value in known_files list. if the file isn't in
-   known_files then there's no point checking against the
-   filesystem either, as it shouldn't exist there.
-   the only case where it could be interesting to check against
-   a filesystem copy would be the case of a huge repo checked
-   out with a different client (i.e. no known_files file exists
-   yet), and the user being unwilling to check
-   out every single file again - but in that case he could just
-   produce the file known_files with a script that runs md5sum
-   over all files.
-*/
-static void check_md5(connector *connection, file_node *file) {
-	char buf[4096];
-	struct tree_node  *data, *next;
-	if(file->md5[0] && !file->md5_checked) {
-		file->md5_checked = 1;
-		file->download = 1; /* default to "md5 doesn't match local file" */
-		snprintf(buf, sizeof buf, "%s",
-			strip_rev_root_stub(connection, file->path));
+		while (total_bytes_written < bytes_to_write) {
+			if (connection->protocol == HTTPS)
+				bytes_written = SSL_write(
+					connection->ssl,
+					command + total_bytes_written,
+					bytes_to_write - total_bytes_written);
+			else
+				bytes_written = write(
+					connection->socket_descriptor,
+					command + total_bytes_written,
+					bytes_to_write - total_bytes_written);
 
-		for (data = RB_MIN(tree_known_files, &known_files); data != NULL; data = next) {
-			if(!strcmp(data->path, buf)) {
-				if(!memcmp(data->md5, file->md5, 32)) {
-					file->download = 0;
-					return;
+			if (bytes_written <= 0) {
+				if ((bytes_written < 0) && ((errno == EINTR) || (errno == 0))) {
+					continue;
+				} else {
+					job_err(EXIT_FAILURE, "send command");
 				}
-				/* file encountered in known_files, but md5 mismatch */
-				break;
 			}
-			next = RB_NEXT(tree_known_files, head, data);
-		}
-	}
-}
-
-/*
- * new_file_node
- *
- * Function that allocates a new file_node and expands the dynamic
- * array that stores file_nodes.
- */
-
-static file_node *
-new_file_node(file_node ***file, int *file_count, int *file_max)
-{
-	file_node *node = calloc(1, sizeof(file_node));
-
-	if (node == NULL)
-		err(EXIT_FAILURE, "new_file_node node malloc");
 
-	(*file)[*file_count] = node;
+			total_bytes_written += bytes_written;
+			connection->stats.bytes_written += bytes_written;
+		}
 
-	if (++(*file_count) == *file_max) {
-		*file_max += BUFFER_UNIT;
+		transport_cork(connection, 0);
+		transport_sample(connection);
 
-		if ((*file = (file_node **)realloc(*file, *file_max * sizeof(file_node **))) == NULL)
-			err(EXIT_FAILURE, "new_file_node file realloc");
+		if (bytes_to_write) {
+			connection->stats.awaiting = 1;
+			clock_gettime(CLOCK_MONOTONIC, &connection->stats.last_io);
+		}
 	}
-
-	return (node);
 }
 
+
 /*
- * save_file
+ * check_command_success
  *
- * Procedure that saves a file.
+ * Function that makes sure a failure response has not been sent from the svn server.
  */
 
 static int
-save_file(char *filename, char *start, char *end, int executable, int special)
+check_command_success(int protocol, char **start, char **end)
 {
-	struct stat  local;
-	int          fd, saved;
-	char        *tag;
-
-	saved = 0;
+	int   fail = 0;
+	char *response = *start;
 
-	if (special) {
-		if (starts_with_lit(start, "link ")) {
-			*end = '\0';
+	if (protocol == SVN) {
+		if (starts_with_lit(*start, "( success ( ( ) 0: ) ) ( failure"))
+			fail = 1;
 
-			if (stat(filename, &local) == 0)
-				if (remove(filename) != 0)
-					errx(EXIT_FAILURE, "Please remove %s manually and restart svnup", filename);
+		else if (starts_with_lit(*start, "( success ( ) ) ( failure"))
+			fail = 1;
 
-			if (symlink(start + 5, filename)) {
-				err(EXIT_FAILURE, "Cannot link %s -> %s", start + 5, filename);
+		if (!fail) {
+			while (**start == ' ') (*start)++;
 
-			saved = 1;
+			if (starts_with_lit(*start, "( success ")) {
+				if (starts_with_lit(*start, "( success ( ( ) 0: ) )"))
+					*start += LIT_LEN("( success ( ( ) 0: ) )")+1;
+				*end = find_response_end(protocol, *start, *end) + 1;
 			}
+			else fail = 1;
 		}
-	} else {
-		if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC)) == -1)
-			err(EXIT_FAILURE, "write file failure %s", filename);
+	}
 
-		write(fd, start, end - start);
-		close(fd);
-		chmod(filename, executable ? 0755 : 0644);
+	if (protocol >= HTTP) {
+		if (!starts_with_lit(*start, "HTTP/1.1 "))
+			fail = 1;
+		else {
+			*start += LIT_LEN("HTTP/1.1 ");
+			if(**start != '2') fail = 1;
+			else {
+				*start = strstr(*start, "\r\n\r\n");
+				if (*start) *start += 4; else fail = 1;
+			}
+		}
+	}
 
-		saved = 1;
+	if (fail) {
+		if(protocol == SVN || !strstr(response, "xml version="))
+			fprintf(stderr, "\nCommand Failure: %s\n", response);
+		else {
+			char *ec = parse_xml_value(*start, *end, "m:human-readable");
+			if(ec) { fprintf(stderr, "\n%s\n", ec); free(ec); }
+			else fprintf(stderr, "\nCommand Failure: %s\n", response);
+		}
 	}
 
-	return (saved);
+	return (fail);
 }
 
 
 /*
- * save_known_file_list
+ * process_command_svn
  *
- * Procedure that saves the list of files known to be in the repository.
+ * Function that sends a command set to the svn server and parses its response to make
+ * sure that the expected number of response strings have been received.
  */
 
-static void
-save_known_file_list(connector *connection, file_node **file, int file_count)
+static char *
+process_command_svn(connector *connection, const char *command, unsigned int expected_bytes)
 {
-	struct tree_node  find, *found;
-	int               fd, x;
+	ssize_t       bytes_read;
+	int           count, ok;
+	unsigned int  group, position, try;
+	char         *check, input[BUFFER_UNIT + 1];
 
-	if ((fd = open(connection->known_files_new, O_WRONLY | O_CREAT | O_TRUNC)) == -1)
-		err(EXIT_FAILURE, "write file failure %s", connection->known_files_new);
+	try = 0;
+	retry:
 
-	for (x = 0; x < file_count; x++) {
-		write(fd, file[x]->md5, strlen(file[x]->md5));
-		write(fd, "\t", 1);
-		char* ftmp = strip_rev_root_stub(connection, file[x]->path);
-		write(fd, ftmp, strlen(ftmp));
-		write(fd, "\n", 1);
+	send_command(connection, command);
 
-		/* If the file exists in the red-black trees, remove it. */
+	count = position = ok = group = connection->response_length = 0;
 
-		find.path = ftmp;
+	do {
+		bzero(input, BUFFER_UNIT + 1);
 
-		if ((found = RB_FIND(tree_known_files, &known_files, &find)) != NULL)
-			tree_node_free(RB_REMOVE(tree_known_files, &known_files, found));
+		bytes_read = transport_read(connection, input, BUFFER_UNIT);
 
-		if ((found = RB_FIND(tree_local_files, &local_files, &find)) != NULL)
-			tree_node_free(RB_REMOVE(tree_local_files, &local_files, found));
+		if (bytes_read <= 0) {
+			if ((bytes_read < 0) && (errno == EINTR)) continue;
 
-		if (file[x]->href)
-			free(file[x]->href);
+			if ((++try > 5) || (connection->in_handshake))
+				job_errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
 
-		free(file[x]->path);
-		free(file[x]);
-		file[x] = NULL;
-	}
+			if (try > 1)
+				fprintf(stderr, "Error in svn stream, retry #%d\n", try);
 
-	close(fd);
-	chmod(connection->known_files_new, 0644);
-}
+			transport_retry(connection, connection->response_length);
+			reconnect(connection);
 
+			goto retry;
+		}
 
-static int protocol_from_str(char* line, connector *connection) {
-	if (strncmp(line, "svn", 3) == 0) {
-		connection->protocol = SVN;
-		connection->port = 3690;
-	} else
+		input[bytes_read] = 0;
+		if (connection->verbosity > 3)
+			fprintf(stdout, "<< %s\n", input);
 
-	if (strncmp(line, "https", 5) == 0) {
-		connection->protocol = HTTPS;
-		connection->port = 443;
-	} else
+		connection->response_length += bytes_read;
 
-	if (strncmp(line, "http", 4) == 0) {
-		connection->protocol = HTTP;
-		connection->port = 80;
-	} else {
-		connection->protocol = NONE;
-		return 0;
-	}
+		/* always allocate at least BUFFER_UNIT bytes more than we actually need
+		   because there's some wacky code in get_files() - see FIXME comment
+		   before the memmove() there */
+		size_t max = connection->response_length + BUFFER_UNIT;
+		if(expected_bytes + BUFFER_UNIT > max) max = expected_bytes + BUFFER_UNIT;
+		if (max >= connection->response_blocks * BUFFER_UNIT) {
+			do connection->response_blocks += (connection->response_blocks/2);
+			while(max >= connection->response_blocks * BUFFER_UNIT);
 
-	return 1;
-}
+			connection->response = realloc(
+				connection->response,
+				connection->response_blocks * BUFFER_UNIT + 1);
 
-/*
- * create_directory
- *
- * Procedure that checks for and creates a local directory if possible.
- */
+			if (connection->response == NULL)
+				job_err(EXIT_FAILURE, "process_command_svn realloc");
+		}
 
-static void
-create_directory(char *directory)
-{
-	struct stat  local;
-	int          create;
+		if (expected_bytes == 0) {
+			if (input[1] == '\0') {
+				connection->response[position++] = input[0];
+				continue;
+			}
 
-	create = stat(directory, &local);
+			if (connection->verbosity > 3)
+				fprintf(stdout, "==========\n>> Response Parse:\n");
 
-	if (create == 0) {
-		/* If a file exists with the same name, try and remove it first. */
+			check = input;
+			if ((count == 0) && (input[0] == ' '))
+				*check++ = '\0';
 
-		if (!S_ISDIR(local.st_mode)) {
-			if (remove(directory) != 0)
-				err(EXIT_FAILURE, "%s exists and is not a directory.  Please remove it manually and restart svnup", directory);
-			else
-				create = 1;
-		}
-	}
+			do {
 
-	if (create)
-		if (mkdir(directory, 0755))
-			err(EXIT_FAILURE, "Cannot create %s", directory);
-}
+				if (*check == ')')
+					--count;
+				else if(*check == '(') {
+					/* trying to skip size-annotated block, which in case of
+					   a commit message may contain unbalanced parens */
+					int skip = 0;
+					char *q, *p = check+1, *e = input + bytes_read;
+					if(p+2 < e && p[0] == ' ' && isdigit(p[1])) {
+						q = p+1;
+						while(q < e && isdigit(*q)) ++q;
+						if(q < e && *q == ':') {
+							skip = atoi(p)+1;
+							check = q;
+						}
+					}
+					if(skip) {
+						if(check+skip < input + bytes_read) {
+							check += skip;
+						} else if (connection->verbosity > 3) {
+							fprintf(stderr, "couldn't skip %d bytes", skip);
+						}
+					}
+					++count;
+				}
 
+				if (connection->verbosity > 3)
+					fprintf(stderr, "%d", count);
 
-/* concats all strings in stringlist (up to a defined margin) into a single
-   long string, and removes the processed entries from the list.
-   returns pointer to a freshly allocated string.
-   returns NULL if no strings are left.
-   if items is set to non-zero, it is used as a max value for the number
-   of items concatenated.
-   items will be filled with the number of strings joined into the result.*/
-static char *concat_stringlist(stringlist *sl, size_t maxlen, size_t *items) {
-	char *chain = malloc(maxlen),
-	     *cp = chain, *ce = chain+(maxlen-1);
-	size_t max_items = *items;
-	*items = 0;
-	while(stringlist_getsize(sl)) {
-		char *s = stringlist_get(sl, 0);
-		size_t l = strlen(s);
-		if(cp + l < ce && (!max_items || *items < max_items)) {
-			strcpy(cp, s);
-			cp += l;
-			++(*items);
-			stringlist_delete(sl, 0);
-			free(s);
-		} else {
-			return chain;
+				if (count == 0) {
+					group++;
+					check++;
+					if (check < input + bytes_read) {
+						if (*check == ' ')
+							*check = '\0';
+
+						if (*check != '\0')
+							fprintf(stderr, "oops: %d %c\n", *check, *check);
+
+						char *q = check + 1;
+						while(q < input + bytes_read && *q != '(') ++q;
+						check = q-1;
+					}
+				}
+			}
+			while (++check < input + bytes_read);
 		}
+
+		memcpy(connection->response + position, input, bytes_read + 1);
+		position += bytes_read;
+
+		if ((expected_bytes == 0) && (connection->verbosity > 3))
+			fprintf(stderr, ". = %d %d\n", group, connection->response_groups);
+
+		if (group >= connection->response_groups)
+			ok = 1;
+
+		if (position == expected_bytes)
+			ok = 1;
+
+		if ((expected_bytes > 0) && (connection->response[0] == ' ') && (position == expected_bytes + 1))
+			ok = 1;
 	}
-	if(*items == 0) { free(chain); chain = 0; }
-	return chain;
+	while (!ok);
+
+	if ((expected_bytes == 0) && (connection->verbosity > 2))
+		fprintf(stdout, "==========\n>> Response:\n%s", connection->response);
+
+	connection->response[position] = '\0';
+
+	return (connection->response);
 }
 
+
 /*
- * process_report_svn
+ * http_request_length
  *
- * Procedure that sends the svn report command and saves the initial details
- * in a dynamic array of file_nodes.
+ * Function that returns the length of the http request at the start of a command
+ * set: its header and the chunked body, if any.
  */
 
-static void
-process_report_svn(connector *connection, char *command, file_node ***file, int *file_count, int *file_max)
+static size_t
+http_request_length(const char *request)
 {
-	file_node   *this_file;
-	struct tree_node  *found, find;
-	struct stat  local;
-	int          count, path_exists, try, x;
-	size_t       d, length, name_length, path_length, path_source_length;
-	char        *command_start, *directory_end, *directory_start, *end;
-	char        *item_end, *item_start, *marker, *name;
-	char        *path_source, *start, *temp;
-	stringlist *buffered_commands = stringlist_new(16);
+	const char  *body, *chunked, *end;
 
-	path_source = malloc(MAXNAMLEN + 1);
+	if ((end = strstr(request, "\r\n\r\n")) == NULL)
+		return (strlen(request));
 
-	try = -1;
+	body = end + 4;
 
-	retry:
-
-	start = process_command_svn(connection, command, 0);
-	end   = start + connection->response_length;
+	if (((chunked = strstr(request, "Transfer-Encoding: chunked")) != NULL) && (chunked < end)
+		&& ((end = strstr(body, "\r\n0\r\n\r\n")) != NULL))
+		return (end + LIT_LEN("\r\n0\r\n\r\n") - request);
 
-	command_start = command;
+	return (body - request);
+}
 
-	directory_start = command_start;
 
-	for (d = 0; d < connection->response_groups / 2; d++) {
-		if (!starts_with_lit(directory_start, "( get-dir ( "))
-			errx(EXIT_FAILURE, "Error in response: %s\n", directory_start);
+/*
+ * send_requests_http
+ *
+ * Procedure that sends the next requests of a command set, as many as the
+ * connection still takes before the server closes it.
+ */
 
-		directory_end = strchr(directory_start, '\n');
+static void
+send_requests_http(connector *connection, char *command, size_t *starts, int requests, int *sent)
+{
+	char  saved;
+	int   count;
 
-		temp = strchr(directory_start, ':') + 1;
-		directory_start = strchr(temp, ' ');
+	count = requests - *sent;
 
-		length = directory_start - temp;
-		if (length > 0)
-			memcpy(path_source, temp, length);
+	if ((connection->requests_left >= 0) && (count > connection->requests_left))
+		count = connection->requests_left;
 
-		path_source[length] = '\0';
-		path_source_length = length;
+	if (count <= 0)
+		return;
 
-		directory_start = directory_end + 1;
+	saved = command[starts[*sent + count]];
+	command[starts[*sent + count]] = '\0';
+	send_command(connection, command + starts[*sent]);
+	command[starts[*sent + count]] = saved;
 
-		/* Parse the response for file/directory names. */
+	*sent += count;
 
-		end = connection->response + connection->response_length;
-		if (check_command_success(connection->protocol, &start, &end)) {
-			if (++try > 5)
-				errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
+	if (connection->requests_left > 0)
+		connection->requests_left -= count;
+}
 
-			if (try > 1)
-				fprintf(stderr, "Error in svn stream, retry #%d\n", try);
 
-			goto retry;
-		}
+/*
+ * process_command_http
+ *
+ * Function that sends a command set to the http server and parses its response to make
+ * sure that the expected number of response bytes have been received.
+ */
 
-		parse_response_group(connection, &start, &end);
+static char *
+process_command_http(connector *connection, char *command)
+{
+	int           bytes_read, chunk, chunked_transfer, first_chunk, gap, read_more, spread;
+	int           complete, connection_end, headers, requests, sent;
+	int           boundary_first_chunk, resumed_at;
+	unsigned int  boundary, boundary_groups, groups, offset, try;
+	size_t       *starts;
+	char         *begin, *end, input[BUFFER_UNIT + 1], *marker1, *marker2, *temp, hex_chunk[32];
+	char         *value, saved;
 
-		item_start = start;
-		item_end = end;
+	/* Find where each request of the command set starts. */
 
-		count = 0;
+	for (requests = 0, temp = command; *temp; requests++)
+		temp += http_request_length(temp);
 
-		while (parse_response_item(connection, end, &count, &item_start, &item_end)) {
-			temp = NULL;
+	if ((starts = (size_t *)malloc((requests + 1) * sizeof(size_t))) == NULL)
+		job_err(EXIT_FAILURE, "process_command_http malloc");
 
-			/* Keep track of the remote files. */
+	for (requests = 0, temp = command; *temp; temp += http_request_length(temp))
+		starts[requests++] = temp - command;
 
-			length = strtol(item_start + 1, (char **)NULL, 10);
-			if (length > MAXNAMLEN)
-				errx(EXIT_FAILURE, "entry_is_file file name is too long");
+	starts[requests] = temp - command;
 
-			marker = strchr(item_start, ':') + 1 + length;
+	try = resumed_at = 0;
+	retry:
 
-			if (starts_with_lit(marker, " file ")) {
-				this_file = new_file_node(file, file_count, file_max);
+	chunked_transfer = -1;
+	connection->response_length = chunk = groups = 0;
+	offset = read_more = 0;
+	first_chunk = 1;
+	boundary = boundary_groups = 0;
+	boundary_first_chunk = 1;
+	begin = end = marker1 = marker2 = temp = NULL;
 
-				name_length = strtol(item_start + 1, (char **)NULL, 10);
-				if (name_length > MAXNAMLEN)
-					errx(EXIT_FAILURE, "process_file_entry file name is too long");
+	bzero(connection->response, connection->response_blocks * BUFFER_UNIT + 1);
+	bzero(input, BUFFER_UNIT + 1);
 
-				name = item_start = strchr(item_start, ':') + 1;
+	if (try)
+		reconnect(connection);
+	else if (connection->socket_descriptor == -1)
+		reset_connection(connection);
+	else if (connection->requests_left == 0)
+		rollover_http(connection);
 
-				item_start += name_length;
-				*item_start = '\0';
-				path_length = strlen(path_source) + name_length + 2;
+	/* Send no more requests than the server takes on the connection. */
 
-				if (!starts_with_lit(item_start + 1, "file "))
-					errx(EXIT_FAILURE, "process_file_entry malformed response");
+	sent = headers = 0;
+	connection_end = connection->requests_left >= 0 ? connection->requests_left : INT_MAX;
 
-				if ((this_file->path = (char *)malloc(path_length)) == NULL)
-					err(EXIT_FAILURE, "process_file_entry file->path malloc");
+	if (connection_end < requests)
+		standby_start(connection);
 
-				snprintf(this_file->path, path_length, "%s/%s", path_source, name);
+	send_requests_http(connection, command, starts, requests, &sent);
 
-				item_start = strchr(item_start + 1, ' ');
-				this_file->size = strtol(item_start, (char **)NULL, 10);
-			}
+	while (groups < connection->response_groups) {
+		spread = connection->response_length - offset;
 
-			if (starts_with_lit(marker, " dir ")) {
-				length = strtol(item_start + 1, (char **)NULL, 10);
-				if (length > MAXNAMLEN)
-					errx(EXIT_FAILURE, "process_file file name is too long");
+		if (spread <= 0)
+			read_more = 1;
 
-				name = strchr(item_start, ':') + 1;
-				name[length] = '\0';
+		/* Sometimes the read returns only part of the next offset, so
+		 * if there were less than five bytes read, keep reading to get
+		 * the remainder of the offset. */
 
-				char *temp_path = malloc(BUFFER_UNIT+1);
+		if ((chunked_transfer == 1) && (spread <= 5))
+			read_more = 1;
 
-				snprintf(temp_path,
-					BUFFER_UNIT,
-					"%s%s/%s",
-					connection->path_target,
-					path_source,
-					name);
+		if ((chunked_transfer == 0) && (spread == 0) && (connection->response_groups - groups == 1))
+			break;
 
-				/* Create the directory locally if it doesn't exist. */
+		if (read_more) {
+			/* The server is done with the connection: carry on on the next one. */
 
-				path_exists = stat(temp_path, &local);
+			complete = (groups + ((chunked_transfer == 0) && (spread >= 0))) / 2;
 
-				if ((path_exists != -1) && (!S_ISDIR(local.st_mode)))
-					errx(EXIT_FAILURE, "%s exists locally and is not a directory.  Please remove it manually and restart svnup", temp_path);
+			if (((chunked_transfer == -1) || ((chunked_transfer == 0) && (spread >= 0)))
+				&& (complete < requests)
+				&& ((complete >= connection_end) || (complete == sent))) {
+				rollover_http(connection);
 
-				if (path_exists == -1) {
-					if (connection->verbosity)
-						printf(" + %s\n", temp_path);
+				sent = headers = complete;
+				connection_end = connection->requests_left >= 0 ? sent + connection->requests_left : INT_MAX;
+				send_requests_http(connection, command, starts, requests, &sent);
+			}
 
-					if (mkdir(temp_path, 0755) && errno != EEXIST)
-						err(EXIT_FAILURE, "Cannot create target directory");
-				}
+			bytes_read = transport_read(connection, input, BUFFER_UNIT);
 
-				/* Remove the directory from the local directory tree to avoid later attempts at pruning. */
+			if (connection->response_length + bytes_read > connection->response_blocks * BUFFER_UNIT) {
+				while(connection->response_length + bytes_read > connection->response_blocks * BUFFER_UNIT)
+					connection->response_blocks += (connection->response_blocks/2);
 
-				find.path = temp_path;
+			#define SAVE_VAR(X) \
+				intptr_t X ## _offset; \
+				int was_null_ ## X = 0; \
+				if(X) X ## _offset = X - connection->response; \
+				else was_null_ ## X = 1;
 
-				if ((found = RB_FIND(tree_local_directories, &local_directories, &find)) != NULL)
-					tree_node_free(RB_REMOVE(tree_local_directories, &local_directories, found));
+				SAVE_VAR(marker2);
+				SAVE_VAR(begin);
+				SAVE_VAR(end);
 
-				/* Add a get-dir command to the command buffer. */
+				connection->response = (char *)realloc(
+					connection->response,
+					connection->response_blocks * BUFFER_UNIT + 1);
 
-				length += path_source_length + 1;
+				if (connection->response == NULL)
+					job_err(EXIT_FAILURE, "process_command_http realloc");
 
-				char* next_command = malloc(BUFFER_UNIT+1);
-				snprintf(next_command,
-					BUFFER_UNIT,
-					"( get-dir ( %zd:%s/%s ( %d ) false true ( kind size ) false ) )\n",
-					length,
-					path_source,
-					name,
-					connection->revision);
+			#define RESTORE_VAR(X) \
+				if (!was_null_ ## X) \
+					X = connection->response + X ## _offset;
 
-				stringlist_add_dup(buffered_commands, next_command);
-				free(next_command);
-				free(temp_path);
+				RESTORE_VAR(marker2);
+				RESTORE_VAR(begin);
+				RESTORE_VAR(end);
 			}
 
-			item_start = item_end + 1;
-		}
+			if ((bytes_read < 0) && (errno == EINTR))
+				continue;
 
-		start = end + 1;
-	}
+			/* Keep the complete responses of a broken or stalled connection and
+			 * send again on a new one only the requests left unanswered. */
 
-	/* Recursively process the command buffers. */
-	/* we pack up to 32KB worth of file requests into a single buffer */
-	char *chain;
-	size_t chain_count = 0;
-	while((chain = concat_stringlist(buffered_commands, BUFFER_UNIT, &chain_count))) {
-		connection->response_groups = 2 * chain_count;
-		process_report_svn(connection, chain, file, file_count, file_max);
-		free(chain);
-	}
-	stringlist_free(buffered_commands);
-	free(path_source);
-}
+			if ((bytes_read < 0) || ((bytes_read == 0) && (connection->response_length))) {
+				if ((chunked_transfer == -1) || ((chunked_transfer == 0) && (spread >= 0))) {
+					boundary = offset;
+					boundary_groups = groups + (chunked_transfer == 0);
+					boundary_first_chunk = first_chunk;
+				}
 
-static char* craft_http_packet(const char *host, const char* url,
-	const char* verb, const char* footer, char* command) {
-	snprintf(command,
-		COMMAND_BUFFER,
-		"%s %s HTTP/1.1\r\n"
-		"Host: %s\r\n"
-		"User-Agent: svnup-%s\r\n"
-		"Content-Type: text/xml\r\n"
-		"Connection: Keep-Alive\r\n"
-		"DAV: http://subversion.tigris.org/xmlns/dav/svn/depth\r\n"
-		"DAV: http://subversion.tigris.org/xmlns/dav/svn/mergeinfo\r\n"
-		"DAV: http://subversion.tigris.org/xmlns/dav/svn/log-revprops\r\n"
-		"Transfer-Encoding: chunked\r\n\r\n"
-		"%lx\r\n"
-		"%s"
-		"\r\n0\r\n\r\n",
-		verb, url, host,
-		SVNUP_VERSION,
-		strlen(footer),
-		footer);
-	return command;
-}
+				complete = boundary_groups / 2;
 
-/* expects pointer to a string like "( 6: foobar )", puts "foobar" into saveloc (heap)
-   returns pointer to after ')' */
-static char* extract_svn_string_from_group(char* data, char** saveloc) {
-	char *p = data;
-	assert(*p == '(');
-	++p;
-	assert(*p == ' ');
-	++p;
-	assert(isdigit(*p));
-	int n = atoi(p);
-	while(isdigit(*p))++p;
-	assert(*p == ':');
-	++p;
-	*saveloc = malloc(n+1);
-	memcpy(*saveloc, p, n);
-	(*saveloc)[n] = 0;
-	p += n + 1;
-	assert(*p == ')');
-	return ++p;
-}
+				if ((complete > 0) && (complete < requests) && ((complete > resumed_at) || (++try <= 5))) {
+					if (connection->verbosity > 1)
+						fprintf(stderr, "# Resuming after %d of %d responses\n", complete, requests);
 
+					connection->stats.resumes++;
+					connection->stats.resumed += sent - complete;
+					transport_retry(connection, connection->response_length - boundary);
 
-static void process_log_svn(connector *connection) {
-	char command[COMMAND_BUFFER + 1], *start, *end;
+					connection->response_length = offset = boundary;
+					connection->response[offset] = '\0';
+					groups = boundary_groups;
+					first_chunk = boundary_first_chunk;
+					chunked_transfer = -1;
+					resumed_at = complete;
 
-	snprintf(command, COMMAND_BUFFER,
-		 "( log ( ( 0: ) ( %d ) ( %d ) false false 0 false revprops"
-		 " ( 10:svn:author 8:svn:date 7:svn:log ) ) ) ",
-		 connection->revision, connection->revision);
+					reconnect(connection);
 
-	connection->response_groups = 2; /* 3 on success, 2 on error */
-	process_command_svn(connection, command, 0);
-	start = connection->response;
-	end = connection->response + connection->response_length;
+					sent = headers = complete;
+					connection_end = connection->requests_left >= 0 ? sent + connection->requests_left : INT_MAX;
 
-	char* group2 = connection->response + strlen(connection->response) +1;
-	if(group2 < end && starts_with_lit(group2, "done ( failure ( ( "))
-		errx(EXIT_FAILURE, "%s", group2 + LIT_LEN("done ( failure ( ( "));
+					if (connection_end < requests)
+						standby_start(connection);
 
-	if (check_command_success(connection->protocol, &start, &end))
-		errx(EXIT_FAILURE, "couldn't get log");
+					send_requests_http(connection, command, starts, requests, &sent);
+					continue;
+				}
+			}
 
-	char buf[32], *p, *date;
-	snprintf(buf, sizeof buf, " %d ( ", connection->revision);
-	p = strstr(start, buf);
-	if(!p) return;
+			if (bytes_read < 0) {
+			check_tries_and_retry:;
+				if (++try > 5)
+					job_errx(EXIT_FAILURE, "Error in http stream.  Quitting.");
 
-	p += strlen(buf)-2;
+				if (try > 1)
+					fprintf(stderr, "Error in http stream, retry #%d\n", try);
 
-	p = extract_svn_string_from_group(p, &connection->commit_author);
-	assert(*p == ' ');
-	++p;
+				transport_retry(connection, connection->response_length);
 
-	p = extract_svn_string_from_group(p, &connection->commit_date);
-	assert(*p == ' ');
-	++p;
+				goto retry;
+			}
 
-	p = extract_svn_string_from_group(p, &connection->commit_msg);
-	assert(*p == ' ');
+			if (bytes_read == 0) {
+				if(connection->response_length == 0) goto check_tries_and_retry;
+				break;
+			}
 
-	sanitize_svn_date(connection->commit_date);
-}
+			memcpy(connection->response + connection->response_length, input, bytes_read + 1);
+			connection->response_length += bytes_read;
+			connection->response[connection->response_length] = '\0';
+			read_more = 0;
+			spread = connection->response_length - offset;
+		}
 
-static void process_log_http(connector *connection) {
-	char command[COMMAND_BUFFER + 1], footer[1024], url[512];
+		if ((chunked_transfer == 0) && (spread >= 0)) {
+			chunked_transfer = -1;
+			groups++;
+		}
 
-	snprintf(url, sizeof url,
-		"%s/%d",
-		connection->rev_root_stub,
-		connection->revision
-	);
-	snprintf(footer, sizeof footer,
-		"<S:log-report xmlns:S=\"svn:\">"
-			"<S:start-revision>%d</S:start-revision>"
-			"<S:end-revision>%d</S:end-revision>"
-			"<S:revprop>svn:author</S:revprop>"
-			"<S:revprop>svn:date</S:revprop>"
-			"<S:revprop>svn:log</S:revprop>"
-			"<S:path></S:path>"
-			"<S:encode-binary-props></S:encode-binary-props>"
-		"</S:log-report>\r\n"
-		,
-		connection->revision,
-		connection->revision
-	);
+		if (chunked_transfer == -1) {
+			boundary = offset;
+			boundary_groups = groups;
+			boundary_first_chunk = first_chunk;
+			begin = connection->response + offset;
 
-	craft_http_packet(connection->address, url, "REPORT", footer, command);
-	connection->response_groups = 2;
+			if ((begin = strstr(begin, "HTTP/1.1 ")) == NULL) {
+				read_more = 1;
+				continue;
+			}
 
-	process_command_http(connection, command);
+			if ((end = strstr(begin, "\r\n\r\n")) == NULL) {
+				read_more = 1;
+				continue;
+			}
 
-	char *start = connection->response,
-	     *end = start + connection->response_length, *p;
+			if(strstr(begin, "DAV: http://subversion.tigris.org/xmlns/dav/svn/inline-props"))
+				connection->inline_props = 1;
 
-	if(check_command_success(connection->protocol, &start, &end))
-		errx(EXIT_FAILURE, "couldn't get log\n%s", start);
+			/* Keep track of how many more requests the server takes on the connection. */
 
-	if((p = strstr(start, "xml version="))) start = p+10;
+			headers++;
+			connection->requests_served++;
+			saved = *end;
+			*end = '\0';
 
-	connection->commit_author = parse_xml_value(start, end, "D:creator-displayname");
-	connection->commit_date   = parse_xml_value(start, end, "S:date");
-	connection->commit_msg    = parse_xml_value(start, end, "D:comment");
-	if(connection->commit_date)
-		sanitize_svn_date(connection->commit_date);
-	else
-		fprintf(stderr, "warning: empty reply for log request\n");
-}
+			if (strstr(begin, "Connection: close"))
+				connection_end = headers;
+			else if (((value = strstr(begin, "Keep-Alive: ")) != NULL) && ((value = strstr(value, "max=")) != NULL)) {
+				connection_end = headers + atoi(value + 4);
+				connection->keepalive_max = connection->requests_served + atoi(value + 4);
+			}
 
-/*
- * process_report_http
- *
- * Procedure that sends the http report command and saves the initial details
- * in a dynamic array of file_nodes.
- */
+			*end = saved;
 
-static void
-process_report_http(connector *connection, file_node ***file, int *file_count, int *file_max)
-{
-	file_node   *this_file;
-	struct tree_node  *found, find;
-	char         command[COMMAND_BUFFER + 1], *d, *end, *href, *md5, *path;
-	char        *start, *temp, temp_buffer[BUFFER_UNIT], *value;
-	char footer[512];
+			if (connection_end != INT_MAX) {
+				connection->requests_left = MAX(connection_end - sent, 0);
 
-	connection->response_groups = 2;
+				if (connection_end < requests)
+					standby_start(connection);
 
-	snprintf(footer, sizeof footer,
-		"<S:update-report xmlns:S=\"svn:\">"
-			"%s"
-			"<S:src-path>/%s</S:src-path>"
-			"<S:target-revision>%d</S:target-revision>"
-			"<S:depth>unknown</S:depth>"
-			"<S:entry rev=\"%d\" depth=\"infinity\" start-empty=\"true\"></S:entry>"
-		"</S:update-report>\r\n"
-		,
-		connection->inline_props ? "<S:include-props>yes</S:include-props>" : "",
-		connection->branch,
-		connection->revision,
-		connection->revision
-	);
+				send_requests_http(connection, command, starts, requests, &sent);
+			}
 
-	char url[256];
-	snprintf(url, sizeof url, "/%s/!svn/me", connection->root);
+			end += 4;
 
-	craft_http_packet(connection->address, url, "REPORT", footer, command);
+			offset += (end - begin);
+			groups++;
 
-	process_command_http(connection, command);
+			marker1 = strstr(begin, "Content-Length: ");
+			marker2 = strstr(begin, "Transfer-Encoding: chunked");
 
-	/* Process response for subdirectories and create them locally. */
+			if (marker1) chunked_transfer = 0;
+			if (marker2) chunked_transfer = 1;
 
-	start = connection->response;
-	end   = connection->response + connection->response_length;
+			if ((marker1) && (marker2))
+				chunked_transfer = (marker1 < marker2) ? 0 : 1;
 
-	int has_inline_props = !!strstr(start, "inline-props=\"true\">");
-	connection->inline_props = has_inline_props;
+			if (chunked_transfer == 0) {
+				chunk = strtol(marker1 + 16, (char **)NULL, 10);
 
-	while ((start = strstr(start, "<S:add-directory")) && (start < end)) {
-		value = parse_xml_value(start, end, "D:href");
-		char *ptmp = strip_rev_root_stub(connection, value);
-		temp = strstr(ptmp, connection->trunk) + strlen(connection->trunk);
-		snprintf(temp_buffer, BUFFER_UNIT, "%s%s", connection->path_target, temp);
+				if (chunk < 0)
+					job_errx(EXIT_FAILURE, "process_command_http: Bad stream data");
 
-		/* If a file exists with the same name, try and remove it first. */
-/*
-		if (stat(temp_buffer, &local) == 0)
-			if (S_ISDIR(local.st_mode) == 0)
-				if (remove(temp_buffer) != 0)
-					err(EXIT_FAILURE, "Please remove %s manually and restart svnup", temp_buffer);
-*/
-		if(mkdir(temp_buffer, 0755) && errno != EEXIST)
-			err(EXIT_FAILURE, "failed to create directory %s", temp_buffer);
-		free(value);
-		start++;
+				offset += chunk;
+				if (connection->response_length > offset) {
+					chunked_transfer = -1;
+					groups++;
+				}
+			}
 
-		/* Remove the directory from the local directory tree to avoid later attempts at pruning. */
+			if (chunked_transfer == 1) {
+				chunk = 0;
+				marker2 = end;
+			}
+		}
 
-		find.path = temp_buffer;
+		while ((chunked_transfer == 1) && ((end = strstr(marker2, "\r\n")) != NULL)) {
+			chunk = strtol(marker2, (char **)NULL, 16);
+			marker2 -= 2;
 
-		if ((found = RB_FIND(tree_local_directories, &local_directories, &find)) != NULL)
-			tree_node_free(RB_REMOVE(tree_local_directories, &local_directories, found));
-	}
+			if (chunk < 0)
+				job_errx(EXIT_FAILURE, "process_command_http: Bad stream data ");
 
-	start = connection->response;
+			snprintf(hex_chunk, sizeof(hex_chunk), "\r\n%x\r\n", chunk);
+			gap = strlen(hex_chunk);
 
-	while ((start = strstr(start, "<S:add-file")) && (start < end)) {
-		this_file = new_file_node(file, file_count, file_max);
+			if (marker2 + chunk + gap > connection->response + connection->response_length) {
+				marker2 += 2;
+				read_more = 1;
+				break;
+			}
 
-		char *file_end = strstr(start, "</S:add-file>");
-		if(file_end) file_end += LIT_LEN("</S:add-file>");
-		else file_end = end;
-		if(has_inline_props) {
-			temp = strstr(start, "<S:set-prop name=\"svn:executable\">*</S:set-prop>");
-			if(temp && temp < file_end)
-				this_file->executable = 1;
-			temp = strstr(start, "<S:set-prop name=\"svn:special\">*</S:set-prop>");
-			if(temp && temp < file_end)
-				this_file->special = 1;
-			this_file->size = -1;
-		}
-		md5  = parse_xml_value(start, file_end, "V:md5-checksum");
-		href = parse_xml_value(start, file_end, "D:href");
-		if(connection->trunk[0] == 0)
-			temp = href;
-		else
-			temp = strstr(href, connection->trunk);
-		temp += strlen(connection->trunk);
-		path = strdup(temp);
+			if (first_chunk) {
+				first_chunk = 0;
+				chunk += gap;
+			}
+			else {
+				/* Remove the chunk from the buffer. */
 
-		/* Convert any hex encoded characters in the path. */
+				memmove(marker2,
+					marker2 + gap,
+					connection->response_length - (marker2 - connection->response));
 
-		d = path;
-		while ((d = strchr(d, '%')) != NULL)
-			if ((isxdigit(d[1])) && (isxdigit(d[2]))) {
-				d[1] = toupper(d[1]);
-				d[2] = toupper(d[2]);
-				*d = ((isalpha(d[1]) ? 10 + d[1] -'A' : d[1] - '0') << 4) +
-				      (isalpha(d[2]) ? 10 + d[2] -'A' : d[2] - '0');
-				memmove(d + 1, d + 3, strlen(path) - (d - path + 2));
-				d++;
+				connection->response_length -= gap;
 			}
 
-		this_file->href = href;
-		this_file->path = path;
-		memcpy(this_file->md5, md5, 32);
+			/* Move the offset to the end of the chunk. */
 
-		start = file_end;
-	}
-}
+			offset += chunk;
+			marker2 += chunk + 2;
 
+			if (chunk == 0) {
+				chunked_transfer = -1;
+				groups++;
+			}
+		}
 
-/*
- * parse_additional_attributes
- *
- * Procedure that extracts md5 signature plus last author, committed date
- * and committed rev and saves them for later inclusion in revision tags.
- */
+		if (connection->verbosity > 2)
+			fprintf(stderr, "\rBytes read: %zd, Bytes expected: %d, g:%d, rg:%d",
+				connection->response_length,
+				offset,
+				groups,
+				connection->response_groups);
+	}
 
-static void
-parse_additional_attributes(connector *connection, char *start, char *end, file_node *file)
-{
-	char *md5, *temp, *value;
+	if (connection->verbosity > 2)
+		fprintf(stderr, "\rBytes read: %zd, Bytes expected: %d, g:%d, rg:%d",
+			connection->response_length,
+			offset,
+			groups,
+			connection->response_groups);
 
-	if (file == NULL) return;
+	if (connection->verbosity > 2)
+		fprintf(stderr, "\n");
 
-	if (connection->protocol == SVN) {
-		if ((temp = strchr(start, ':')) != NULL) {
-			md5 = ++temp;
-			memcpy(file->md5, md5, 32);
+	if (connection->verbosity > 3)
+		fprintf(stderr, "==========\n%s\n==========\n", connection->response);
 
-			file->executable = (strstr(start, "14:svn:executable") ? 1 : 0);
-			file->special    = (strstr(start, "11:svn:special") ? 1 : 0);
-		}
-	} else if (connection->protocol >= HTTP) {
-		value = parse_xml_value(start, end, "lp1:getcontentlength");
-		file->size = strtol(value, (char **)NULL, 10);
-		free(value);
+	free(starts);
 
-		file->executable = (strstr(start, "<S:executable/>") ? 1 : 0);
-		file->special    = (strstr(start, "<S:special>*</S:special>") ? 1 : 0);
-	}
-}
+	if(!strstr(connection->response, "HTTP/1.1 "))
+		job_errx(EXIT_FAILURE, "unexpected response from HTTP server:\n%s", connection->response);
 
-static int get_content_length(const char *start, const char *end, size_t *len) {
-	char *p = strstr(start, "Content-Length: ");
-	if(!p || p > end) return 0;
-	*len = strtol(p + LIT_LEN("Content-Length: "), NULL, 10);
-	return 1;
+	return (connection->response);
 }
 
+
 /*
- * get_files
+ * parse_xml_value
  *
- * Procedure that extracts and saves files from the response stream.
+ * Function that returns the text found between the opening and closing tags passed in.
  */
 
-static void
-get_files(connector *connection, char *command, char *path_target, file_node **file, int file_start, int file_end)
+static char *
+parse_xml_value(char *start, char *end, const char *tag)
 {
-	int     try, x, block_size, block_size_markers, file_block_remainder;
-	int     first_response, last_response, offset, position, raw_size, saved;
-	char   *begin, *end, file_path_target[BUFFER_UNIT], *gap, *start, *temp_end;
-	char    md5_check[33];
-
-	/* Calculate the number of bytes the server is going to send back. */
-
-	try = 0;
-	retry:
-	if (try) reset_connection(connection);
-
-	raw_size = 0;
+	size_t  tag_length;
+	char   *data_end, *data_start, *end_tag, temp_end, *value;
 
-	if (connection->protocol >= HTTP) {
-		process_command_http(connection, command);
+	value = NULL;
+	temp_end = *end;
+	*end = '\0';
 
-		start = connection->response;
+	tag_length = strlen(tag) + 4;
+	if ((end_tag = (char *)malloc(tag_length)) == NULL)
+		job_err(EXIT_FAILURE, "parse_xml_value end_tag malloc");
 
-		for (x = file_start; x <= file_end; x++) {
-			if ((file[x] == NULL) || (file[x]->download == 0))
-				continue;
+	snprintf(end_tag, tag_length, "</%s>", tag);
 
-			if(start == connection->response + connection->response_length)
-				goto increment_tries;
+	if ((data_start = strstr(start, tag))) {
+		if ((data_start = strchr(data_start, '>'))) {
+			data_start++;
+			data_end = strstr(data_start, end_tag);
 
-			if(!(end = strstr(start, "\r\n\r\n")))
-				goto increment_tries;
+			if (data_end) {
+				if ((value = (char *)malloc(data_end - data_start + 1)) == NULL)
+					job_err(EXIT_FAILURE, "parse_xml_value value malloc");
 
-			if(file[x]->size == -1LL) {
-				size_t ns;
-				if(!get_content_length(start, end, &ns))
-					errx(EXIT_FAILURE, "failed to extract Content-Length!");
-				file[x]->size = ns;
+				memcpy(value, data_start, data_end - data_start);
+				value[data_end - data_start] = '\0';
 			}
-			end += 4;
-			file[x]->raw_size = file[x]->size + (end - start);
-			start = end + file[x]->size;
-			raw_size += file[x]->raw_size;
 		}
 	}
 
-	if (connection->protocol == SVN) {
-		last_response  = 20;
-		first_response = 84;
-
-		x = connection->revision;
-		while ((int)(x /= 10) > 0)
-			first_response++;
-
-		for (x = file_start; x <= file_end; x++) {
-			if ((file[x] == NULL) || (file[x]->download == 0))
-				continue;
+	free(end_tag);
+	*end = temp_end;
 
-			block_size_markers = 6 * (int)(file[x]->size / BUFFER_UNIT);
-			if (file[x]->size % BUFFER_UNIT)
-				block_size_markers += 3;
+	return (value);
+}
 
-			file_block_remainder = file[x]->size % BUFFER_UNIT;
-			while ((int)(file_block_remainder /= 10) > 0)
-				block_size_markers++;
 
-			file[x]->raw_size = file[x]->size +
-				first_response +
-				last_response +
-				block_size_markers;
+/*
+ * parse_response_group
+ *
+ * Procedure that isolates the next response group from the response stream.
+ */
 
-			raw_size += file[x]->raw_size;
-		}
+static void
+parse_response_group(connector *connection, char **start, char **end)
+{
+	if (connection->protocol == SVN)
+		*end = find_response_end(connection->protocol, *start, *end);
 
-		process_command_svn(connection, command, raw_size);
+	if (connection->protocol >= HTTP) {
+		*end = strstr(*start, "</D:multistatus>");
+		if (*end != NULL) *end += 16;
+		else job_errx(EXIT_FAILURE, "Error in http stream: %s\n", *start);
 	}
 
-	/* Process the response stream and extract each file. */
-
-	position = raw_size;
-
-	for (x = file_end; x >= file_start; x--) {
-		if (file[x]->download == 0)
-			continue;
-
-		char *tmp = strip_rev_root_stub(connection, file[x]->path);
+	**end = '\0';
+}
 
-		snprintf(file_path_target,
-			BUFFER_UNIT,
-			"%s%s",
-			path_target,
-			tmp);
 
-		/* Isolate the file from the response stream. */
+/*
+ * parse_response_item
+ *
+ * Function that isolates the next response from the current response group.
+ */
 
-		end = connection->response + position;
-		start = end - file[x]->raw_size;
-		begin = end - file[x]->size;
-		temp_end = end;
+static int
+parse_response_item(connector *connection, char *end, int *count, char **item_start, char **item_end)
+{
+	int c, has_entries, ok;
 
-		if (check_command_success(connection->protocol, &start, &temp_end)) {
-		increment_tries:;
-			if (++try > 5)
-				errx(EXIT_FAILURE, "Error in get_files.  Quitting.");
+	c = has_entries = 0;
+	ok = 1;
 
-			if (try > 1)
-				fprintf(stderr, "Error in get files, retry #%d\n", try);
+	if (connection->protocol == SVN) {
+		if (*count == '\0') {
+			while ((c < 3) && (*item_start < end)) {
+				c += (**item_start == '(' ? 1 : (**item_start == ')' ? -1 : 0));
+				if (**item_start == ':') has_entries++;
+				(*item_start)++;
+			}
 
-			goto retry;
+			(*item_start) += 5;
+			*item_end = *item_start;
 		}
 
-		if (connection->protocol == SVN) {
-			start = find_response_end(connection->protocol, start, temp_end) + 1;
-			begin = strchr(start, ':') + 1;
-			block_size = strtol(start, (char **)NULL, 10);
-			offset = 0;
-			start = begin;
+		c = 1;
+		(*item_end)++;
 
-			while (block_size == BUFFER_UNIT) {
-				start += block_size + offset;
-				gap = start;
-				start = strchr(gap, ':') + 1;
-				block_size = strtol(gap, (char **)NULL, 10);
-		/* FIXME this memmove here was identified as writing memory
-		   outside the allocated area (if the aread allocated was very close to
-		   the actually transfered content size); probably by as many
-		   bytes as it tries to move the block around, which is identical to the SVN
-		   header for that block. */
-				memmove(gap, start, file[x]->raw_size - (start - begin) + 1);
-				offset = gap - start;
-			}
+		while ((c > 0) && (*item_end < end)) {
+			(*item_end)++;
+			c += (**item_end == '(' ? 1 : (**item_end == ')' ? -1 : 0));
+			if (**item_end == ':') has_entries++;
 		}
 
-		/*
-		 * Check to make sure the MD5 signature of the file in the buffer
-		 * matches what the svn server originally reported.
-		 */
+		(*item_end)++;
+		**item_end = '\0';
+	}
 
-		if (connection->verbosity > 1)
-			printf("\r\e[0K\r");
+	if (connection->protocol >= HTTP) {
+		*item_end = strstr(*item_start, "</D:response>");
 
-		/* Make sure the MD5 checksums match before saving the file. */
+		if (*item_end != NULL) {
+			*item_end += 13;
+			**item_end = '\0';
+			has_entries = 1;
+		} else ok = 0;
+	}
 
-		if (strncmp(file[x]->md5, md5sum(begin, file[x]->size, md5_check), 33) != 0) {
-			begin[file[x]->size] = '\0';
-			errx(EXIT_FAILURE, "MD5 checksum mismatch: should be %s, calculated %s\n", file[x]->md5, md5_check);
-		}
+	if (!has_entries) ok = 0;
 
-		saved = save_file(file_path_target,
-				begin,
-				begin + file[x]->size,
-				file[x]->executable,
-				file[x]->special);
+	(*count)++;
 
-		if ((saved) && (connection->verbosity))
-			printf(" + %s\n", file_path_target);
+	return (ok);
+}
 
-		position -= file[x]->raw_size;
-		bzero(connection->response + position, file[x]->raw_size);
+/* checking whether the md5 of file as retrieved from online repo
+   matches the value in known_files list. if the file isn't in
+   known_files then there's no point checking against the
+   filesystem either, as it shouldn't exist there.
+   the only case where it could be interesting to check against
+   a filesystem copy would be the case of a huge repo checked
+   out with a different client (i.e. no known_files file exists
+   yet), and the user being unwilling to check
+   out every single file again - but in that case he could just
+   produce the file known_files with a script that runs md5sum
+   over all files.
+*/
+static void check_md5(connector *connection, file_node *file) {
+	char buf[4096];
+	struct tree_node  *data, *next;
+	if(file->md5[0] && !file->md5_checked) {
+		file->md5_checked = 1;
+		file->download = 1; /* default to "md5 doesn't match local file" */
+		snprintf(buf, sizeof buf, "%s",
+			strip_rev_root_stub(connection, file->path));
+
+		for (data = RB_MIN(tree_known_files, &connection->known_files); data != NULL; data = next) {
+			if(!strcmp(data->path, buf)) {
+				if(!memcmp(data->md5, file->md5, 32)) {
+					file->download = 0;
+					return;
+				}
+				/* file encountered in known_files, but md5 mismatch */
+				break;
+			}
+			next = RB_NEXT(tree_known_files, head, data);
+		}
 	}
 }
 
-
 /*
- * progress_indicator
+ * new_file_node
  *
- * Procedure that neatly prints the current file and its position in the file list as a percentage.
+ * Function that allocates a new file_node and expands the dynamic
+ * array that stores file_nodes.
  */
 
-static void
-progress_indicator(connector *connection, char *path, int f, int file_count)
+static file_node *
+new_file_node(file_node ***file, int *file_count, int *file_max)
 {
-	struct winsize window;
-	int            file_width, term_width, x;
-	char          *columns, file_path_target[BUFFER_UNIT], temp_buffer[BUFFER_UNIT];
+	file_node *node = calloc(1, sizeof(file_node));
 
-	term_width = -1;
-	file_width = 2;
+	if (node == NULL)
+		job_err(EXIT_FAILURE, "new_file_node node malloc");
 
-	x = file_count;
-	while ((int)(x /= 10) > 0)
-		file_width++;
+	(*file)[*file_count] = node;
 
-	/* Figure out the width of the terminal window. */
+	if (++(*file_count) == *file_max) {
+		*file_max += BUFFER_UNIT;
 
-	if (isatty(STDERR_FILENO)) {
-		if (((columns = getenv("COLUMNS")) != NULL) && (*columns != '\0'))
-			term_width = strtol(columns, (char **)NULL, 10);
-		else {
-			if ((ioctl(STDERR_FILENO, TIOCGWINSZ, &window) != -1) && (window.ws_col > 0))
-				term_width = window.ws_col;
-		}
+		if ((*file = (file_node **)realloc(*file, *file_max * sizeof(file_node **))) == NULL)
+			job_err(EXIT_FAILURE, "new_file_node file realloc");
 	}
 
-	snprintf(file_path_target,
-		BUFFER_UNIT,
-		"%s%s",
+	return (node);
+}
+
+/*
+ * save_file
+ *
+ * Procedure that saves a file.
+ */
+
+static int
+save_file(char *filename, char *start, char *end, int executable, int special, time_t mtime)
+{
+	struct timespec  times[2] = { { 0, UTIME_OMIT }, { mtime, 0 } };
+	struct stat      local;
+	ssize_t          written;
+	int              fd, saved;
+	char            *tag;
+
+	saved = 0;
+
+	if (special) {
+		if (starts_with_lit(start, "link ")) {
+			*end = '\0';
+
+			if (stat(filename, &local) == 0)
+				if (remove(filename) != 0)
+					job_errx(EXIT_FAILURE, "Please remove %s manually and restart svnup", filename);
+
+			if (symlink(start + 5, filename)) {
+				job_err(EXIT_FAILURE, "Cannot link %s -> %s", start + 5, filename);
+
+			saved = 1;
+			}
+
+			if (mtime)
+				utimensat(AT_FDCWD, filename, times, AT_SYMLINK_NOFOLLOW);
+		}
+	} else {
+		/* a file hard linked by --dedup hardlink gets an inode of its own */
+		if ((lstat(filename, &local) == 0) && (local.st_nlink > 1) && (remove(filename) != 0))
+			job_err(EXIT_FAILURE, "Cannot remove %s", filename);
+
+		if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+			job_err(EXIT_FAILURE, "write file failure %s", filename);
+
+		for (; start < end; start += written)
+			if ((written = write(fd, start, end - start)) < 0) {
+				if (errno != EINTR)
+					job_err(EXIT_FAILURE, "write file failure %s", filename);
+
+				written = 0;
+			}
+
+		fchmod(fd, executable ? 0755 : 0644);
+
+		if (mtime)
+			futimens(fd, times);
+
+		close(fd);
+
+		saved = 1;
+	}
+
+	return (saved);
+}
+
+
+/*
+ * journal_open
+ *
+ * Function that opens the temporary file a --changes or --content-manifest list is
+ * written to, so that readers only ever see a complete list.  - writes to stdout.
+ */
+
+static FILE *
+journal_open(const char *name, char *temp, size_t size)
+{
+	FILE  *out;
+
+	if (strcmp(name, "-") == 0)
+		return (stdout);
+
+	snprintf(temp, size, "%s.tmp", name);
+
+	if ((out = fopen(temp, "w")) == NULL)
+		job_err(EXIT_FAILURE, "%s", temp);
+
+	return (out);
+}
+
+
+/*
+ * journal_close
+ *
+ * Procedure that puts a finished --changes or --content-manifest list in place.
+ */
+
+static void
+journal_close(FILE *out, const char *name, const char *temp)
+{
+	if (out == stdout) {
+		fflush(stdout);
+		return;
+	}
+
+	if (fclose(out) != 0)
+		job_err(EXIT_FAILURE, "%s", temp);
+
+	if (rename(temp, name) != 0)
+		job_err(EXIT_FAILURE, "Cannot rename %s", temp);
+}
+
+
+/*
+ * journal_record
+ *
+ * Procedure that writes one file to a --changes (status set) or --content-manifest
+ * (status NULL) list, either as a JSON object per line or, with --null, as a
+ * "[STATUS<tab>]MD5<tab>SIZE<tab>PATH" record ended by a NUL byte.  A negative size
+ * is unknown.  The path is relative to the working copy.
+ */
+
+static void
+journal_record(connector *connection, FILE *out, const char *status, const char *md5, int64_t size, const char *path)
+{
+	const char *p;
+
+	while (*path == '/')
+		path++;
+
+	if (connection->null_records) {
+		if (status)
+			fprintf(out, "%s\t", status);
+
+		if (size < 0)
+			fprintf(out, "%.32s\t-\t%s%c", md5, path, '\0');
+		else
+			fprintf(out, "%.32s\t%" PRId64 "\t%s%c", md5, size, path, '\0');
+
+		return;
+	}
+
+	fputc('{', out);
+
+	if (status)
+		fprintf(out, "\"status\":\"%s\",", status);
+
+	fputs("\"path\":\"", out);
+
+	for (p = path; *p; p++) {
+		if ((*p == '"') || (*p == '\\'))
+			fprintf(out, "\\%c", *p);
+		else if ((unsigned char)*p < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*p);
+		else
+			fputc(*p, out);
+	}
+
+	fprintf(out, "\",\"md5\":\"%.32s\"", md5);
+
+	if (size >= 0)
+		fprintf(out, ",\"size\":%" PRId64, size);
+
+	fputs("}\n", out);
+}
+
+
+/*
+ * journal_file
+ *
+ * Procedure that reports a file of the new revision to the --changes list (as added,
+ * modified or unchanged) and to the --content-manifest list.
+ */
+
+static void
+journal_file(connector *connection, file_node *file, const char *path, int existed)
+{
+	struct stat  local;
+	char         full_path[PATH_MAX];
+	const char  *status;
+	int64_t      size;
+
+	size = file->size;
+
+	/* http only learns the size of the files it downloads */
+	if (size < 0) {
+		snprintf(full_path, sizeof(full_path), "%s%s", connection->path_target, path);
+
+		if (lstat(full_path, &local) == 0)
+			size = local.st_size;
+	}
+
+	if (connection->changes_out) {
+		if (file->download)
+			status = existed ? "modified" : "added";
+		else
+			status = "unchanged";
+
+		journal_record(connection, connection->changes_out, status, file->md5, size, path);
+	}
+
+	if (connection->content_out)
+		journal_record(connection, connection->content_out, NULL, file->md5, size, path);
+}
+
+
+/*
+ * save_known_file_list
+ *
+ * Procedure that saves the list of files known to be in the repository.
+ */
+
+static void
+save_known_file_list(connector *connection, file_node **file, int file_count)
+{
+	struct tree_node  find, *found;
+	int               existed, fd, x;
+
+	if ((fd = open(connection->known_files_new, O_WRONLY | O_CREAT | O_TRUNC)) == -1)
+		job_err(EXIT_FAILURE, "write file failure %s", connection->known_files_new);
+
+	for (x = 0; x < file_count; x++) {
+		write(fd, file[x]->md5, strlen(file[x]->md5));
+		write(fd, "\t", 1);
+		char* ftmp = strip_rev_root_stub(connection, file[x]->path);
+		write(fd, ftmp, strlen(ftmp));
+		write(fd, "\n", 1);
+
+		/* If the file exists in the red-black trees, remove it. */
+
+		find.path = ftmp;
+		existed = file[x]->existed;
+
+		if ((found = RB_FIND(tree_known_files, &connection->known_files, &find)) != NULL) {
+			tree_node_free(RB_REMOVE(tree_known_files, &connection->known_files, found));
+			existed = 1;
+		}
+
+		if ((connection->changes_out) || (connection->content_out))
+			journal_file(connection, file[x], ftmp, existed);
+
+		if ((found = RB_FIND(tree_local_files, &connection->local_files, &find)) != NULL)
+			tree_node_free(RB_REMOVE(tree_local_files, &connection->local_files, found));
+
+		if (connection->watch) {
+			if ((found = (struct tree_node *)malloc(sizeof(struct tree_node))) == NULL)
+				job_err(EXIT_FAILURE, "save_known_file_list malloc");
+
+			found->path = strdup(ftmp);
+			found->md5 = strdup(file[x]->md5);
+
+			if (RB_INSERT(tree_known_files, &connection->watch_files, found) != NULL)
+				tree_node_free(found);
+		}
+
+		if (file[x]->href)
+			free(file[x]->href);
+
+		free(file[x]->path);
+		free(file[x]);
+		file[x] = NULL;
+	}
+
+	close(fd);
+	chmod(connection->known_files_new, 0644);
+}
+
+
+static int protocol_from_str(char* line, connector *connection) {
+	if (strncmp(line, "file", 4) == 0) {
+		connection->protocol = LOCAL;
+		connection->port = 0;
+	} else
+
+	if (strncmp(line, "svn", 3) == 0) {
+		connection->protocol = SVN;
+		connection->port = 3690;
+	} else
+
+	if (strncmp(line, "https", 5) == 0) {
+		connection->protocol = HTTPS;
+		connection->port = 443;
+	} else
+
+	if (strncmp(line, "http", 4) == 0) {
+		connection->protocol = HTTP;
+		connection->port = 80;
+	} else {
+		connection->protocol = NONE;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * create_directory
+ *
+ * Procedure that checks for and creates a local directory if possible.
+ */
+
+static void
+create_directory(char *directory)
+{
+	struct stat  local;
+	int          create;
+
+	create = stat(directory, &local);
+
+	if (create == 0) {
+		/* If a file exists with the same name, try and remove it first. */
+
+		if (!S_ISDIR(local.st_mode)) {
+			if (remove(directory) != 0)
+				job_err(EXIT_FAILURE, "%s exists and is not a directory.  Please remove it manually and restart svnup", directory);
+			else
+				create = 1;
+		}
+	}
+
+	if (create)
+		if (mkdir(directory, 0755))
+			job_err(EXIT_FAILURE, "Cannot create %s", directory);
+}
+
+
+/*
+ * command_queue_*
+ *
+ * Commands waiting to be sent are formatted straight into one growing buffer,
+ * back to back, with the end offset of each command kept in an sblist.
+ * Handing out a chain of commands is just a matter of advancing the head index
+ * and temporarily terminating the buffer after the last command of the chain,
+ * so neither queueing nor dequeueing allocates per command.
+ */
+
+static void
+command_queue_init(command_queue *queue)
+{
+	queue->data = NULL;
+	queue->length = queue->capacity = queue->head = 0;
+	queue->chain_end = 0;
+	queue->chain_saved = '\0';
+	sblist_init(&queue->ends, sizeof(size_t), 64);
+}
+
+static void
+command_queue_free(command_queue *queue)
+{
+	free(queue->data);
+	sblist_free_items(&queue->ends);
+	command_queue_init(queue);
+}
+
+static void
+command_queue_add(command_queue *queue, const char *format, ...)
+{
+	va_list  ap;
+	size_t   space;
+	int      length;
+
+	/* the terminator of a chain ending at the tail is about to be overwritten */
+	if (queue->chain_end == queue->length)
+		queue->chain_end = 0;
+
+	while (1) {
+		space = queue->capacity - queue->length;
+
+		va_start(ap, format);
+		length = vsnprintf(queue->data + queue->length, space, format, ap);
+		va_end(ap);
+
+		if (length < 0)
+			job_errx(EXIT_FAILURE, "command_queue_add: bad format");
+
+		if ((size_t)length < space)
+			break;
+
+		do queue->capacity = queue->capacity ? queue->capacity * 2 : BUFFER_UNIT;
+		while (queue->capacity - queue->length <= (size_t)length);
+
+		if ((queue->data = realloc(queue->data, queue->capacity)) == NULL)
+			job_err(EXIT_FAILURE, "command_queue_add realloc");
+	}
+
+	queue->length += length;
+
+	if (!sblist_add(&queue->ends, &queue->length))
+		job_err(EXIT_FAILURE, "command_queue_add sblist_add");
+}
+
+/* returns the next run of queued commands as a single string of at most
+   maxlen - 1 bytes (a single command longer than that is returned on its own),
+   or NULL if the queue is empty.  if items is set to non-zero, it is used as
+   a max value for the number of commands in the chain; it is then filled with
+   the number of commands actually returned.  the string points into the queue
+   and stays valid until the next call to command_queue_add(),
+   command_queue_chain() or command_queue_free(). */
+static char *
+command_queue_chain(command_queue *queue, size_t maxlen, size_t *items)
+{
+	size_t  count, max_items, start, end;
+
+	max_items = *items;
+	*items = 0;
+
+	if (queue->chain_end)
+		queue->data[queue->chain_end] = queue->chain_saved;
+
+	queue->chain_end = 0;
+	count = sblist_getsize(&queue->ends);
+
+	if (queue->head == count) {
+		/* everything handed out, recycle the buffer */
+		queue->length = queue->head = 0;
+		sblist_reset(&queue->ends);
+		return (NULL);
+	}
+
+	start = queue->head ? *(size_t *)sblist_get(&queue->ends, queue->head - 1) : 0;
+	end = start;
+
+	while (queue->head < count && (!max_items || *items < max_items)) {
+		size_t next = *(size_t *)sblist_get(&queue->ends, queue->head);
+
+		if (*items && next - start >= maxlen)
+			break;
+
+		end = next;
+		queue->head++;
+		(*items)++;
+	}
+
+	queue->chain_end = end;
+	queue->chain_saved = queue->data[end];
+	queue->data[end] = '\0';
+
+	return (queue->data + start);
+}
+
+/*
+ * report_listing_svn
+ *
+ * Procedure that adds the files of one get-dir response group to the dynamic array
+ * of file_nodes, creates the subdirectories in the working copy and appends their
+ * repository paths to the list of directories still to be listed.
+ */
+
+static void
+report_listing_svn(connector *connection, const char *path_source, char *start, char *end, file_node ***file, int *file_count, int *file_max, sblist *directories)
+{
+	file_node   *this_file;
+	int          count;
+	size_t       length, name_length, path_length;
+	char        *item_end, *item_start, *marker, *name, *path;
+	char         temp_path[BUFFER_UNIT + 1];
+
+	item_start = start;
+	item_end = end;
+
+	count = 0;
+
+	while (parse_response_item(connection, end, &count, &item_start, &item_end)) {
+		/* Keep track of the remote files. */
+
+		length = strtol(item_start + 1, (char **)NULL, 10);
+		if (length > MAXNAMLEN)
+			job_errx(EXIT_FAILURE, "entry_is_file file name is too long");
+
+		marker = strchr(item_start, ':') + 1 + length;
+
+		if (starts_with_lit(marker, " file ")) {
+			this_file = new_file_node(file, file_count, file_max);
+
+			name_length = strtol(item_start + 1, (char **)NULL, 10);
+			if (name_length > MAXNAMLEN)
+				job_errx(EXIT_FAILURE, "process_file_entry file name is too long");
+
+			name = item_start = strchr(item_start, ':') + 1;
+
+			item_start += name_length;
+			*item_start = '\0';
+			path_length = strlen(path_source) + name_length + 2;
+
+			if (!starts_with_lit(item_start + 1, "file "))
+				job_errx(EXIT_FAILURE, "process_file_entry malformed response");
+
+			if ((this_file->path = (char *)malloc(path_length)) == NULL)
+				job_err(EXIT_FAILURE, "process_file_entry file->path malloc");
+
+			snprintf(this_file->path, path_length, "%s/%s", path_source, name);
+
+			item_start = strchr(item_start + 1, ' ');
+			this_file->size = strtol(item_start, (char **)NULL, 10);
+		}
+
+		if (starts_with_lit(marker, " dir ")) {
+			length = strtol(item_start + 1, (char **)NULL, 10);
+			if (length > MAXNAMLEN)
+				job_errx(EXIT_FAILURE, "process_file file name is too long");
+
+			name = strchr(item_start, ':') + 1;
+			name[length] = '\0';
+
+			snprintf(temp_path,
+				BUFFER_UNIT,
+				"%s%s/%s",
+				connection->path_target,
+				path_source,
+				name);
+
+			/* Create the directory locally if it doesn't exist. */
+
+			create_report_directory(connection, temp_path);
+
+			/* Remember the directory so that its listing is requested. */
+
+			path_length = strlen(path_source) + length + 2;
+
+			if ((path = (char *)malloc(path_length)) == NULL)
+				job_err(EXIT_FAILURE, "report_listing_svn path malloc");
+
+			snprintf(path, path_length, "%s/%s", path_source, name);
+			sblist_add(directories, &path);
+		}
+
+		item_start = item_end + 1;
+	}
+}
+
+/*
+ * response_group_length
+ *
+ * Function that returns the length of the svn response group at the start of the
+ * buffer, or 0 if it has not been received in full yet.  Strings are skipped by
+ * their length, so parentheses in file names do not upset the count.
+ */
+
+static size_t
+response_group_length(const char *start, const char *end)
+{
+	const char  *p, *q;
+	size_t       length;
+	int          depth;
+
+	for (p = start, depth = 0; p < end; ) {
+		if (*p == '(') {
+			depth++;
+			p++;
+		} else if (*p == ')') {
+			p++;
+
+			if (--depth == 0)
+				return (p - start);
+		} else if (isdigit((unsigned char)*p)) {
+			for (q = p; q < end && isdigit((unsigned char)*q); q++)
+				;
+
+			if (q == end)
+				return (0);
+
+			if (*q == ':') {
+				length = strtoul(p, (char **)NULL, 10);
+
+				if (length >= (size_t)(end - q))
+					return (0);
+
+				p = q + 1 + length;
+			} else
+				p = q;
+		} else if (isalpha((unsigned char)*p)) {
+			while (p < end && (isalnum((unsigned char)*p) || *p == '-'))
+				p++;
+		} else
+			p++;
+	}
+
+	return (0);
+}
+
+
+/*
+ * process_report_svn
+ *
+ * Procedure that lists the tree below path_source breadth first and saves the
+ * initial details in a dynamic array of file_nodes.  Up to connection->window
+ * get-dir commands are kept in flight on the connection; each response is parsed
+ * as soon as it is complete and the subdirectories it holds are queued behind the
+ * others, so a tree costs about one round trip per level rather than per batch.
+ */
+
+static void
+process_report_svn(connector *connection, const char *path_source, file_node ***file, int *file_count, int *file_max)
+{
+	command_queue  commands;
+	sblist         directories;
+	ssize_t        bytes_read;
+	size_t         answered, capacity, chain_count, first, length, offset, second, sent;
+	char          *buffer, *chain, *directory, *end, *root, *start, saved, **path;
+	int            try;
+
+	command_queue_init(&commands);
+	sblist_init(&directories, sizeof(char *), 256);
+
+	if ((root = strdup(path_source)) == NULL)
+		job_err(EXIT_FAILURE, "process_report_svn strdup");
+
+	sblist_add(&directories, &root);
+
+	capacity = COMMAND_BUFFER;
+	length = answered = sent = 0;
+	try = 0;
+
+	if ((buffer = (char *)malloc(capacity + 1)) == NULL)
+		job_err(EXIT_FAILURE, "process_report_svn malloc");
+
+	while (answered < sblist_getsize(&directories)) {
+		/* Top the window up with the directories waiting to be listed. */
+
+		while ((sent < sblist_getsize(&directories)) && (sent - answered < (size_t)connection->window)) {
+			path = sblist_get(&directories, sent++);
+
+			command_queue_add(&commands,
+				"( get-dir ( %zd:%s ( %d ) false true ( kind size ) false ) )\n",
+				strlen(*path),
+				*path,
+				connection->revision);
+		}
+
+		chain_count = 0;
+
+		while ((chain = command_queue_chain(&commands, COMMAND_BUFFER, &chain_count))) {
+			send_command(connection, chain);
+			chain_count = 0;
+		}
+
+		if (capacity - length < BUFFER_UNIT) {
+			capacity *= 2;
+
+			if ((buffer = (char *)realloc(buffer, capacity + 1)) == NULL)
+				job_err(EXIT_FAILURE, "process_report_svn realloc");
+		}
+
+		bytes_read = transport_read(connection, buffer + length, capacity - length);
+
+		if (bytes_read <= 0) {
+			if ((bytes_read < 0) && (errno == EINTR))
+				continue;
+
+			if (++try > 5)
+				job_errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
+
+			if (try > 1)
+				fprintf(stderr, "Error in svn stream, retry #%d\n", try);
+
+			/* everything in flight is asked for again on the new session */
+			transport_retry(connection, length);
+			reconnect(connection);
+
+			length = 0;
+			sent = answered;
+			continue;
+		}
+
+		length += bytes_read;
+		buffer[length] = '\0';
+
+		if (connection->verbosity > 3)
+			fprintf(stdout, "<< %.*s\n", (int)bytes_read, buffer + length - bytes_read);
+
+		/* Parse every response that is complete: the auth request and the listing. */
+
+		offset = 0;
+
+		while (answered < sent) {
+			while ((offset < length) && ((buffer[offset] == ' ') || (buffer[offset] == '\n')))
+				offset++;
+
+			if ((first = response_group_length(buffer + offset, buffer + length)) == 0)
+				break;
+
+			if ((second = response_group_length(buffer + offset + first, buffer + length)) == 0)
+				break;
+
+			start = buffer + offset;
+			end = start + first + second;
+			saved = *end;
+			*end = '\0';
+
+			if (check_command_success(connection->protocol, &start, &end))
+				job_errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
+
+			parse_response_group(connection, &start, &end);
+
+			/* the listing may grow the list, so the path is taken out of it first */
+			directory = *(char **)sblist_get(&directories, answered++);
+
+			report_listing_svn(connection, directory, start, end, file, file_count, file_max, &directories);
+
+			free(directory);
+
+			offset += first + second;
+			buffer[offset] = saved;
+			try = 0;
+		}
+
+		memmove(buffer, buffer + offset, length - offset);
+		length -= offset;
+	}
+
+	command_queue_free(&commands);
+	sblist_free_items(&directories);
+	free(buffer);
+}
+
+#define CRAWL_BATCH 64
+
+/*
+ * crawl_take
+ *
+ * Function that moves the next directories to list into the batch of a crawler: the
+ * most recently found ones of its own queue or, once that is empty, the oldest half
+ * of the longest queue of another crawler, both at most CRAWL_BATCH at a time.
+ * Returns the number taken.
+ */
+
+static size_t
+crawl_take(crawl_pool *pool, int index, sblist *batch)
+{
+	sblist  *queue, *victim;
+	size_t   count;
+	int      c;
+
+	queue = &pool->queues[index];
+
+	if (sblist_empty(queue)) {
+		for (c = 0, victim = NULL; c < pool->crawlers; c++)
+			if ((victim == NULL) || (sblist_getsize(&pool->queues[c]) > sblist_getsize(victim)))
+				victim = &pool->queues[c];
+
+		count = MIN((sblist_getsize(victim) + 1) / 2, CRAWL_BATCH);
+
+		if (count == 0)
+			return (0);
+
+		while (batch->capa < batch->count + count)
+			if (!sblist_grow_if_needed(batch))
+				return (0);
+
+		memcpy(sblist_item_from_index(batch, batch->count),
+			sblist_item_from_index(victim, 0),
+			count * victim->itemsize);
+
+		batch->count += count;
+
+		memmove(sblist_item_from_index(victim, 0),
+			sblist_item_from_index(victim, count),
+			(victim->count - count) * victim->itemsize);
+
+		victim->count -= count;
+
+		return (sblist_getsize(batch));
+	}
+
+	while ((!sblist_empty(queue)) && (sblist_getsize(batch) < CRAWL_BATCH)) {
+		sblist_add(batch, sblist_get(queue, sblist_getsize(queue) - 1));
+		sblist_delete(queue, sblist_getsize(queue) - 1);
+	}
+
+	return (sblist_getsize(batch));
+}
+
+
+/*
+ * crawl_run
+ *
+ * Procedure run by each crawler: it pipelines the get-dir commands of a batch of
+ * directories over its own session, adds what the listings hold to the report and
+ * queues the subdirectories found, until no crawler has anything left to list.
+ */
+
+static void
+crawl_run(crawl_worker *worker)
+{
+	crawl_pool     *pool = worker->pool;
+	connector      *session = worker->session;
+	command_queue   commands;
+	sblist          batch, found;
+	size_t          chain_count, d, g;
+	char           *chain, *end, *start, **path;
+
+	command_queue_init(&commands);
+	sblist_init(&batch, sizeof(char *), CRAWL_BATCH);
+	sblist_init(&found, sizeof(char *), 64);
+
+	pthread_mutex_lock(&pool->lock);
+	worker->locked = 1;
+
+	while (!pool->failed) {
+		if (crawl_take(pool, worker->index, &batch) == 0) {
+			if (pool->busy == 0)
+				break;
+
+			pthread_cond_wait(&pool->changed, &pool->lock);
+			continue;
+		}
+
+		pool->busy++;
+		worker->locked = 0;
+		pthread_mutex_unlock(&pool->lock);
+
+		sblist_iter(&batch, path)
+			command_queue_add(&commands,
+				"( get-dir ( %zd:%s ( %d ) false true ( kind size ) false ) )\n",
+				strlen(*path),
+				*path,
+				session->revision);
+
+		g = chain_count = 0;
+
+		while ((chain = command_queue_chain(&commands, BUFFER_UNIT, &chain_count))) {
+			session->response_groups = 2 * chain_count;
+			start = process_command_svn(session, chain, 0);
+
+			for (d = 0; d < chain_count; d++, g++) {
+				end = session->response + session->response_length;
+
+				if (check_command_success(session->protocol, &start, &end))
+					job_errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
+
+				parse_response_group(session, &start, &end);
+
+				pthread_mutex_lock(&pool->lock);
+				worker->locked = 1;
+
+				report_listing_svn(pool->connection,
+					*(char **)sblist_get(&batch, g),
+					start,
+					end,
+					pool->file,
+					pool->file_count,
+					pool->file_max,
+					&found);
+
+				worker->locked = 0;
+				pthread_mutex_unlock(&pool->lock);
+
+				start = end + 1;
+			}
+
+			chain_count = 0;
+		}
+
+		command_queue_free(&commands);
+		command_queue_init(&commands);
+
+		sblist_iter(&batch, path)
+			free(*path);
+
+		sblist_reset(&batch);
+
+		pthread_mutex_lock(&pool->lock);
+		worker->locked = 1;
+
+		sblist_iter(&found, path)
+			sblist_add(&pool->queues[worker->index], path);
+
+		found.count = 0;
+		pool->busy--;
+		pthread_cond_broadcast(&pool->changed);
+	}
+
+	pthread_cond_broadcast(&pool->changed);
+	worker->locked = 0;
+	pthread_mutex_unlock(&pool->lock);
+
+	command_queue_free(&commands);
+	sblist_free_items(&batch);
+	sblist_free_items(&found);
+}
+
+
+/*
+ * crawl_thread
+ *
+ * Function that runs a crawler on its own thread (or on the calling one for the
+ * first crawler, which uses the checkout's session).  The other crawlers open their
+ * own session first.  A crawler failing stops them all.
+ */
+
+static void *
+crawl_thread(void *data)
+{
+	crawl_worker  *worker = data;
+	crawl_pool    *pool = worker->pool;
+	connector     *connection = pool->connection;
+	jmp_buf        failure;
+	jmp_buf       *outer;
+
+	outer = job_failure;
+	job_failure = &failure;
+
+	if (setjmp(failure) == 0) {
+		if (worker->session == NULL) {
+			if ((worker->session = (connector *)malloc(sizeof(connector))) == NULL)
+				job_err(EXIT_FAILURE, "crawl_thread malloc");
+
+			connector_init(worker->session);
+			worker->session->protocol = connection->protocol;
+			worker->session->address = connection->address;
+			worker->session->port = connection->port;
+			worker->session->family = connection->family;
+			worker->session->branch = connection->branch;
+			worker->session->revision = connection->revision;
+			worker->session->verbosity = connection->verbosity;
+			worker->session->faults = connection->faults;
+			worker->session->connect_timeout = connection->connect_timeout;
+			worker->session->idle_timeout = connection->idle_timeout;
+			worker->session->total_timeout = connection->total_timeout;
+			worker->session->min_rate = connection->min_rate;
+			worker->session->rate_window = connection->rate_window;
+			worker->session->socket_buffer = connection->socket_buffer;
+			worker->session->stats.start = connection->stats.start;
+
+			if ((worker->session->response = (char *)malloc(worker->session->response_blocks * BUFFER_UNIT + 1)) == NULL)
+				job_err(EXIT_FAILURE, "crawl_thread response malloc");
+
+			reset_connection(worker->session);
+			open_session_svn(worker->session);
+		}
+
+		crawl_run(worker);
+	} else {
+		if (!worker->locked)
+			pthread_mutex_lock(&pool->lock);
+
+		pool->failed = 1;
+		pthread_cond_broadcast(&pool->changed);
+		worker->locked = 0;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	job_failure = outer;
+
+	return (NULL);
+}
+
+
+/*
+ * crawl_report_svn
+ *
+ * Procedure that lists the tree of the checkout on connection->crawlers sessions at
+ * once.  Each crawler keeps a queue of the directories it found and lists them in
+ * batches, taking work from the others when its own queue runs dry, so that deep
+ * trees are not crawled one round trip per level on a single session.
+ */
+
+static void
+crawl_report_svn(connector *connection, file_node ***file, int *file_count, int *file_max)
+{
+	crawl_pool      pool;
+	crawl_worker   *workers;
+	pthread_attr_t  attributes;
+	connector      *session;
+	char           *root, **path;
+	int             c;
+
+	pool.connection = connection;
+	pool.file = file;
+	pool.file_count = file_count;
+	pool.file_max = file_max;
+	pool.crawlers = connection->crawlers;
+	pool.busy = pool.failed = 0;
+
+	if ((pool.queues = (sblist *)malloc(pool.crawlers * sizeof(sblist))) == NULL)
+		job_err(EXIT_FAILURE, "crawl_report_svn malloc");
+
+	if ((workers = (crawl_worker *)calloc(pool.crawlers, sizeof(crawl_worker))) == NULL)
+		job_err(EXIT_FAILURE, "crawl_report_svn calloc");
+
+	for (c = 0; c < pool.crawlers; c++) {
+		sblist_init(&pool.queues[c], sizeof(char *), 64);
+		workers[c].pool = &pool;
+		workers[c].index = c;
+	}
+
+	root = strdup("");
+	sblist_add(&pool.queues[0], &root);
+	workers[0].session = connection;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.changed, NULL);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	/* some libcs hand out small thread stacks by default */
+	pthread_attr_init(&attributes);
+	pthread_attr_setstacksize(&attributes, 1024 * 1024);
+
+	for (c = 1; c < pool.crawlers; c++)
+		if ((errno = pthread_create(&workers[c].thread, &attributes, crawl_thread, &workers[c])) != 0)
+			job_err(EXIT_FAILURE, "crawl_report_svn pthread_create");
+
+	crawl_thread(&workers[0]);
+
+	for (c = 1; c < pool.crawlers; c++) {
+		pthread_join(workers[c].thread, NULL);
+
+		if ((session = workers[c].session) == NULL)
+			continue;
+
+		if (session->socket_descriptor != -1)
+			close(session->socket_descriptor);
+
+		connection->stats.bytes_read += session->stats.bytes_read;
+		connection->stats.bytes_written += session->stats.bytes_written;
+		connection->stats.reconnects += session->stats.reconnects;
+		connection->stats.retries += session->stats.retries;
+		connection->stats.refetched += session->stats.refetched;
+
+		if (connection->stats.tcp_rtt == 0) {
+			connection->stats.tcp_rtt = session->stats.tcp_rtt;
+			connection->stats.tcp_rtt_min = session->stats.tcp_rtt_min;
+			connection->stats.rcvbuf = session->stats.rcvbuf;
+			connection->stats.sndbuf = session->stats.sndbuf;
+		}
+
+		free(session->uuid);
+		free(session->root);
+		free(session->trunk);
+		free(session->response);
+		free(session);
+	}
+
+	for (c = 0; c < pool.crawlers; c++) {
+		sblist_iter(&pool.queues[c], path)
+			free(*path);
+
+		sblist_free_items(&pool.queues[c]);
+	}
+
+	pthread_attr_destroy(&attributes);
+	pthread_cond_destroy(&pool.changed);
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.queues);
+	free(workers);
+
+	if (pool.failed)
+		job_errx(EXIT_FAILURE, "Cannot list %s", connection->branch);
+}
+
+
+static const char *http_options_footer =
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+	"<D:options xmlns:D=\"DAV:\">"
+	"<D:activity-collection-set></D:activity-collection-set>"
+	"</D:options>\r\n";
+
+static char* craft_http_packet(const char *host, const char* url,
+	const char* verb, const char* footer, char* command) {
+	snprintf(command,
+		COMMAND_BUFFER,
+		"%s %s HTTP/1.1\r\n"
+		"Host: %s\r\n"
+		"User-Agent: svnup-%s\r\n"
+		"Content-Type: text/xml\r\n"
+		"Connection: Keep-Alive\r\n"
+		"DAV: http://subversion.tigris.org/xmlns/dav/svn/depth\r\n"
+		"DAV: http://subversion.tigris.org/xmlns/dav/svn/mergeinfo\r\n"
+		"DAV: http://subversion.tigris.org/xmlns/dav/svn/log-revprops\r\n"
+		"Transfer-Encoding: chunked\r\n\r\n"
+		"%lx\r\n"
+		"%s"
+		"\r\n0\r\n\r\n",
+		verb, url, host,
+		SVNUP_VERSION,
+		strlen(footer),
+		footer);
+	return command;
+}
+
+/* expects pointer to a string like "( 6: foobar )", puts "foobar" into saveloc (heap)
+   returns pointer to after ')' */
+static char* extract_svn_string_from_group(char* data, char** saveloc) {
+	char *p = data;
+	assert(*p == '(');
+	++p;
+	assert(*p == ' ');
+	++p;
+	assert(isdigit(*p));
+	int n = atoi(p);
+	while(isdigit(*p))++p;
+	assert(*p == ':');
+	++p;
+	*saveloc = malloc(n+1);
+	memcpy(*saveloc, p, n);
+	(*saveloc)[n] = 0;
+	p += n + 1;
+	assert(*p == ')');
+	return ++p;
+}
+
+
+/*
+ * parse_repos_info_svn
+ *
+ * Procedure that picks the repository UUID and root URL out of the response to the
+ * ANONYMOUS auth command and, like the http code, splits the session path into
+ * connection->root and connection->trunk.
+ */
+
+static void parse_repos_info_svn(connector *connection) {
+	char *end = connection->response + connection->response_length;
+	char *p = connection->response + strlen(connection->response) + 1;
+	char *url;
+	size_t n, length;
+
+	if(p >= end || !(p = strstr(p, "( success ( "))) return;
+	p += LIT_LEN("( success ( ");
+
+	n = strtoul(p, &p, 10);
+	if(*p != ':' || p + 1 + n >= end) return;
+	connection->uuid = strndup(p + 1, n);
+	p += 1 + n + 1;
+
+	n = strtoul(p, &p, 10);
+	if(*p != ':' || p + 1 + n >= end) return;
+	url = p + 1;
+
+	/* svn://host[:port]/path, only the path is of interest */
+	if(!(p = memchr(url, ':', n)) || p + 3 >= url + n || !(p = memchr(p + 3, '/', url + n - p - 3))) {
+		connection->root = strdup("");
+		length = 0;
+	} else {
+		connection->root = strndup(p + 1, url + n - p - 1);
+		length = strlen(connection->root);
+	}
+
+	if(strncmp(connection->branch, connection->root, length) == 0) {
+		p = connection->branch + length;
+		if(*p == '/') ++p;
+		connection->trunk = strdup(p);
+	}
+}
+
+static void process_log_svn(connector *connection) {
+	char command[COMMAND_BUFFER + 1], *start, *end;
+
+	snprintf(command, COMMAND_BUFFER,
+		 "( log ( ( 0: ) ( %d ) ( %d ) false false 0 false revprops"
+		 " ( 10:svn:author 8:svn:date 7:svn:log ) ) ) ",
+		 connection->revision, connection->revision);
+
+	connection->response_groups = 2; /* 3 on success, 2 on error */
+	process_command_svn(connection, command, 0);
+	start = connection->response;
+	end = connection->response + connection->response_length;
+
+	char* group2 = connection->response + strlen(connection->response) +1;
+	if(group2 < end && starts_with_lit(group2, "done ( failure ( ( "))
+		job_errx(EXIT_FAILURE, "%s", group2 + LIT_LEN("done ( failure ( ( "));
+
+	if (check_command_success(connection->protocol, &start, &end))
+		job_errx(EXIT_FAILURE, "couldn't get log");
+
+	char buf[32], *p, *date;
+	snprintf(buf, sizeof buf, " %d ( ", connection->revision);
+	p = strstr(start, buf);
+	if(!p) return;
+
+	p += strlen(buf)-2;
+
+	p = extract_svn_string_from_group(p, &connection->commit_author);
+	assert(*p == ' ');
+	++p;
+
+	p = extract_svn_string_from_group(p, &connection->commit_date);
+	assert(*p == ' ');
+	++p;
+
+	p = extract_svn_string_from_group(p, &connection->commit_msg);
+	assert(*p == ' ');
+
+	sanitize_svn_date(connection->commit_date);
+}
+
+static void process_log_http(connector *connection) {
+	char command[COMMAND_BUFFER + 1], footer[1024], url[512];
+
+	snprintf(url, sizeof url,
+		"%s/%d",
+		connection->rev_root_stub,
+		connection->revision
+	);
+	snprintf(footer, sizeof footer,
+		"<S:log-report xmlns:S=\"svn:\">"
+			"<S:start-revision>%d</S:start-revision>"
+			"<S:end-revision>%d</S:end-revision>"
+			"<S:revprop>svn:author</S:revprop>"
+			"<S:revprop>svn:date</S:revprop>"
+			"<S:revprop>svn:log</S:revprop>"
+			"<S:path></S:path>"
+			"<S:encode-binary-props></S:encode-binary-props>"
+		"</S:log-report>\r\n"
+		,
+		connection->revision,
+		connection->revision
+	);
+
+	craft_http_packet(connection->address, url, "REPORT", footer, command);
+	connection->response_groups = 2;
+
+	process_command_http(connection, command);
+
+	char *start = connection->response,
+	     *end = start + connection->response_length, *p;
+
+	if(check_command_success(connection->protocol, &start, &end))
+		job_errx(EXIT_FAILURE, "couldn't get log\n%s", start);
+
+	if((p = strstr(start, "xml version="))) start = p+10;
+
+	connection->commit_author = parse_xml_value(start, end, "D:creator-displayname");
+	connection->commit_date   = parse_xml_value(start, end, "S:date");
+	connection->commit_msg    = parse_xml_value(start, end, "D:comment");
+	if(connection->commit_date)
+		sanitize_svn_date(connection->commit_date);
+	else
+		fprintf(stderr, "warning: empty reply for log request\n");
+}
+
+/*
+ * process_report_http
+ *
+ * Procedure that sends the http report command and saves the initial details
+ * in a dynamic array of file_nodes.
+ */
+
+static void
+process_report_http(connector *connection, file_node ***file, int *file_count, int *file_max)
+{
+	file_node   *this_file;
+	char         command[COMMAND_BUFFER + 1], *d, *end, *href, *md5, *path;
+	char        *start, *temp, temp_buffer[BUFFER_UNIT], *value;
+	char footer[512];
+	size_t       length;
+
+	connection->response_groups = 2;
+
+	snprintf(footer, sizeof footer,
+		"<S:update-report xmlns:S=\"svn:\">"
+			"%s"
+			"<S:src-path>/%s</S:src-path>"
+			"<S:target-revision>%d</S:target-revision>"
+			"<S:depth>unknown</S:depth>"
+			"<S:entry rev=\"%d\" depth=\"infinity\" start-empty=\"true\"></S:entry>"
+		"</S:update-report>\r\n"
+		,
+		connection->inline_props ? "<S:include-props>yes</S:include-props>" : "",
+		connection->branch,
+		connection->revision,
+		connection->revision
+	);
+
+	char url[256];
+	snprintf(url, sizeof url, "/%s/!svn/me", connection->root);
+
+	craft_http_packet(connection->address, url, "REPORT", footer, command);
+
+	process_command_http(connection, command);
+
+	/* Process response for subdirectories and create them locally. */
+
+	start = connection->response;
+	end   = connection->response + connection->response_length;
+
+	int has_inline_props = !!strstr(start, "inline-props=\"true\">");
+	connection->inline_props = has_inline_props;
+
+	while ((start = strstr(start, "<S:add-directory")) && (start < end)) {
+		value = parse_xml_value(start, end, "D:href");
+		char *ptmp = strip_rev_root_stub(connection, value);
+		temp = strstr(ptmp, connection->trunk) + strlen(connection->trunk);
+		snprintf(temp_buffer, BUFFER_UNIT, "%s%s", connection->path_target, temp);
+
+		/* If a file exists with the same name, try and remove it first. */
+/*
+		if (stat(temp_buffer, &local) == 0)
+			if (S_ISDIR(local.st_mode) == 0)
+				if (remove(temp_buffer) != 0)
+					job_err(EXIT_FAILURE, "Please remove %s manually and restart svnup", temp_buffer);
+*/
+		create_report_directory(connection, temp_buffer);
+		free(value);
+		start++;
+	}
+
+	start = connection->response;
+
+	while ((start = strstr(start, "<S:add-file")) && (start < end)) {
+		this_file = new_file_node(file, file_count, file_max);
+
+		char *file_end = strstr(start, "</S:add-file>");
+		if(file_end) file_end += LIT_LEN("</S:add-file>");
+		else file_end = end;
+		if(has_inline_props) {
+			temp = strstr(start, "<S:set-prop name=\"svn:executable\">*</S:set-prop>");
+			if(temp && temp < file_end)
+				this_file->executable = 1;
+			temp = strstr(start, "<S:set-prop name=\"svn:special\">*</S:set-prop>");
+			if(temp && temp < file_end)
+				this_file->special = 1;
+		}
+		/* the size is not in the report; PROPFIND or Content-Length tell it */
+		this_file->size = -1;
+		md5  = parse_xml_value(start, file_end, "V:md5-checksum");
+		href = parse_xml_value(start, file_end, "D:href");
+		if(connection->trunk[0] == 0)
+			temp = href;
+		else
+			temp = strstr(href, connection->trunk);
+		temp += strlen(connection->trunk);
+		path = strdup(temp);
+
+		/* Convert any hex encoded characters in the path. */
+
+		d = path;
+		while ((d = strchr(d, '%')) != NULL)
+			if ((isxdigit(d[1])) && (isxdigit(d[2]))) {
+				d[1] = toupper(d[1]);
+				d[2] = toupper(d[2]);
+				*d = ((isalpha(d[1]) ? 10 + d[1] -'A' : d[1] - '0') << 4) +
+				      (isalpha(d[2]) ? 10 + d[2] -'A' : d[2] - '0');
+				memmove(d + 1, d + 3, strlen(path) - (d - path + 2));
+				d++;
+			}
+
+		/* Fetch and PROPFIND through <rev-root-stub>/<rev>/<path>, rev being the revision
+		   that last changed the file: what is behind such an URL never changes, so shared
+		   HTTP caches can keep it across updates.  The version resource the report names,
+		   <root>/!svn/ver/<rev>/<path>, has both, the whole path already URL-encoded. */
+
+		if ((connection->rev_root_stub) && (temp = strstr(href, "/!svn/ver/")) != NULL && isdigit(temp[LIT_LEN("/!svn/ver/")])) {
+			temp += LIT_LEN("/!svn/ver/");
+			length = strlen(connection->rev_root_stub) + strlen(temp) + 2;
+
+			if ((value = (char *)malloc(length)) == NULL)
+				job_err(EXIT_FAILURE, "process_report_http href malloc");
+
+			snprintf(value, length, "%s/%s", connection->rev_root_stub, temp);
+
+			free(href);
+			href = value;
+		}
+
+		this_file->href = href;
+		this_file->path = path;
+		memcpy(this_file->md5, md5, 32);
+		free(md5);
+
+		start = file_end;
+	}
+}
+
+
+/*
+ * parse_additional_attributes
+ *
+ * Procedure that extracts md5 signature plus last author, committed date
+ * and committed rev and saves them for later inclusion in revision tags.
+ */
+
+static void
+parse_additional_attributes(connector *connection, char *start, char *end, file_node *file)
+{
+	char *md5, *temp, *value;
+
+	if (file == NULL) return;
+
+	if (connection->protocol == SVN) {
+		if ((temp = strchr(start, ':')) != NULL) {
+			md5 = ++temp;
+			memcpy(file->md5, md5, 32);
+
+			file->executable = (strstr(start, "14:svn:executable") ? 1 : 0);
+			file->special    = (strstr(start, "11:svn:special") ? 1 : 0);
+
+			if ((temp = strstr(start, "24:svn:entry:committed-date ")) != NULL)
+				if ((temp = strchr(temp + LIT_LEN("24:svn:entry:committed-date "), ':')) != NULL)
+					file->mtime = parse_commit_time(temp + 1);
+		}
+	} else if (connection->protocol >= HTTP) {
+		value = parse_xml_value(start, end, "lp1:getcontentlength");
+		file->size = strtol(value, (char **)NULL, 10);
+		free(value);
+
+		file->executable = (strstr(start, "<S:executable/>") ? 1 : 0);
+		file->special    = (strstr(start, "<S:special>*</S:special>") ? 1 : 0);
+
+		if ((value = parse_xml_value(start, end, "lp1:getlastmodified")) != NULL) {
+			file->mtime = parse_commit_time(value);
+			free(value);
+		}
+	}
+}
+
+static int get_content_length(const char *start, const char *end, size_t *len) {
+	char *p = strstr(start, "Content-Length: ");
+	if(!p || p > end) return 0;
+	*len = strtol(p + LIT_LEN("Content-Length: "), NULL, 10);
+	return 1;
+}
+
+/*
+ * get_files
+ *
+ * Procedure that extracts and saves files from the response stream.
+ */
+
+static void
+get_files(connector *connection, char *command, char *path_target, file_node **file, int file_start, int file_end)
+{
+	int     try, x, block_size, block_size_markers, file_block_remainder;
+	int     first_response, last_response, offset, position, raw_size, saved;
+	char   *begin, *end, file_path_target[BUFFER_UNIT], *gap, *modified, *start, *temp_end;
+	char    md5_check[33];
+
+	/* Calculate the number of bytes the server is going to send back. */
+
+	try = 0;
+	retry:
+	if (try) reconnect(connection);
+
+	raw_size = 0;
+
+	if (connection->protocol >= HTTP) {
+		process_command_http(connection, command);
+
+		start = connection->response;
+
+		for (x = file_start; x <= file_end; x++) {
+			if ((file[x] == NULL) || (file[x]->download == 0))
+				continue;
+
+			if(start == connection->response + connection->response_length)
+				goto increment_tries;
+
+			if(!(end = strstr(start, "\r\n\r\n")))
+				goto increment_tries;
+
+			/* mod_dav_svn sends the last-changed commit date */
+			if((modified = strstr(start, "Last-Modified: ")) && modified < end)
+				file[x]->mtime = parse_commit_time(modified + LIT_LEN("Last-Modified: "));
+
+			if(file[x]->size == -1LL) {
+				size_t ns;
+				if(!get_content_length(start, end, &ns))
+					job_errx(EXIT_FAILURE, "failed to extract Content-Length!");
+				file[x]->size = ns;
+			}
+			end += 4;
+			file[x]->raw_size = file[x]->size + (end - start);
+			start = end + file[x]->size;
+			raw_size += file[x]->raw_size;
+		}
+	}
+
+	if (connection->protocol == SVN) {
+		last_response  = 20;
+		first_response = 84;
+
+		x = connection->revision;
+		while ((int)(x /= 10) > 0)
+			first_response++;
+
+		for (x = file_start; x <= file_end; x++) {
+			if ((file[x] == NULL) || (file[x]->download == 0))
+				continue;
+
+			block_size_markers = 6 * (int)(file[x]->size / BUFFER_UNIT);
+			if (file[x]->size % BUFFER_UNIT)
+				block_size_markers += 3;
+
+			file_block_remainder = file[x]->size % BUFFER_UNIT;
+			while ((int)(file_block_remainder /= 10) > 0)
+				block_size_markers++;
+
+			file[x]->raw_size = file[x]->size +
+				first_response +
+				last_response +
+				block_size_markers;
+
+			raw_size += file[x]->raw_size;
+		}
+
+		process_command_svn(connection, command, raw_size);
+	}
+
+	/* Process the response stream and extract each file. */
+
+	position = raw_size;
+
+	for (x = file_end; x >= file_start; x--) {
+		if (file[x]->download == 0)
+			continue;
+
+		char *tmp = strip_rev_root_stub(connection, file[x]->path);
+
+		snprintf(file_path_target,
+			BUFFER_UNIT,
+			"%s%s",
+			path_target,
+			tmp);
+
+		/* Isolate the file from the response stream. */
+
+		end = connection->response + position;
+		start = end - file[x]->raw_size;
+		begin = end - file[x]->size;
+		temp_end = end;
+
+		if (check_command_success(connection->protocol, &start, &temp_end)) {
+		increment_tries:;
+			if (++try > 5)
+				job_errx(EXIT_FAILURE, "Error in get_files.  Quitting.");
+
+			if (try > 1)
+				fprintf(stderr, "Error in get files, retry #%d\n", try);
+
+			transport_retry(connection, connection->response_length);
+
+			goto retry;
+		}
+
+		if (connection->protocol == SVN) {
+			start = find_response_end(connection->protocol, start, temp_end) + 1;
+			begin = strchr(start, ':') + 1;
+			block_size = strtol(start, (char **)NULL, 10);
+			offset = 0;
+			start = begin;
+
+			while (block_size == BUFFER_UNIT) {
+				start += block_size + offset;
+				gap = start;
+				start = strchr(gap, ':') + 1;
+				block_size = strtol(gap, (char **)NULL, 10);
+		/* FIXME this memmove here was identified as writing memory
+		   outside the allocated area (if the aread allocated was very close to
+		   the actually transfered content size); probably by as many
+		   bytes as it tries to move the block around, which is identical to the SVN
+		   header for that block. */
+				memmove(gap, start, file[x]->raw_size - (start - begin) + 1);
+				offset = gap - start;
+			}
+		}
+
+		/*
+		 * Check to make sure the MD5 signature of the file in the buffer
+		 * matches what the svn server originally reported.
+		 */
+
+		if (connection->verbosity > 1)
+			printf("\r\e[0K\r");
+
+		/* Make sure the MD5 checksums match before saving the file. */
+
+		if (strncmp(file[x]->md5, md5sum(begin, file[x]->size, md5_check), 33) != 0) {
+			begin[file[x]->size] = '\0';
+			job_errx(EXIT_FAILURE, "MD5 checksum mismatch: should be %s, calculated %s\n", file[x]->md5, md5_check);
+		}
+
+		saved = save_file(file_path_target,
+				begin,
+				begin + file[x]->size,
+				file[x]->executable,
+				file[x]->special,
+				connection->commit_times ? file[x]->mtime : 0);
+
+		if ((saved) && (connection->verbosity))
+			printf(" + %s\n", file_path_target);
+
+		position -= file[x]->raw_size;
+		bzero(connection->response + position, file[x]->raw_size);
+	}
+}
+
+
+/*
+ * whole_compare
+ *
+ * Function that sorts files by size for whole_plan.
+ */
+
+static int
+whole_compare(const void *a, const void *b)
+{
+	const file_node *x = *(file_node * const *)a, *y = *(file_node * const *)b;
+
+	return ((x->size > y->size) - (x->size < y->size));
+}
+
+
+/*
+ * whole_size_compare
+ *
+ * Function that orders the sizes of local files for whole_plan.
+ */
+
+static int
+whole_size_compare(const void *a, const void *b)
+{
+	const int64_t *x = a, *y = b;
+
+	return ((*x > *y) - (*x < *y));
+}
+
+
+/*
+ * whole_sizes
+ *
+ * Procedure that adds the sizes of the regular files of a known_files tree, found
+ * below root, to a list.
+ */
+
+static void
+whole_sizes(const char *root, struct tree_known_files *tree, sblist *sizes)
+{
+	struct tree_node  *node;
+	struct stat        local;
+	char               path[PATH_MAX];
+	int64_t            size;
+
+	RB_FOREACH(node, tree_known_files, tree) {
+		snprintf(path, sizeof(path), "%s%s", root, node->path);
+
+		if ((lstat(path, &local) != 0) || (!S_ISREG(local.st_mode)))
+			continue;
+
+		size = local.st_size;
+
+		if (!sblist_add(sizes, &size))
+			job_err(EXIT_FAILURE, "whole_sizes sblist_add");
+	}
+}
+
+
+/*
+ * whole_plan
+ *
+ * Procedure that marks the files of an svn:// checkout that will be downloaded
+ * whatever their checksum turns out to be, so that their properties and contents
+ * are fetched in one request.  Those are the files not yet in the working copy (nor,
+ * with --adopt, at their path) that nothing local can stand in for: no file of the
+ * working copy or of the --reference one has their size, to be moved or cloned
+ * from, and no other file of the same size is fetched for --dedup to make them from.
+ */
+
+static void
+whole_plan(connector *connection, file_node **file, int file_count)
+{
+	struct tree_node   find;
+	struct stat        local;
+	file_node        **sorted;
+	sblist             sizes;
+	char               path[PATH_MAX];
+	int                f, g, planned;
+
+	for (f = planned = 0; f < file_count; f++) {
+		find.path = strip_rev_root_stub(connection, file[f]->path);
+
+		if (RB_FIND(tree_known_files, &connection->known_files, &find) != NULL)
+			continue;
+
+		if (connection->adopt) {
+			snprintf(path, sizeof(path), "%s%s", connection->path_target, find.path);
+
+			if (lstat(path, &local) == 0)
+				continue;
+		}
+
+		file[f]->whole = 1;
+		planned++;
+	}
+
+	if (planned == 0)
+		return;
+
+	sblist_init(&sizes, sizeof(int64_t), 256);
+	whole_sizes(connection->path_target, &connection->known_files, &sizes);
+
+	if (connection->reference)
+		whole_sizes(connection->reference, &connection->reference_files, &sizes);
+
+	qsort(sizes.items, sblist_getsize(&sizes), sizeof(int64_t), whole_size_compare);
+
+	for (f = 0; f < file_count; f++)
+		if ((file[f]->whole) && (bsearch(&file[f]->size, sizes.items, sblist_getsize(&sizes), sizeof(int64_t), whole_size_compare)))
+			file[f]->whole = 0;
+
+	sblist_free_items(&sizes);
+
+	if ((sorted = (file_node **)malloc((file_count + 1) * sizeof(file_node *))) == NULL)
+		job_err(EXIT_FAILURE, "whole_plan malloc");
+
+	memcpy(sorted, file, file_count * sizeof(file_node *));
+	qsort(sorted, file_count, sizeof(file_node *), whole_compare);
+
+	for (f = 0; f < file_count; f = g) {
+		for (g = f + 1; g < file_count && sorted[g]->size == sorted[f]->size; g++)
+			;
+
+		if ((g - f > 1) && (sorted[f]->size > 0) && (connection->dedup != DEDUP_OFF))
+			for (; f < g; f++)
+				sorted[f]->whole = 0;
+	}
+
+	free(sorted);
+}
+
+
+/*
+ * whole_response_length
+ *
+ * Function that returns the length of the response to a get-file asking for both
+ * properties and contents at the start of the buffer (the auth request, the
+ * checksum and properties, the contents as strings ended by an empty one and the
+ * closing status), or 0 if it has not been received in full yet.
+ */
+
+static size_t
+whole_response_length(const char *start, const char *end)
+{
+	const char  *p, *q;
+	size_t       length;
+	int          group;
+
+	for (p = start, group = 0; group < 2; group++) {
+		while ((p < end) && ((*p == ' ') || (*p == '\n')))
+			p++;
+
+		if ((length = response_group_length(p, end)) == 0)
+			return (0);
+
+		/* a failure comes without contents */
+		if ((group == 1) && (strncmp(p, "( success ", LIT_LEN("( success "))))
+			return (p + length - start);
+
+		p += length;
+	}
+
+	do {
+		while ((p < end) && (*p == ' '))
+			p++;
+
+		for (q = p; q < end && isdigit((unsigned char)*q); q++)
+			;
+
+		if (q == end)
+			return (0);
+
+		if ((q == p) || (*q != ':'))
+			job_errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
+
+		length = strtoul(p, (char **)NULL, 10);
+
+		if (length >= (size_t)(end - q))
+			return (0);
+
+		p = q + 1 + length;
+	} while (length);
+
+	while ((p < end) && (*p == ' '))
+		p++;
+
+	if ((length = response_group_length(p, end)) == 0)
+		return (0);
+
+	return (p + length - start);
+}
+
+
+/*
+ * whole_save
+ *
+ * Procedure that takes the checksum and properties of a file from the response to
+ * its get-file, joins the strings of its contents in place and saves it once its
+ * checksum has been verified.
+ */
+
+static void
+whole_save(connector *connection, file_node *file, char *start, char *end)
+{
+	char    path[PATH_MAX], md5_check[33], *begin, *header, *p, *q, saved;
+	size_t  length;
+
+	/* the auth request and the checksum and properties */
+	for (p = start; *p == ' ' || *p == '\n'; p++)
+		;
+
+	p += response_group_length(p, end);
+
+	while (*p == ' ' || *p == '\n')
+		p++;
+
+	header = end = p + response_group_length(p, end);
+	saved = *header;
+	*header = '\0';
+
+	if (check_command_success(connection->protocol, &start, &end))
+		job_fail();
+
+	parse_additional_attributes(connection, start, header, file);
+	*header = saved;
+
+	/* the contents */
+	begin = q = p = header;
+
+	do {
+		while (*p == ' ')
+			p++;
+
+		length = strtoul(p, &p, 10);
+		memmove(q, p + 1, length);
+		q += length;
+		p += 1 + length;
+	} while (length);
+
+	file->size = q - begin;
+
+	if (strncmp(file->md5, md5sum(begin, file->size, md5_check), 33) != 0)
+		job_errx(EXIT_FAILURE, "MD5 checksum mismatch: should be %s, calculated %s\n", file->md5, md5_check);
+
+	snprintf(path, sizeof(path), "%s%s", connection->path_target, strip_rev_root_stub(connection, file->path));
+
+	if ((save_file(path, begin, q, file->executable, file->special, connection->commit_times ? file->mtime : 0))
+		&& (connection->verbosity))
+		printf(" + %s\n", path);
+}
+
+#define WHOLE_BYTES (8 * 1024 * 1024)
+
+/*
+ * get_files_whole_svn
+ *
+ * Procedure that downloads the files whole_plan marked with one get-file each,
+ * bringing their checksum, properties and contents together.  Up to
+ * connection->window of them (and about WHOLE_BYTES) are kept in flight and each
+ * is saved as soon as its response is complete.  They are then marked as no
+ * longer to download.
+ */
+
+static void
+get_files_whole_svn(connector *connection, file_node **file, int file_count)
+{
+	command_queue  commands;
+	ssize_t        bytes_read;
+	size_t         capacity, chain_count, length, offset, response;
+	int64_t        pending;
+	char          *buffer, *chain;
+	int            answered, flight, sent, try;
+
+	command_queue_init(&commands);
+
+	capacity = COMMAND_BUFFER;
+	length = 0;
+	pending = 0;
+	answered = sent = flight = try = 0;
+
+	if ((buffer = (char *)malloc(capacity + 1)) == NULL)
+		job_err(EXIT_FAILURE, "get_files_whole_svn malloc");
+
+	for (;;) {
+		while ((answered < file_count) && (!file[answered]->whole))
+			answered++;
+
+		if (answered == file_count)
+			break;
+
+		/* Top the window up with the files waiting to be fetched. */
+
+		while ((sent < file_count) && (flight < connection->window) && ((flight == 0) || (pending < WHOLE_BYTES))) {
+			if (file[sent]->whole) {
+				command_queue_add(&commands,
+					"( get-file ( %zd:%s ( %d ) true true false ) )\n",
+					strlen(file[sent]->path),
+					file[sent]->path,
+					connection->revision);
+
+				pending += file[sent]->size;
+				flight++;
+			}
+
+			sent++;
+		}
+
+		chain_count = 0;
+
+		while ((chain = command_queue_chain(&commands, COMMAND_BUFFER, &chain_count))) {
+			send_command(connection, chain);
+			chain_count = 0;
+		}
+
+		if (capacity - length < BUFFER_UNIT) {
+			capacity *= 2;
+
+			if ((buffer = (char *)realloc(buffer, capacity + 1)) == NULL)
+				job_err(EXIT_FAILURE, "get_files_whole_svn realloc");
+		}
+
+		bytes_read = transport_read(connection, buffer + length, capacity - length);
+
+		if (bytes_read <= 0) {
+			if ((bytes_read < 0) && (errno == EINTR))
+				continue;
+
+			if (++try > 5)
+				job_errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
+
+			if (try > 1)
+				fprintf(stderr, "Error in svn stream, retry #%d\n", try);
+
+			/* everything in flight is asked for again on the new session */
+			transport_retry(connection, length);
+			reconnect(connection);
+
+			length = 0;
+			pending = 0;
+			flight = 0;
+			sent = answered;
+			continue;
+		}
+
+		length += bytes_read;
+		buffer[length] = '\0';
+
+		if (connection->verbosity > 3)
+			fprintf(stdout, "<< %.*s\n", (int)bytes_read, buffer + length - bytes_read);
+
+		/* Save every file whose response is complete. */
+
+		offset = 0;
+
+		while (flight) {
+			while (!file[answered]->whole)
+				answered++;
+
+			if ((response = whole_response_length(buffer + offset, buffer + length)) == 0)
+				break;
+
+			whole_save(connection, file[answered], buffer + offset, buffer + offset + response);
+
+			if (connection->verbosity > 1)
+				progress_indicator(connection, file[answered]->path, answered, file_count);
+
+			pending -= file[answered]->size;
+			file[answered++]->download = 0;
+			flight--;
+			offset += response;
+			try = 0;
+		}
+
+		memmove(buffer, buffer + offset, length - offset);
+		length -= offset;
+	}
+
+	command_queue_free(&commands);
+	free(buffer);
+}
+
+
+/*
+ * create_report_directory
+ *
+ * Procedure that creates a directory of the checked out tree for the reports that
+ * don't come from a server and keeps it from being pruned.
+ */
+
+static void
+create_report_directory(connector *connection, char *path)
+{
+	struct tree_node  *found, find;
+	struct stat        local;
+	int                exists;
+
+	if (((exists = (stat(path, &local) != -1))) && (!S_ISDIR(local.st_mode)))
+		job_errx(EXIT_FAILURE, "%s exists locally and is not a directory.  Please remove it manually and restart svnup", path);
+
+	if (connection->dry_run) {
+		if (!exists)
+			connection->dry_directories++;
+	} else if (mkdir(path, 0755) == 0) {
+		if (connection->verbosity)
+			printf(" + %s\n", path);
+	} else if (errno != EEXIST)
+		job_err(EXIT_FAILURE, "Cannot create target directory");
+
+	/* Remove the directory from the local directory tree to avoid later attempts at pruning. */
+
+	find.path = path;
+
+	if ((found = RB_FIND(tree_local_directories, &connection->local_directories, &find)) != NULL)
+		tree_node_free(RB_REMOVE(tree_local_directories, &connection->local_directories, found));
+}
+
+
+/*
+ * fsfs_*
+ *
+ * Read-only access to local FSFS repositories for file:// URLs.  Revision
+ * files are mapped into memory once and node-revisions, directories,
+ * properties and file contents are decoded straight from the mappings, so
+ * a local checkout never goes through svnserve.  Both physical (format < 7)
+ * and logical (format 7+, via the L2P index) addressing are supported, as
+ * are packed shards and svndiff0/svndiff1 delta chains.
+ */
+
+#define FSFS_ITEM_INDEX_ROOT_NODE 2
+
+static int
+fsfs_rev_file_compare(const struct fsfs_rev_file *a, const struct fsfs_rev_file *b)
+{
+	return (a->first < b->first ? -1 : a->first > b->first);
+}
+
+RB_PROTOTYPE(tree_fsfs_rev_files, fsfs_rev_file, link, fsfs_rev_file_compare)
+RB_GENERATE(tree_fsfs_rev_files, fsfs_rev_file, link, fsfs_rev_file_compare)
+
+/* reads a small file below the repository root into a malloc'd string. */
+static char *
+fsfs_slurp(fsfs_repo *repo, const char *name, size_t *length)
+{
+	struct stat  local;
+	char         path[PATH_MAX], *data;
+	int          fd;
+
+	snprintf(path, sizeof(path), "%s/%s", repo->path, name);
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return (NULL);
+
+	if (fstat(fd, &local) == -1)
+		job_err(EXIT_FAILURE, "fstat %s", path);
+
+	if ((data = malloc(local.st_size + 1)) == NULL)
+		job_err(EXIT_FAILURE, "fsfs_slurp malloc");
+
+	if (read(fd, data, local.st_size) != local.st_size)
+		job_err(EXIT_FAILURE, "read file error (%s)", path);
+
+	data[local.st_size] = '\0';
+	close(fd);
+
+	if (length)
+		*length = local.st_size;
+
+	return (data);
+}
+
+/*
+ * fsfs_open
+ *
+ * Procedure that locates the repository containing the path in
+ * connection->branch and reads its format and youngest revision.  The part
+ * of the path below the repository root is stored in connection->trunk.
+ */
+
+static void
+fsfs_open(connector *connection)
+{
+	struct stat  local;
+	fsfs_repo   *repo;
+	char         path[PATH_MAX], *data, *line, *p;
+	size_t       length;
+
+	if ((repo = calloc(1, sizeof(fsfs_repo))) == NULL)
+		job_err(EXIT_FAILURE, "fsfs_open calloc");
+
+	RB_INIT(&repo->files);
+
+	/* walk up from the url path until a directory containing db/format is found */
+
+	snprintf(path, sizeof(path), "/%s", connection->branch);
+	length = strlen(path);
+
+	while (1) {
+		while (length > 1 && path[length - 1] == '/')
+			path[--length] = '\0';
+
+		snprintf(path + length, sizeof(path) - length, "/db/format");
+		if (stat(path, &local) == 0)
+			break;
+
+		path[length] = '\0';
+		if ((p = strrchr(path, '/')) == NULL || p == path)
+			job_errx(EXIT_FAILURE, "No FSFS repository found in /%s", connection->branch);
+
+		length = p - path;
+		path[length] = '\0';
+	}
+
+	path[length] = '\0';
+	repo->path = strdup(path);
+
+	p = connection->branch + length - 1;
+	while (*p == '/') p++;
+	connection->root = strndup(connection->branch, length - 1);
+	connection->trunk = strdup(p);
+
+	/* db/format: format number followed by optional layout/addressing lines */
+
+	if ((data = fsfs_slurp(repo, "db/format", NULL)) == NULL)
+		job_err(EXIT_FAILURE, "Cannot read %s/db/format", repo->path);
+
+	repo->format = strtol(data, (char **)NULL, 10);
+	if (repo->format < 1 || repo->format > 8)
+		job_errx(EXIT_FAILURE, "Unsupported FSFS format %d", repo->format);
+
+	for (line = strchr(data, '\n'); line && *++line; line = strchr(line, '\n')) {
+		if (starts_with_lit(line, "layout sharded "))
+			repo->shard_size = strtol(line + LIT_LEN("layout sharded "), (char **)NULL, 10);
+
+		if (starts_with_lit(line, "addressing logical"))
+			repo->logical = 1;
+	}
+
+	free(data);
+
+	if ((data = fsfs_slurp(repo, "db/current", NULL)) == NULL)
+		job_err(EXIT_FAILURE, "Cannot read %s/db/current", repo->path);
+
+	repo->youngest = strtoul(data, (char **)NULL, 10);
+	free(data);
+
+	if ((data = fsfs_slurp(repo, "db/min-unpacked-rev", NULL)) != NULL) {
+		repo->min_unpacked = strtoul(data, (char **)NULL, 10);
+		free(data);
+	}
+
+	if ((data = fsfs_slurp(repo, "db/uuid", NULL)) != NULL) {
+		if ((p = strchr(data, '\n')))
+			*p = '\0';
+		repo->uuid = data;
+	}
+
+	connection->fsfs = repo;
+}
+
+/*
+ * fsfs_close
+ *
+ * Procedure that unmaps the rev and pack files read from the repository and frees
+ * what fsfs_open and the reader allocated for it.
+ */
+
+static void
+fsfs_close(connector *connection)
+{
+	fsfs_repo             *repo = connection->fsfs;
+	struct fsfs_rev_file  *rf;
+
+	if (repo == NULL)
+		return;
+
+	while ((rf = RB_MIN(tree_fsfs_rev_files, &repo->files)) != NULL) {
+		RB_REMOVE(tree_fsfs_rev_files, &repo->files, rf);
+		munmap(rf->map, rf->size);
+		free(rf->manifest);
+		free(rf->l2p_rev_pages);
+		free(rf->l2p_pages);
+		free(rf);
+	}
+
+	free(repo->dates);
+	free(repo->path);
+	free(repo->uuid);
+	free(repo);
+
+	connection->fsfs = NULL;
+}
+
+/* decodes one unsigned integer of an L2P index (7 bits per byte, lsb first). */
+static const unsigned char *
+fsfs_index_varint(const unsigned char *p, const unsigned char *end, uint64_t *value)
+{
+	int shift = 0;
+
+	*value = 0;
+	while (p < end && shift < 64) {
+		*value |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return (p);
+		shift += 7;
+	}
+
+	job_errx(EXIT_FAILURE, "Corrupt FSFS index");
+}
+
+/*
+ * fsfs_load_l2p_index
+ *
+ * Procedure that parses the header and page table of the log-to-phys index
+ * referenced by the footer at the end of a logically addressed rev or pack file.
+ */
+
+static void
+fsfs_load_l2p_index(struct fsfs_rev_file *rf)
+{
+	const unsigned char *p, *end;
+	uint64_t             value, page_count, x, offset;
+	char                 footer[256];
+	size_t               footer_length;
+
+	footer_length = (unsigned char)rf->map[rf->size - 1];
+	if (footer_length + 1 > rf->size || footer_length >= sizeof(footer))
+		job_errx(EXIT_FAILURE, "Corrupt FSFS footer in r%u", rf->first);
+
+	memcpy(footer, rf->map + rf->size - 1 - footer_length, footer_length);
+	footer[footer_length] = '\0';
+
+	offset = strtoull(footer, (char **)NULL, 10);
+	if (offset >= rf->size)
+		job_errx(EXIT_FAILURE, "Corrupt FSFS footer in r%u", rf->first);
+
+	p = (const unsigned char *)rf->map + offset;
+	end = (const unsigned char *)rf->map + rf->size;
+
+	if (starts_with_lit((const char *)p, "L2P-INDEX\n"))
+		p += LIT_LEN("L2P-INDEX\n");
+
+	p = fsfs_index_varint(p, end, &value);
+	rf->l2p_first = value;
+	p = fsfs_index_varint(p, end, &value);
+	rf->l2p_revisions = value;
+	p = fsfs_index_varint(p, end, &value);
+	rf->l2p_page_size = value;
+	p = fsfs_index_varint(p, end, &page_count);
+
+	if (rf->l2p_page_size == 0 || rf->l2p_revisions == 0)
+		job_errx(EXIT_FAILURE, "Corrupt FSFS index in r%u", rf->first);
+
+	rf->l2p_rev_pages = malloc((rf->l2p_revisions + 1) * sizeof(size_t));
+	rf->l2p_pages = malloc(page_count * sizeof(*rf->l2p_pages));
+
+	if (rf->l2p_rev_pages == NULL || rf->l2p_pages == NULL)
+		job_err(EXIT_FAILURE, "fsfs_load_l2p_index malloc");
+
+	rf->l2p_rev_pages[0] = 0;
+	for (x = 0; x < rf->l2p_revisions; x++) {
+		p = fsfs_index_varint(p, end, &value);
+		rf->l2p_rev_pages[x + 1] = rf->l2p_rev_pages[x] + value;
+	}
+
+	if (rf->l2p_rev_pages[rf->l2p_revisions] != page_count)
+		job_errx(EXIT_FAILURE, "Corrupt FSFS index in r%u", rf->first);
+
+	for (x = 0; x < page_count; x++) {
+		p = fsfs_index_varint(p, end, &value);
+		rf->l2p_pages[x].size = value;
+		p = fsfs_index_varint(p, end, &value);
+		rf->l2p_pages[x].entries = value;
+	}
+
+	/* the pages themselves follow the page table */
+
+	offset = p - (const unsigned char *)rf->map;
+	for (x = 0; x < page_count; x++) {
+		rf->l2p_pages[x].offset = offset;
+		offset += rf->l2p_pages[x].size;
+	}
+
+	if (offset > rf->size)
+		job_errx(EXIT_FAILURE, "Corrupt FSFS index in r%u", rf->first);
+}
+
+/*
+ * fsfs_rev_file
+ *
+ * Function that returns the (cached) memory mapping of the rev or pack file
+ * that holds the specified revision.
+ */
+
+static struct fsfs_rev_file *
+fsfs_rev_file(fsfs_repo *repo, uint32_t revision)
+{
+	struct fsfs_rev_file  find, *rf;
+	struct stat           local;
+	char                  name[64], path[PATH_MAX], *manifest, *p;
+	int                   fd, packed;
+	size_t                x;
+
+	if (revision > repo->youngest)
+		job_errx(EXIT_FAILURE, "No such revision %u", revision);
+
+	packed = (repo->shard_size && revision < repo->min_unpacked);
+	find.first = packed ? revision - revision % repo->shard_size : revision;
+
+	if ((rf = RB_FIND(tree_fsfs_rev_files, &repo->files, &find)) != NULL)
+		return (rf);
+
+	if (packed)
+		snprintf(name, sizeof(name), "db/revs/%u.pack/pack", revision / repo->shard_size);
+	else if (repo->shard_size)
+		snprintf(name, sizeof(name), "db/revs/%u/%u", revision / repo->shard_size, revision);
+	else
+		snprintf(name, sizeof(name), "db/revs/%u", revision);
+
+	if (snprintf(path, sizeof(path), "%s/%s", repo->path, name) >= (int)sizeof(path))
+		job_errx(EXIT_FAILURE, "Repository path too long: %s", repo->path);
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		job_err(EXIT_FAILURE, "open file (%s)", path);
+
+	if (fstat(fd, &local) == -1)
+		job_err(EXIT_FAILURE, "fstat %s", path);
+
+	if ((rf = calloc(1, sizeof(struct fsfs_rev_file))) == NULL)
+		job_err(EXIT_FAILURE, "fsfs_rev_file calloc");
+
+	rf->first = find.first;
+	rf->size = local.st_size;
+	rf->packed = packed;
+
+	if (rf->size == 0)
+		job_errx(EXIT_FAILURE, "Empty revision file %s", path);
+
+	if ((rf->map = mmap(NULL, rf->size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		job_err(EXIT_FAILURE, "mmap %s", path);
+
+	close(fd);
+	madvise(rf->map, rf->size, MADV_WILLNEED);
+
+	if (repo->logical)
+		fsfs_load_l2p_index(rf);
+
+	else if (packed) {
+		/* physical pack files come with a manifest of revision start offsets */
+
+		snprintf(name, sizeof(name), "db/revs/%u.pack/manifest", revision / repo->shard_size);
+		if ((manifest = fsfs_slurp(repo, name, NULL)) == NULL)
+			job_err(EXIT_FAILURE, "Cannot read %s/%s", repo->path, name);
+
+		if ((rf->manifest = calloc(repo->shard_size + 1, sizeof(size_t))) == NULL)
+			job_err(EXIT_FAILURE, "fsfs_rev_file manifest calloc");
+
+		for (p = manifest, x = 0; *p && x < (size_t)repo->shard_size; x++) {
+			rf->manifest[x] = strtoull(p, &p, 10);
+			while (*p == '\n') p++;
+		}
+
+		for (; x <= (size_t)repo->shard_size; x++)
+			rf->manifest[x] = rf->size;
+
+		free(manifest);
+	}
+
+	RB_INSERT(tree_fsfs_rev_files, &repo->files, rf);
+
+	return (rf);
+}
+
+/*
+ * fsfs_item
+ *
+ * Function that returns a pointer to the start of an item (node-revision,
+ * representation, ...) given by revision and item number.  For physical
+ * addressing the item number is the offset within the revision.
+ */
+
+static char *
+fsfs_item(fsfs_repo *repo, uint32_t revision, uint64_t item, char **end)
+{
+	struct fsfs_rev_file *rf;
+	const unsigned char  *p, *page_end;
+	uint64_t              offset, value, x, page, index;
+	int64_t               last;
+
+	rf = fsfs_rev_file(repo, revision);
+	*end = rf->map + rf->size;
+
+	if (repo->logical) {
+		if (revision < rf->l2p_first || revision - rf->l2p_first >= rf->l2p_revisions)
+			job_errx(EXIT_FAILURE, "r%u not covered by its FSFS index", revision);
+
+		x = revision - rf->l2p_first;
+		page = rf->l2p_rev_pages[x] + item / rf->l2p_page_size;
+		index = item % rf->l2p_page_size;
+
+		if (page >= rf->l2p_rev_pages[x + 1] || index >= rf->l2p_pages[page].entries)
+			job_errx(EXIT_FAILURE, "Item %" PRIu64 " not found in r%u", item, revision);
+
+		/* page entries are delta-encoded, zig-zag signed, offset + 1 */
+
+		p = (const unsigned char *)rf->map + rf->l2p_pages[page].offset;
+		page_end = p + rf->l2p_pages[page].size;
+		last = 0;
+
+		for (x = 0; x <= index; x++) {
+			p = fsfs_index_varint(p, page_end, &value);
+			last += (value & 1) ? -1 - (int64_t)(value / 2) : (int64_t)(value / 2);
+		}
+
+		if (last <= 0)
+			job_errx(EXIT_FAILURE, "Item %" PRIu64 " not found in r%u", item, revision);
+
+		offset = last - 1;
+	} else {
+		offset = item;
+
+		if (rf->manifest) {
+			offset += rf->manifest[revision - rf->first];
+			*end = rf->map + rf->manifest[revision - rf->first + 1];
+		}
+	}
+
+	if (offset >= (uint64_t)(*end - rf->map))
+		job_errx(EXIT_FAILURE, "Item %" PRIu64 " out of range in r%u", item, revision);
+
+	return (rf->map + offset);
+}
+
+/* returns the item number of the root node-revision of a revision. */
+static uint64_t
+fsfs_root_item(fsfs_repo *repo, uint32_t revision)
+{
+	struct fsfs_rev_file *rf;
+	char                 *start, *end, *p;
+
+	if (repo->logical)
+		return (FSFS_ITEM_INDEX_ROOT_NODE);
+
+	/* physical addressing: the last line of the revision reads
+	   "<root offset> <changes offset>" */
+
+	rf = fsfs_rev_file(repo, revision);
+	start = rf->map;
+	end = rf->map + rf->size;
+
+	if (rf->manifest) {
+		start = rf->map + rf->manifest[revision - rf->first];
+		end = rf->map + rf->manifest[revision - rf->first + 1];
+	}
+
+	if (end - start < 2 || end[-1] != '\n')
+		job_errx(EXIT_FAILURE, "Corrupt trailer in r%u", revision);
+
+	for (p = end - 2; p > start && *p != '\n'; p--);
+
+	return (strtoull(p + (*p == '\n'), (char **)NULL, 10));
+}
+
+/* parses "REV ITEM SIZE EXPANDED_SIZE MD5 ..." of a text: or props: line. */
+static void
+fsfs_parse_rep(char *line, fsfs_rep *rep)
+{
+	unsigned long long item, size, expanded;
+	long               revision;
+	char               md5[33];
+
+	if (sscanf(line, "%ld %llu %llu %llu %32s", &revision, &item, &size, &expanded, md5) != 5 || revision < 0)
+		job_errx(EXIT_FAILURE, "Malformed FSFS representation: %.60s", line);
+
+	rep->present = 1;
+	rep->revision = revision;
+	rep->item = item;
+	rep->size = size;
+	rep->expanded_size = expanded ? expanded : size;
+	memcpy(rep->md5, md5, 33);
+}
+
+/* parses the node-revision header found at revision/item. */
+static void
+fsfs_read_noderev(fsfs_repo *repo, uint32_t revision, uint64_t item, fsfs_noderev *node)
+{
+	char *p, *end, *eol;
+
+	memset(node, 0, sizeof(*node));
+	p = fsfs_item(repo, revision, item, &end);
+
+	while (p < end && *p != '\n') {
+		if ((eol = memchr(p, '\n', end - p)) == NULL)
+			break;
+
+		if (starts_with_lit(p, "type: "))
+			node->dir = starts_with_lit(p + LIT_LEN("type: "), "dir");
+
+		else if (starts_with_lit(p, "text: "))
+			fsfs_parse_rep(p + LIT_LEN("text: "), &node->text);
+
+		else if (starts_with_lit(p, "props: "))
+			fsfs_parse_rep(p + LIT_LEN("props: "), &node->props);
+
+		p = eol + 1;
+	}
+}
+
+/* reads a big-endian base-128 svndiff integer. */
+static const unsigned char *
+svndiff_varint(const unsigned char *p, const unsigned char *end, uint64_t *value)
+{
+	*value = 0;
+
+	while (p < end) {
+		*value = (*value << 7) | (*p & 0x7f);
+		if (!(*p++ & 0x80))
+			return (p);
+	}
+
+	job_errx(EXIT_FAILURE, "Corrupt svndiff data");
+}
+
+/* returns a section of an svndiff window, inflating it for svndiff1. */
+static const unsigned char *
+svndiff_section(int version, const unsigned char *data, uint64_t length, unsigned char **buffer, uint64_t *out_length)
+{
+	const unsigned char *p;
+	uint64_t             original;
+	uLongf               inflated;
+
+	*buffer = NULL;
+	*out_length = length;
+
+	if (version == 0 || length == 0)
+		return (data);
+
+	p = svndiff_varint(data, data + length, &original);
+	length -= p - data;
+	*out_length = original;
+
+	if (original == length)
+		return (p);
+
+	if ((*buffer = malloc(original + 1)) == NULL)
+		job_err(EXIT_FAILURE, "svndiff_section malloc");
+
+	inflated = original;
+	if (uncompress(*buffer, &inflated, p, length) != Z_OK || inflated != original)
+		job_errx(EXIT_FAILURE, "Cannot inflate svndiff data");
+
+	return (*buffer);
+}
+
+/*
+ * svndiff_apply
+ *
+ * Function that applies svndiff data to the source text and returns the
+ * resulting text in a freshly allocated, NUL-terminated buffer.
+ */
+
+static char *
+svndiff_apply(const char *source, uint64_t source_length, const char *delta, uint64_t delta_length, uint64_t *length)
+{
+	const unsigned char *p, *end, *ins, *ins_end, *new_data;
+	unsigned char       *ins_buffer, *new_buffer, *target;
+	uint64_t             sview_offset, sview_length, tview_length, ins_length, new_length;
+	uint64_t             ins_size, new_size, new_offset, op_length, op_offset, t, x;
+	uint64_t             capacity;
+	char                *result;
+	int                  action, version;
+
+	p = (const unsigned char *)delta;
+	end = p + delta_length;
+
+	if (delta_length < 4 || memcmp(p, "SVN", 3) != 0)
+		job_errx(EXIT_FAILURE, "Not an svndiff stream");
+
+	if ((version = p[3]) > 1)
+		job_errx(EXIT_FAILURE, "Unsupported svndiff version %d", version);
+
+	p += 4;
+	*length = 0;
+	capacity = BUFFER_UNIT;
+
+	if ((result = malloc(capacity)) == NULL)
+		job_err(EXIT_FAILURE, "svndiff_apply malloc");
+
+	while (p < end) {
+		p = svndiff_varint(p, end, &sview_offset);
+		p = svndiff_varint(p, end, &sview_length);
+		p = svndiff_varint(p, end, &tview_length);
+		p = svndiff_varint(p, end, &ins_length);
+		p = svndiff_varint(p, end, &new_length);
+
+		if ((ins_length > (uint64_t)(end - p)) ||
+		    (new_length > (uint64_t)(end - p) - ins_length) ||
+		    (sview_offset + sview_length > source_length))
+			job_errx(EXIT_FAILURE, "Corrupt svndiff window");
+
+		ins = svndiff_section(version, p, ins_length, &ins_buffer, &ins_size);
+		new_data = svndiff_section(version, p + ins_length, new_length, &new_buffer, &new_size);
+		p += ins_length + new_length;
+		ins_end = ins + ins_size;
+
+		while (*length + tview_length + 1 > capacity)
+			capacity *= 2;
+
+		if ((result = realloc(result, capacity)) == NULL)
+			job_err(EXIT_FAILURE, "svndiff_apply realloc");
+
+		target = (unsigned char *)result + *length;
+		t = new_offset = 0;
+
+		while (ins < ins_end) {
+			action = *ins >> 6;
+			op_length = *ins++ & 0x3f;
+			op_offset = 0;
+
+			if (op_length == 0)
+				ins = svndiff_varint(ins, ins_end, &op_length);
+
+			if (action != 2)
+				ins = svndiff_varint(ins, ins_end, &op_offset);
+
+			if (op_length > tview_length - t)
+				job_errx(EXIT_FAILURE, "Corrupt svndiff instruction");
+
+			switch (action) {
+			case 0: /* copy from source view */
+				if (op_offset > sview_length || op_length > sview_length - op_offset)
+					job_errx(EXIT_FAILURE, "Corrupt svndiff instruction");
+
+				memcpy(target + t, source + sview_offset + op_offset, op_length);
+				break;
+			case 1: /* copy from target view, ranges may overlap */
+				if (op_offset >= t)
+					job_errx(EXIT_FAILURE, "Corrupt svndiff instruction");
+
+				for (x = 0; x < op_length; x++)
+					target[t + x] = target[op_offset + x];
+				break;
+			case 2: /* copy from new data */
+				if (op_length > new_size - new_offset)
+					job_errx(EXIT_FAILURE, "Corrupt svndiff instruction");
+
+				memcpy(target + t, new_data + new_offset, op_length);
+				new_offset += op_length;
+				break;
+			default:
+				job_errx(EXIT_FAILURE, "Corrupt svndiff instruction");
+			}
+
+			t += op_length;
+		}
+
+		if (t != tview_length)
+			job_errx(EXIT_FAILURE, "Corrupt svndiff window");
+
+		*length += tview_length;
+		free(ins_buffer);
+		free(new_buffer);
+	}
+
+	result[*length] = '\0';
+
+	return (result);
+}
+
+/*
+ * fsfs_read_rep
+ *
+ * Function that reconstructs the full text of a representation, following
+ * its delta chain, and returns it in a freshly allocated buffer.
+ */
+
+static char *
+fsfs_read_rep(fsfs_repo *repo, uint32_t revision, uint64_t item, uint64_t size, uint64_t *length)
+{
+	char               *base, *data, *end, *eol, *result;
+	uint64_t            base_length;
+	unsigned long long  base_item, base_size;
+	long                base_revision;
+
+	data = fsfs_item(repo, revision, item, &end);
+
+	if ((eol = memchr(data, '\n', end - data)) == NULL)
+		job_errx(EXIT_FAILURE, "Malformed representation header in r%u", revision);
+
+	eol++;
+	if (size > (uint64_t)(end - eol))
+		job_errx(EXIT_FAILURE, "Truncated representation in r%u", revision);
+
+	if (starts_with_lit(data, "PLAIN\n")) {
+		if ((result = malloc(size + 1)) == NULL)
+			job_err(EXIT_FAILURE, "fsfs_read_rep malloc");
+
+		memcpy(result, eol, size);
+		result[size] = '\0';
+		*length = size;
+
+		return (result);
+	}
+
+	if (starts_with_lit(data, "DELTA\n"))
+		return (svndiff_apply("", 0, eol, size, length));
+
+	if (sscanf(data, "DELTA %ld %llu %llu", &base_revision, &base_item, &base_size) != 3 || base_revision < 0)
+		job_errx(EXIT_FAILURE, "Malformed representation header in r%u", revision);
+
+	base = fsfs_read_rep(repo, base_revision, base_item, base_size, &base_length);
+	result = svndiff_apply(base, base_length, eol, size, length);
+	free(base);
+
+	return (result);
+}
+
+/* returns the contents of a representation referenced by a node-revision. */
+static char *
+fsfs_read_text(fsfs_repo *repo, fsfs_rep *rep, uint64_t *length)
+{
+	char *result;
+
+	if (!rep->present) {
+		*length = 0;
+		return (strdup(""));
+	}
+
+	result = fsfs_read_rep(repo, rep->revision, rep->item, rep->size, length);
+
+	if (*length != rep->expanded_size)
+		job_errx(EXIT_FAILURE, "Representation size mismatch in r%u", rep->revision);
+
+	return (result);
+}
+
+/*
+ * fsfs_hash_next
+ *
+ * Function that iterates over the entries of a serialized hash
+ * ("K len\nkey\nV len\nvalue\n ... END\n") as used for directories and
+ * property lists.  Returns 0 when there are no more entries.
+ */
+
+static int
+fsfs_hash_next(char **p, char *end, char **key, size_t *key_length, char **value, size_t *value_length)
+{
+	char *q = *p;
+
+	if (q >= end || starts_with_lit(q, "END\n") || *q != 'K')
+		return (0);
+
+	*key_length = strtoul(q + 2, &q, 10);
+	*key = ++q;
+	q += *key_length + 1;
+
+	if (q >= end || *q != 'V')
+		job_errx(EXIT_FAILURE, "Malformed FSFS hash");
+
+	*value_length = strtoul(q + 2, &q, 10);
+	*value = ++q;
+	q += *value_length + 1;
+
+	if (q > end)
+		job_errx(EXIT_FAILURE, "Malformed FSFS hash");
+
+	*p = q;
+
+	return (1);
+}
+
+/* reads the svn:executable and svn:special properties of a node. */
+static void
+fsfs_file_props(fsfs_repo *repo, fsfs_noderev *node, file_node *file)
+{
+	char     *props, *p, *key, *value;
+	size_t    key_length, value_length;
+	uint64_t  length;
+
+	if (!node->props.present)
+		return;
+
+	p = props = fsfs_read_text(repo, &node->props, &length);
+
+	while (fsfs_hash_next(&p, props + length, &key, &key_length, &value, &value_length)) {
+		if (key_length == LIT_LEN("svn:executable") && starts_with_lit(key, "svn:executable"))
+			file->executable = 1;
+
+		if (key_length == LIT_LEN("svn:special") && starts_with_lit(key, "svn:special"))
+			file->special = 1;
+	}
+
+	free(props);
+}
+
+/* parses a directory entry value like "file 2-1.0.r1/42" into rev/item. */
+static int
+fsfs_parse_entry(char *value, size_t length, int *dir, uint32_t *revision, uint64_t *item)
+{
+	char  buffer[256], *p;
+
+	if (length >= sizeof(buffer))
+		return (0);
+
+	memcpy(buffer, value, length);
+	buffer[length] = '\0';
+
+	*dir = starts_with_lit(buffer, "dir ");
+
+	if ((p = strstr(buffer, ".r")) == NULL)
+		return (0);
+
+	*revision = strtoul(p + 2, &p, 10);
+	if (*p != '/')
+		return (0);
+
+	*item = strtoull(p + 1, (char **)NULL, 10);
+
+	return (1);
+}
+
+/*
+ * fsfs_lookup
+ *
+ * Procedure that resolves the path in connection->trunk to its node-revision.
+ */
+
+static void
+fsfs_lookup(connector *connection, uint32_t *revision, uint64_t *item, int *dir)
+{
+	fsfs_repo    *repo = connection->fsfs;
+	fsfs_noderev  node;
+	char         *entries, *p, *name, *next, *key, *value;
+	size_t        name_length, key_length, value_length;
+	uint64_t      length;
+	int           found;
+
+	*revision = connection->revision;
+	*item = fsfs_root_item(repo, connection->revision);
+	*dir = 1;
+
+	for (name = connection->trunk; *name; name = next) {
+		while (*name == '/') name++;
+		if (*name == '\0')
+			break;
+
+		if ((next = strchr(name, '/')) == NULL)
+			next = name + strlen(name);
+		name_length = next - name;
+
+		fsfs_read_noderev(repo, *revision, *item, &node);
+		if (!node.dir) {
+			*dir = 0;
+			return;
+		}
+
+		p = entries = fsfs_read_text(repo, &node.text, &length);
+		found = 0;
+
+		while (fsfs_hash_next(&p, entries + length, &key, &key_length, &value, &value_length)) {
+			if (key_length == name_length && memcmp(key, name, name_length) == 0) {
+				found = fsfs_parse_entry(value, value_length, dir, revision, item);
+				break;
+			}
+		}
+
+		free(entries);
+
+		if (!found)
+			job_errx(EXIT_FAILURE, "Path %s not found in r%u", connection->trunk, connection->revision);
+	}
+}
+
+/*
+ * fsfs_revision_date
+ *
+ * Function that returns when a revision of the local repository was committed,
+ * reading its svn:date revision property once and caching it.
+ */
+
+static time_t
+fsfs_revision_date(fsfs_repo *repo, uint32_t revision)
+{
+	char    name[PATH_MAX], *props, *p, *key, *value, *date;
+	size_t  key_length, value_length, length;
+
+	if (revision > repo->youngest)
+		return (0);
+
+	if ((repo->dates == NULL) && ((repo->dates = calloc(repo->youngest + 1, sizeof(time_t))) == NULL))
+		job_err(EXIT_FAILURE, "fsfs_revision_date calloc");
+
+	if (repo->dates[revision])
+		return (repo->dates[revision]);
+
+	if (repo->shard_size)
+		snprintf(name, sizeof(name), "db/revprops/%u/%u", revision / repo->shard_size, revision);
+	else
+		snprintf(name, sizeof(name), "db/revprops/%u", revision);
+
+	/* packed revprops are not supported */
+	if ((p = props = fsfs_slurp(repo, name, &length)) == NULL)
+		return (0);
+
+	while (fsfs_hash_next(&p, props + length, &key, &key_length, &value, &value_length))
+		if (key_length == LIT_LEN("svn:date") && starts_with_lit(key, "svn:date")) {
+			if ((date = strndup(value, value_length)) != NULL)
+				repo->dates[revision] = parse_commit_time(date);
+
+			free(date);
+		}
+
+	free(props);
+
+	return (repo->dates[revision]);
+}
+
+/*
+ * fsfs_report
+ *
+ * Procedure that walks a directory of the local repository, creates the
+ * subdirectories in the working copy and saves the files in the dynamic
+ * array of file_nodes, just like process_report_svn() does for svn://.
+ */
+
+static void
+fsfs_report(connector *connection, char *path_source, uint32_t revision, uint64_t item, file_node ***file, int *file_count, int *file_max)
+{
+	fsfs_repo        *repo = connection->fsfs;
+	fsfs_noderev      node, child;
+	file_node        *this_file;
+	char             *entries, *p, *key, *value, *path, temp_path[BUFFER_UNIT];
+	size_t            key_length, value_length, path_length;
+	uint64_t          length, child_item;
+	uint32_t          child_revision;
+	int               dir;
+
+	fsfs_read_noderev(repo, revision, item, &node);
+	p = entries = fsfs_read_text(repo, &node.text, &length);
+
+	while (fsfs_hash_next(&p, entries + length, &key, &key_length, &value, &value_length)) {
+		if (!fsfs_parse_entry(value, value_length, &dir, &child_revision, &child_item))
+			job_errx(EXIT_FAILURE, "Malformed directory entry in r%u", revision);
+
+		if (key_length > MAXNAMLEN)
+			job_errx(EXIT_FAILURE, "fsfs_report file name is too long");
+
+		path_length = strlen(path_source) + key_length + 2;
+		if ((path = malloc(path_length)) == NULL)
+			job_err(EXIT_FAILURE, "fsfs_report path malloc");
+
+		snprintf(path, path_length, "%s/%.*s", path_source, (int)key_length, key);
+
+		if (dir) {
+			snprintf(temp_path, sizeof(temp_path), "%s%s", connection->path_target, path);
+			create_report_directory(connection, temp_path);
+
+			fsfs_report(connection, path, child_revision, child_item, file, file_count, file_max);
+			free(path);
+		} else {
+			fsfs_read_noderev(repo, child_revision, child_item, &child);
+
+			this_file = new_file_node(file, file_count, file_max);
+			this_file->path = path;
+			this_file->text = child.text;
+			this_file->size = child.text.present ? (int64_t)child.text.expanded_size : 0;
+
+			if (child.text.present)
+				memcpy(this_file->md5, child.text.md5, 33);
+			else
+				md5sum("", 0, this_file->md5);
+
+			fsfs_file_props(repo, &child, this_file);
+
+			if (connection->commit_times)
+				this_file->mtime = fsfs_revision_date(repo, child_revision);
+		}
+	}
+
+	free(entries);
+}
+
+/*
+ * fsfs_get_files
+ *
+ * Procedure that reconstructs and saves the files that need to be downloaded.
+ */
+
+static void
+fsfs_get_files(connector *connection, file_node **file, int file_count)
+{
+	char      *data, file_path_target[BUFFER_UNIT], md5_check[33];
+	uint64_t   length;
+	int        x;
+
+	for (x = 0; x < file_count; x++) {
+		if (file[x]->download == 0)
+			continue;
+
+		snprintf(file_path_target, BUFFER_UNIT, "%s%s", connection->path_target, file[x]->path);
+
+		data = fsfs_read_text(connection->fsfs, &file[x]->text, &length);
+
+		if (strncmp(file[x]->md5, md5sum(data, length, md5_check), 33) != 0)
+			job_errx(EXIT_FAILURE, "MD5 checksum mismatch for %s: should be %s, calculated %s\n", file[x]->path, file[x]->md5, md5_check);
+
+		if (save_file(file_path_target, data, data + length, file[x]->executable, file[x]->special, connection->commit_times ? file[x]->mtime : 0) && connection->verbosity)
+			printf(" + %s\n", file_path_target);
+
+		if (connection->verbosity > 1)
+			progress_indicator(connection, file[x]->path, x, file_count);
+
+		free(data);
+	}
+}
+
+/*
+ * process_log_file
+ *
+ * Procedure that reads author, date and log message of the selected
+ * revision from the revision properties of the local repository.
+ */
+
+static void
+process_log_file(connector *connection)
+{
+	fsfs_repo *repo = connection->fsfs;
+	char       name[PATH_MAX], *props, *p, *key, *value, **target;
+	size_t     key_length, value_length, length;
+
+	if (repo->shard_size)
+		snprintf(name, sizeof(name), "db/revprops/%u/%u", connection->revision / repo->shard_size, connection->revision);
+	else
+		snprintf(name, sizeof(name), "db/revprops/%u", connection->revision);
+
+	if ((p = props = fsfs_slurp(repo, name, &length)) == NULL) {
+		/* packed revprops are not supported */
+		fprintf(stderr, "warning: no revision properties for r%u\n", connection->revision);
+		return;
+	}
+
+	while (fsfs_hash_next(&p, props + length, &key, &key_length, &value, &value_length)) {
+		target = NULL;
+
+		if (key_length == LIT_LEN("svn:author") && starts_with_lit(key, "svn:author"))
+			target = &connection->commit_author;
+		else if (key_length == LIT_LEN("svn:date") && starts_with_lit(key, "svn:date"))
+			target = &connection->commit_date;
+		else if (key_length == LIT_LEN("svn:log") && starts_with_lit(key, "svn:log"))
+			target = &connection->commit_msg;
+
+		if (target)
+			*target = strndup(value, value_length);
+	}
+
+	free(props);
+
+	if (connection->commit_date)
+		sanitize_svn_date(connection->commit_date);
+}
+
+/*
+ * dumpfile_*
+ *
+ * Offline checkouts from svn dumpfiles (dump:FILE[@REV][#SUBDIR]).  The dumpfile is
+ * read sequentially up to the requested revision.  File texts are appended to an
+ * unlinked spill file, so memory only holds the version history of each path (kind,
+ * executable/special flags and the location of the text in the spill file), which
+ * is what copies from older revisions need.
+ */
+
+static int
+dumpfile_node_compare(const struct dumpfile_node *a, const struct dumpfile_node *b)
+{
+	return (strcmp(a->path, b->path));
+}
+
+RB_PROTOTYPE(tree_dumpfile_nodes, dumpfile_node, link, dumpfile_node_compare)
+RB_GENERATE(tree_dumpfile_nodes, dumpfile_node, link, dumpfile_node_compare)
+
+
+static struct dumpfile_node *
+dumpfile_find(dumpfile *dump, const char *path, int create)
+{
+	struct dumpfile_node  *node, find;
+
+	find.path = (char *)path;
+
+	if ((node = RB_FIND(tree_dumpfile_nodes, &dump->nodes, &find)) != NULL || !create)
+		return (node);
+
+	if ((node = malloc(sizeof(struct dumpfile_node))) == NULL)
+		job_err(EXIT_FAILURE, "dumpfile_find malloc");
+
+	node->path = strdup(path);
+	sblist_init(&node->versions, sizeof(dumpfile_version), 2);
+	RB_INSERT(tree_dumpfile_nodes, &dump->nodes, node);
+
+	return (node);
+}
+
+
+/* returns the version of node in the given revision, NULL if it doesn't exist there */
+static dumpfile_version *
+dumpfile_get(struct dumpfile_node *node, uint32_t revision)
+{
+	dumpfile_version  *version;
+	size_t             x;
+
+	for (x = sblist_getsize(&node->versions); x > 0; x--) {
+		version = sblist_get(&node->versions, x - 1);
+
+		if (version->revision <= revision)
+			return (version->kind ? version : NULL);
+	}
+
+	return (NULL);
+}
+
+
+/* returns the version of path to be modified by the given (current) revision */
+static dumpfile_version *
+dumpfile_set(dumpfile *dump, const char *path, uint32_t revision)
+{
+	struct dumpfile_node  *node = dumpfile_find(dump, path, 1);
+	dumpfile_version       version, *last = NULL;
+
+	if (!sblist_empty(&node->versions))
+		last = sblist_get(&node->versions, sblist_getsize(&node->versions) - 1);
+
+	if (last && last->revision == revision)
+		return (last);
+
+	if (last)
+		version = *last;
+	else
+		memset(&version, 0, sizeof(version));
+
+	version.revision = revision;
+
+	if (!sblist_add(&node->versions, &version))
+		job_err(EXIT_FAILURE, "dumpfile_set sblist_add");
+
+	return (sblist_get(&node->versions, sblist_getsize(&node->versions) - 1));
+}
+
+
+/*
+ * collects the nodes at or below path that exist in the given revision.  siblings
+ * such as "src.c" or "src-old" sort between "src" and "src/...", so the nodes below
+ * path are looked up from "path/" on rather than scanned from path itself.
+ */
+static void
+dumpfile_subtree(dumpfile *dump, const char *path, uint32_t revision, sblist *nodes)
+{
+	struct dumpfile_node  *node, find;
+	char                   prefix[PATH_MAX];
+	size_t                 length = strlen(path);
+
+	if (length) {
+		if ((node = dumpfile_find(dump, path, 0)) != NULL && dumpfile_get(node, revision))
+			sblist_add(nodes, &node);
+
+		if (snprintf(prefix, sizeof(prefix), "%s/", path) >= (int)sizeof(prefix))
+			job_errx(EXIT_FAILURE, "dumpfile_subtree path too long: %s", path);
+
+		length++;
+	} else
+		prefix[0] = '\0';
+
+	find.path = prefix;
+
+	for (node = RB_NFIND(tree_dumpfile_nodes, &dump->nodes, &find); node; node = RB_NEXT(tree_dumpfile_nodes, &dump->nodes, node)) {
+		if (strncmp(node->path, prefix, length))
+			break;
+
+		if (dumpfile_get(node, revision))
+			sblist_add(nodes, &node);
+	}
+}
+
+
+static void
+dumpfile_delete(dumpfile *dump, const char *path, uint32_t revision)
+{
+	struct dumpfile_node  **node;
+	sblist                  nodes;
+
+	sblist_init(&nodes, sizeof(struct dumpfile_node *), 64);
+	dumpfile_subtree(dump, path, revision, &nodes);
+
+	sblist_iter(&nodes, node)
+		dumpfile_set(dump, (*node)->path, revision)->kind = 0;
+
+	sblist_free_items(&nodes);
+}
+
+
+static void
+dumpfile_copy(dumpfile *dump, const char *source, uint32_t source_revision, const char *path, uint32_t revision)
+{
+	struct dumpfile_node  **node;
+	dumpfile_version       *version;
+	sblist                  nodes;
+	char                    target[PATH_MAX];
+
+	sblist_init(&nodes, sizeof(struct dumpfile_node *), 64);
+	dumpfile_subtree(dump, source, source_revision, &nodes);
+
+	if (sblist_empty(&nodes))
+		job_errx(EXIT_FAILURE, "Copy source %s@%u not found in dumpfile", source, source_revision);
+
+	sblist_iter(&nodes, node) {
+		snprintf(target, sizeof(target), "%s%s", path, (*node)->path + strlen(source));
+		version = dumpfile_set(dump, target, revision);
+		*version = *dumpfile_get(*node, source_revision);
+		version->revision = revision;
+	}
+
+	sblist_free_items(&nodes);
+}
+
+
+/* applies a (possibly delta) property block to the flags of a version */
+static void
+dumpfile_props(dumpfile_version *version, char *props, size_t length, int delta)
+{
+	char   *p = props, *end = props + length, *key;
+	size_t  key_length, value_length;
+	int     set;
+
+	if (!delta)
+		version->executable = version->special = 0;
+
+	while (p < end && (*p == 'K' || *p == 'D')) {
+		set = (*p == 'K');
+		key_length = strtoul(p + 2, &p, 10);
+		key = ++p;
+		p += key_length + 1;
+
+		if (set) {
+			if (p >= end || *p != 'V')
+				job_errx(EXIT_FAILURE, "Malformed property block in dumpfile");
+
+			value_length = strtoul(p + 2, &p, 10);
+			p += value_length + 2;
+		}
+
+		if (p > end)
+			job_errx(EXIT_FAILURE, "Malformed property block in dumpfile");
+
+		if (key_length == LIT_LEN("svn:executable") && starts_with_lit(key, "svn:executable"))
+			version->executable = set;
+
+		if (key_length == LIT_LEN("svn:special") && starts_with_lit(key, "svn:special"))
+			version->special = set;
+	}
+}
+
+
+static char *
+dumpfile_read(FILE *in, uint64_t length)
+{
+	char  *data;
+
+	if ((data = malloc(length + 1)) == NULL)
+		job_err(EXIT_FAILURE, "dumpfile_read malloc");
+
+	if (length && fread(data, 1, length, in) != length)
+		job_errx(EXIT_FAILURE, "Unexpected end of dumpfile");
+
+	data[length] = '\0';
+
+	return (data);
+}
+
+
+static uint64_t
+dumpfile_spill(dumpfile *dump, const char *data, uint64_t length)
+{
+	uint64_t  offset = dump->spill_size;
+
+	if (length && fwrite(data, 1, length, dump->spill) != length)
+		job_err(EXIT_FAILURE, "dumpfile spill write");
+
+	dump->spill_size += length;
+
+	return (offset);
+}
+
+
+/* reads a text from the spill file, which is only mapped once loading is done */
+static char *
+dumpfile_text(dumpfile *dump, dumpfile_version *version)
+{
+	char  *data;
+
+	if ((data = malloc(version->length + 1)) == NULL)
+		job_err(EXIT_FAILURE, "dumpfile_text malloc");
+
+	fflush(dump->spill);
+
+	if (version->length && pread(fileno(dump->spill), data, version->length, version->offset) != (ssize_t)version->length)
+		job_err(EXIT_FAILURE, "dumpfile spill read");
+
+	data[version->length] = '\0';
+
+	return (data);
+}
+
+
+/*
+ * dumpfile_close
+ *
+ * Procedure that unmaps and closes the spill file of a dumpfile and frees the history
+ * dumpfile_load recorded.
+ */
+
+static void
+dumpfile_close(connector *connection)
+{
+	dumpfile              *dump = connection->dump;
+	struct dumpfile_node  *node;
+
+	if (dump == NULL)
+		return;
+
+	while ((node = RB_MIN(tree_dumpfile_nodes, &dump->nodes)) != NULL) {
+		RB_REMOVE(tree_dumpfile_nodes, &dump->nodes, node);
+		sblist_free_items(&node->versions);
+		free(node->path);
+		free(node);
+	}
+
+	if (dump->map)
+		munmap(dump->map, dump->spill_size);
+
+	if (dump->source)
+		fclose(dump->source);
+
+	if (dump->spill)
+		fclose(dump->spill);
+
+	free(dump->dates);
+	free(dump);
+
+	connection->dump = NULL;
+}
+
+
+/*
+ * dumpfile_load
+ *
+ * Procedure that reads the dumpfile named in connection->branch ("-" for stdin) up to
+ * connection->revision (all of it if that is 0), recording every path's history and
+ * the author, date and log message of the last revision read.
+ */
+
+static void
+dumpfile_load(connector *connection)
+{
+	dumpfile          *dump;
+	dumpfile_version  *version;
+	FILE              *in;
+	char              *line, *value, *path, *kind, *action, *copy_path, *props, *text, *delta, **target;
+	char              *p, *key, buffer[BUFFER_UNIT * 16];
+	size_t             line_size, key_length, value_length;
+	ssize_t            line_length;
+	int64_t            revision, record, copy_revision, prop_length, text_length, content_length, chunk;
+	uint64_t           length;
+	int                headers, text_delta, prop_delta;
+
+	if ((dump = connection->dump = calloc(1, sizeof(dumpfile))) == NULL)
+		job_err(EXIT_FAILURE, "dumpfile_load calloc");
+
+	RB_INIT(&dump->nodes);
+
+	if ((dump->spill = tmpfile()) == NULL)
+		job_err(EXIT_FAILURE, "dumpfile_load tmpfile");
+
+	if (strcmp(connection->branch, "-") == 0)
+		in = stdin;
+	else if ((in = dump->source = fopen(connection->branch, "r")) == NULL)
+		job_err(EXIT_FAILURE, "Cannot open dumpfile %s", connection->branch);
+
+	line = NULL;
+	line_size = 0;
+	revision = -1;
+
+	while (1) {
+		path = kind = action = copy_path = NULL;
+		record = copy_revision = prop_length = text_length = content_length = -1;
+		text_delta = prop_delta = headers = 0;
+
+		/* header block */
+
+		while ((line_length = getline(&line, &line_size, in)) > 0) {
+			if (line[line_length - 1] == '\n')
+				line[--line_length] = '\0';
+
+			if (line_length == 0) {
+				if (headers)
+					break;
+				continue;
+			}
+
+			headers++;
+
+			if ((value = strstr(line, ": ")) == NULL)
+				continue;
+
+			*value = '\0';
+			value += 2;
+
+			if (strcmp(line, "Revision-number") == 0)
+				record = strtoll(value, NULL, 10);
+			else if (strcmp(line, "Node-path") == 0)
+				path = strdup(value + (*value == '/'));
+			else if (strcmp(line, "Node-kind") == 0)
+				kind = strdup(value);
+			else if (strcmp(line, "Node-action") == 0)
+				action = strdup(value);
+			else if (strcmp(line, "Node-copyfrom-path") == 0)
+				copy_path = strdup(value + (*value == '/'));
+			else if (strcmp(line, "Node-copyfrom-rev") == 0)
+				copy_revision = strtoll(value, NULL, 10);
+			else if (strcmp(line, "Prop-content-length") == 0)
+				prop_length = strtoll(value, NULL, 10);
+			else if (strcmp(line, "Text-content-length") == 0)
+				text_length = strtoll(value, NULL, 10);
+			else if (strcmp(line, "Content-length") == 0)
+				content_length = strtoll(value, NULL, 10);
+			else if (strcmp(line, "Text-delta") == 0)
+				text_delta = (strcmp(value, "true") == 0);
+			else if (strcmp(line, "Prop-delta") == 0)
+				prop_delta = (strcmp(value, "true") == 0);
+		}
+
+		if (!headers)
+			break;
+
+		if (record >= 0) {
+			if (connection->revision && record > connection->revision)
+				break;
+
+			revision = record;
+		}
+
+		if (prop_length < 0)
+			prop_length = 0;
+
+		if (content_length < 0)
+			content_length = prop_length + (text_length > 0 ? text_length : 0);
+
+		props = dumpfile_read(in, prop_length);
+		content_length -= prop_length;
+
+		if (record >= 0) {
+			/* revision record, keep author, date and log message */
+
+			free(connection->commit_author);
+			free(connection->commit_date);
+			free(connection->commit_msg);
+			connection->commit_author = connection->commit_date = connection->commit_msg = NULL;
+
+			p = props;
+
+			while (fsfs_hash_next(&p, props + prop_length, &key, &key_length, &value, &value_length)) {
+				target = NULL;
+
+				if (key_length == LIT_LEN("svn:author") && starts_with_lit(key, "svn:author"))
+					target = &connection->commit_author;
+				else if (key_length == LIT_LEN("svn:date") && starts_with_lit(key, "svn:date"))
+					target = &connection->commit_date;
+				else if (key_length == LIT_LEN("svn:log") && starts_with_lit(key, "svn:log"))
+					target = &connection->commit_msg;
+
+				if (target) {
+					free(*target);
+					*target = strndup(value, value_length);
+				}
+			}
+
+			/* remember when each revision was committed for --use-commit-times */
+			if ((uint64_t)revision >= dump->dates_count) {
+				length = MAX((uint64_t)revision + 1, dump->dates_count * 2);
+
+				if ((dump->dates = realloc(dump->dates, length * sizeof(time_t))) == NULL)
+					job_err(EXIT_FAILURE, "dumpfile_load dates realloc");
+
+				memset(dump->dates + dump->dates_count, 0, (length - dump->dates_count) * sizeof(time_t));
+				dump->dates_count = length;
+			}
+
+			dump->dates[revision] = connection->commit_date ? parse_commit_time(connection->commit_date) : 0;
+		}
+
+		if (path && revision < 0)
+			job_errx(EXIT_FAILURE, "Node record before the first revision in dumpfile");
+
+		if (path && action) {
+			if (strcmp(action, "delete") == 0 || strcmp(action, "replace") == 0)
+				dumpfile_delete(dump, path, revision);
+
+			if (strcmp(action, "delete") != 0) {
+				if (copy_path)
+					dumpfile_copy(dump, copy_path, copy_revision, path, revision);
+
+				version = dumpfile_set(dump, path, revision);
+
+				if (strcmp(action, "change") != 0 && !copy_path) {
+					memset(version, 0, sizeof(dumpfile_version));
+					version->revision = revision;
+				}
+
+				if (kind)
+					version->kind = (strcmp(kind, "dir") == 0 ? 'd' : 'f');
+
+				if (!version->kind)
+					job_errx(EXIT_FAILURE, "Unknown node kind for %s in r%" PRId64, path, revision);
+
+				if (prop_length > 0)
+					dumpfile_props(version, props, prop_length, prop_delta);
+
+				if (text_length >= 0 && text_delta) {
+					delta = dumpfile_read(in, text_length);
+					text = dumpfile_text(dump, version);
+					value = svndiff_apply(text, version->length, delta, text_length, &length);
+					version->offset = dumpfile_spill(dump, value, length);
+					version->length = length;
+					content_length -= text_length;
+					free(delta);
+					free(text);
+					free(value);
+				} else if (text_length >= 0) {
+					version->offset = dump->spill_size;
+					version->length = text_length;
+					content_length -= text_length;
+
+					for (length = text_length; length; length -= chunk) {
+						chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+
+						if (fread(buffer, 1, chunk, in) != (size_t)chunk)
+							job_errx(EXIT_FAILURE, "Unexpected end of dumpfile");
+
+						dumpfile_spill(dump, buffer, chunk);
+					}
+				}
+			}
+		}
+
+		/* skip whatever is left of the record */
+
+		for (; content_length > 0; content_length -= chunk) {
+			chunk = content_length < (int64_t)sizeof(buffer) ? content_length : (int64_t)sizeof(buffer);
+
+			if (fread(buffer, 1, chunk, in) != (size_t)chunk)
+				job_errx(EXIT_FAILURE, "Unexpected end of dumpfile");
+		}
+
+		free(props);
+		free(path);
+		free(kind);
+		free(action);
+		free(copy_path);
+	}
+
+	free(line);
+
+	if (in != stdin)
+		fclose(in);
+
+	dump->source = NULL;
+
+	if (revision < 0)
+		job_errx(EXIT_FAILURE, "No revisions found in dumpfile %s", connection->branch);
+
+	if (connection->revision && revision != connection->revision)
+		job_errx(EXIT_FAILURE, "Dumpfile ends at r%" PRId64 ", r%u requested", revision, connection->revision);
+
+	connection->revision = revision;
+
+	fflush(dump->spill);
+
+	if (dump->spill_size && (dump->map = mmap(NULL, dump->spill_size, PROT_READ, MAP_PRIVATE, fileno(dump->spill), 0)) == MAP_FAILED)
+		job_err(EXIT_FAILURE, "dumpfile_load mmap");
+
+	if (connection->commit_date)
+		sanitize_svn_date(connection->commit_date);
+}
+
+
+/*
+ * dumpfile_report
+ *
+ * Procedure that creates the directories and lists the files of the dumped tree below
+ * connection->trunk in the loaded revision.
+ */
+
+static void
+dumpfile_report(connector *connection, file_node ***file, int *file_count, int *file_max)
+{
+	dumpfile               *dump = connection->dump;
+	struct dumpfile_node  **node;
+	dumpfile_version       *version;
+	file_node              *this_file;
+	sblist                  nodes;
+	char                    temp_path[BUFFER_UNIT], *relative;
+	size_t                  length = strlen(connection->trunk);
+
+	sblist_init(&nodes, sizeof(struct dumpfile_node *), 256);
+	dumpfile_subtree(dump, connection->trunk, connection->revision, &nodes);
+
+	if (length && (sblist_empty(&nodes) || dumpfile_get(*(struct dumpfile_node **)sblist_get(&nodes, 0), connection->revision)->kind != 'd'))
+		job_errx(EXIT_FAILURE, "Remote path %s is not a repository directory.", connection->trunk);
+
+	sblist_iter(&nodes, node) {
+		version = dumpfile_get(*node, connection->revision);
+		relative = (*node)->path + length;
+
+		if (*relative == '\0')
+			continue;
+
+		if (version->kind == 'd') {
+			snprintf(temp_path, sizeof(temp_path), "%s%s%s", connection->path_target, length ? "" : "/", relative);
+			create_report_directory(connection, temp_path);
+			continue;
+		}
+
+		this_file = new_file_node(file, file_count, file_max);
+		snprintf(temp_path, sizeof(temp_path), "%s%s", length ? "" : "/", relative);
+		this_file->path = strdup(temp_path);
+		this_file->size = version->length;
+		this_file->executable = version->executable;
+		this_file->special = version->special;
+		this_file->mtime = version->revision < dump->dates_count ? dump->dates[version->revision] : 0;
+
+		/* the text lives in the spill file, at item with a length of expanded_size */
+		this_file->text.present = 1;
+		this_file->text.item = version->offset;
+		this_file->text.expanded_size = version->length;
+
+		md5sum(dump->map ? dump->map + version->offset : "", version->length, this_file->md5);
+	}
+
+	sblist_free_items(&nodes);
+}
+
+
+/*
+ * dumpfile_get_files
+ *
+ * Procedure that saves the files that need to be downloaded from the spill file.
+ */
+
+static void
+dumpfile_get_files(connector *connection, file_node **file, int file_count)
+{
+	char  *data, file_path_target[BUFFER_UNIT], empty[1] = "";
+	int    x;
+
+	for (x = 0; x < file_count; x++) {
+		if (file[x]->download == 0)
+			continue;
+
+		snprintf(file_path_target, BUFFER_UNIT, "%s%s", connection->path_target, file[x]->path);
+
+		data = connection->dump->map ? connection->dump->map + file[x]->text.item : empty;
+
+		/* save_file() terminates symlink targets in place, the mapping is read-only */
+		if (file[x]->special && (data = strndup(data, file[x]->text.expanded_size)) == NULL)
+			job_err(EXIT_FAILURE, "dumpfile_get_files strndup");
+
+		if (save_file(file_path_target, data, data + file[x]->text.expanded_size, file[x]->executable, file[x]->special, connection->commit_times ? file[x]->mtime : 0) && connection->verbosity)
+			printf(" + %s\n", file_path_target);
+
+		if (connection->verbosity > 1)
+			progress_indicator(connection, file[x]->path, x, file_count);
+
+		if (file[x]->special)
+			free(data);
+	}
+}
+
+
+static void
+dump_buffer_add(dump_buffer *buffer, const char *data, size_t length)
+{
+	if (buffer->length + length + 1 > buffer->capacity) {
+		do buffer->capacity = buffer->capacity ? buffer->capacity * 2 : BUFFER_UNIT;
+		while (buffer->length + length + 1 > buffer->capacity);
+
+		if ((buffer->data = realloc(buffer->data, buffer->capacity)) == NULL)
+			job_err(EXIT_FAILURE, "dump_buffer_add realloc");
+	}
+
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+	buffer->data[buffer->length] = '\0';
+}
+
+
+/*
+ * svn_reader_fill
+ *
+ * Procedure that makes sure at least need unread bytes of the svn stream are buffered.
+ */
+
+static void
+svn_reader_fill(svn_reader *reader, size_t need)
+{
+	ssize_t  bytes_read;
+
+	while (reader->end - reader->start < need) {
+		if (reader->start > 0) {
+			memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+			reader->end -= reader->start;
+			reader->start = 0;
+		}
+
+		if (need > reader->capacity || reader->end == reader->capacity) {
+			do reader->capacity = reader->capacity ? reader->capacity * 2 : COMMAND_BUFFER;
+			while (reader->capacity < need);
+
+			if ((reader->buffer = realloc(reader->buffer, reader->capacity)) == NULL)
+				job_err(EXIT_FAILURE, "svn_reader_fill realloc");
+		}
+
+		bytes_read = read(reader->socket_descriptor, reader->buffer + reader->end, reader->capacity - reader->end);
+
+		if (bytes_read <= 0) {
+			if ((bytes_read < 0) && (errno == EINTR))
+				continue;
+
+			job_errx(EXIT_FAILURE, "Error in svn stream.  Quitting.");
+		}
+
+		reader->end += bytes_read;
+	}
+}
+
+
+/*
+ * svn_reader_token
+ *
+ * Function that reads the next token from the svn stream and returns its type.  Words
+ * and strings are left in reader->string/length, numbers in reader->number; they stay
+ * valid until the next token is read.
+ */
+
+static int
+svn_reader_token(svn_reader *reader)
+{
+	size_t  n;
+	char    c, *p;
+
+	while (1) {
+		svn_reader_fill(reader, 1);
+		c = reader->buffer[reader->start];
+		if (c != ' ' && c != '\n')
+			break;
+		reader->start++;
+	}
+
+	if (c == '(' || c == ')') {
+		reader->start++;
+		return (reader->type = (c == '(' ? SVN_TOKEN_OPEN : SVN_TOKEN_CLOSE));
+	}
+
+	if (!isalnum((unsigned char)c))
+		job_errx(EXIT_FAILURE, "Malformed svn response (unexpected '%c').", c);
+
+	/* numbers, strings and words are all followed by a delimiter */
+	for (n = 1; ; n++) {
+		svn_reader_fill(reader, n + 1);
+		c = reader->buffer[reader->start + n];
+		if (isdigit((unsigned char)reader->buffer[reader->start]) ? !isdigit((unsigned char)c) : !(isalnum((unsigned char)c) || c == '-'))
+			break;
+	}
+
+	p = reader->buffer + reader->start;
+
+	if (!isdigit((unsigned char)*p)) {
+		reader->string = p;
+		reader->length = n;
+		reader->start += n;
+		return (reader->type = SVN_TOKEN_WORD);
+	}
+
+	reader->number = strtoull(p, NULL, 10);
+
+	if (c != ':') {
+		reader->start += n;
+		return (reader->type = SVN_TOKEN_NUMBER);
+	}
+
+	reader->length = reader->number;
+	svn_reader_fill(reader, n + 1 + reader->length);
+	reader->string = reader->buffer + reader->start + n + 1;
+	reader->start += n + 1 + reader->length;
+
+	return (reader->type = SVN_TOKEN_STRING);
+}
+
+
+/*
+ * svn_reader_next
+ *
+ * Function that returns the next token, the one peeked at if there is one.  With
+ * reader->capture set, every token read is also appended to it in the single-space
+ * form svnserve writes, so that a request or response can be passed on verbatim.
+ */
+
+static int
+svn_reader_next(svn_reader *reader)
+{
+	char  number[24];
+
+	if (reader->peeked) {
+		reader->peeked = 0;
+		return (reader->type);
+	}
+
+	svn_reader_token(reader);
+
+	if (reader->capture == NULL)
+		return (reader->type);
+
+	if (reader->capture->length)
+		dump_buffer_add(reader->capture, " ", 1);
+
+	if (reader->type == SVN_TOKEN_OPEN)
+		dump_buffer_add(reader->capture, "(", 1);
+	else if (reader->type == SVN_TOKEN_CLOSE)
+		dump_buffer_add(reader->capture, ")", 1);
+	else if (reader->type == SVN_TOKEN_WORD)
+		dump_buffer_add(reader->capture, reader->string, reader->length);
+	else if (reader->type == SVN_TOKEN_NUMBER)
+		dump_buffer_add(reader->capture, number, snprintf(number, sizeof(number), "%" PRIu64, reader->number));
+	else {
+		dump_buffer_add(reader->capture, number, snprintf(number, sizeof(number), "%zu:", reader->length));
+		dump_buffer_add(reader->capture, reader->string, reader->length);
+	}
+
+	return (reader->type);
+}
+
+
+static int
+svn_reader_peek(svn_reader *reader)
+{
+	svn_reader_next(reader);
+	reader->peeked = 1;
+
+	return (reader->type);
+}
+
+
+static void
+svn_reader_expect(svn_reader *reader, int type)
+{
+	if (svn_reader_next(reader) != type)
+		job_errx(EXIT_FAILURE, "Malformed svn response (token %d, expected %d).", reader->type, type);
+}
+
+
+static int
+svn_reader_word(svn_reader *reader, const char *word)
+{
+	return (reader->type == SVN_TOKEN_WORD &&
+		reader->length == strlen(word) &&
+		memcmp(reader->string, word, reader->length) == 0);
+}
+
+
+static uint64_t
+svn_reader_number(svn_reader *reader)
+{
+	svn_reader_expect(reader, SVN_TOKEN_NUMBER);
+
+	return (reader->number);
+}
+
+
+/* consumes the remainder of the current list, including its closing paren */
+static void
+svn_reader_skip_list(svn_reader *reader)
+{
+	int  depth = 1;
+
+	while (depth) {
+		svn_reader_next(reader);
+		if (reader->type == SVN_TOKEN_OPEN)
+			depth++;
+		else if (reader->type == SVN_TOKEN_CLOSE)
+			depth--;
+	}
+}
+
+
+static void
+svn_reader_skip_item(svn_reader *reader)
+{
+	if (svn_reader_next(reader) == SVN_TOKEN_OPEN)
+		svn_reader_skip_list(reader);
+}
+
+
+/*
+ * svn_reader_response
+ *
+ * Procedure that reads the head of a "( success ( " response and leaves the reader
+ * inside its parameter list.  Failure responses are fatal.
+ */
+
+static void
+svn_reader_response(svn_reader *reader)
+{
+	svn_reader_expect(reader, SVN_TOKEN_OPEN);
+	svn_reader_expect(reader, SVN_TOKEN_WORD);
+
+	if (svn_reader_word(reader, "failure")) {
+		svn_reader_expect(reader, SVN_TOKEN_OPEN);
+		svn_reader_expect(reader, SVN_TOKEN_OPEN);
+		svn_reader_number(reader);
+		svn_reader_expect(reader, SVN_TOKEN_STRING);
+		job_errx(EXIT_FAILURE, "Command Failure: %.*s", (int)reader->length, reader->string);
+	}
+
+	if (!svn_reader_word(reader, "success"))
+		job_errx(EXIT_FAILURE, "Malformed svn response (%.*s).", (int)reader->length, reader->string);
+
+	svn_reader_expect(reader, SVN_TOKEN_OPEN);
+}
+
+
+static void
+svn_reader_response_end(svn_reader *reader)
+{
+	svn_reader_skip_list(reader);
+	svn_reader_expect(reader, SVN_TOKEN_CLOSE);
+}
+
+
+/* skips the auth request preceding each command response and enters the response */
+static void
+svn_reader_command_response(svn_reader *reader)
+{
+	svn_reader_response(reader);
+	svn_reader_response_end(reader);
+	svn_reader_response(reader);
+}
+
+
+
+/*
+ * svn_reader_props
+ *
+ * Procedure that reads a property list and stores it in dumpfile hash format.  The
+ * svn:entry: and svn:wc: properties the server adds on its own are dropped.
+ */
+
+static void
+svn_reader_props(svn_reader *reader, dump_buffer *props)
+{
+	char  header[32];
+	int   skip;
+
+	props->length = 0;
+
+	svn_reader_expect(reader, SVN_TOKEN_OPEN);
+
+	while (svn_reader_next(reader) == SVN_TOKEN_OPEN) {
+		svn_reader_expect(reader, SVN_TOKEN_STRING);
+
+		skip = (reader->length >= 10 && !memcmp(reader->string, "svn:entry:", 10)) ||
+			(reader->length >= 7 && !memcmp(reader->string, "svn:wc:", 7));
+
+		if (!skip) {
+			snprintf(header, sizeof(header), "K %zu\n", reader->length);
+			dump_buffer_add(props, header, strlen(header));
+			dump_buffer_add(props, reader->string, reader->length);
+		}
+
+		svn_reader_expect(reader, SVN_TOKEN_STRING);
+
+		if (!skip) {
+			snprintf(header, sizeof(header), "\nV %zu\n", reader->length);
+			dump_buffer_add(props, header, strlen(header));
+			dump_buffer_add(props, reader->string, reader->length);
+			dump_buffer_add(props, "\n", 1);
+		}
+
+		svn_reader_skip_list(reader);
+	}
+
+	if (reader->type != SVN_TOKEN_CLOSE)
+		job_errx(EXIT_FAILURE, "Malformed svn property list.");
+
+	dump_buffer_add(props, "PROPS-END\n", 10);
+}
+
+
+/*
+ * dump_in_prefix / dump_session_path
+ *
+ * Helpers mapping repository paths (as written to the dumpfile) to the dumped subtree
+ * (connection->trunk) and to paths relative to the session URL.
+ */
+
+static int
+dump_in_prefix(connector *connection, const char *path)
+{
+	size_t  length = strlen(connection->trunk);
+
+	return (length == 0 ||
+		(strncmp(path, connection->trunk, length) == 0 && (path[length] == '\0' || path[length] == '/')));
+}
+
+
+static const char *
+dump_session_path(connector *connection, const char *path)
+{
+	size_t  length = strlen(connection->trunk);
+
+	if (length == 0)
+		return (path);
+
+	return (path[length] == '/' ? path + length + 1 : path + length);
+}
+
+
+static int
+dump_node_compare(const void *a, const void *b)
+{
+	const dump_node *x = a, *y = b;
+	int  result = strcmp(x->path, y->path);
+
+	/* a replaced path is deleted before it is added again */
+	if (result == 0)
+		result = (y->action == 'D') - (x->action == 'D');
+
+	return (result);
+}
+
+
+static void
+dump_node_free(dump_node *node)
+{
+	free(node->path);
+	free(node->copy_path);
+}
+
+
+/*
+ * dump_send
+ *
+ * Procedure that sends the next chain of queued commands and returns the number of
+ * responses to read, or 0 once the queue is drained.
+ */
+
+static size_t
+dump_send(connector *connection, command_queue *queue)
+{
+	char    *chain;
+	size_t   items = 0;
+
+	if ((chain = command_queue_chain(queue, BUFFER_UNIT, &items)) == NULL)
+		return (0);
+
+	send_command(connection, chain);
+
+	return (items);
+}
+
+
+/*
+ * dump_expand
+ *
+ * Procedure that adds every node below path in the given revision to the node list.
+ * Used for copies whose source is not part of the dump.
+ */
+
+static void
+dump_expand(connector *connection, svn_reader *reader, sblist *nodes, const char *path, uint32_t revision)
+{
+	command_queue  queue;
+	sblist         level, next;
+	dump_node      node;
+	char          *dir, *child, **entry;
+	size_t         d, items;
+
+	command_queue_init(&queue);
+	sblist_init(&level, sizeof(char *), 16);
+	sblist_init(&next, sizeof(char *), 16);
+
+	dir = strdup(path);
+	sblist_add(&level, &dir);
+
+	while (!sblist_empty(&level)) {
+		sblist_iter(&level, entry)
+			command_queue_add(&queue,
+				"( get-dir ( %zu:%s ( %u ) false true ( kind ) false ) )\n",
+				strlen(dump_session_path(connection, *entry)),
+				dump_session_path(connection, *entry),
+				revision);
+
+		d = 0;
+		while ((items = dump_send(connection, &queue))) {
+			for (; items; items--, d++) {
+				dir = *(char **)sblist_get(&level, d);
+
+				svn_reader_command_response(reader);
+				svn_reader_number(reader);
+				svn_reader_skip_item(reader);
+				svn_reader_expect(reader, SVN_TOKEN_OPEN);
+
+				while (svn_reader_next(reader) == SVN_TOKEN_OPEN) {
+					svn_reader_expect(reader, SVN_TOKEN_STRING);
+
+					if ((child = malloc(strlen(dir) + reader->length + 2)) == NULL)
+						job_err(EXIT_FAILURE, "dump_expand malloc");
+
+					sprintf(child, "%s%s%.*s", dir, *dir ? "/" : "", (int)reader->length, reader->string);
+					svn_reader_expect(reader, SVN_TOKEN_WORD);
+
+					memset(&node, 0, sizeof(node));
+					node.path = child;
+					node.action = 'A';
+					node.dir = svn_reader_word(reader, "dir");
+					node.text = !node.dir;
+					node.props = 1;
+
+					if (!sblist_add(nodes, &node))
+						job_err(EXIT_FAILURE, "dump_expand sblist_add");
+
+					if (node.dir) {
+						child = strdup(child);
+						sblist_add(&next, &child);
+					}
+
+					svn_reader_skip_list(reader);
+				}
+
+				svn_reader_response_end(reader);
+			}
+		}
+
+		sblist_iter(&level, entry)
+			free(*entry);
+
+		level.count = 0;
+		sblist_iter(&next, entry)
+			sblist_add(&level, entry);
+		next.count = 0;
+	}
+
+	sblist_free_items(&level);
+	sblist_free_items(&next);
+	command_queue_free(&queue);
+}
+
+
+/*
+ * dump_emit_node
+ *
+ * Procedure that writes a node record to stdout, reading its properties and text from
+ * the pipelined responses if it has any.
+ */
+
+static void
+dump_emit_node(svn_reader *reader, dump_node *node, dump_buffer *props)
+{
+	static const char  *action[] = { ['A'] = "add", ['D'] = "delete", ['M'] = "change" };
+	char                md5[33];
+	uint64_t            size;
+
+	size = 0;
+	md5[0] = '\0';
+	props->length = 0;
+
+	if (node->action != 'D' && node->dir && node->props) {
+		svn_reader_command_response(reader);
+		svn_reader_number(reader);
+		svn_reader_props(reader, props);
+		svn_reader_response_end(reader);
+	}
+
+	if (node->action != 'D' && !node->dir && (node->text || node->props)) {
+		if (node->text) {
+			svn_reader_command_response(reader);
+			svn_reader_expect(reader, SVN_TOKEN_OPEN);
+			svn_reader_expect(reader, SVN_TOKEN_OPEN);
+			svn_reader_expect(reader, SVN_TOKEN_WORD);
+			size = svn_reader_number(reader);
+			svn_reader_skip_list(reader);
+			svn_reader_expect(reader, SVN_TOKEN_CLOSE);
+			svn_reader_response_end(reader);
+		}
+
+		svn_reader_command_response(reader);
+		svn_reader_expect(reader, SVN_TOKEN_OPEN);
+
+		if (svn_reader_next(reader) == SVN_TOKEN_STRING) {
+			snprintf(md5, sizeof(md5), "%.*s", (int)reader->length, reader->string);
+			svn_reader_expect(reader, SVN_TOKEN_CLOSE);
+		}
+
+		svn_reader_number(reader);
+
+		if (node->props)
+			svn_reader_props(reader, props);
+		else
+			svn_reader_skip_item(reader);
+
+		svn_reader_response_end(reader);
+	}
+
+	printf("Node-path: %s\n", node->path);
+
+	if (node->action != 'D')
+		printf("Node-kind: %s\n", node->dir ? "dir" : "file");
+
+	printf("Node-action: %s\n", action[(int)node->action]);
+
+	if (node->copy_path)
+		printf("Node-copyfrom-rev: %u\nNode-copyfrom-path: %s\n", node->copy_revision, node->copy_path);
+
+	if (node->action == 'D' || (!node->props && !node->text)) {
+		printf("\n\n");
+		return;
+	}
+
+	if (node->props)
+		printf("Prop-content-length: %zu\n", props->length);
+
+	if (node->text)
+		printf("Text-content-length: %" PRIu64 "\nText-content-md5: %s\n", size, md5);
+
+	printf("Content-length: %" PRIu64 "\n\n", (uint64_t)props->length + size);
+
+	if (node->props)
+		fwrite(props->data, 1, props->length, stdout);
+
+	if (node->text) {
+		while (svn_reader_expect(reader, SVN_TOKEN_STRING), reader->length)
+			fwrite(reader->string, 1, reader->length, stdout);
+
+		svn_reader_response(reader);
+		svn_reader_response_end(reader);
+	}
+
+	printf("\n\n");
+}
+
+
+/*
+ * dump_revision_nodes
+ *
+ * Procedure that turns the changed paths of a revision into node records.  Copies
+ * from outside the dumped range or subtree are written as plain adds of the whole
+ * copied tree; with full set, the complete subtree is written instead (the first
+ * revision of a non-incremental dump that doesn't start at r0).
+ */
+
+static void
+dump_revision_nodes(connector *connection, svn_reader *reader, uint32_t revision, sblist *changes, int full)
+{
+	command_queue  queue;
+	sblist         nodes, expanded;
+	dump_node     *change, node;
+	dump_buffer    props = { NULL, 0, 0 };
+	char         **prefix;
+	size_t         c, n, items, length;
+	int            skip;
+
+	command_queue_init(&queue);
+	sblist_init(&nodes, sizeof(dump_node), 64);
+	sblist_init(&expanded, sizeof(char *), 8);
+
+	if (full) {
+		if (*connection->trunk) {
+			memset(&node, 0, sizeof(node));
+			node.path = strdup(connection->trunk);
+			node.action = 'A';
+			node.dir = node.props = 1;
+			sblist_add(&nodes, &node);
+		}
+
+		dump_expand(connection, reader, &nodes, connection->trunk, revision);
+	} else {
+		qsort(changes->items, sblist_getsize(changes), sizeof(dump_node), dump_node_compare);
+
+		/* old servers don't report the node kind with the changed paths */
+		sblist_iter(changes, change)
+			if (change->dir == -1 && change->action != 'D')
+				command_queue_add(&queue, "( check-path ( %zu:%s ( %u ) ) )\n",
+					strlen(dump_session_path(connection, change->path)),
+					dump_session_path(connection, change->path),
+					revision);
+
+		c = 0;
+		while ((items = dump_send(connection, &queue))) {
+			for (; items; items--, c++) {
+				while ((change = sblist_get(changes, c))->dir != -1 || change->action == 'D')
+					c++;
+
+				svn_reader_command_response(reader);
+				svn_reader_expect(reader, SVN_TOKEN_WORD);
+				change->dir = svn_reader_word(reader, "dir");
+				svn_reader_response_end(reader);
+			}
+		}
+
+		for (c = 0; c < sblist_getsize(changes); c++) {
+			change = sblist_get(changes, c);
+
+			skip = 0;
+			sblist_iter(&expanded, prefix) {
+				length = strlen(*prefix);
+				if (strncmp(change->path, *prefix, length) == 0 && change->path[length] == '/')
+					skip = 1;
+			}
+
+			if (skip)
+				continue;
+
+			memset(&node, 0, sizeof(node));
+			node.dir = change->dir;
+
+			if (change->action == 'D' || change->action == 'R') {
+				node.path = strdup(change->path);
+				node.action = 'D';
+				sblist_add(&nodes, &node);
+			}
+
+			if (change->action == 'D')
+				continue;
+
+			node.path = strdup(change->path);
+			node.action = change->action == 'M' ? 'M' : 'A';
+			node.text = !node.dir && (node.action == 'A' || change->text);
+			node.props = node.action == 'A' || change->props;
+
+			if (node.action == 'A' && change->copy_path) {
+				if (change->copy_revision >= connection->revision_start && dump_in_prefix(connection, change->copy_path)) {
+					node.copy_path = strdup(change->copy_path);
+					node.copy_revision = change->copy_revision;
+					node.text = !node.dir && change->text;
+					node.props = change->props;
+				} else if (node.dir) {
+					dump_expand(connection, reader, &nodes, change->path, revision);
+					sblist_add(&expanded, &change->path);
+				}
+			}
+
+			if (node.action == 'M' && !node.text && !node.props)
+				free(node.path);
+			else
+				sblist_add(&nodes, &node);
+		}
+
+		qsort(nodes.items, sblist_getsize(&nodes), sizeof(dump_node), dump_node_compare);
+	}
+
+	/* request the properties and texts of all nodes, then write them in order */
+
+	sblist_iter(&nodes, change) {
+		const char  *path = dump_session_path(connection, change->path);
+
+		if (change->action == 'D' || (!change->text && !change->props))
+			continue;
+
+		if (change->dir)
+			command_queue_add(&queue,
+				"( get-dir ( %zu:%s ( %u ) true false ( ) false ) )\n",
+				strlen(path), path, revision);
+		else if (change->text)
+			command_queue_add(&queue,
+				"( stat ( %zu:%s ( %u ) ) )\n"
+				"( get-file ( %zu:%s ( %u ) %s true false ) )\n",
+				strlen(path), path, revision,
+				strlen(path), path, revision,
+				change->props ? "true" : "false");
+		else
+			command_queue_add(&queue,
+				"( get-file ( %zu:%s ( %u ) true false false ) )\n",
+				strlen(path), path, revision);
+	}
+
+	n = 0;
+	while ((items = dump_send(connection, &queue))) {
+		for (; items; n++) {
+			change = sblist_get(&nodes, n);
+			if (change->action != 'D' && (change->text || change->props))
+				items--;
+
+			dump_emit_node(reader, change, &props);
+		}
+	}
+
+	for (; n < sblist_getsize(&nodes); n++)
+		dump_emit_node(reader, sblist_get(&nodes, n), &props);
+
+	sblist_iter(&nodes, change)
+		dump_node_free(change);
+
+	sblist_free_items(&nodes);
+	sblist_free_items(&expanded);
+	command_queue_free(&queue);
+	free(props.data);
+}
+
+
+/*
+ * dump_read_log
+ *
+ * Procedure that reads a log response and stores the changed paths below the dumped
+ * subtree for each reported revision.  Returns the number of log entries.
+ */
+
+static size_t
+dump_read_log(connector *connection, svn_reader *reader, sblist *entries)
+{
+	dump_entry  entry;
+	dump_node   node;
+	size_t      count, field;
+
+	count = 0;
+
+	svn_reader_response(reader);
+	svn_reader_response_end(reader);
+
+	while (svn_reader_next(reader) == SVN_TOKEN_OPEN) {
+		if ((entry.changes = sblist_new(sizeof(dump_node), 16)) == NULL)
+			job_err(EXIT_FAILURE, "dump_read_log sblist_new");
+
+		svn_reader_expect(reader, SVN_TOKEN_OPEN);
+
+		while (svn_reader_next(reader) == SVN_TOKEN_OPEN) {
+			memset(&node, 0, sizeof(node));
+			node.dir = -1;
+
+			svn_reader_expect(reader, SVN_TOKEN_STRING);
+			node.path = strndup(reader->string + (reader->length && *reader->string == '/'),
+				reader->length - (reader->length && *reader->string == '/'));
+
+			svn_reader_expect(reader, SVN_TOKEN_WORD);
+			node.action = *reader->string;
+
+			svn_reader_expect(reader, SVN_TOKEN_OPEN);
+
+			if (svn_reader_next(reader) == SVN_TOKEN_STRING) {
+				node.copy_path = strndup(reader->string + (reader->length && *reader->string == '/'),
+					reader->length - (reader->length && *reader->string == '/'));
+				node.copy_revision = svn_reader_number(reader);
+				svn_reader_expect(reader, SVN_TOKEN_CLOSE);
+			}
+
+			/* optional ( node-kind text-mods prop-mods ) */
+			if (svn_reader_next(reader) == SVN_TOKEN_OPEN) {
+				for (field = 0; svn_reader_next(reader) != SVN_TOKEN_CLOSE; field++) {
+					if (reader->type == SVN_TOKEN_OPEN)
+						svn_reader_skip_list(reader);
+					else if (field == 0 && reader->type == SVN_TOKEN_WORD)
+						node.dir = svn_reader_word(reader, "dir") ? 1 : svn_reader_word(reader, "file") ? 0 : -1;
+					else if (field == 1)
+						node.text = svn_reader_word(reader, "true");
+					else if (field == 2)
+						node.props = svn_reader_word(reader, "true");
+				}
+
+				svn_reader_skip_list(reader);
+			} else if (reader->type != SVN_TOKEN_CLOSE) {
+				svn_reader_skip_list(reader);
+			}
+
+			/* servers that don't report modifications get everything refetched */
+			if (node.dir == -1)
+				node.text = node.props = 1;
+
+			if (dump_in_prefix(connection, node.path))
+				sblist_add(entry.changes, &node);
+			else
+				dump_node_free(&node);
+		}
+
+		entry.revision = svn_reader_number(reader);
+		svn_reader_skip_list(reader);
+
+		if (!sblist_add(entries, &entry))
+			job_err(EXIT_FAILURE, "dump_read_log sblist_add");
+
+		count++;
+	}
+
+	if (!svn_reader_word(reader, "done"))
+		job_errx(EXIT_FAILURE, "Malformed svn log response.");
+
+	svn_reader_response(reader);
+	svn_reader_response_end(reader);
+
+	return (count);
+}
+
+
+/*
+ * dump_svn
+ *
+ * Procedure that writes the revisions revision_start to revision of the repository
+ * subtree as a dumpfile (format 3) to stdout.  The changed paths come from a log
+ * request covering DUMP_BATCH revisions at a time, the revision properties and the
+ * node contents from pipelined commands, so nothing but a single revision's node list
+ * is ever held in memory.
+ */
+
+#define DUMP_BATCH 64
+
+static void
+dump_svn(connector *connection)
+{
+	svn_reader     reader;
+	command_queue  queue;
+	sblist         entries;
+	dump_entry    *entry;
+	dump_node     *change;
+	dump_buffer    props[DUMP_BATCH];
+	uint32_t       next, last, revision, r;
+	size_t         e, items, p;
+
+	memset(&reader, 0, sizeof(reader));
+	memset(props, 0, sizeof(props));
+	reader.socket_descriptor = connection->socket_descriptor;
+
+	command_queue_init(&queue);
+	sblist_init(&entries, sizeof(dump_entry), DUMP_BATCH);
+
+	if (!connection->uuid || !connection->trunk)
+		job_errx(EXIT_FAILURE, "Cannot find SVN Repository Root.");
+
+	printf("SVN-fs-dump-format-version: 3\n\nUUID: %s\n\n", connection->uuid);
+
+	for (next = connection->revision_start; next <= connection->revision; next = last + 1) {
+		/* ascending log from next to the end of the range, at most DUMP_BATCH
+		   entries; revisions up to the last reported one are then complete */
+
+		command_queue_add(&queue,
+			"( log ( ( 0: ) ( %u ) ( %u ) true false %d false revprops ( ) ) )\n",
+			next, connection->revision, DUMP_BATCH);
+
+		dump_send(connection, &queue);
+
+		if (dump_read_log(connection, &reader, &entries) < DUMP_BATCH)
+			last = connection->revision;
+		else
+			last = ((dump_entry *)sblist_get(&entries, sblist_getsize(&entries) - 1))->revision;
+
+		e = 0;
+
+		for (revision = next; revision <= last; revision += DUMP_BATCH) {
+			for (r = revision; r <= last && r - revision < DUMP_BATCH; r++)
+				command_queue_add(&queue, "( rev-proplist ( %u ) )\n", r);
+
+			p = 0;
+			while ((items = dump_send(connection, &queue)))
+				for (; items; items--, p++) {
+					svn_reader_command_response(&reader);
+					svn_reader_props(&reader, &props[p]);
+					svn_reader_response_end(&reader);
+				}
+
+			for (r = revision, p = 0; r <= last && r - revision < DUMP_BATCH; r++, p++) {
+				printf("Revision-number: %u\nProp-content-length: %zu\nContent-length: %zu\n\n",
+					r, props[p].length, props[p].length);
+				fwrite(props[p].data, 1, props[p].length, stdout);
+				printf("\n");
+
+				while (e < sblist_getsize(&entries) && ((dump_entry *)sblist_get(&entries, e))->revision < r)
+					e++;
+
+				entry = e < sblist_getsize(&entries) ? sblist_get(&entries, e) : NULL;
+
+				if (r == connection->revision_start && r > 0 && !connection->incremental)
+					dump_revision_nodes(connection, &reader, r, NULL, 1);
+				else if (entry && entry->revision == r)
+					dump_revision_nodes(connection, &reader, r, entry->changes, 0);
+
+				if (connection->verbosity > 1)
+					fprintf(stderr, "* Dumped revision %u.\n", r);
+			}
+		}
+
+		sblist_iter(&entries, entry) {
+			sblist_iter(entry->changes, change)
+				dump_node_free(change);
+
+			sblist_free(entry->changes);
+		}
+
+		entries.count = 0;
+	}
+
+	fflush(stdout);
+
+	for (p = 0; p < DUMP_BATCH; p++)
+		free(props[p].data);
+
+	sblist_free_items(&entries);
+	command_queue_free(&queue);
+	free(reader.buffer);
+}
+
+
+/* the proxy's side of the handshake, it offers what svnup itself uses */
+#define PROXY_GREETING "( success ( 2 2 ( ) ( edit-pipeline svndiff1 absent-entries depth log-revprops ) ) ) "
+#define PROXY_MECHANISMS "( success ( ( ANONYMOUS ) 0: ) ) "
+#define PROXY_ANONYMOUS "( ANONYMOUS ( 0: ) )\n"
+#define PROXY_REPARENTED "( success ( ( ) 0: ) ) ( success ( ) ) "
+
+/*
+ * proxy_write
+ *
+ * Procedure that writes the whole buffer to a socket.
+ */
+
+static void
+proxy_write(int descriptor, const char *data, size_t length)
+{
+	ssize_t  bytes_written;
+
+	while (length) {
+		if ((bytes_written = write(descriptor, data, length)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			job_err(EXIT_FAILURE, "proxy_write");
+		}
+
+		data += bytes_written;
+		length -= bytes_written;
+	}
+}
+
+
+/*
+ * proxy_upstream_url
+ *
+ * Function that maps a session URL of a client to the same path on the upstream server.
+ */
+
+static char *
+proxy_upstream_url(proxy_session *session, const char *url)
+{
+	const char  *path;
+	char        *upstream;
+	size_t       length;
+
+	if ((path = strstr(url, "://")) == NULL || (path = strchr(path + 3, '/')) == NULL)
+		path = "";
+
+	length = strlen(session->upstream.address) + strlen(path) + 16;
+
+	if ((upstream = malloc(length)) == NULL)
+		job_err(EXIT_FAILURE, "proxy_upstream_url malloc");
+
+	snprintf(upstream, length, "svn://%s:%d%s", session->upstream.address, session->upstream.port, path);
+
+	return (upstream);
+}
+
+
+/*
+ * proxy_cache_path
+ *
+ * Procedure that builds the name of the cache file holding the response to a request
+ * made in the current session.
+ */
+
+static void
+proxy_cache_path(proxy_session *session, const char *request, char *path, size_t size)
+{
+	dump_buffer  key = { 0 };
+	char         md5[MD5_DIGEST_LENGTH * 2 + 1];
+
+	dump_buffer_add(&key, session->url, strlen(session->url));
+	dump_buffer_add(&key, "\n", 1);
+	dump_buffer_add(&key, request, strlen(request));
+	md5sum(key.data, key.length, md5);
+	free(key.data);
+
+	snprintf(path, size, "%s/%.2s/%s", session->cache, md5, md5);
+}
+
+
+/*
+ * proxy_cache_read
+ *
+ * Function that loads a cache file that is no older than ttl seconds (0 means it never
+ * expires).  Returns 0 if there is no such file.
+ */
+
+static int
+proxy_cache_read(const char *path, int ttl, dump_buffer *buffer)
+{
+	struct stat  local;
+	ssize_t      bytes_read;
+	int          fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return (0);
+
+	if ((fstat(fd, &local) != 0) || ((ttl) && (time(NULL) - local.st_mtime >= ttl))) {
+		close(fd);
+		return (0);
+	}
+
+	buffer->length = 0;
+
+	if (buffer->capacity < (size_t)local.st_size + 1) {
+		buffer->capacity = local.st_size + 1;
+
+		if ((buffer->data = realloc(buffer->data, buffer->capacity)) == NULL)
+			job_err(EXIT_FAILURE, "proxy_cache_read realloc");
+	}
+
+	while (buffer->length < (size_t)local.st_size) {
+		if ((bytes_read = read(fd, buffer->data + buffer->length, local.st_size - buffer->length)) <= 0) {
+			if ((bytes_read < 0) && (errno == EINTR))
+				continue;
+
+			close(fd);
+			return (0);
+		}
+
+		buffer->length += bytes_read;
+	}
+
+	buffer->data[buffer->length] = '\0';
+	close(fd);
+
+	return (1);
+}
+
+
+/*
+ * proxy_cache_write
+ *
+ * Procedure that stores a cache file.  It is written under a temporary name and renamed
+ * so that other proxy processes never see a partial file.
+ */
+
+static void
+proxy_cache_write(const char *path, dump_buffer *buffer)
+{
+	char  temp[PATH_MAX];
+	int   fd;
+
+	snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+
+	if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		job_err(EXIT_FAILURE, "write file failure %s", temp);
+
+	proxy_write(fd, buffer->data, buffer->length);
+	close(fd);
+
+	if (rename(temp, path) != 0)
+		job_err(EXIT_FAILURE, "Cannot rename %s", temp);
+}
+
+
+/*
+ * proxy_lock
+ *
+ * Function that takes the lock of a cache file.  Processes missing the same entry wait
+ * here for the first one to fetch it instead of all asking the upstream server.
+ */
+
+static int
+proxy_lock(const char *path)
+{
+	char  lock[PATH_MAX + 5];
+	int   fd;
+
+	if (snprintf(lock, sizeof(lock), "%s.lock", path) >= (int)sizeof(lock))
+		job_errx(EXIT_FAILURE, "Cache path too long: %s", path);
+
+	if ((fd = open(lock, O_RDWR | O_CREAT, 0644)) == -1)
+		job_err(EXIT_FAILURE, "open %s", lock);
+
+	while (flock(fd, LOCK_EX) != 0)
+		if (errno != EINTR)
+			job_err(EXIT_FAILURE, "flock %s", lock);
+
+	return (fd);
+}
+
+
+/*
+ * proxy_unlock
+ *
+ * Procedure that drops the lock of a cache file.  The cache file exists by then, so the
+ * lock file can go: processes still waiting on it find the entry once they get it.
+ */
+
+static void
+proxy_unlock(const char *path, int fd)
+{
+	char  lock[PATH_MAX + 5];
+
+	snprintf(lock, sizeof(lock), "%s.lock", path);
+	unlink(lock);
+	close(fd);
+}
+
+
+/*
+ * proxy_read_status
+ *
+ * Function that reads a "( success ( ... ) )" or "( failure ( ... ) )" tuple and
+ * returns 1 for the former.
+ */
+
+static int
+proxy_read_status(svn_reader *reader)
+{
+	int  success;
+
+	svn_reader_expect(reader, SVN_TOKEN_OPEN);
+	svn_reader_expect(reader, SVN_TOKEN_WORD);
+	success = svn_reader_word(reader, "success");
+	svn_reader_skip_list(reader);
+
+	return (success);
+}
+
+
+/*
+ * proxy_connect
+ *
+ * Procedure that opens the upstream session for the client's current URL and stores
+ * the repository information the upstream server sends for it.
+ */
+
+static void
+proxy_connect(proxy_session *session)
+{
+	svn_reader   *reader = &session->upstream_reader;
+	dump_buffer   info = { 0 }, capabilities = { 0 };
+	char          command[COMMAND_BUFFER + 1], path[PATH_MAX], *url, *root;
+
+	reset_connection(&session->upstream);
+
+	reader->socket_descriptor = session->upstream.socket_descriptor;
+	reader->start = reader->end = 0;
+	reader->peeked = 0;
+	reader->capture = NULL;
+
+	svn_reader_skip_item(reader);
+
+	free(session->upstream_url);
+	session->upstream_url = url = proxy_upstream_url(session, session->url);
+
+	snprintf(command,
+		COMMAND_BUFFER,
+		"( 2 ( edit-pipeline svndiff1 absent-entries depth log-revprops ) %zu:%s %zu:svnup-%s ( ) )\n",
+		strlen(url),
+		url,
+		strlen(SVNUP_VERSION) + 6,
+		SVNUP_VERSION);
+
+	proxy_write(session->upstream.socket_descriptor, command, strlen(command));
+	svn_reader_response(reader);
+	svn_reader_response_end(reader);
+
+	proxy_write(session->upstream.socket_descriptor, PROXY_ANONYMOUS, strlen(PROXY_ANONYMOUS));
+	svn_reader_response(reader);
+	svn_reader_response_end(reader);
+
+	/* ( success ( uuid root-url ( capabilities ) ) ) */
+
+	svn_reader_response(reader);
+	svn_reader_expect(reader, SVN_TOKEN_STRING);
+	dump_buffer_add(&info, reader->string, reader->length);
+	dump_buffer_add(&info, "\n", 1);
+
+	svn_reader_expect(reader, SVN_TOKEN_STRING);
+	root = strndup(reader->string, reader->length);
+
+	reader->capture = &capabilities;
+	svn_reader_skip_item(reader);
+	reader->capture = NULL;
+	svn_reader_response_end(reader);
+
+	/* only the path of the root URL is kept, clients see it below the proxy's address */
+	if ((url = strstr(root, "://")) == NULL || (url = strchr(url + 3, '/')) == NULL)
+		url = "";
+
+	dump_buffer_add(&info, url, strlen(url));
+	dump_buffer_add(&info, "\n", 1);
+	dump_buffer_add(&info, capabilities.data, capabilities.length);
+	dump_buffer_add(&info, "\n", 1);
+
+	proxy_cache_path(session, "repos-info", path, sizeof(path));
+	proxy_cache_write(path, &info);
+
+	free(root);
+	free(info.data);
+	free(capabilities.data);
+}
+
+
+/*
+ * proxy_forward
+ *
+ * Function that passes the request in session->request on to the upstream server and
+ * reads the complete response into session->response.  Returns 1 if the command
+ * succeeded.
+ */
+
+static int
+proxy_forward(proxy_session *session, const char *name, int contents)
+{
+	svn_reader  *reader = &session->upstream_reader;
+	char         command[COMMAND_BUFFER + 1], *url;
+	int          success;
+
+	if (session->upstream.socket_descriptor == -1)
+		proxy_connect(session);
+
+	url = proxy_upstream_url(session, session->url);
+
+	if (strcmp(url, session->upstream_url)) {
+		snprintf(command, COMMAND_BUFFER, "( reparent ( %zu:%s ) )\n", strlen(url), url);
+		proxy_write(session->upstream.socket_descriptor, command, strlen(command));
+		svn_reader_command_response(reader);
+		svn_reader_response_end(reader);
+
+		free(session->upstream_url);
+		session->upstream_url = url;
+	} else
+		free(url);
+
+	proxy_write(session->upstream.socket_descriptor, session->request.data, session->request.length);
+	proxy_write(session->upstream.socket_descriptor, "\n", 1);
+
+	session->response.length = 0;
+	reader->capture = &session->response;
+
+	/* the auth request, log entries up to "done", the command response and file contents */
+
+	svn_reader_skip_item(reader);
+
+	if (strcmp(name, "log") == 0) {
+		while (svn_reader_peek(reader) == SVN_TOKEN_OPEN)
+			svn_reader_skip_item(reader);
+
+		svn_reader_next(reader);
+	}
+
+	success = proxy_read_status(reader);
+
+	if ((success) && (contents)) {
+		while (svn_reader_next(reader) == SVN_TOKEN_STRING && reader->length)
+			;
+
+		success = proxy_read_status(reader);
+	}
+
+	reader->capture = NULL;
+	dump_buffer_add(&session->response, " ", 1);
+
+	return (success);
+}
+
+
+/*
+ * proxy_request
+ *
+ * Function that reads the next request of the client into session->request and picks
+ * out what decides how it is answered: its name, whether it names an explicit
+ * revision (its response can then never change) and whether file contents follow the
+ * response.  Returns 0 when the client has closed the connection.
+ */
+
+static int
+proxy_request(proxy_session *session, char **name, int *fixed, int *contents)
+{
+	svn_reader  *reader = &session->client_reader;
+	char         c;
+
+	/* a client that is done closes the connection between two requests */
+	while (reader->start < reader->end && (reader->buffer[reader->start] == ' ' || reader->buffer[reader->start] == '\n'))
+		reader->start++;
+
+	if (reader->start == reader->end && recv(reader->socket_descriptor, &c, 1, MSG_PEEK) <= 0)
+		return (0);
+
+	*fixed = *contents = 0;
+	session->request.length = 0;
+	reader->capture = &session->request;
+
+	svn_reader_expect(reader, SVN_TOKEN_OPEN);
+	svn_reader_expect(reader, SVN_TOKEN_WORD);
+	*name = strndup(reader->string, reader->length);
+	svn_reader_expect(reader, SVN_TOKEN_OPEN);
+
+	if (!strcmp(*name, "get-dir") || !strcmp(*name, "get-file") || !strcmp(*name, "check-path") || !strcmp(*name, "stat")) {
+		/* ( path ( rev ) ... ) */
+		svn_reader_expect(reader, SVN_TOKEN_STRING);
+		svn_reader_expect(reader, SVN_TOKEN_OPEN);
+		*fixed = (svn_reader_peek(reader) == SVN_TOKEN_NUMBER);
+		svn_reader_skip_list(reader);
+
+		if (!strcmp(*name, "get-file") && svn_reader_peek(reader) == SVN_TOKEN_WORD) {
+			svn_reader_next(reader);
+			svn_reader_next(reader);
+			*contents = svn_reader_word(reader, "true");
+		}
+	} else if (!strcmp(*name, "log")) {
+		/* ( ( paths ) ( start ) ( end ) ... ) */
+		svn_reader_expect(reader, SVN_TOKEN_OPEN);
+		svn_reader_skip_list(reader);
+		svn_reader_expect(reader, SVN_TOKEN_OPEN);
+		*fixed = (svn_reader_peek(reader) == SVN_TOKEN_NUMBER);
+		svn_reader_skip_list(reader);
+		svn_reader_expect(reader, SVN_TOKEN_OPEN);
+		*fixed &= (svn_reader_peek(reader) == SVN_TOKEN_NUMBER);
+		svn_reader_skip_list(reader);
+	} else if (!strcmp(*name, "rev-proplist") || !strcmp(*name, "rev-prop")) {
+		/* ( rev ... ) */
+		*fixed = (svn_reader_peek(reader) == SVN_TOKEN_NUMBER);
+	} else if (!strcmp(*name, "reparent")) {
+		svn_reader_expect(reader, SVN_TOKEN_STRING);
+		free(session->url);
+		session->url = strndup(reader->string, reader->length);
+	}
+
+	svn_reader_skip_list(reader);
+	svn_reader_expect(reader, SVN_TOKEN_CLOSE);
+	reader->capture = NULL;
+
+	return (1);
+}
+
+
+/*
+ * proxy_client
+ *
+ * Procedure that serves one client connection: it does the handshake itself, answers
+ * requests for a fixed revision from the cache and passes everything else on to the
+ * upstream server, which is only connected to once a request misses the cache.
+ */
+
+static void
+proxy_client(connector *connection, int client)
+{
+	proxy_session   session = { .client = client };
+	dump_buffer     info = { 0 };
+	char            path[PATH_MAX], *name, *uuid, *root, *capabilities, *authority;
+	int             fixed, contents, success, lock, ttl;
+	size_t          length;
+
+	session.upstream = *connection;
+	session.upstream.socket_descriptor = -1;
+	session.cache = connection->cache;
+	session.client_reader.socket_descriptor = client;
+
+	proxy_write(client, PROXY_GREETING, strlen(PROXY_GREETING));
+
+	/* ( version ( capabilities ) url ... ) */
+
+	svn_reader_expect(&session.client_reader, SVN_TOKEN_OPEN);
+	svn_reader_number(&session.client_reader);
+	svn_reader_skip_item(&session.client_reader);
+	svn_reader_expect(&session.client_reader, SVN_TOKEN_STRING);
+	session.url = strndup(session.client_reader.string, session.client_reader.length);
+	svn_reader_skip_list(&session.client_reader);
+
+	proxy_write(client, PROXY_MECHANISMS, strlen(PROXY_MECHANISMS));
+	svn_reader_skip_item(&session.client_reader);
+
+	proxy_cache_path(&session, "repos-info", path, sizeof(path));
+
+	if (!proxy_cache_read(path, 0, &info)) {
+		lock = proxy_lock(path);
+
+		if (!proxy_cache_read(path, 0, &info)) {
+			proxy_connect(&session);
+
+			if (!proxy_cache_read(path, 0, &info))
+				job_errx(EXIT_FAILURE, "Cannot read %s", path);
+		}
+
+		proxy_unlock(path, lock);
+	}
+
+	uuid = info.data;
+	root = strchr(uuid, '\n');
+	*root++ = '\0';
+	capabilities = strchr(root, '\n');
+	*capabilities++ = '\0';
+	capabilities[strcspn(capabilities, "\n")] = '\0';
+
+	/* svn://host[:port] as the client called the proxy */
+	authority = strdup(session.url);
+
+	if ((name = strstr(authority, "://")) && (name = strchr(name + 3, '/')))
+		*name = '\0';
+
+	dump_buffer_add(&session.response, "( success ( ) ) ( success ( ", strlen("( success ( ) ) ( success ( "));
+	length = strlen(authority) + strlen(root);
+	snprintf(path, sizeof(path), "%zu:%s %zu:%s%s ", strlen(uuid), uuid, length, authority, root);
+	dump_buffer_add(&session.response, path, strlen(path));
+	dump_buffer_add(&session.response, capabilities, strlen(capabilities));
+	dump_buffer_add(&session.response, " ) ) ", 5);
+	proxy_write(client, session.response.data, session.response.length);
+
+	free(authority);
+	free(info.data);
+
+	while (proxy_request(&session, &name, &fixed, &contents)) {
+		if (!strcmp(name, "reparent")) {
+			proxy_write(client, PROXY_REPARENTED, strlen(PROXY_REPARENTED));
+		} else if (!strcmp(name, "get-latest-rev") || !strcmp(name, "get-dir") || !strcmp(name, "get-file") ||
+			!strcmp(name, "check-path") || !strcmp(name, "stat") || !strcmp(name, "log") ||
+			!strcmp(name, "rev-proplist") || !strcmp(name, "rev-prop")) {
+
+			/* the youngest revision may be served stale for a few seconds */
+			ttl = strcmp(name, "get-latest-rev") ? 0 : connection->latest_ttl;
+
+			if ((fixed) || (ttl)) {
+				proxy_cache_path(&session, session.request.data, path, sizeof(path));
+
+				if (!proxy_cache_read(path, ttl, &session.response)) {
+					lock = proxy_lock(path);
+
+					if (!proxy_cache_read(path, ttl, &session.response)) {
+						if (connection->verbosity > 1)
+							printf("miss %s\n", session.request.data);
+
+						if ((success = proxy_forward(&session, name, contents)))
+							proxy_cache_write(path, &session.response);
+					}
+
+					proxy_unlock(path, lock);
+				}
+			} else
+				proxy_forward(&session, name, contents);
+
+			proxy_write(client, session.response.data, session.response.length);
+		} else {
+			session.response.length = 0;
+			dump_buffer_add(&session.response, "( failure ( ( 210001 ", strlen("( failure ( ( 210001 "));
+			snprintf(path, sizeof(path), "%zu:Unsupported command %s 0: 0 ) ) ) ", strlen(name) + 20, name);
+			dump_buffer_add(&session.response, path, strlen(path));
+			proxy_write(client, session.response.data, session.response.length);
+		}
+
+		free(name);
+	}
+
+	if (session.upstream.socket_descriptor != -1)
+		close(session.upstream.socket_descriptor);
+
+	close(client);
+	free(session.url);
+	free(session.upstream_url);
+	free(session.request.data);
+	free(session.response.data);
+	free(session.client_reader.buffer);
+	free(session.upstream_reader.buffer);
+}
+
+
+/*
+ * proxy_svn
+ *
+ * Procedure that runs a caching svn:// proxy: it listens on connection->listen and
+ * serves each client in a child process of its own.
+ */
+
+static void
+proxy_svn(connector *connection)
+{
+	struct addrinfo  hints = {
+		.ai_family = connection->family,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+	}, *address;
+	char             directory[PATH_MAX], *host, *port;
+	int              listener, client, option, error, shard;
+	pid_t            pid;
+
+	/* [ADDR:]PORT */
+	host = strdup(connection->listen);
+
+	if ((port = strrchr(host, ':'))) {
+		*port++ = '\0';
+
+		if (*host == '[' && host[strlen(host) - 1] == ']') {
+			host[strlen(host) - 1] = '\0';
+			memmove(host, host + 1, strlen(host));
+		}
+	} else {
+		port = host;
+		host = NULL;
+	}
+
+	if ((error = getaddrinfo(host && *host ? host : NULL, port, &hints, &address)))
+		job_errx(EXIT_FAILURE, "%s", gai_strerror(error));
+
+	if ((listener = socket(address->ai_family, address->ai_socktype, address->ai_protocol)) < 0)
+		job_err(EXIT_FAILURE, "socket failure");
+
+	option = 1;
+
+	if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option)))
+		job_err(EXIT_FAILURE, "setsockopt SO_REUSEADDR error");
+
+	if (bind(listener, address->ai_addr, address->ai_addrlen) != 0)
+		job_err(EXIT_FAILURE, "bind %s", connection->listen);
+
+	if (listen(listener, 64) != 0)
+		job_err(EXIT_FAILURE, "listen %s", connection->listen);
+
+	freeaddrinfo(address);
+	free(host ? host : port);
+
+	create_directory(connection->cache);
+
+	for (shard = 0; shard < 256; shard++) {
+		snprintf(directory, sizeof(directory), "%s/%02x", connection->cache, shard);
+		create_directory(directory);
+	}
+
+	/* children are never waited for */
+	signal(SIGCHLD, SIG_IGN);
+
+	if (connection->verbosity)
+		printf("# proxying svn://%s:%d on %s, cache %s\n",
+			connection->address,
+			connection->port,
+			connection->listen,
+			connection->cache);
+
+	fflush(stdout);
+
+	while (1) {
+		if ((client = accept(listener, NULL, NULL)) == -1) {
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+
+			job_err(EXIT_FAILURE, "accept");
+		}
+
+		if ((pid = fork()) == -1) {
+			warn("proxy_svn fork");
+		} else if (pid == 0) {
+			close(listener);
+			proxy_client(connection, client);
+			exit(EXIT_SUCCESS);
+		}
+
+		close(client);
+	}
+}
+
+/*
+ * progress_indicator
+ *
+ * Procedure that neatly prints the current file and its position in the file list as a percentage.
+ */
+
+static void
+progress_indicator(connector *connection, char *path, int f, int file_count)
+{
+	struct winsize window;
+	int            file_width, term_width, x;
+	char          *columns, file_path_target[BUFFER_UNIT], temp_buffer[BUFFER_UNIT];
+
+	term_width = -1;
+	file_width = 2;
+
+	x = file_count;
+	while ((int)(x /= 10) > 0)
+		file_width++;
+
+	/* Figure out the width of the terminal window. */
+
+	if (isatty(STDERR_FILENO)) {
+		if (((columns = getenv("COLUMNS")) != NULL) && (*columns != '\0'))
+			term_width = strtol(columns, (char **)NULL, 10);
+		else {
+			if ((ioctl(STDERR_FILENO, TIOCGWINSZ, &window) != -1) && (window.ws_col > 0))
+				term_width = window.ws_col;
+		}
+	}
+
+	snprintf(file_path_target,
+		BUFFER_UNIT,
+		"%s%s",
 		connection->path_target,
 		path);
 
-	/* If the width of the window is smaller than the output line, trim
-	 * off the beginning of the path. */
+	/* If the width of the window is smaller than the output line, trim
+	 * off the beginning of the path. */
+
+	x = (term_width == -1) ? 1 : 0;
+	if (15 + 2 * file_width + strlen(file_path_target) < (unsigned int)term_width)
+		x = 1;
+
+	snprintf(temp_buffer,
+		BUFFER_UNIT,
+		"% *d of %d (% 5.1f%%)  %s%s\e[0K\r",
+		file_width,
+		f + 1,
+		file_count,
+		100.0 * f / (double)file_count,
+		(x ? "" : "..."),
+		file_path_target + (x ? 0 : strlen(file_path_target) - term_width + file_width + file_width + 18));
+
+	fprintf(stderr, "%s", temp_buffer);
+}
+
+static void
+usage_svn(char *arg0) {
+	fprintf(stderr,
+		"svn-lite version %s by John Mehr & rofl0r\n\n"
+		"Usage: svn command [options] [args]\n\n"
+		"commands:\n\n"
+		"info [options] TARGET\n"
+		"   print some information about TARGET.\n"
+		"   TARGET may either be an URL or a local directory.\n\n"
+		"log [options] TARGET\n"
+		"   print commit log of TARGET\n"
+		"   TARGET may either be an URL or a local directory.\n\n"
+		"checkout/co [options] URL [PATH]\n"
+		"   checkout repository (equivalent to git clone/git pull).\n"
+		"   if PATH is omitted, basename of URL will be used as destination\n"
+		"   URL may also be dump:FILE[@REV][#SUBDIR] to check out SUBDIR (default:\n"
+		"   the repository root) from an svn dumpfile, FILE - reads stdin.  PATH\n"
+		"   is mandatory in that case.\n"
+		"   --manifest FILE checks out every \"URL PATH [REV]\" line of FILE (- reads\n"
+		"   stdin) instead, -j/--jobs N at a time (default: 8) and --host-jobs N\n"
+		"   per server (default: 4), and reports the result of each.  with\n"
+		"   --threads, the checkouts run on threads of this process instead of\n"
+		"   forked children.\n"
+		"   --watch N keeps running after the checkout and updates PATH whenever\n"
+		"   a new revision appears, checking every N seconds.  --hook CMD is run\n"
+		"   after each revision applied, with SVNUP_REVISION and SVNUP_PATH set.\n"
+		"   --changes FILE lists every added, modified, deleted and unchanged file\n"
+		"   of the update with its MD5 and size, one JSON object per line, and\n"
+		"   --content-manifest FILE lists all files of the new tree the same way.\n"
+		"   both are replaced after each update (- writes to stdout); --null\n"
+		"   writes [STATUS<tab>]MD5<tab>SIZE<tab>PATH records ended by NUL instead.\n"
+		"   --dry-run compares PATH with URL without changing anything and prints\n"
+		"   the files and bytes to download, the files to delete, the directories\n"
+		"   to create, the requests and batches needed and an estimated time from\n"
+		"   the round trip time and throughput measured meanwhile.\n\n"
+		"export [options] URL [PATH]\n"
+		"   like checkout, but writes a plain tree without .svnup state.  an\n"
+		"   existing PATH is refused unless --force is given, in which case files\n"
+		"   in it are overwritten and other files are left alone.\n"
+		"   checkout and export print transfer totals with --stats.  for testing\n"
+		"   the recovery paths, --faults SEED[:BYTES[:KINDS]] injects a seeded\n"
+		"   fault about every BYTES bytes read (default: 262144), KINDS being any\n"
+		"   of d (disconnect), s (short read), p (stall), c (read ending inside a\n"
+		"   chunk header) and t (TLS error); --stats then reports the recovery\n"
+		"   time and bytes fetched again per fault.\n"
+		"   --crawlers N lists the tree of an svn:// URL on N sessions at once,\n"
+		"   crawlers running out of directories taking over those of the others.\n"
+		"   --window N keeps up to N directory listings of an svn:// URL in flight\n"
+		"   on a session while its tree is crawled breadth first (default: 64),\n"
+		"   and as many new files while they are fetched.\n"
+		"   --dedup MODE fetches files of identical content once and makes the\n"
+		"   others from the first, MODE being copy (default), reflink, hardlink\n"
+		"   (files of the same mode and mtime) or off.\n"
+		"   --reference DIR takes the files whose content DIR, another svn-lite\n"
+		"   working copy, holds unchanged since its last update from there, as\n"
+		"   reflinks or kernel copies (hard links with --dedup hardlink).\n"
+		"   --adopt keeps the files of a tree without .svnup state (checked out\n"
+		"   by another client or unpacked from an archive) whose content matches\n"
+		"   the revision, hashing them on all processors, and fetches the rest.\n"
+		"   --use-commit-times sets the mtime of each file written to the date of\n"
+		"   the revision that last changed it, instead of the current time.\n"
+		"   --timeout CONNECT[:IDLE[:TOTAL]] gives up a connection attempt after\n"
+		"   CONNECT seconds (default: 30) and a connection no data arrives on\n"
+		"   for IDLE seconds (default: 600), reconnecting and sending again only\n"
+		"   the requests still unanswered; the checkout fails after TOTAL seconds\n"
+		"   (default: 0, no limit).  --min-rate BYTES[:SECONDS] also reconnects\n"
+		"   when less than BYTES per second arrive over SECONDS seconds spent\n"
+		"   waiting on the server (default: 30).  --stats counts these events.\n"
+		"   --socket-buffer MODE leaves the socket buffers to the kernel's\n"
+		"   autotuning (auto, default), sizes those of later connections to twice\n"
+		"   the bandwidth-delay product measured so far (bdp) or sets them to a\n"
+		"   number of bytes.  --stats reports the round trip time, buffers and\n"
+		"   throughput.\n\n"
+		"dump [options] URL\n"
+		"   write a dumpfile (svnadmin load format) of URL to stdout (svn:// only).\n"
+		"   -r takes a range FROM:TO (default: 0:HEAD). unless --incremental is\n"
+		"   given, the first revision of a range not starting at 0 is dumped in full.\n"
+		"   node contents are always written as full texts, fetched with log and\n"
+		"   get-file, not as the deltas svnadmin dump or replay would produce.\n"
+		"\n"
+		"proxy [options] --listen [ADDR:]PORT --upstream svn://HOST[:PORT]/\n"
+		"   serve svn:// clients (get-latest-rev, get-dir, get-file, check-path,\n"
+		"   stat, log and rev-proplist) from the upstream server, keeping responses\n"
+		"   for explicit revisions in a cache directory (--cache DIR, default:\n"
+		"   svnup-cache).  clients asking for the same missing entry wait for one\n"
+		"   upstream request.  --latest-ttl N caches get-latest-rev for N seconds\n"
+		"   (default: 5, 0 disables).  client URL paths are passed on unchanged.\n"
+		"\n"
+		"poll [options] --list FILE\n"
+		"   print \"URL REVISION\" for every svn:// or http(s):// URL in FILE (one\n"
+		"   per line, - reads stdin) whose youngest revision moved on since the\n"
+		"   last poll, as recorded in --state FILE (default: FILE.state).  all\n"
+		"   servers are asked at once, each repository over one connection.  with\n"
+		"   --interval N, polls again every N seconds, keeping connections open.\n"
+		"\n"
+		"URL may be svn://, http://, https:// or file:// (local FSFS repository).\n"
+		"\n"
+		"options applicable to all commands:\n"
+		"   -r or --revision   NUMBER (default: 0)\n"
+		"   -v or --verbosity  NUMBER (default: 1)\n"
+		, SVNUP_VERSION
+	);
+	job_fail();
+}
+
+static int has_revision_option(enum svn_job mode) {
+	switch(mode) {
+	case SVN_INFO: case SVN_CO: case SVN_LOG: case SVN_DUMP: case SVN_EXPORT:
+		return 1;
+	case SVN_NONE: case SVN_PROXY: case SVN_POLL:
+		break;
+	}
+	return 0;
+}
+
+static char *protocol_check(char *str, connector *connection)
+{
+	char *p = strchr(str, ':');
+	if(!p || p[1] != '/' || p[2] != '/') {
+		connection->protocol = NONE;
+		return str;
+	}
+	if(!protocol_from_str(str, connection)) {
+		job_errx(EXIT_FAILURE, "unknown protocol %s\n", str);
+	}
+	p += 3;
+	return p;
+}
+
+
+static void
+getopts_svn(int argc, char **argv, connector *connection)
+{
+	char *url, *upstream = NULL;
+	int a = 1;
+
+	if(argc < 2) usage_svn(argv[0]);
+	if(!strcmp(argv[a], "checkout") || !strcmp(argv[a], "co"))
+		connection->job = SVN_CO;
+	else if(!strcmp(argv[a], "info"))
+		connection->job = SVN_INFO;
+	else if(!strcmp(argv[a], "log"))
+		connection->job = SVN_LOG;
+	else if(!strcmp(argv[a], "dump"))
+		connection->job = SVN_DUMP;
+	else if(!strcmp(argv[a], "export"))
+		connection->job = SVN_EXPORT;
+	else if(!strcmp(argv[a], "proxy"))
+		connection->job = SVN_PROXY;
+	else if(!strcmp(argv[a], "poll"))
+		connection->job = SVN_POLL;
+	else
+		usage_svn(argv[0]);
+	++a;
+	while(1) {
+		int opt = 0;
+		if(a >= argc) break;
+		if(!strcmp(argv[a], "-r") || !strcmp(argv[a], "--revision"))
+			opt = 1;
+		else if(!strcmp(argv[a], "-v") || !strcmp(argv[a], "--verbosity"))
+			opt = 2;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--manifest"))
+			opt = 3;
+		else if(connection->job == SVN_CO && (!strcmp(argv[a], "-j") || !strcmp(argv[a], "--jobs")))
+			opt = 4;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--host-jobs"))
+			opt = 5;
+		else if(connection->job == SVN_PROXY && !strcmp(argv[a], "--listen"))
+			opt = 6;
+		else if(connection->job == SVN_PROXY && !strcmp(argv[a], "--upstream"))
+			opt = 7;
+		else if(connection->job == SVN_PROXY && !strcmp(argv[a], "--cache"))
+			opt = 8;
+		else if(connection->job == SVN_PROXY && !strcmp(argv[a], "--latest-ttl"))
+			opt = 9;
+		else if(connection->job == SVN_POLL && !strcmp(argv[a], "--list"))
+			opt = 10;
+		else if(connection->job == SVN_POLL && !strcmp(argv[a], "--state"))
+			opt = 11;
+		else if(connection->job == SVN_POLL && !strcmp(argv[a], "--interval"))
+			opt = 12;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--watch"))
+			opt = 13;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--hook"))
+			opt = 14;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--threads")) {
+			connection->threads = 1;
+			++a;
+			continue;
+		}
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--faults"))
+			opt = 15;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--changes"))
+			opt = 16;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--content-manifest"))
+			opt = 17;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--null")) {
+			connection->null_records = 1;
+			++a;
+			continue;
+		}
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--stats")) {
+			connection->show_stats = 1;
+			++a;
+			continue;
+		}
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--crawlers"))
+			opt = 18;
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--window"))
+			opt = 19;
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--dedup"))
+			opt = 20;
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--reference"))
+			opt = 21;
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--timeout"))
+			opt = 22;
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--min-rate"))
+			opt = 23;
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--socket-buffer"))
+			opt = 24;
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--adopt")) {
+			connection->adopt = 1;
+			++a;
+			continue;
+		}
+		else if(connection->job == SVN_CO && !strcmp(argv[a], "--dry-run")) {
+			connection->dry_run = 1;
+			++a;
+			continue;
+		}
+		else if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && !strcmp(argv[a], "--use-commit-times")) {
+			connection->commit_times = 1;
+			++a;
+			continue;
+		}
+		else if(!strcmp(argv[a], "--incremental") && connection->job == SVN_DUMP) {
+			connection->incremental = 1;
+			++a;
+			continue;
+		}
+		else if(!strcmp(argv[a], "--force") && connection->job == SVN_EXPORT) {
+			connection->force = 1;
+			++a;
+			continue;
+		}
+		if(!opt) break;
+		if(opt == 1 && !has_revision_option(connection->job))
+			usage_svn(argv[0]);
+		++a;
+		if(a >= argc) usage_svn(argv[0]);
+		if(opt == 3) {
+			connection->manifest = strdup(argv[a++]);
+			continue;
+		}
+		if(opt == 14) {
+			connection->hook = strdup(argv[a++]);
+			continue;
+		}
+		if(opt == 21) {
+			connection->reference = strdup(argv[a++]);
+			continue;
+		}
+		if(opt == 15) {
+			if(fault_plan_init(&connection->faults, argv[a++])) usage_svn(argv[0]);
+			continue;
+		}
+		if(opt == 24) {
+			/* auto: kernel autotuning, bdp: sized from the measured bandwidth-delay product */
+			if(!strcmp(argv[a], "auto")) connection->socket_buffer = 0;
+			else if(!strcmp(argv[a], "bdp")) connection->socket_buffer = -1;
+			else if((connection->socket_buffer = atoi(argv[a])) <= 0) usage_svn(argv[0]);
+			++a;
+			continue;
+		}
+		if(opt == 20) {
+			const char *modes[] = { "off", "copy", "reflink", "hardlink" };
+			int m;
+			for(m = 0; m < 4 && strcmp(argv[a], modes[m]); m++);
+			if(m == 4) usage_svn(argv[0]);
+			connection->dedup = m;
+			++a;
+			continue;
+		}
+		if(opt == 16 || opt == 17) {
+			if(opt == 16) connection->changes = strdup(argv[a++]);
+			else connection->content_manifest = strdup(argv[a++]);
+			continue;
+		}
+		if(opt == 6 || opt == 7 || opt == 8 || opt == 10 || opt == 11) {
+			if(opt == 6) connection->listen = strdup(argv[a]);
+			else if(opt == 7) upstream = argv[a];
+			else if(opt == 8) connection->cache = strdup(argv[a]);
+			else if(opt == 10) connection->poll_list = strdup(argv[a]);
+			else connection->poll_state = strdup(argv[a]);
+			++a;
+			continue;
+		}
+		char *q = strchr(argv[a], ':');
+		int n = atoi(argv[a++]);
+		if(opt == 1 && q) {
+			if(connection->job != SVN_DUMP) usage_svn(argv[0]);
+			/* FROM:TO, TO may be HEAD */
+			connection->revision_start = n;
+			connection->revision = atoi(q + 1);
+		} else if(opt == 1) {
+			connection->revision_start = connection->revision = n;
+		}
+		else if(opt == 2) connection->verbosity = n;
+		else if(opt == 4 && n > 0) connection->jobs = n;
+		else if(opt == 5 && n > 0) connection->host_jobs = n;
+		else if(opt == 9 && n >= 0) connection->latest_ttl = n;
+		else if(opt == 12 && n >= 0) connection->interval = n;
+		else if(opt == 18) {
+			if(n <= 0) usage_svn(argv[0]);
+			connection->crawlers = n;
+		}
+		else if(opt == 19) {
+			if(n <= 0) usage_svn(argv[0]);
+			connection->window = n;
+		}
+		else if(opt == 22) {
+			/* CONNECT[:IDLE[:TOTAL]], 0 meaning no limit */
+			if(n < 0) usage_svn(argv[0]);
+			connection->connect_timeout = n;
+			if(q) {
+				connection->idle_timeout = atoi(q + 1);
+				if((q = strchr(q + 1, ':'))) connection->total_timeout = atoi(q + 1);
+			}
+			if(connection->idle_timeout < 0 || connection->total_timeout < 0) usage_svn(argv[0]);
+		}
+		else if(opt == 23) {
+			if(n <= 0) usage_svn(argv[0]);
+			connection->min_rate = n;
+			if(q) connection->rate_window = atoi(q + 1);
+			if(connection->rate_window <= 0) usage_svn(argv[0]);
+		}
+		else if(opt == 13) {
+			if(n <= 0) usage_svn(argv[0]);
+			connection->watch = 1;
+			connection->interval = n;
+		}
+	}
+
+	/* a watched working copy follows the youngest revision */
+	if(connection->watch && (connection->manifest || connection->revision))
+		usage_svn(argv[0]);
+	if(connection->hook && !connection->watch)
+		usage_svn(argv[0]);
+	if(connection->threads && !connection->manifest)
+		usage_svn(argv[0]);
+	if(connection->dry_run && (connection->watch || connection->manifest))
+		usage_svn(argv[0]);
+	/* a manifest replaces URL and PATH, the checkouts are set up by run_manifest */
+	if(connection->manifest) {
+		if(a < argc) usage_svn(argv[0]);
+		return;
+	}
+	/* the URLs to poll come from --list, the revisions seen last from --state */
+	if(connection->job == SVN_POLL) {
+		if(a < argc || !connection->poll_list) usage_svn(argv[0]);
+		if(!connection->poll_state) {
+			char buf[PATH_MAX];
+			if(!strcmp(connection->poll_list, "-"))
+				snprintf(buf, sizeof buf, "svnup-poll.state");
+			else
+				snprintf(buf, sizeof buf, "%s.state", connection->poll_list);
+			connection->poll_state = strdup(buf);
+		}
+		return;
+	}
+	/* the proxy takes its URL from --upstream */
+	if(connection->job == SVN_PROXY) {
+		if(a < argc || !upstream || !connection->listen) usage_svn(argv[0]);
+		url = upstream;
+		if(!connection->cache) connection->cache = strdup("svnup-cache");
+	} else if(a >= argc)
+		usage_svn(argv[0]);
+	else
+		url = argv[a];
+
+	char *p, *q, *dst;
+	if(starts_with_lit(url, "dump:")) {
+		connection->protocol = DUMP;
+		p = url + LIT_LEN("dump:");
+	} else
+		p = protocol_check(url, connection);
+	if((connection->job == SVN_CO || connection->job == SVN_DUMP || connection->job == SVN_EXPORT) && connection->protocol == NONE)
+		usage_svn(argv[0]);
+	if(connection->job == SVN_DUMP && connection->protocol != SVN)
+		job_errx(EXIT_FAILURE, "dump is only supported for svn:// URLs");
+	if(connection->job == SVN_PROXY && connection->protocol != SVN)
+		job_errx(EXIT_FAILURE, "proxy is only supported for svn:// URLs");
+	if(connection->watch && connection->protocol == DUMP)
+		job_errx(EXIT_FAILURE, "--watch needs a repository, not a dumpfile");
+	if(connection->protocol == DUMP) {
+		/* dump:FILE[@REV][#SUBDIR], SUBDIR selects the tree below the repository root */
+		connection->address = strdup("");
+		connection->branch = strdup(p);
+		if((q = strrchr(connection->branch, '#'))) {
+			*q++ = 0;
+			while(*q == '/') q++;
+			connection->trunk = strdup(q);
+			for(dst = connection->trunk + strlen(connection->trunk); dst > connection->trunk && dst[-1] == '/'; ) *--dst = 0;
+		} else
+			connection->trunk = strdup("");
+		if((q = strrchr(connection->branch, '@')) && !strchr(q, '/')) {
+			*q++ = 0;
+			if(!connection->revision) connection->revision = atoi(q);
+		}
+		if((connection->job == SVN_CO || connection->job == SVN_EXPORT) && a + 1 >= argc)
+			usage_svn(argv[0]);
+	} else if(connection->protocol == LOCAL) {
+		/* file:///path or file://host/path, the host part is ignored */
+		if(*p != '/' && !(p = strchr(p, '/')))
+			job_errx(EXIT_FAILURE, "expected '/' in URL!");
+		connection->address = strdup("");
+		connection->branch = strdup(p + 1);
+	} else if(connection->protocol != NONE) {
+		if((q = strchr(p, ':'))) {
+			connection->port = atoi(q+1);
+			*q = 0;
+			connection->address = strdup(p);
+			*q = ':';
+		} else if((q = strchr(p, '/'))) {
+			*q = 0;
+			connection->address = strdup(p);
+			*q = '/';
+		}
+		if(q && *q == ':') q = strchr(q, '/');
+		if(!q) {
+			job_err(EXIT_FAILURE, "expected '/' in URL!");
+		}
+		p = ++q;
+		connection->branch = strdup(p);
+	}
+	if(connection->protocol != NONE) {
+		if(connection->job == SVN_CO || connection->job == SVN_EXPORT) {
+			if(++a >= argc)
+				dst = basename(connection->branch);
+			else
+				dst = argv[a];
+			connection->path_target = strdup(dst);
+		}
+	} else {
+		connection->path_target = strdup(url);
+	}
+	if(++a < argc) usage_svn(argv[0]);
+
+	/* exports keep no working copy state */
+	if(connection->path_target && connection->job != SVN_EXPORT) {
+		char buf[PATH_MAX];
+		snprintf(buf, sizeof buf, "%s/.svnup", connection->path_target);
+		connection->path_work = strdup(buf);
+	}
+
+	connection->trim_tree = 1;
+}
+
+static void write_info_or_log(connector *connection) {
+	if(connection->job == SVN_LOG) {
+		char deco[73];
+		memset(deco, '-', 72);
+		deco[72] = 0;
+		fprintf(stdout, "%s\n", deco);
+		/* some broken svn repos have empty revisions, and svn log prints only a
+		   single line of decorations, e.g.
+
+		   user@~$ svn log -r 70 svn://repo.hu/genht/trunk
+		   ------------------------------------------------------------------------
+		   user@~$
+
+		   in case of svn info, the last "good" rev is displayed as "Last Changed Rev"
+
+		   user@~$ svn info -r 70 svn://repo.hu/genht/trunk
+		   Path: trunk
+		   URL: svn://repo.hu/genht/trunk
+		   Relative URL: ^/trunk
+		   Repository Root: svn://repo.hu/genht
+		   Repository UUID: 050b73db-cdb7-47b8-9107-1ae054b27eea
+		   Revision: 70
+		   Node Kind: directory
+		   Last Changed Author: igor2
+		   Last Changed Rev: 69
+		   Last Changed Date: 2017-06-27 07:06:39 +0000 (Tue, 27 Jun 2017)
+		   user@~$
+		*/
+		if(connection->commit_author) {
+			fprintf(stdout, "r%u | %s | %s |\n\n", connection->revision, connection->commit_author, connection->commit_date);
+			fprintf(stdout, "%s\n%s\n", connection->commit_msg, deco);
+		}
+	} else if(connection->job == SVN_INFO) {
+		fprintf(stdout, "Revision: %u\n", connection->revision);
+		if(connection->commit_author) {
+			fprintf(stdout, "Last Changed Author: %s\n", connection->commit_author);
+			fprintf(stdout, "Last Changed Rev: %u\n", connection->revision);
+			fprintf(stdout, "Last Changed Date: %s +0000\n", connection->commit_date);
+		}
+	} else {
+		assert(0);
+	}
+}
+
+static const char* protocol_to_string(int proto) {
+	static const char proto_strmap[][6] = {
+		[LOCAL] = "file", [DUMP] = "dump", [SVN] = "svn", [HTTP] = "http", [HTTPS] = "https",
+	};
+	return proto >= LOCAL && proto <= HTTPS ? proto_strmap[proto] : NULL;
+}
+
+static void save_revision_file(connector *connection, char *svn_version_path) {
+	FILE *f;
+	if (!(f = fopen(svn_version_path, "w")))
+		job_err(EXIT_FAILURE, "write file failure %s", svn_version_path);
+	const char *ps = protocol_to_string(connection->protocol);
+	fprintf(f, "rev=%u\n", connection->revision);
+	if (connection->protocol == DUMP)
+		fprintf(f, "url=dump:%s#%s\n", connection->branch, connection->trunk);
+	else
+		fprintf(f, "url=%s://%s/%s\n", ps, connection->address, connection->branch);
+	fprintf(f, "date=%s\n", connection->commit_date ? connection->commit_date : "");
+	fprintf(f, "author=%s\n", connection->commit_author ? connection->commit_author : "");
+	fprintf(f, "log=%s\n", connection->commit_msg ? connection->commit_msg : "");
+	fclose(f);
+	chmod(svn_version_path, 0644);
+}
+
+static void read_revision_file(connector *connection, char *svn_version_path) {
+	FILE *f = fopen(svn_version_path, "r");
+	char buf[1024];
+	int in_log = 0;
+	if(!f) job_errx(EXIT_FAILURE, "couldn't open %s", svn_version_path);
+	while(fgets(buf, sizeof buf, f)) {
+		if(in_log) {
+			size_t l = strlen(connection->commit_msg);
+			connection->commit_msg = realloc(connection->commit_msg, l + 1 + sizeof buf);
+			if(l && connection->commit_msg[l-1] == '\n');
+			else { connection->commit_msg[l] = '\n'; ++l; }
+			char *p = strchr(buf, '\n');
+			if(p) *p = 0;
+			memcpy(connection->commit_msg+l, buf, strlen(buf)+1);
+		} else if(!strncmp(buf, "rev=", 4)) {
+			unsigned rev = atoi(buf+4);
+			if(connection->revision && connection->revision != rev)
+				job_errx(EXIT_FAILURE, "no local date for selected revision available, got %u", rev);
+			connection->revision = rev;
+		} else if(!strncmp(buf, "date=", 5)) {
+			char *p = strchr(buf+5, '\n');
+			if(!p) job_errx(EXIT_FAILURE, "malformed file %s", svn_version_path);
+			*p = 0;
+			p = buf + 5;
+			if(*p)
+				connection->commit_date = strdup(p);
+		} else if(!strncmp(buf, "author=", 7)) {
+			char *p = strchr(buf+7, '\n');
+			if(!p) job_errx(EXIT_FAILURE, "malformed file %s", svn_version_path);
+			*p = 0;
+			p = buf+7;
+			if(*p)
+				connection->commit_author = strdup(p);
+		} else if(!strncmp(buf, "log=", 4)) {
+			/* log entry may span multiple lines, therefore is last in file */
+			char *p = strchr(buf+4, '\n');
+			if(p) *p = 0;
+			connection->commit_msg = malloc(strlen(buf+4)+1);
+			memcpy(connection->commit_msg, buf+4, strlen(buf+4)+1);
+			in_log = 1;
+		}
+	}
+	fclose(f);
+}
+
+/* adds the "MD5<tab>PATH" lines of a known_files list to the tree */
+static void parse_known_files(char *value, struct tree_known_files *tree) {
+	char *md5, *path;
+	struct tree_node *data;
+
+	while (*value) {
+		md5 = value;
+		path = strchr(value, '\t') + 1;
+		value = strchr(path, '\n');
+		*value++ = '\0';
+		md5[32] = '\0';
+		data = (struct tree_node *)malloc(sizeof(struct tree_node));
+		data->path = strdup(path);
+		data->md5 = strdup(md5);
+		if (RB_INSERT(tree_known_files, tree, data) != NULL)
+			tree_node_free(data);
+	}
+}
+
+static void load_known_files(connector *connection) {
+	struct stat local;
+	int fd;
+	size_t length;
+
+	length = strlen(connection->path_work) + MAXNAMLEN;
+
+	connection->known_files_old = (char *)malloc(length);
+	connection->known_files_new = (char *)malloc(length);
+
+	snprintf(connection->known_files_old, length, "%s/known_files", connection->path_work);
+	snprintf(connection->known_files_new, length, "%s/known_files.new", connection->path_work);
+
+	if (stat(connection->known_files_old, &local) != -1) {
+		connection->known_files_size = local.st_size;
+
+		if ((connection->known_files_buffer = (char *)malloc(connection->known_files_size + 1)) == NULL)
+			job_err(EXIT_FAILURE, "connection.known_files malloc");
+
+		if ((fd = open(connection->known_files_old, O_RDONLY)) == -1)
+			job_err(EXIT_FAILURE, "open file (%s)", connection->known_files_old);
+
+		if (read(fd, connection->known_files_buffer, connection->known_files_size) != connection->known_files_size)
+			job_err(EXIT_FAILURE, "read file error (%s)", connection->known_files_old);
+
+		connection->known_files_buffer[connection->known_files_size] = '\0';
+		close(fd);
+
+		parse_known_files(connection->known_files_buffer, &connection->known_files);
+	}
+}
+
+/*
+ * load_reference_files
+ *
+ * Procedure that loads the known files of the --reference working copy.  Files of
+ * it changed after its known_files was written are not trusted, so its time is kept.
+ */
+
+static void
+load_reference_files(connector *connection)
+{
+	struct stat  local;
+	char         name[PATH_MAX], *buffer;
+	int          fd;
+
+	snprintf(name, sizeof(name), "%s/.svnup/known_files", connection->reference);
+
+	if ((fd = open(name, O_RDONLY)) == -1)
+		job_err(EXIT_FAILURE, "open file (%s)", name);
+
+	if (fstat(fd, &local) != 0)
+		job_err(EXIT_FAILURE, "stat file (%s)", name);
+
+	if ((buffer = (char *)malloc(local.st_size + 1)) == NULL)
+		job_err(EXIT_FAILURE, "load_reference_files malloc");
+
+	if (read(fd, buffer, local.st_size) != local.st_size)
+		job_err(EXIT_FAILURE, "read file error (%s)", name);
+
+	buffer[local.st_size] = '\0';
+	close(fd);
+
+	connection->reference_time = local.st_mtim;
+	parse_known_files(buffer, &connection->reference_files);
+	free(buffer);
+}
+
+/*
+ * save_working_copy
+ *
+ * Procedure that records the checked out revision and its files in the working
+ * copy state and prunes whatever local files and directories are no longer part
+ * of the tree.
+ */
+
+static void
+save_working_copy(connector *connection, file_node **file, int file_count, char *svn_version_path)
+{
+	struct tree_node  *data, *found, *next;
+	char               changes_temp[PATH_MAX], content_temp[PATH_MAX];
+
+	if (connection->changes)
+		connection->changes_out = journal_open(connection->changes, changes_temp, sizeof(changes_temp));
+
+	if (connection->content_manifest)
+		connection->content_out = journal_open(connection->content_manifest, content_temp, sizeof(content_temp));
+
+	save_known_file_list(connection, file, file_count);
+
+	/* Save details about the current revision */
+	save_revision_file(connection, svn_version_path);
+
+	/* Any files left in the tree are safe to delete. */
+
+	for (data = RB_MIN(tree_known_files, &connection->known_files); data != NULL; data = next) {
+		next = RB_NEXT(tree_known_files, head, data);
+
+		if ((found = RB_FIND(tree_local_files, &connection->local_files, data)) != NULL)
+			tree_node_free(RB_REMOVE(tree_local_files, &connection->local_files, found));
+
+		if (strncmp(connection->path_work, data->path, strlen(connection->path_work)))
+			prune(connection, data->path);
+
+		if (connection->changes_out)
+			journal_record(connection, connection->changes_out, "deleted", data->md5, -1, data->path);
+
+		tree_node_free(RB_REMOVE(tree_known_files, &connection->known_files, data));
+	}
+
+	if (connection->changes_out)
+		journal_close(connection->changes_out, connection->changes, changes_temp);
+
+	if (connection->content_out)
+		journal_close(connection->content_out, connection->content_manifest, content_temp);
+
+	connection->changes_out = connection->content_out = NULL;
+
+	if (connection->verbosity > 1)
+		printf("\r\e[0K\r");
+
+	/* Print/prune any local files left. */
+
+	for (data = RB_MIN(tree_local_files, &connection->local_files); data != NULL; data = next) {
+		next = RB_NEXT(tree_local_files, head, data);
+
+		if (connection->trim_tree) {
+			/* exempt .git/ from being removed, as it may be used by svn2git tool */
+			if(!strncmp(data->path, "/.git/", 6)) goto no_prune;
+
+			char buf[1024];
+			snprintf(buf, sizeof buf, "%s%s", connection->path_target, data->path);
+			if (strncmp(connection->path_work, buf, strlen(connection->path_work)))
+				prune(connection, data->path);
+		} else {
+			if (connection->extra_files)
+				fprintf(stderr, " * %s%s\n", connection->path_target, data->path);
+		}
+
+	no_prune:;
+		tree_node_free(RB_REMOVE(tree_local_files, &connection->local_files, data));
+	}
+
+	/* Prune any empty local directories not found in the repository. */
+
+	if (connection->verbosity > 1)
+		fprintf(stderr, "\e[0K\r");
+
+	for (data = RB_MAX(tree_local_directories, &connection->local_directories); data != NULL; data = next) {
+		next = RB_PREV(tree_local_directories, head, data);
+
+		char buf[1024];
+		snprintf(buf, sizeof buf, "%s/.git/", connection->path_target);
+
+		if (strncmp(data->path, buf, strlen(buf)) && rmdir(data->path) == 0)
+			fprintf(stderr, " = %s\n", data->path);
+
+		tree_node_free(RB_REMOVE(tree_local_directories, &connection->local_directories, data));
+	}
+
+	remove(connection->known_files_old);
+
+	if ((rename(connection->known_files_new, connection->known_files_old)) != 0)
+		job_err(EXIT_FAILURE, "Cannot rename %s", connection->known_files_old);
+}
+
+/*
+ * open_session_svn
+ *
+ * Procedure that greets the svn server, logs in anonymously and reads the repository
+ * details.
+ */
+
+static void
+open_session_svn(connector *connection)
+{
+	char   command[COMMAND_BUFFER + 1], *end, *start;
+
+	connection->in_handshake = 1;
+	connection->response_groups = 1;
+	process_command_svn(connection, "", 0);
+
+	snprintf(command,
+		COMMAND_BUFFER,
+		"( 2 ( edit-pipeline svndiff1 absent-entries commit-revprops depth log-revprops atomic-revprops partial-replay ) %ld:svn://%s/%s %ld:svnup-%s ( ) )\n",
+		strlen(connection->address) + strlen(connection->branch) + 7,
+		connection->address,
+		connection->branch,
+		strlen(SVNUP_VERSION) + 6,
+		SVNUP_VERSION);
+
+	process_command_svn(connection, command, 0);
+
+	start = connection->response;
+	end = connection->response + connection->response_length;
+	if (check_command_success(connection->protocol, &start, &end))
+		job_fail();
+
+	/* Login anonymously. */
+
+	connection->response_groups = 2;
+	process_command_svn(connection, "( ANONYMOUS ( 0: ) )\n", 0);
+
+	parse_repos_info_svn(connection);
+	connection->in_handshake = 0;
+}
+
+
+/*
+ * latest_revision_svn
+ *
+ * Function that returns the youngest revision of the repository.
+ */
+
+static uint32_t
+latest_revision_svn(connector *connection)
+{
+	char   *end, *start, *value;
+
+	connection->response_groups = 2;
+	process_command_svn(connection, "( get-latest-rev ( ) )\n", 0);
+
+	start = connection->response;
+	end = connection->response + connection->response_length;
+	if (check_command_success(connection->protocol, &start, &end))
+		job_fail();
+
+	if ((start == NULL) || !starts_with_lit(start, "( success ( "))
+		job_errx(EXIT_FAILURE, "Cannot retrieve latest revision.");
+
+	start += LIT_LEN("( success ( ");
+	value = start;
+	while (*start != ' ') start++;
+	*start = '\0';
+
+	return (strtol(value, (char **)NULL, 10));
+}
+
+
+/*
+ * report_files
+ *
+ * Procedure that requests the report(s) containing the names of all files and dirs
+ * in connection->revision and adds a file_node for each file.
+ */
+
+static void
+report_files(connector *connection, file_node ***file, int *file_count, int *file_max)
+{
+	char  *end, *start;
+
+	/* at this point, we're checking out a revision, so we request report(s) containing
+	   the names of all files and dirs in that revision, including some additional
+	   properties that vary among protocol and features of the server */
+
+	if (connection->protocol == SVN) {
+		if (connection->crawlers > 1)
+			crawl_report_svn(connection, file, file_count, file_max);
+		else
+			process_report_svn(connection, "", file, file_count, file_max);
+	}
+
+	if (connection->protocol == LOCAL) {
+		uint32_t  revision;
+		uint64_t  item;
+		int       dir;
+
+		fsfs_lookup(connection, &revision, &item, &dir);
+
+		if (!dir)
+			job_errx(EXIT_FAILURE, "Remote path %s is not a repository directory.", connection->branch);
+
+		fsfs_report(connection, "", revision, item, file, file_count, file_max);
+	}
+
+	if (connection->protocol == DUMP)
+		dumpfile_report(connection, file, file_count, file_max);
+
+	if (connection->protocol >= HTTP) {
+		process_report_http(connection, file, file_count, file_max);
+
+		start = connection->response;
+		end = connection->response + connection->response_length;
+		if (check_command_success(connection->protocol, &start, &end))
+			job_fail();
+	}
+}
+
+
+/*
+ * clone_file
+ *
+ * Procedure that makes target a copy of the open file source of the given size: a
+ * hard link to it with DEDUP_HARDLINK, a reflink sharing its blocks with
+ * DEDUP_REFLINK where the file system supports them, or else a copy made by the
+ * kernel.  If none of these works, the content (mapped here unless data is given)
+ * is written out by save_file().
+ */
+
+static void
+clone_file(int mode, const char *source, int descriptor, char *data, off_t size, const char *target, int executable, time_t mtime)
+{
+	struct timespec  times[2] = { { 0, UTIME_OMIT }, { mtime, 0 } };
+	char            *mapped;
+	int              clone, done;
+
+	if ((mode == DEDUP_HARDLINK) && (link(source, target) == 0))
+		return;
+
+	if ((clone = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		job_err(EXIT_FAILURE, "write file failure %s", target);
+
+	done = (size == 0);
+
+#ifdef FICLONE
+	if ((mode == DEDUP_REFLINK) && (!done))
+		done = (ioctl(clone, FICLONE, descriptor) == 0);
+#endif
+
+#ifdef SYS_copy_file_range
+	if (!done) {
+		loff_t   offset = 0;
+		ssize_t  copied = 0;
+
+		while ((offset < size) && ((copied = syscall(SYS_copy_file_range, descriptor, &offset, clone, NULL, size - offset, 0)) > 0))
+			;
+
+		done = (offset == size);
+	}
+#endif
+
+	if (done) {
+		fchmod(clone, executable ? 0755 : 0644);
+
+		if (mtime)
+			futimens(clone, times);
+	}
+
+	close(clone);
+
+	if (done)
+		return;
+
+	if ((mapped = data) == NULL)
+		if ((mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0)) == MAP_FAILED)
+			job_err(EXIT_FAILURE, "Cannot map %s", source);
+
+	save_file((char *)target, mapped, mapped + size, executable, 0, mtime);
+
+	if (data == NULL)
+		munmap(mapped, size);
+}
+
+
+/*
+ * dedup_compare
+ *
+ * Function that orders pointers into the file table by MD5 checksum and then by
+ * position, so that the first file of a group of identical ones comes first.
+ */
+
+static int
+dedup_compare(const void *a, const void *b)
+{
+	file_node **first = *(file_node ***)a, **second = *(file_node ***)b;
+	int         order;
+
+	if ((order = strcmp((*first)->md5, (*second)->md5)) != 0)
+		return (order);
+
+	return ((first > second) - (first < second));
+}
+
+
+/*
+ * dedup_plan
+ *
+ * Procedure that groups the files to download by MD5 checksum and keeps only the
+ * first file of each group marked for download.  The others are added to the list
+ * of duplicates, to be made from the downloaded copy once it has been saved.
+ */
+
+static void
+dedup_plan(file_node **file, int file_count, sblist *duplicates)
+{
+	file_node  ***order;
+	dedup_pair    pair;
+	int           f, count, first;
+
+	if ((order = (file_node ***)malloc(file_count * sizeof(file_node **) + 1)) == NULL)
+		job_err(EXIT_FAILURE, "dedup_plan malloc");
+
+	/* symlinks are cheap to fetch and have no content to share.  sizes unknown
+	   before the download (-1, over http) are taken from the source copy later. */
+	for (f = count = 0; f < file_count; f++)
+		if ((file[f]->download) && (file[f]->md5[0]) && (!file[f]->special) && (file[f]->size != 0))
+			order[count++] = &file[f];
+
+	qsort(order, count, sizeof(file_node **), dedup_compare);
+
+	for (f = first = 0; f < count; f++) {
+		if (strcmp((*order[first])->md5, (*order[f])->md5) != 0)
+			first = f;
+
+		if (f == first)
+			continue;
+
+		pair.copy = *order[f];
+		pair.source = *order[first];
+		pair.copy->download = 0;
+
+		if (!sblist_add(duplicates, &pair))
+			job_err(EXIT_FAILURE, "dedup_plan sblist_add");
+	}
+
+	free(order);
+}
+
+
+/*
+ * dedup_materialize
+ *
+ * Procedure that makes a duplicate file from the copy of its content saved in the
+ * working copy, after checking the MD5 checksum of that copy.  Depending on --dedup,
+ * the duplicate is a hard link to it (if the two have the same mode and mtime), a
+ * reflink sharing its blocks or a copy.
+ */
+
+static void
+dedup_materialize(connector *connection, dedup_pair *pair)
+{
+	struct stat  local;
+	char         source[PATH_MAX], target[PATH_MAX], md5_check[33], empty[1];
+	char        *data;
+	off_t        size;
+	time_t       mtime;
+	int          descriptor, mode;
+
+	snprintf(source, sizeof(source), "%s%s", connection->path_target, strip_rev_root_stub(connection, pair->source->path));
+	snprintf(target, sizeof(target), "%s%s", connection->path_target, strip_rev_root_stub(connection, pair->copy->path));
+
+	if ((descriptor = open(source, O_RDONLY)) == -1)
+		job_err(EXIT_FAILURE, "Cannot read %s", source);
+
+	if (fstat(descriptor, &local) != 0)
+		job_err(EXIT_FAILURE, "Cannot stat %s", source);
+
+	/* over http the size of the duplicate is unknown (-1): the source tells it */
+	size = local.st_size;
+	data = empty;
+
+	if ((size) && ((data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0)) == MAP_FAILED))
+		job_err(EXIT_FAILURE, "Cannot map %s", source);
+
+	if (strncmp(pair->copy->md5, md5sum(data, size, md5_check), 33) != 0)
+		job_errx(EXIT_FAILURE, "MD5 checksum mismatch: %s should be %s, calculated %s\n", source, pair->copy->md5, md5_check);
+
+	pair->copy->size = size;
+
+	mtime = connection->commit_times ? pair->copy->mtime : 0;
+	mode = connection->dedup;
+
+	/* a hard link shares the mode and mtime too */
+	if ((mode == DEDUP_HARDLINK)
+		&& ((pair->copy->executable != pair->source->executable)
+		|| (mtime != (connection->commit_times ? pair->source->mtime : 0))))
+		mode = DEDUP_COPY;
+
+	/* never write through a link the old file may share with others */
+	if ((lstat(target, &local) == 0) && (remove(target) != 0))
+		job_err(EXIT_FAILURE, "Cannot remove %s", target);
+
+	clone_file(mode, source, descriptor, data, size, target, pair->copy->executable, mtime);
+
+	if (data != empty)
+		munmap(data, size);
+
+	close(descriptor);
+
+	if (connection->verbosity)
+		printf(" + %s\n", target);
+}
+
+
+/*
+ * relocate_compare
+ *
+ * Function that orders the known files by MD5 checksum and then by path.
+ */
+
+static int
+relocate_compare(const void *a, const void *b)
+{
+	const relocate_source *first = a, *second = b;
+	int                    order;
+
+	if ((order = strcmp(first->node->md5, second->node->md5)) != 0)
+		return (order);
+
+	return (strcmp(first->node->path, second->node->path));
+}
+
+
+/*
+ * relocate_find
+ *
+ * Function that returns the first known file with the given MD5 checksum in the
+ * sorted index, or NULL if there is none.
+ */
+
+static relocate_source *
+relocate_find(relocate_source *index, size_t count, const char *md5)
+{
+	size_t  low, high, middle;
+
+	for (low = 0, high = count; low < high; ) {
+		middle = low + (high - low) / 2;
+
+		if (strcmp(index[middle].node->md5, md5) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return (((low < count) && (strcmp(index[low].node->md5, md5) == 0)) ? &index[low] : NULL);
+}
+
+
+/*
+ * relocate_plan
+ *
+ * Function that looks up every file to download in an index of the known files by
+ * MD5 checksum.  A file whose content is already in the working copy is taken from
+ * there instead: moved from a path that leaves the tree, if one is left, or else
+ * copied.  Returns the index, which the list of relocations points into.
+ */
+
+static relocate_source *
+relocate_plan(connector *connection, file_node **file, int file_count, sblist *relocations)
+{
+	struct tree_node  *node, find;
+	relocate_source   *index, *source, *candidate;
+	relocate_pair      pair;
+	size_t             count;
+	int                f;
+
+	count = 0;
+
+	RB_FOREACH(node, tree_known_files, &connection->known_files)
+		count++;
+
+	if ((index = (relocate_source *)calloc(count + 1, sizeof(relocate_source))) == NULL)
+		job_err(EXIT_FAILURE, "relocate_plan calloc");
+
+	count = 0;
+
+	RB_FOREACH(node, tree_known_files, &connection->known_files)
+		if ((node->md5) && (strlen(node->md5) >= 32))
+			index[count++].node = node;
+
+	qsort(index, count, sizeof(relocate_source), relocate_compare);
+
+	/* known files still in the new tree can only be copied */
+	for (f = 0; f < file_count; f++) {
+		find.path = strip_rev_root_stub(connection, file[f]->path);
+
+		if ((node = RB_FIND(tree_known_files, &connection->known_files, &find)) == NULL)
+			continue;
+
+		for (source = relocate_find(index, count, node->md5); source && source < index + count; source++) {
+			if (strcmp(source->node->md5, node->md5))
+				break;
+
+			if (source->node == node)
+				source->kept = 1;
+		}
+	}
+
+	for (f = 0; f < file_count; f++) {
+		if ((!file[f]->download) || (!file[f]->md5[0]) || (file[f]->special))
+			continue;
+
+		if ((source = relocate_find(index, count, file[f]->md5)) == NULL)
+			continue;
+
+		pair.copy = file[f];
+		pair.source = source;
+		pair.move = pair.staged = 0;
+
+		for (candidate = source; candidate < index + count; candidate++) {
+			if (strcmp(candidate->node->md5, file[f]->md5))
+				break;
+
+			if ((!candidate->kept) && (!candidate->claimed)) {
+				candidate->claimed = 1;
+				pair.source = candidate;
+				pair.move = 1;
+				break;
+			}
+		}
+
+		file[f]->download = 0;
+
+		if (!sblist_add(relocations, &pair))
+			job_err(EXIT_FAILURE, "relocate_plan sblist_add");
+	}
+
+	return (index);
+}
+
+
+/*
+ * relocate_stage
+ *
+ * Function that puts the content of a relocated file in its staging file in the
+ * work directory, after checking the MD5 checksum of the local copy it comes from.
+ * Returns 0 if that copy is missing or was changed, for the file to be downloaded.
+ */
+
+static int
+relocate_stage(connector *connection, relocate_pair *pair, const char *stage)
+{
+	struct timespec  times[2] = { { 0, UTIME_OMIT }, { pair->copy->mtime, 0 } };
+	struct stat      local;
+	char             source[PATH_MAX], md5_check[33], empty[1];
+	char            *data;
+	int              descriptor, valid;
+
+	snprintf(source, sizeof(source), "%s%s", connection->path_target, pair->source->node->path);
+
+	if ((lstat(source, &local) != 0) || (!S_ISREG(local.st_mode)))
+		return (0);
+
+	if ((descriptor = open(source, O_RDONLY)) == -1)
+		return (0);
+
+	data = empty;
+
+	if ((local.st_size) && ((data = mmap(NULL, local.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0)) == MAP_FAILED))
+		job_err(EXIT_FAILURE, "Cannot map %s", source);
+
+	valid = (strncmp(pair->copy->md5, md5sum(data, local.st_size, md5_check), 33) == 0);
+
+	if ((valid) && (!pair->move))
+		save_file((char *)stage, data, data + local.st_size, pair->copy->executable, 0,
+			connection->commit_times ? pair->copy->mtime : 0);
+
+	if ((valid) && (pair->move)) {
+		if (rename(source, stage) != 0)
+			job_err(EXIT_FAILURE, "Cannot rename %s", source);
+
+		fchmod(descriptor, pair->copy->executable ? 0755 : 0644);
+		futimens(descriptor, connection->commit_times ? times : NULL);
+
+		if (connection->verbosity)
+			printf(" - %s\n", source);
+	}
+
+	if (data != empty)
+		munmap(data, local.st_size);
+
+	close(descriptor);
+
+	return (valid);
+}
+
+
+/*
+ * relocate_files
+ *
+ * Procedure that makes the relocated files from the local copies of their content.
+ * Every copy is staged before any file is put in place, and the copies before the
+ * moves, so that files swapping their contents come out right.  Files whose local
+ * copy turned out to be stale are marked for download again.
+ */
+
+static void
+relocate_files(connector *connection, sblist *relocations)
+{
+	relocate_pair  *pair;
+	char            stage[PATH_MAX], target[PATH_MAX];
+	size_t          r;
+	int             move;
+
+	for (move = 0; move < 2; move++)
+		for (r = 0; r < sblist_getsize(relocations); r++) {
+			pair = sblist_get(relocations, r);
+
+			if (pair->move != move)
+				continue;
+
+			snprintf(stage, sizeof(stage), "%s/relocate.%zu", connection->path_work, r);
+
+			if ((pair->staged = relocate_stage(connection, pair, stage)) == 0)
+				pair->copy->download = 1;
+		}
+
+	for (r = 0; r < sblist_getsize(relocations); r++) {
+		pair = sblist_get(relocations, r);
+
+		if (!pair->staged)
+			continue;
+
+		snprintf(stage, sizeof(stage), "%s/relocate.%zu", connection->path_work, r);
+		snprintf(target, sizeof(target), "%s%s", connection->path_target, strip_rev_root_stub(connection, pair->copy->path));
+
+		if (rename(stage, target) != 0)
+			job_err(EXIT_FAILURE, "Cannot rename %s", stage);
+
+		if (connection->verbosity)
+			printf(" + %s\n", target);
+	}
+}
+
+
+/*
+ * reference_trusted
+ *
+ * Function that tells whether a file of the --reference working copy can stand in
+ * for a remote file without hashing it: it must be a regular file of the expected
+ * size that has not been written to since the reference's known_files.
+ */
+
+static int
+reference_trusted(connector *connection, struct stat *local, file_node *file)
+{
+	if (!S_ISREG(local->st_mode))
+		return (0);
+
+	if ((file->size >= 0) && (local->st_size != file->size))
+		return (0);
+
+	if (local->st_mtim.tv_sec != connection->reference_time.tv_sec)
+		return (local->st_mtim.tv_sec < connection->reference_time.tv_sec);
+
+	return (local->st_mtim.tv_nsec <= connection->reference_time.tv_nsec);
+}
+
+
+/*
+ * reference_files
+ *
+ * Function that makes every file still to download whose content the --reference
+ * working copy holds (by MD5 checksum, at any path) from that copy, and marks it as
+ * no longer to download.  It is cloned as --dedup says, reflinked by default.  In a
+ * dry run, the files are only counted.  Returns the list of files made.
+ */
+
+static sblist *
+reference_files(connector *connection, file_node **file, int file_count)
+{
+	struct tree_node  *node;
+	struct stat        local;
+	relocate_source   *index, *source;
+	sblist            *made;
+	char               path[PATH_MAX], target[PATH_MAX];
+	size_t             count;
+	time_t             mtime;
+	int                descriptor, f, mode;
+
+	count = 0;
+
+	RB_FOREACH(node, tree_known_files, &connection->reference_files)
+		count++;
+
+	if ((index = (relocate_source *)calloc(count + 1, sizeof(relocate_source))) == NULL)
+		job_err(EXIT_FAILURE, "reference_files calloc");
+
+	if ((made = sblist_new(sizeof(file_node *), 64)) == NULL)
+		job_err(EXIT_FAILURE, "reference_files sblist_new");
+
+	count = 0;
+
+	RB_FOREACH(node, tree_known_files, &connection->reference_files)
+		if ((node->md5) && (strlen(node->md5) >= 32))
+			index[count++].node = node;
+
+	qsort(index, count, sizeof(relocate_source), relocate_compare);
+
+	for (f = 0; f < file_count; f++) {
+		if ((!file[f]->download) || (!file[f]->md5[0]) || (file[f]->special))
+			continue;
+
+		for (source = relocate_find(index, count, file[f]->md5); source && source < index + count; source++) {
+			if (strcmp(source->node->md5, file[f]->md5)) {
+				source = NULL;
+				break;
+			}
+
+			snprintf(path, sizeof(path), "%s%s", connection->reference, source->node->path);
+
+			if ((lstat(path, &local) == 0) && (reference_trusted(connection, &local, file[f])))
+				break;
+		}
+
+		if ((source == NULL) || (source == index + count))
+			continue;
+
+		file[f]->download = 0;
+		sblist_add(made, &file[f]);
+
+		if (connection->dry_run)
+			continue;
+
+		snprintf(target, sizeof(target), "%s%s", connection->path_target, strip_rev_root_stub(connection, file[f]->path));
+
+		if ((lstat(target, &local) == 0) && (remove(target) != 0))
+			job_err(EXIT_FAILURE, "Cannot remove %s", target);
+
+		if ((descriptor = open(path, O_RDONLY)) == -1)
+			job_err(EXIT_FAILURE, "Cannot read %s", path);
+
+		if (fstat(descriptor, &local) != 0)
+			job_err(EXIT_FAILURE, "Cannot stat %s", path);
+
+		mtime = connection->commit_times ? file[f]->mtime : 0;
+		mode = (connection->dedup == DEDUP_HARDLINK) ? DEDUP_HARDLINK : DEDUP_REFLINK;
+
+		if ((mode == DEDUP_HARDLINK)
+			&& ((!(local.st_mode & S_IXUSR) != !file[f]->executable)
+			|| ((mtime) && (local.st_mtime != mtime))))
+			mode = DEDUP_REFLINK;
+
+		clone_file(mode, path, descriptor, NULL, local.st_size, target, file[f]->executable, mtime);
+		close(descriptor);
+
+		if (connection->verbosity)
+			printf(" + %s\n", target);
+	}
+
+	free(index);
+
+	return (made);
+}
+
+
+/*
+ * adopt_file
+ *
+ * Function that tells whether the local copy of a file, left by another client or
+ * unpacked from an archive, already holds the content the server reports (by MD5
+ * checksum), setting its executable bit as the server says if it does (unless this
+ * is a dry run).  It runs on the --adopt threads, so it does not fail the checkout:
+ * a file it cannot read is simply downloaded.
+ */
+
+static int
+adopt_file(connector *connection, file_node *file)
+{
+	struct stat  local;
+	char         path[PATH_MAX], link[PATH_MAX + 5], md5[33];
+	void        *data;
+	ssize_t      length;
+	mode_t       mode;
+	int          descriptor, match;
+
+	snprintf(path, sizeof(path), "%s%s", connection->path_target, strip_rev_root_stub(connection, file->path));
+
+	if (lstat(path, &local) != 0)
+		return (0);
+
+	if (file->special) {
+		if (!S_ISLNK(local.st_mode))
+			return (0);
+
+		if ((length = readlink(path, link + 5, PATH_MAX - 1)) == -1)
+			return (0);
+
+		memcpy(link, "link ", 5);
+
+		return (strncmp(md5sum(link, length + 5, md5), file->md5, 32) == 0);
+	}
+
+	if ((!S_ISREG(local.st_mode)) || ((file->size >= 0) && (local.st_size != file->size)))
+		return (0);
+
+	if ((descriptor = open(path, O_RDONLY)) == -1)
+		return (0);
+
+	data = NULL;
+
+	if ((local.st_size) && ((data = mmap(NULL, local.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0)) == MAP_FAILED)) {
+		close(descriptor);
+		return (0);
+	}
+
+	match = (strncmp(md5sum(local.st_size ? data : "", local.st_size, md5), file->md5, 32) == 0);
+
+	if (local.st_size)
+		munmap(data, local.st_size);
+
+	close(descriptor);
+
+	mode = file->executable ? 0755 : 0644;
+
+	if ((match) && (!connection->dry_run) && ((local.st_mode & 0777) != mode))
+		chmod(path, mode);
+
+	return (match);
+}
+
+
+/*
+ * adopt_thread
+ *
+ * Function run by each --adopt thread.  It keeps taking the next file to download
+ * and hashes its local copy until none is left.
+ */
+
+static void *
+adopt_thread(void *data)
+{
+	adopt_pool  *pool = data;
+	file_node   *file;
+	int          f;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+
+		while ((pool->next < pool->file_count)
+			&& ((!pool->file[pool->next]->download) || (!pool->file[pool->next]->md5[0])))
+			pool->next++;
+
+		f = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (f >= pool->file_count)
+			break;
+
+		file = pool->file[f];
+
+		if (!adopt_file(pool->connection, file))
+			continue;
+
+		file->download = 0;
+
+		pthread_mutex_lock(&pool->lock);
+		pool->adopted++;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return (NULL);
+}
+
+
+/*
+ * adopt_files
+ *
+ * Procedure that, for a checkout run with --adopt, hashes the local copies of the
+ * files still to download on as many threads as there are processors and marks
+ * those matching the server's MD5 checksum as not to download.  They then make it
+ * into known_files like any other file of the revision.
+ */
+
+static void
+adopt_files(connector *connection, file_node **file, int file_count)
+{
+	pthread_attr_t   attributes;
+	pthread_t       *threads;
+	adopt_pool       pool;
+	long             count;
+	int              t;
+
+	if ((count = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		count = 1;
+
+	count = MIN(count, 64);
+
+	pool.connection = connection;
+	pool.file = file;
+	pool.file_count = file_count;
+	pool.next = pool.adopted = 0;
+
+	if ((threads = (pthread_t *)calloc(count, sizeof(pthread_t))) == NULL)
+		job_err(EXIT_FAILURE, "adopt_files calloc");
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_attr_init(&attributes);
+	pthread_attr_setstacksize(&attributes, 1024 * 1024);
+
+	for (t = 1; t < count; t++)
+		if ((errno = pthread_create(&threads[t], &attributes, adopt_thread, &pool)) != 0)
+			job_err(EXIT_FAILURE, "adopt_files pthread_create");
+
+	adopt_thread(&pool);
+
+	for (t = 1; t < count; t++)
+		pthread_join(threads[t], NULL);
+
+	pthread_attr_destroy(&attributes);
+	pthread_mutex_destroy(&pool.lock);
+	free(threads);
+
+	if (connection->verbosity > 1)
+		printf("# adopted %d local files\n", pool.adopted);
+
+	connection->dry_adopted += pool.adopted;
+}
+
+
+/*
+ * fetch_files
+ *
+ * Procedure that completes the attributes of the files in the table, decides which
+ * of them differ from the local copies and downloads those.
+ */
+
+static void
+fetch_files(connector *connection, file_node **file, int file_count)
+{
+	char  *end, *start;
+	int    c, f, f0;
+	sblist duplicates, relocations;
+	dedup_pair *pair;
+	relocate_pair *relocation;
+	relocate_source *known;
+	sblist *referenced;
+	file_node **made;
+
+	/* if we have received the md5 checksum already, filter out the files that
+	   exist locally and have a matching checksum, so we don't need to download them,
+	   nor request additional properties about them.  exports fetch everything. */
+	for (f = 0; f < file_count; ++f) {
+		if (connection->job == SVN_EXPORT)
+			file[f]->download = 1;
+		else
+			check_md5(connection, file[f]);
+	}
+
+	/* on svn://, the files downloaded whatever their checksum get their properties
+	   and contents in one request. */
+	if ((connection->protocol == SVN) && (!connection->inline_props) && (!connection->dry_run))
+		whole_plan(connection, file, file_count);
+
+	/* Get additional file information not contained in the first report and store the
+	   commands in a list. */
+
+	command_queue buffered_commands;
+
+	command_queue_init(&buffered_commands);
+
+	/* only retrieve additional information about files
+	   if we haven't received inline props already */
+	if (!connection->inline_props)
+	for (f = 0; f < file_count; f++) {
+		if ((connection->protocol == SVN) && (!file[f]->whole))
+			command_queue_add(&buffered_commands,
+				"( get-file ( %zd:%s ( %d ) true false false ) )\n",
+				strlen(file[f]->path),
+				file[f]->path,
+				connection->revision);
+
+		if (connection->protocol >= HTTP) {
+			if (file[f]->download) {
+				command_queue_add(&buffered_commands,
+					"PROPFIND %s HTTP/1.1\r\n"
+					"Depth: 1\r\n"
+					"Host: %s\r\n\r\n",
+					file[f]->href,
+					connection->address);
+			}
+		}
+	}
+
+	/* Process the additional commands to retrieve extended attributes.
+	   In case of SVN, this includes the md5 checksum and special(i.e. symlink)
+	   and executable properties, for HTTP only the latter 2 plus filesize. */
+
+#define MAX_HTTP_REQUESTS_PER_PACKET 95
+
+	char *chain;
+	size_t chain_count = connection->protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
+	f = f0 = 0;
+	while ((chain = command_queue_chain(&buffered_commands, BUFFER_UNIT, &chain_count))) {
+		size_t chain_items = chain_count;
+		chain_count = connection->protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
+		connection->response_groups = chain_items * 2;
+
+		if (connection->protocol >= HTTP)
+			process_command_http(connection, chain);
+
+		if (connection->protocol == SVN)
+			process_command_svn(connection, chain, 0);
+
+		start = connection->response;
+		end = start + connection->response_length;
+
+		connection->response_groups = 0;
+
+		for (c = 0; c < chain_items; c++) {
+			if (connection->protocol >= HTTP)
+			while (f < file_count && file[f]->download == 0) {
+				/* on http, skip files that already had their md5 checked,
+				   therefore no PROPFIND request was submitted,
+				   so they're not in the chain */
+				if (connection->verbosity > 1)
+					progress_indicator(connection, file[f]->path, f, file_count);
+
+				f++;
+			}
+
+			while ((connection->protocol == SVN) && (f < file_count) && (file[f]->whole))
+				f++;
+
+			if (check_command_success(connection->protocol, &start, &end))
+				job_fail();
+
+			if (connection->protocol >= HTTP)
+				parse_response_group(connection, &start, &end);
+
+			if (connection->protocol == SVN)
+				end = strchr(start, '\0');
+
+			parse_additional_attributes(connection, start, end, file[f]);
+
+			if (connection->verbosity > 1)
+				progress_indicator(connection, file[f]->path, f, file_count);
+
+			start = end + 1;
+			f++;
+		}
+	}
+
+	/* check md5 again for those still unchecked; in case we only retrieved
+	   the checked-in file's checksum right now via additional attributes. */
+	if (connection->job != SVN_EXPORT)
+		for (f = 0; f < file_count; ++f)
+			check_md5(connection, file[f]);
+
+	get_files_whole_svn(connection, file, file_count);
+
+	/* files of a tree another client left are kept if their content is current */
+	if (connection->adopt)
+		adopt_files(connection, file, file_count);
+
+	/* content the working copy already holds under another path is not fetched */
+	sblist_init(&relocations, sizeof(relocate_pair), 64);
+	known = NULL;
+
+	if (connection->path_work) {
+		known = relocate_plan(connection, file, file_count, &relocations);
+
+		if (!connection->dry_run)
+			relocate_files(connection, &relocations);
+	}
+
+	/* then whatever the --reference working copy holds */
+	referenced = NULL;
+
+	if (connection->reference)
+		referenced = reference_files(connection, file, file_count);
+
+	/* identical files are fetched once and copied locally */
+	sblist_init(&duplicates, sizeof(dedup_pair), 64);
+
+	if (connection->dedup != DEDUP_OFF)
+		dedup_plan(file, file_count, &duplicates);
+
+	if ((connection->protocol == LOCAL) && (!connection->dry_run))
+		fsfs_get_files(connection, file, file_count);
+
+	if ((connection->protocol == DUMP) && (!connection->dry_run))
+		dumpfile_get_files(connection, file, file_count);
+
+	for (f=0; f < file_count; ++f) {
+		if (file[f]->download) {
+			if (connection->protocol >= HTTP)
+				command_queue_add(&buffered_commands,
+					"GET %s HTTP/1.1\r\n"
+					"Host: %s\r\n"
+					"Connection: Keep-Alive\r\n\r\n",
+					file[f]->href,
+					connection->address);
+
+			if (connection->protocol == SVN)
+				command_queue_add(&buffered_commands,
+					"( get-file ( %zd:%s ( %d ) false true false ) )\n",
+					strlen(file[f]->path),
+					file[f]->path,
+					connection->revision);
+		}
+	}
+
+	/* a dry run only counts the batches the downloads would be sent in */
+	if (connection->dry_run) {
+		chain_count = connection->protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
+
+		while (command_queue_chain(&buffered_commands, BUFFER_UNIT, &chain_count)) {
+			chain_count = connection->protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
+			connection->dry_batches++;
+		}
+
+		connection->dry_duplicates += sblist_getsize(&duplicates);
+		connection->dry_relocated += sblist_getsize(&relocations);
+		connection->dry_referenced += referenced ? sblist_getsize(referenced) : 0;
+		sblist_free_items(&duplicates);
+		sblist_free_items(&relocations);
+		free(known);
+
+		if (referenced)
+			sblist_free(referenced);
+
+		command_queue_free(&buffered_commands);
+		return;
+	}
+
+	/* download the actual files missing from tree */
+	chain_count = connection->protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
+	f = f0 = 0;
+	while ((chain = command_queue_chain(&buffered_commands, BUFFER_UNIT, &chain_count))) {
+		size_t chain_items = chain_count;
+		size_t file_incs = 0;
+		chain_count = connection->protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
+		connection->response_groups = chain_items * 2;
+
+		while (f < file_count && file_incs < chain_items) {
+			if(file[f]->download != 0) ++file_incs;
+			++f;
+		}
+		get_files(connection, chain, connection->path_target,
+				file, f0, f - 1);
+
+		if ((connection->verbosity > 1) && (f < file_count))
+			progress_indicator(connection, file[f]->path, f, file_count);
+
+		f0 = f;
+	}
+	command_queue_free(&buffered_commands);
+
+	sblist_iter(&duplicates, pair) {
+		dedup_materialize(connection, pair);
+		pair->copy->download = 1;
+	}
+
+	/* relocated, referenced and whole files count as written for the change list */
+	sblist_iter(&relocations, relocation)
+		relocation->copy->download = 1;
+
+	for (f = 0; f < file_count; f++)
+		if (file[f]->whole)
+			file[f]->download = 1;
+
+	if (referenced) {
+		sblist_iter(referenced, made)
+			(*made)->download = 1;
+
+		sblist_free(referenced);
+	}
+
+	sblist_free_items(&duplicates);
+	sblist_free_items(&relocations);
+	free(known);
+}
+
+
+/*
+ * dry_run_report
+ *
+ * Procedure that prints what a checkout would transfer and change without doing it:
+ * the files and bytes to download, the files to delete, the directories to create,
+ * the requests and batches needed and the time it would take at the round trip time
+ * and throughput measured while reading the report.
+ */
+
+static void
+dry_run_report(connector *connection, file_node **file, int file_count)
+{
+	transport_stats   *stats = &connection->stats;
+	struct tree_node   find, *found;
+	uint64_t           bytes;
+	double             throughput, estimate;
+	char               path[PATH_MAX];
+	uint32_t           downloads, deletions, extra;
+	int                f;
+
+	bytes = downloads = deletions = extra = 0;
+
+	/* as in save_working_copy, the files left in the trees are the ones to remove */
+	for (f = 0; f < file_count; f++) {
+		find.path = strip_rev_root_stub(connection, file[f]->path);
+
+		if ((found = RB_FIND(tree_known_files, &connection->known_files, &find)) != NULL)
+			tree_node_free(RB_REMOVE(tree_known_files, &connection->known_files, found));
+
+		if ((found = RB_FIND(tree_local_files, &connection->local_files, &find)) != NULL)
+			tree_node_free(RB_REMOVE(tree_local_files, &connection->local_files, found));
+
+		if (file[f]->download) {
+			downloads++;
+			bytes += file[f]->size > 0 ? file[f]->size : 0;
+		}
+	}
+
+	while ((found = RB_MIN(tree_local_files, &connection->local_files)) != NULL) {
+		snprintf(path, sizeof(path), "%s%s", connection->path_target, found->path);
+
+		/* --trim-tree spares the working copy state and .git/ */
+		if ((RB_FIND(tree_known_files, &connection->known_files, found) == NULL)
+			&& (strncmp(found->path, "/.git/", 6))
+			&& (strncmp(connection->path_work, path, strlen(connection->path_work))))
+			extra++;
+
+		tree_node_free(RB_REMOVE(tree_local_files, &connection->local_files, found));
+	}
+
+	while ((found = RB_MIN(tree_known_files, &connection->known_files)) != NULL) {
+		deletions++;
+		tree_node_free(RB_REMOVE(tree_known_files, &connection->known_files, found));
+	}
+
+	while ((found = RB_MIN(tree_local_directories, &connection->local_directories)) != NULL)
+		tree_node_free(RB_REMOVE(tree_local_directories, &connection->local_directories, found));
+
+	throughput = stats->receiving > 0 ? stats->received / stats->receiving : 0;
+	estimate = connection->dry_batches * stats->rtt + (throughput > 0 ? bytes / throughput : 0);
+
+	printf("# dry run of r%d\n", connection->revision);
+	printf("# download %u files, %" PRIu64 " bytes\n", downloads, bytes);
+	printf("# delete %u files\n", deletions + (connection->trim_tree ? extra : 0));
+	printf("# create %u directories\n", connection->dry_directories);
+	printf("# requests %u in %u batches\n", connection->dry_batches ? downloads : 0, connection->dry_batches);
+	printf("# copy %u duplicate files locally\n", connection->dry_duplicates);
+	printf("# move or copy %u files already in the working copy\n", connection->dry_relocated);
+	if (connection->reference)
+		printf("# clone %u files from %s\n", connection->dry_referenced, connection->reference);
+	if (connection->adopt)
+		printf("# keep %u local files not yet known\n", connection->dry_adopted);
+	printf("# rtt %.4fs, throughput %.0f bytes/s\n", stats->rtt, throughput);
+	printf("# estimate %.2fs\n", estimate);
+}
+
+
+/*
+ * watch_seed_directories
+ *
+ * Procedure that puts the directories holding the files of the working copy into the
+ * local directory tree, so that those missing from the next report get removed just
+ * as if the working copy had been scanned.
+ */
+
+static void
+watch_seed_directories(connector *connection)
+{
+	struct tree_node  *data, *directory;
+	char               path[PATH_MAX], *slash;
+
+	RB_FOREACH(data, tree_known_files, &connection->known_files) {
+		snprintf(path, sizeof(path), "%s%s", connection->path_target, data->path);
+
+		while (((slash = strrchr(path, '/')) != NULL) && (slash - path > (ptrdiff_t)strlen(connection->path_target))) {
+			*slash = '\0';
+
+			if ((directory = (struct tree_node *)malloc(sizeof(struct tree_node))) == NULL)
+				job_err(EXIT_FAILURE, "watch_seed_directories malloc");
+
+			directory->path = strdup(path);
+			directory->md5 = NULL;
+
+			/* the parents of a directory already in the tree are in it too */
+			if (RB_INSERT(tree_local_directories, &connection->local_directories, directory) != NULL) {
+				tree_node_free(directory);
+				break;
+			}
+		}
+	}
+}
+
+
+/*
+ * watch_restore
+ *
+ * Procedure that makes the files recorded while saving the working copy the known
+ * files of the next update, instead of reading them back from disk.
+ */
+
+static void
+watch_restore(connector *connection)
+{
+	connection->known_files = connection->watch_files;
+	RB_INIT(&connection->watch_files);
+	RB_INIT(&connection->reference_files);
+}
+
+
+/*
+ * watch_session_closed
+ *
+ * Function that checks whether the server has hung up on the idle svn session.
+ */
+
+static int
+watch_session_closed(connector *connection)
+{
+	ssize_t  bytes_read;
+	char     c;
+
+	bytes_read = recv(connection->socket_descriptor, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+	return (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK));
+}
+
+
+/*
+ * watch_reachable
+ *
+ * Function that checks whether the server accepts connections again, so that a
+ * restarting server delays the next update instead of ending the watch.
+ */
+
+static int
+watch_reachable(connector *connection)
+{
+	struct addrinfo  hints = { .ai_family = connection->family, .ai_socktype = SOCK_STREAM }, *address, *temp;
+	char             port[8];
+	int              descriptor, reachable;
+
+	snprintf(port, sizeof(port), "%d", connection->port);
+
+	if (getaddrinfo(connection->address, port, &hints, &address))
+		return (0);
+
+	for (reachable = 0, temp = address; (temp) && (!reachable); temp = temp->ai_next) {
+		if ((descriptor = socket(temp->ai_family, temp->ai_socktype, temp->ai_protocol)) < 0)
+			continue;
+
+		reachable = (connect(descriptor, temp->ai_addr, temp->ai_addrlen) == 0);
+		close(descriptor);
+	}
+
+	freeaddrinfo(address);
+
+	return (reachable);
+}
+
+
+/*
+ * watch_latest
+ *
+ * Function that returns the youngest revision of the repository, asking over the
+ * session kept open since the last update.
+ */
+
+static uint32_t
+watch_latest(connector *connection)
+{
+	char      command[COMMAND_BUFFER + 1], url[512], *value;
+	uint32_t  revision;
+
+	if (connection->protocol == SVN) {
+		if (watch_session_closed(connection)) {
+			if (!watch_reachable(connection)) {
+				if (connection->verbosity > 1)
+					fprintf(stderr, "# %s is not reachable\n", connection->address);
+
+				return (0);
+			}
+
+			reconnect(connection);
+		}
+
+		return (latest_revision_svn(connection));
+	}
+
+	if (connection->protocol == LOCAL) {
+		if ((value = fsfs_slurp(connection->fsfs, "db/current", NULL)) == NULL)
+			job_err(EXIT_FAILURE, "Cannot read %s/db/current", connection->fsfs->path);
+
+		revision = connection->fsfs->youngest = strtoul(value, (char **)NULL, 10);
+		free(value);
+
+		return (revision);
+	}
+
+	/* process_command_http reconnects by itself, once the server is back */
+	if (!watch_reachable(connection))
+		return (0);
+
+	snprintf(url, sizeof url, "/%s", connection->branch);
+	craft_http_packet(connection->address, url, "OPTIONS", http_options_footer, command);
+	connection->response_groups = 2;
+	process_command_http(connection, command);
+
+	if ((value = strstr(connection->response, "SVN-Youngest-Rev: ")) == NULL)
+		job_errx(EXIT_FAILURE, "Cannot find revision number.");
+
+	return (strtol(value + 18, (char **)NULL, 10));
+}
+
+
+/*
+ * watch_stat
+ *
+ * Function that returns 1 if path is a directory in connection->revision, 0 if it is
+ * a file (whose size is stored in size) and -1 if it does not exist.
+ */
+
+static int
+watch_stat(connector *connection, const char *path, int64_t *size)
+{
+	char  command[COMMAND_BUFFER + 1], *entry;
+
+	snprintf(command,
+		COMMAND_BUFFER,
+		"( stat ( %zu:%s ( %u ) ) )\n",
+		strlen(path),
+		path,
+		connection->revision);
+
+	connection->response_groups = 2;
+	process_command_svn(connection, command, 0);
+
+	entry = connection->response + strlen(connection->response) + 1;
+
+	if ((entry >= connection->response + connection->response_length) || (!starts_with_lit(entry, "( success ( ( ( ")))
+		return (-1);
+
+	entry += LIT_LEN("( success ( ( ( ");
+
+	if (starts_with_lit(entry, "dir "))
+		return (1);
+
+	if (!starts_with_lit(entry, "file "))
+		return (-1);
+
+	*size = strtoll(entry + LIT_LEN("file "), (char **)NULL, 10);
+
+	return (0);
+}
+
+
+/*
+ * watch_changed
+ *
+ * Function that decides whether a known file is touched by the changes of a revision.
+ * Deleted, replaced and newly added directories take everything below them along.
+ */
+
+static int
+watch_changed(sblist *changes, const char *path, int below)
+{
+	dump_node  *change;
+	size_t      length;
+
+	sblist_iter(changes, change) {
+		length = strlen(change->path);
+
+		if ((change->action == 'D') || (change->action == 'R') || ((change->dir == 1) && (change->action == 'A'))) {
+			if ((strncmp(path, change->path, length) == 0) && (path[length] == '/' || (path[length] == '\0' && !below)))
+				return (1);
+		} else if ((change->dir == 0) && (!below) && (strcmp(path, change->path) == 0))
+			return (1);
+	}
+
+	return (0);
+}
+
+
+/*
+ * watch_apply_svn
+ *
+ * Procedure that brings the working copy from the previous revision to the one of a
+ * log entry, fetching only what the entry's changed paths touch: added or replaced
+ * directories are crawled, changed files are fetched again and deleted paths are
+ * removed.
+ */
+
+static void
+watch_apply_svn(connector *connection, dump_entry *entry, char *svn_version_path)
+{
+	file_node         **file, *node;
+	struct tree_node   *data, find, *found;
+	struct stat         local;
+	dump_node          *change;
+	char                path[PATH_MAX];
+	const char         *relative;
+	int                 file_count, file_max, first;
+
+	connection->revision = entry->revision;
+	file_count = 0;
+	file_max = BUFFER_UNIT;
+
+	if ((file = (file_node **)malloc(file_max * sizeof(file_node **))) == NULL)
+		job_err(EXIT_FAILURE, "watch_apply_svn malloc");
+
+	/* Turn the changed paths into working copy paths. */
+
+	sblist_iter(entry->changes, change) {
+		relative = dump_session_path(connection, change->path);
+		snprintf(path, sizeof(path), "%s%s", *relative ? "/" : "", relative);
+
+		/* files are fetched by size, which the log does not tell */
+		if ((change->dir != 1) && (change->action != 'D'))
+			change->dir = watch_stat(connection, relative, &change->size);
+
+		free(change->path);
+		change->path = strdup(path);
+	}
+
+	/* Files left alone by the revision are carried over as they are. */
+
+	RB_FOREACH(data, tree_known_files, &connection->known_files) {
+		if (watch_changed(entry->changes, data->path, 0))
+			continue;
+
+		node = new_file_node(&file, &file_count, &file_max);
+		node->path = strdup(data->path);
+		memcpy(node->md5, data->md5, 32);
+		node->md5_checked = 1;
+	}
+
+	first = file_count;
+
+	/* Deleted subtrees are swept up like extra local files. */
+
+	sblist_iter(entry->changes, change) {
+		if ((change->action != 'D') && (change->action != 'R'))
+			continue;
+
+		snprintf(path, sizeof(path), "%s%s", connection->path_target, change->path);
+
+		if ((lstat(path, &local) == 0) && (S_ISDIR(local.st_mode)))
+			find_local_files_and_directories(connection, connection->path_target, change->path, 1);
+	}
+
+	/* Everything added, replaced or modified is fetched again. */
+
+	sblist_iter(entry->changes, change) {
+		if ((change->action == 'D') || (change->dir == -1))
+			continue;
+
+		/* already part of a directory crawled for this revision */
+		if (watch_changed(entry->changes, change->path, 1))
+			continue;
+
+		if (change->dir == 0) {
+			/* without a known checksum the file is always downloaded */
+			find.path = change->path;
+
+			if ((found = RB_FIND(tree_known_files, &connection->known_files, &find)) != NULL)
+				tree_node_free(RB_REMOVE(tree_known_files, &connection->known_files, found));
+
+			node = new_file_node(&file, &file_count, &file_max);
+			node->path = strdup(change->path);
+			node->size = change->size;
+			node->existed = (found != NULL);
+		} else if (change->action != 'M') {
+			snprintf(path, sizeof(path), "%s%s", connection->path_target, change->path);
+
+			if (lstat(path, &local) != 0) {
+				if (connection->verbosity)
+					printf(" + %s\n", path);
+
+				create_directory(path);
+			}
+
+			find.path = path;
+
+			if ((found = RB_FIND(tree_local_directories, &connection->local_directories, &find)) != NULL)
+				tree_node_free(RB_REMOVE(tree_local_directories, &connection->local_directories, found));
+
+			process_report_svn(connection, change->path, &file, &file_count, &file_max);
+		}
+	}
+
+	fetch_files(connection, file + first, file_count - first);
+
+	free(connection->commit_author);
+	free(connection->commit_date);
+	free(connection->commit_msg);
+	connection->commit_author = connection->commit_date = connection->commit_msg = NULL;
+
+	process_log_svn(connection);
+
+	save_working_copy(connection, file, file_count, svn_version_path);
+	watch_restore(connection);
+	free(file);
+}
+
+
+/*
+ * watch_apply_full
+ *
+ * Procedure that brings the working copy to a revision by way of a complete report,
+ * for protocols without changed paths in their log.  The known files still come from
+ * memory and only files whose checksum changed are downloaded.
+ */
+
+static void
+watch_apply_full(connector *connection, uint32_t revision, char *svn_version_path)
+{
+	file_node **file;
+	int         file_count, file_max;
+
+	connection->revision = revision;
+	file_count = 0;
+	file_max = BUFFER_UNIT;
+
+	if ((file = (file_node **)malloc(file_max * sizeof(file_node **))) == NULL)
+		job_err(EXIT_FAILURE, "watch_apply_full malloc");
+
+	watch_seed_directories(connection);
+	report_files(connection, &file, &file_count, &file_max);
+	fetch_files(connection, file, file_count);
+
+	free(connection->commit_author);
+	free(connection->commit_date);
+	free(connection->commit_msg);
+	connection->commit_author = connection->commit_date = connection->commit_msg = NULL;
+
+	if (connection->protocol == SVN)
+		process_log_svn(connection);
+	else if (connection->protocol == LOCAL)
+		process_log_file(connection);
+	else if (connection->rev_root_stub)
+		process_log_http(connection);
+
+	save_working_copy(connection, file, file_count, svn_version_path);
+	watch_restore(connection);
+	free(file);
+}
+
+
+/*
+ * watch_hook
+ *
+ * Procedure that runs the --hook command for the revision just applied, passing the
+ * revision and the working copy in SVNUP_REVISION and SVNUP_PATH.
+ */
+
+static void
+watch_hook(connector *connection)
+{
+	char  revision[16];
+	int   status;
+
+	if (connection->hook == NULL)
+		return;
+
+	snprintf(revision, sizeof(revision), "%u", connection->revision);
+	setenv("SVNUP_REVISION", revision, 1);
+	setenv("SVNUP_PATH", connection->path_target, 1);
+
+	fflush(stdout);
+
+	if ((status = system(connection->hook)) != 0)
+		warnx("hook failed for revision %u (status %d)", connection->revision, status);
+}
+
+
+/*
+ * watch_checkout
+ *
+ * Procedure that keeps the working copy at the youngest revision, checking every
+ * --watch seconds over the same session.  Nothing is reloaded or rescanned between
+ * updates: the known files stay in memory.  On svn:// each new revision touching the
+ * working copy is applied on its own, from the changed paths of the log.
+ */
+
+static void
+watch_checkout(connector *connection, char *svn_version_path)
+{
+	char         command[COMMAND_BUFFER + 1];
+	svn_reader   reader;
+	sblist       entries;
+	dump_entry  *entry;
+	dump_node   *change;
+	uint32_t     latest;
+
+	sblist_init(&entries, sizeof(dump_entry), 16);
+
+	while (1) {
+		fflush(stdout);
+		sleep(connection->interval);
+
+		if ((latest = watch_latest(connection)) <= connection->revision)
+			continue;
+
+		if ((connection->protocol != SVN) || (connection->trunk == NULL)) {
+			watch_apply_full(connection, latest, svn_version_path);
+
+			if (connection->verbosity)
+				printf("# Revision: %d\n", connection->revision);
+
+			watch_hook(connection);
+			continue;
+		}
+
+		snprintf(command,
+			COMMAND_BUFFER,
+			"( log ( ( 0: ) ( %u ) ( %u ) true false 0 false revprops ( ) ) )\n",
+			connection->revision + 1,
+			latest);
+
+		send_command(connection, command);
+
+		memset(&reader, 0, sizeof(reader));
+		reader.socket_descriptor = connection->socket_descriptor;
+		dump_read_log(connection, &reader, &entries);
+		free(reader.buffer);
+
+		sblist_iter(&entries, entry) {
+			watch_apply_svn(connection, entry, svn_version_path);
+
+			if (connection->verbosity)
+				printf("# Revision: %d\n", connection->revision);
+
+			watch_hook(connection);
+
+			sblist_iter(entry->changes, change)
+				dump_node_free(change);
+
+			sblist_free(entry->changes);
+		}
+
+		entries.count = 0;
+
+		/* revisions that left the working copy alone still move it forward */
+		if (connection->revision < latest) {
+			connection->revision = latest;
+
+			free(connection->commit_author);
+			free(connection->commit_date);
+			free(connection->commit_msg);
+			connection->commit_author = connection->commit_date = connection->commit_msg = NULL;
+
+			process_log_svn(connection);
+			save_revision_file(connection, svn_version_path);
+		}
+	}
+}
+
+
+/*
+ * job_release
+ *
+ * Procedure that frees what a checkout holds apart from its connection: the file table,
+ * the trees of known, local and reference files, the mapped FSFS or dumpfile data, the
+ * strings of the connector and any journal still open.
+ */
+
+static void
+job_release(connector *connection)
+{
+	struct tree_node  *node;
+	int                f;
+
+	for (f = 0; f < connection->file_count; f++)
+		if (connection->files[f]) {
+			free(connection->files[f]->href);
+			free(connection->files[f]->path);
+			free(connection->files[f]);
+		}
+
+	free(connection->files);
+	connection->files = NULL;
+	connection->file_count = 0;
+
+	fsfs_close(connection);
+	dumpfile_close(connection);
+
+	while ((node = RB_MIN(tree_known_files, &connection->known_files)) != NULL)
+		tree_node_free(RB_REMOVE(tree_known_files, &connection->known_files, node));
+
+	while ((node = RB_MIN(tree_known_files, &connection->watch_files)) != NULL)
+		tree_node_free(RB_REMOVE(tree_known_files, &connection->watch_files, node));
+
+	while ((node = RB_MIN(tree_known_files, &connection->reference_files)) != NULL)
+		tree_node_free(RB_REMOVE(tree_known_files, &connection->reference_files, node));
+
+	while ((node = RB_MIN(tree_local_files, &connection->local_files)) != NULL)
+		tree_node_free(RB_REMOVE(tree_local_files, &connection->local_files, node));
+
+	while ((node = RB_MIN(tree_local_directories, &connection->local_directories)) != NULL)
+		tree_node_free(RB_REMOVE(tree_local_directories, &connection->local_directories, node));
+
+	free(connection->address);
+	free(connection->root);
+	free(connection->trunk);
+	free(connection->uuid);
+	free(connection->branch);
+	free(connection->rev_root_stub);
+	free(connection->reference);
+	free(connection->known_files_buffer);
+	free(connection->path_target);
+	free(connection->path_work);
+	free(connection->commit_author);
+	free(connection->commit_msg);
+	free(connection->commit_date);
+	free(connection->known_files_old);
+	free(connection->known_files_new);
+	free(connection->response);
+
+	connection->address = connection->root = connection->trunk = connection->uuid = NULL;
+	connection->branch = connection->rev_root_stub = connection->reference = connection->known_files_buffer = NULL;
+	connection->path_target = connection->path_work = NULL;
+	connection->commit_author = connection->commit_msg = connection->commit_date = NULL;
+	connection->known_files_old = connection->known_files_new = connection->response = NULL;
+
+	if ((connection->changes_out) && (connection->changes_out != stdout))
+		fclose(connection->changes_out);
+
+	if ((connection->content_out) && (connection->content_out != stdout))
+		fclose(connection->content_out);
+
+	connection->changes_out = connection->content_out = NULL;
+}
+
+
+/*
+ * job_close
+ *
+ * Procedure that ends a checkout that went through: it closes the connections, keeping
+ * the TLS session for the next checkout of the server, and releases the rest.
+ */
+
+static void
+job_close(connector *connection)
+{
+	standby_close(connection, 0);
+
+	if (close(connection->socket_descriptor) != 0)
+		if (errno != EBADF)
+			job_err(EXIT_FAILURE, "close connection failed");
+
+	connection->socket_descriptor = -1;
+
+	if (connection->ssl) {
+		tls_session_keep(connection);
+		tls_session_export(connection);
+		SSL_shutdown(connection->ssl);
+		SSL_CTX_free(connection->ctx);
+		SSL_free(connection->ssl);
+		connection->ssl = NULL;
+		connection->ctx = NULL;
+	}
+
+	job_release(connection);
+}
+
+
+/*
+ * run_checkout
+ *
+ * Procedure that carries out the job set up by getopts_svn.
+ */
+
+static int
+run_checkout(connector *connection)
+{
+	char   command[COMMAND_BUFFER + 1];
+	char  *md5, *path, *value;
+	char   svn_version_path[255];
+	int    b;
+	int    command_count;
+	int    fd;
+
+	connection->files = NULL;
+
+	connection->file_count = command_count = 0;
+
+	connection->file_max = BUFFER_UNIT;
+
+	if ((connection->files = (file_node **)malloc(connection->file_max * sizeof(file_node **))) == NULL)
+		job_err(EXIT_FAILURE, "process_directory source malloc");
+
+	command[0] = '\0';
+
+	clock_gettime(CLOCK_MONOTONIC, &connection->stats.start);
+
+	/* Create the destination directories if they doesn't exist. */
+
+	if(connection->job == SVN_EXPORT && !connection->force && access(connection->path_target, F_OK) == 0)
+		job_errx(EXIT_FAILURE, "%s already exists, use --force to overwrite", connection->path_target);
+
+	if(connection->path_target && !connection->dry_run) create_directory(connection->path_target);
+	if(connection->path_work) {
+		if(!connection->dry_run) create_directory(connection->path_work);
+		snprintf(svn_version_path, sizeof(svn_version_path),
+			"%s/revision", connection->path_work);
+	} else svn_version_path[0] = 0;
+
+	if(connection->protocol == NONE) {
+		read_revision_file(connection, svn_version_path);
+		write_info_or_log(connection);
+		job_close(connection);
+		return 0;
+	}
+
+
+	/* Load the list of known files and MD5 signatures, if they exist. */
+
+	if(connection->path_work) {
+		load_known_files(connection);
+
+		if ((connection->extra_files) || (connection->trim_tree))
+			find_local_files_and_directories(connection, connection->path_target, "", 1);
+		else
+			find_local_files_and_directories(connection, connection->path_target, "", 0);
+	}
+
+	if (connection->reference)
+		load_reference_files(connection);
+
+	/* Initialize connection with the server and get the latest revision number. */
+
+	if ((connection->response = (char *)malloc(connection->response_blocks * BUFFER_UNIT + 1)) == NULL)
+		job_err(EXIT_FAILURE, "main connection->response malloc");
+
+	if (connection->protocol != LOCAL && connection->protocol != DUMP)
+		reset_connection(connection);
+
+	/* Send initial response string. */
+
+	if (connection->protocol == SVN) {
+		open_session_svn(connection);
+
+		/* Get latest revision number. */
+
+		if (connection->revision <= 0)
+			connection->revision = latest_revision_svn(connection);
+
+		/* Check to make sure client-supplied remote path is a directory. */
+
+		snprintf(command,
+			COMMAND_BUFFER,
+			"( check-path ( 0: ( %d ) ) )\n",
+			connection->revision);
+		process_command_svn(connection, command, 0);
+
+		if ((strcmp(connection->response, "( success ( ( ) 0: ) )") != 0) &&
+		    (strcmp(connection->response + 23, "( success ( dir ) ) ") != 0))
+			job_errx(EXIT_FAILURE,
+				"Remote path %s is not a repository directory.\n%s",
+				connection->branch,
+				connection->response);
+
+		if (connection->job == SVN_DUMP) {
+			if (connection->revision_start > connection->revision)
+				job_errx(EXIT_FAILURE, "Invalid revision range %u:%u.", connection->revision_start, connection->revision);
+
+			dump_svn(connection);
+			job_close(connection);
+			return 0;
+		}
+
+		process_log_svn(connection);
+	}
+
+	else if (connection->protocol >= HTTP) {
+		char url[512];
+
+		snprintf(url, sizeof url, "/%s", connection->branch);
+		craft_http_packet(connection->address, url, "OPTIONS", http_options_footer, command);
+		connection->response_groups = 2;
+		process_command_http(connection, command);
+
+		/* Get the latest revision number. */
+
+		if (connection->revision <= 0) {
+			if ((value = strstr(connection->response, "SVN-Youngest-Rev: ")) == NULL)
+				job_errx(EXIT_FAILURE, "Cannot find revision number.");
+			else
+				connection->revision = strtol(value + 18, (char **)NULL, 10);
+		}
+
+		char buf[1024];
+		if(!http_extract_header_value(connection->response, "SVN-Repository-Root", buf, sizeof  buf)) {
+			job_errx(EXIT_FAILURE, "Cannot find SVN Repository Root.");
+		}
+		assert(buf[0] == '/');
+		connection->root = strdup(buf + 1 /* skip leading '/' */);
+		if ((path = strstr(connection->branch, connection->root))) {
+			if(strlen(connection->branch) == strlen(connection->root))
+				path = "";
+			else
+				path += strlen(connection->root) + 1;
+		}
+		else job_errx(EXIT_FAILURE, "Cannot find SVN Repository Trunk.");
+
+		connection->trunk = strdup(path);
+
+		if(http_extract_header_value(connection->response, "SVN-Rev-Root-Stub", buf, sizeof  buf)) {
+			assert(buf[0] == '/');
+			connection->rev_root_stub = strdup(buf);
+		}
+
+		if(connection->rev_root_stub) process_log_http(connection);
+	}
+
+	else if (connection->protocol == LOCAL) {
+		fsfs_open(connection);
+
+		if (connection->revision <= 0)
+			connection->revision = connection->fsfs->youngest;
+
+		process_log_file(connection);
+	}
+
+	else if (connection->protocol == DUMP) {
+		dumpfile_load(connection);
+	}
+
+	if (connection->job == SVN_LOG || connection->job == SVN_INFO) {
+		write_info_or_log(connection);
+		job_close(connection);
+		return 0;
+	}
+
+	if (connection->verbosity)
+		printf("# Revision: %d\n", connection->revision);
+
+	if (connection->verbosity > 1) {
+		fprintf(stderr, "# Protocol: %s\n", protocol_to_string(connection->protocol));
+		fprintf(stderr, "# Address: %s\n", connection->address);
+		fprintf(stderr, "# Port: %d\n", connection->port);
+		fprintf(stderr, "# Branch: %s\n", connection->branch);
+		fprintf(stderr, "# Target: %s\n", connection->path_target);
+		fprintf(stderr, "# Trim tree: %s\n", connection->trim_tree ? "Yes" : "No");
+		fprintf(stderr, "# Show extra files: %s\n", connection->extra_files ? "Yes" : "No");
+		fprintf(stderr, "# Known files directory: %s\n", connection->path_work);
+	}
+
+	report_files(connection, &connection->files, &connection->file_count, &connection->file_max);
+
+	fetch_files(connection, connection->files, connection->file_count);
+
+	if (connection->dry_run)
+		dry_run_report(connection, connection->files, connection->file_count);
+
+	if ((connection->job != SVN_EXPORT) && (!connection->dry_run))
+		save_working_copy(connection, connection->files, connection->file_count, svn_version_path);
+
+	if (connection->watch) {
+		watch_restore(connection);
+		watch_hook(connection);
+		watch_checkout(connection, svn_version_path);
+	}
+
+	/* Wrap it all up. */
+
+	job_close(connection);
+
+	if (connection->show_stats)
+		transport_report(connection);
+
+	return (0);
+}
+
+
+
+/*
+ * connector_init
+ *
+ * Procedure that sets up a connector with the default options.
+ */
+
+static void
+connector_init(connector *connection)
+{
+	memset(connection, 0, sizeof(*connection));
+
+	connection->response_blocks = 16;
+	connection->verbosity = 1;
+	connection->family = AF_UNSPEC;
+	connection->protocol = HTTPS;
+	connection->socket_descriptor = -1;
+	connection->jobs = 8;
+	connection->host_jobs = 4;
+	connection->latest_ttl = 5;
+	connection->window = 64;
+	connection->dedup = DEDUP_COPY;
+	connection->connect_timeout = 30;
+	connection->idle_timeout = 600;
+	connection->rate_window = 30;
+	connection->tls_session_pipe = -1;
+	connection->requests_left = -1;
+	connection->standby_descriptor = -1;
+
+	RB_INIT(&connection->known_files);
+	RB_INIT(&connection->watch_files);
+	RB_INIT(&connection->local_files);
+	RB_INIT(&connection->local_directories);
+}
+
+
+/*
+ * job_abandon
+ *
+ * Procedure that releases what a failed checkout still holds, so that the process
+ * (and the other checkouts running in it) can carry on.
+ */
+
+static void
+job_abandon(connector *connection)
+{
+	if (connection->socket_descriptor != -1)
+		close(connection->socket_descriptor);
+
+	connection->socket_descriptor = -1;
+
+	if (connection->ssl) {
+		SSL_free(connection->ssl);
+		SSL_CTX_free(connection->ctx);
+		connection->ssl = NULL;
+		connection->ctx = NULL;
+	}
+
+	standby_close(connection, 0);
+	job_release(connection);
+}
+
+
+/*
+ * run_job
+ *
+ * Function that parses the options of a checkout (unless argv is NULL because the
+ * connector is already set up) and runs it.  An error inside it only fails this
+ * checkout: the connector is cleaned up and EXIT_FAILURE returned while the process
+ * and its other threads keep running.
+ */
+
+static int
+run_job(connector *connection, int argc, char **argv)
+{
+	jmp_buf   failure;
+	jmp_buf  *outer;
+	int       status;
+
+	outer = job_failure;
+	job_failure = &failure;
+
+	if (setjmp(failure) == 0) {
+		if (argv)
+			getopts_svn(argc, argv, connection);
+
+		status = run_checkout(connection);
+	} else {
+		job_abandon(connection);
+		status = EXIT_FAILURE;
+	}
+
+	job_failure = outer;
+
+	return (status);
+}
+
+
+/*
+ * manifest_args
+ *
+ * Function that builds the "svn co" command line checking out one manifest entry
+ * and returns the number of arguments.
+ */
+
+static int
+manifest_args(connector *connection, manifest_entry *entry, char **args, char *verbosity, size_t size)
+{
+	int  count;
+
+	snprintf(verbosity, size, "%d", connection->verbosity > 1 ? connection->verbosity - 1 : 0);
+
+	count = 0;
+	args[count++] = "svn";
+	args[count++] = "co";
+	args[count++] = "-v";
+	args[count++] = verbosity;
+
+	if (entry->revision) {
+		args[count++] = "-r";
+		args[count++] = entry->revision;
+	}
+
+	args[count++] = entry->url;
+	args[count++] = entry->path;
+	args[count] = NULL;
+
+	return (count);
+}
+
+
+/*
+ * manifest_start
+ *
+ * Procedure that forks a child checking out one manifest entry.  The child gets the
+ * TLS session last used with the entry's server and returns its own through a pipe.
+ */
+
+static void
+manifest_start(connector *connection, manifest_entry *entry)
+{
+	const unsigned char *data;
+	char                *args[10], verbosity[16];
+	int                  count, descriptors[2];
+
+	if (pipe(descriptors) != 0)
+		job_err(EXIT_FAILURE, "manifest_start pipe");
+
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((entry->pid = fork()) == -1)
+		job_err(EXIT_FAILURE, "manifest_start fork");
+
+	if (entry->pid == 0) {
+		close(descriptors[0]);
+		count = manifest_args(connection, entry, args, verbosity, sizeof(verbosity));
+
+		connector_init(connection);
+		connection->tls_session_pipe = descriptors[1];
+
+		if (entry->host->session) {
+			data = entry->host->session;
+			connection->tls_session = d2i_SSL_SESSION(NULL, &data, entry->host->session_length);
+		}
+
+		exit(run_job(connection, count, args));
+	}
+
+	close(descriptors[1]);
+	entry->pipe = descriptors[0];
+	entry->state = 1;
+	entry->host->running++;
+	clock_gettime(CLOCK_MONOTONIC, &entry->start);
+
+	if (connection->verbosity > 1)
+		printf("# started %s -> %s\n", entry->url, entry->path);
+}
+
+
+/*
+ * manifest_done
+ *
+ * Procedure that records a finished checkout: it keeps the TLS session it handed
+ * back for its server and reports the result and the time it took.
+ */
+
+static void
+manifest_done(connector *connection, manifest_entry *entry, unsigned char *session, int length, int failed)
+{
+	struct timespec  now;
+
+	if (length) {
+		free(entry->host->session);
+		entry->host->session = session;
+		entry->host->session_length = length;
+	} else
+		free(session);
+
+	entry->host->running--;
+	entry->state = 2;
+	entry->status = failed ? 1 : 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (connection->verbosity)
+		printf("# %-6s %8.2fs  %s -> %s\n",
+			entry->status ? "failed" : "ok",
+			(now.tv_sec - entry->start.tv_sec) + (now.tv_nsec - entry->start.tv_nsec) / 1e9,
+			entry->url,
+			entry->path);
+}
+
+
+/*
+ * manifest_finish
+ *
+ * Procedure that collects a finished child and the TLS session it wrote to its pipe.
+ */
+
+static void
+manifest_finish(connector *connection, manifest_entry *entry, int status)
+{
+	unsigned char    buffer[4096];
+	unsigned char   *session;
+	ssize_t          bytes;
+	int              length;
+
+	session = NULL;
+	length = 0;
+
+	while ((bytes = read(entry->pipe, buffer, sizeof(buffer))) != 0) {
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if ((session = realloc(session, length + bytes)) == NULL)
+			job_err(EXIT_FAILURE, "manifest_finish realloc");
+
+		memcpy(session + length, buffer, bytes);
+		length += bytes;
+	}
+
+	close(entry->pipe);
+
+	manifest_done(connection, entry, session, length, !(WIFEXITED(status) && WEXITSTATUS(status) == 0));
+}
+
+
+/*
+ * manifest_thread
+ *
+ * Function run by each worker thread of a --threads batch checkout.  It keeps taking
+ * the next entry whose server has a free slot and checks it out in this process,
+ * until every entry has been started.
+ */
+
+static void *
+manifest_thread(void *data)
+{
+	manifest_pool       *pool = data;
+	manifest_entry      *entry;
+	connector            job;
+	const unsigned char *session;
+	unsigned char       *export, *p;
+	char                *args[10], verbosity[16];
+	size_t               e;
+	int                  count, length, status;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->started < sblist_getsize(pool->entries)) {
+		for (e = 0, entry = NULL; e < sblist_getsize(pool->entries) && entry == NULL; e++) {
+			entry = sblist_get(pool->entries, e);
+
+			if ((entry->state != 0) || (entry->host->running >= pool->connection->host_jobs))
+				entry = NULL;
+		}
+
+		if (entry == NULL) {
+			pthread_cond_wait(&pool->changed, &pool->lock);
+			continue;
+		}
+
+		entry->state = 1;
+		entry->host->running++;
+		pool->started++;
+		clock_gettime(CLOCK_MONOTONIC, &entry->start);
+
+		if (pool->connection->verbosity > 1)
+			printf("# started %s -> %s\n", entry->url, entry->path);
+
+		count = manifest_args(pool->connection, entry, args, verbosity, sizeof(verbosity));
+		connector_init(&job);
+
+		if (entry->host->session) {
+			session = entry->host->session;
+			job.tls_session = d2i_SSL_SESSION(NULL, &session, entry->host->session_length);
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+
+		status = run_job(&job, count, args);
+
+		export = NULL;
+		length = 0;
+
+		if (job.tls_session) {
+			if (((length = i2d_SSL_SESSION(job.tls_session, NULL)) > 0) && ((export = p = malloc(length)) != NULL))
+				i2d_SSL_SESSION(job.tls_session, &p);
+			else
+				length = 0;
+
+			SSL_SESSION_free(job.tls_session);
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		manifest_done(pool->connection, entry, export, length, status != 0);
+		fflush(stdout);
+		pthread_cond_broadcast(&pool->changed);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return (NULL);
+}
+
+
+/*
+ * manifest_threads
+ *
+ * Procedure that checks out all manifest entries on connection->jobs threads of this
+ * process.  The checkouts share nothing but the entry list and the TLS sessions.
+ */
+
+static void
+manifest_threads(connector *connection, sblist *entries)
+{
+	manifest_pool   pool;
+	pthread_attr_t  attributes;
+	pthread_t      *threads;
+	size_t          count, t;
+
+	pool.connection = connection;
+	pool.entries = entries;
+	pool.started = 0;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.changed, NULL);
+
+	/* a server dropping the connection must fail one checkout, not the process */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* some libcs hand out small thread stacks by default */
+	pthread_attr_init(&attributes);
+	pthread_attr_setstacksize(&attributes, 1024 * 1024);
+
+	count = MIN((size_t)connection->jobs, sblist_getsize(entries));
+
+	if ((threads = malloc(count * sizeof(pthread_t))) == NULL)
+		job_err(EXIT_FAILURE, "manifest_threads malloc");
+
+	for (t = 0; t < count; t++)
+		if ((errno = pthread_create(&threads[t], &attributes, manifest_thread, &pool)) != 0)
+			job_err(EXIT_FAILURE, "manifest_threads pthread_create");
+
+	for (t = 0; t < count; t++)
+		pthread_join(threads[t], NULL);
+
+	pthread_attr_destroy(&attributes);
+	pthread_cond_destroy(&pool.changed);
+	pthread_mutex_destroy(&pool.lock);
+	free(threads);
+}
+
+
+/*
+ * run_manifest
+ *
+ * Procedure that checks out every "URL PATH [REVISION]" line of the manifest file,
+ * running at most connection->jobs checkouts at a time and at most
+ * connection->host_jobs of them against the same server.
+ */
+
+static int
+run_manifest(connector *connection)
+{
+	struct timespec   begin, now;
+	manifest_entry   *entry;
+	manifest_host    *host;
+	sblist           *entries, *hosts;
+	FILE             *manifest;
+	char             *line, *url, *path, *revision, *name;
+	size_t            size, e, h, running, finished, failed;
+	pid_t             pid;
+	int               status;
+
+	if (strcmp(connection->manifest, "-") == 0)
+		manifest = stdin;
+	else if ((manifest = fopen(connection->manifest, "r")) == NULL)
+		job_err(EXIT_FAILURE, "%s", connection->manifest);
+
+	entries = sblist_new(sizeof(manifest_entry), 16);
+	hosts = sblist_new(sizeof(manifest_host *), 4);
+	line = NULL;
+	size = 0;
+
+	while (getline(&line, &size, manifest) != -1) {
+		if ((url = strtok(line, " \t\r\n")) == NULL || *url == '#')
+			continue;
+
+		if ((path = strtok(NULL, " \t\r\n")) == NULL)
+			job_errx(EXIT_FAILURE, "%s: no destination for %s", connection->manifest, url);
+
+		revision = strtok(NULL, " \t\r\n");
+
+		/* servers are told apart by host[:port] */
+		name = strstr(url, "://") ? strstr(url, "://") + 3 : url;
+		name = strndup(name, strcspn(name, "/"));
+
+		for (h = 0, host = NULL; h < sblist_getsize(hosts); h++)
+			if (strcmp((*(manifest_host **)sblist_get(hosts, h))->host, name) == 0)
+				host = *(manifest_host **)sblist_get(hosts, h);
+
+		if (host == NULL) {
+			if ((host = calloc(1, sizeof(manifest_host))) == NULL)
+				job_err(EXIT_FAILURE, "run_manifest calloc");
+
+			host->host = name;
+			sblist_add(hosts, &host);
+		} else
+			free(name);
+
+		manifest_entry add = {
+			.url = strdup(url),
+			.path = strdup(path),
+			.revision = revision ? strdup(revision) : NULL,
+			.host = host,
+			.pipe = -1,
+		};
+
+		sblist_add(entries, &add);
+	}
+
+	free(line);
+
+	if (manifest != stdin)
+		fclose(manifest);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	running = finished = failed = 0;
+
+	if (connection->threads) {
+		manifest_threads(connection, entries);
+
+		for (e = 0; e < sblist_getsize(entries); e++, finished++)
+			failed += ((manifest_entry *)sblist_get(entries, e))->status;
+	}
+
+	while (finished < sblist_getsize(entries)) {
+		for (e = 0; e < sblist_getsize(entries) && running < (size_t)connection->jobs; e++) {
+			entry = sblist_get(entries, e);
+
+			if ((entry->state == 0) && (entry->host->running < connection->host_jobs)) {
+				manifest_start(connection, entry);
+				running++;
+			}
+		}
+
+		if ((pid = waitpid(-1, &status, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			job_err(EXIT_FAILURE, "run_manifest waitpid");
+		}
+
+		for (e = 0; e < sblist_getsize(entries); e++) {
+			entry = sblist_get(entries, e);
+
+			if ((entry->state == 1) && (entry->pid == pid)) {
+				manifest_finish(connection, entry, status);
+				failed += entry->status;
+				finished++;
+				running--;
+				break;
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (connection->verbosity)
+		printf("# %zu ok, %zu failed, %.2fs\n",
+			finished - failed,
+			failed,
+			(now.tv_sec - begin.tv_sec) + (now.tv_nsec - begin.tv_nsec) / 1e9);
+
+	for (e = 0; e < sblist_getsize(entries); e++) {
+		entry = sblist_get(entries, e);
+		free(entry->url);
+		free(entry->path);
+		free(entry->revision);
+	}
+
+	for (h = 0; h < sblist_getsize(hosts); h++) {
+		host = *(manifest_host **)sblist_get(hosts, h);
+		free(host->host);
+		free(host->session);
+		free(host);
+	}
+
+	sblist_free(entries);
+	sblist_free(hosts);
+	free(connection->manifest);
+
+	return (failed ? EXIT_FAILURE : 0);
+}
+
+
+/*
+ * svn_item_length
+ *
+ * Function that returns the length of the first complete item (a list or a single
+ * token) buffered in data, 0 if more data is needed and -1 if the data is malformed.
+ */
+
+static ssize_t
+svn_item_length(const char *data, size_t length)
+{
+	size_t  i, n;
+	int     depth;
+
+	for (i = 0, depth = 0; ; ) {
+		while (i < length && (data[i] == ' ' || data[i] == '\n'))
+			i++;
+
+		if (i >= length)
+			return (0);
+
+		if (data[i] == '(') {
+			depth++;
+			i++;
+		} else if (data[i] == ')') {
+			if (--depth < 0)
+				return (-1);
+			i++;
+		} else if (isdigit((unsigned char)data[i])) {
+			for (n = 0; i < length && isdigit((unsigned char)data[i]); i++)
+				n = n * 10 + (data[i] - '0');
+
+			if (i >= length)
+				return (0);
+
+			if (data[i] == ':') {
+				if (length - i - 1 < n)
+					return (0);
+
+				i += n + 1;
+			}
+		} else if (isalpha((unsigned char)data[i])) {
+			while (i < length && (isalnum((unsigned char)data[i]) || data[i] == '-'))
+				i++;
+
+			if (i >= length)
+				return (0);
+		} else
+			return (-1);
+
+		if (depth == 0)
+			return (i);
+	}
+}
+
+
+/*
+ * poll_url_path
+ *
+ * Function that returns a copy of the path of a URL, without leading or trailing
+ * slashes.
+ */
+
+static char *
+poll_url_path(const char *url, size_t length)
+{
+	const char  *p, *end;
+
+	end = url + length;
+
+	for (p = url; p + 3 <= end; p++)
+		if (memcmp(p, "://", 3) == 0) {
+			url = p + 3;
+			break;
+		}
 
-	x = (term_width == -1) ? 1 : 0;
-	if (15 + 2 * file_width + strlen(file_path_target) < (unsigned int)term_width)
-		x = 1;
+	while ((url < end) && (*url != '/'))
+		url++;
 
-	snprintf(temp_buffer,
-		BUFFER_UNIT,
-		"% *d of %d (% 5.1f%%)  %s%s\e[0K\r",
-		file_width,
-		f + 1,
-		file_count,
-		100.0 * f / (double)file_count,
-		(x ? "" : "..."),
-		file_path_target + (x ? 0 : strlen(file_path_target) - term_width + file_width + file_width + 18));
+	while ((url < end) && (*url == '/'))
+		url++;
 
-	fprintf(stderr, "%s", temp_buffer);
-}
+	while ((end > url) && (end[-1] == '/'))
+		end--;
 
-static void
-usage_svn(char *arg0) {
-	fprintf(stderr,
-		"svn-lite version %s by John Mehr & rofl0r\n\n"
-		"Usage: svn command [options] [args]\n\n"
-		"commands:\n\n"
-		"info [options] TARGET\n"
-		"   print some information about TARGET.\n"
-		"   TARGET may either be an URL or a local directory.\n\n"
-		"log [options] TARGET\n"
-		"   print commit log of TARGET\n"
-		"   TARGET may either be an URL or a local directory.\n\n"
-		"checkout/co [options] URL [PATH]\n"
-		"   checkout repository (equivalent to git clone/git pull).\n"
-		"   if PATH is omitted, basename of URL will be used as destination\n"
-		"\n"
-		"options applicable to all commands:\n"
-		"   -r or --revision   NUMBER (default: 0)\n"
-		"   -v or --verbosity  NUMBER (default: 1)\n"
-		, SVNUP_VERSION
-	);
-	exit(EXIT_FAILURE);
+	return (strndup(url, end - url));
 }
 
-static int has_revision_option(enum svn_job mode) {
-	switch(mode) {
-	case SVN_INFO: case SVN_CO: case SVN_LOG:
-		return 1;
-	}
-	return 0;
-}
 
-static char *protocol_check(char *str, connector *connection)
+/*
+ * poll_repo_of
+ *
+ * Function that returns the repository of a server a path lies in, NULL if none of
+ * the repositories found so far contains it.
+ */
+
+static poll_repo *
+poll_repo_of(poll_server *server, const char *path)
 {
-	char *p = strchr(str, ':');
-	if(!p || p[1] != '/' || p[2] != '/') {
-		connection->protocol = NONE;
-		return str;
-	}
-	if(!protocol_from_str(str, connection)) {
-		errx(EXIT_FAILURE, "unknown protocol %s\n", str);
+	poll_repo  *repo;
+	size_t      r, length;
+
+	for (r = 0; r < sblist_getsize(server->repos); r++) {
+		repo = *(poll_repo **)sblist_get(server->repos, r);
+
+		if ((repo->root == NULL) || (repo->dead))
+			continue;
+
+		length = strlen(repo->root);
+
+		if ((length == 0) || ((strncmp(path, repo->root, length) == 0) && (path[length] == '\0' || path[length] == '/')))
+			return (repo);
 	}
-	p += 3;
-	return p;
+
+	return (NULL);
 }
 
 
-static void
-getopts_svn(int argc, char **argv, connector *connection)
+/*
+ * poll_open
+ *
+ * Function that starts a non-blocking connection to a server.  The TLS handshake and
+ * everything after it is driven by poll_step.
+ */
+
+static poll_connection *
+poll_open(poll_server *server)
 {
-	int a = 1;
+	struct addrinfo   hints = { .ai_family = server->family, .ai_socktype = SOCK_STREAM };
+	poll_connection  *connection;
+	char              port[8];
+	int               error;
+
+	if ((connection = calloc(1, sizeof(poll_connection))) == NULL)
+		job_err(EXIT_FAILURE, "poll_open calloc");
+
+	connection->descriptor = -1;
+	connection->state = POLL_CONNECTING;
+	connection->events = POLLOUT;
+	connection->expect = sblist_new(sizeof(poll_expect), 8);
+
+	if (server->addresses == NULL) {
+		snprintf(port, sizeof(port), "%d", server->port);
+
+		if ((error = getaddrinfo(server->address, port, &hints, &server->addresses))) {
+			warnx("%s: %s", server->address, gai_strerror(error));
+			server->addresses = NULL;
+			connection->state = POLL_CLOSED;
+			return (connection);
+		}
+	}
 
-	if(argc < 2) usage_svn(argv[0]);
-	if(!strcmp(argv[a], "checkout") || !strcmp(argv[a], "co"))
-		connection->job = SVN_CO;
-	else if(!strcmp(argv[a], "info"))
-		connection->job = SVN_INFO;
-	else if(!strcmp(argv[a], "log"))
-		connection->job = SVN_LOG;
-	else
-		usage_svn(argv[0]);
-	++a;
-	while(1) {
-		int opt = 0;
-		if(!strcmp(argv[a], "-r") || !strcmp(argv[a], "--revision"))
-			opt = 1;
-		else if(!strcmp(argv[a], "-v") || !strcmp(argv[a], "--verbosity"))
-			opt = 2;
-		if(!opt) break;
-		if(opt == 1 && !has_revision_option(connection->job))
-			usage_svn(argv[0]);
-		++a;
-		if(a >= argc) usage_svn(argv[0]);
-		int n = atoi(argv[a++]);
-		if(opt == 1) connection->revision = n;
-		else if(opt == 2) connection->verbosity = n;
-		if(a >= argc) usage_svn(argv[0]);
+	if ((connection->descriptor = socket(server->addresses->ai_family, server->addresses->ai_socktype, server->addresses->ai_protocol)) < 0)
+		job_err(EXIT_FAILURE, "socket failure");
+
+	fcntl(connection->descriptor, F_SETFL, fcntl(connection->descriptor, F_GETFL) | O_NONBLOCK);
+
+	if ((connect(connection->descriptor, server->addresses->ai_addr, server->addresses->ai_addrlen) != 0) && (errno != EINPROGRESS)) {
+		warn("%s", server->address);
+		connection->state = POLL_CLOSED;
 	}
 
-	char *p = protocol_check(argv[a], connection), *q, *dst;
-	if(connection->job == SVN_CO && connection->protocol == NONE)
-		usage_svn(argv[0]);
-	if(connection->protocol != NONE) {
-		if((q = strchr(p, ':'))) {
-			connection->port = atoi(q+1);
-			*q = 0;
-			connection->address = strdup(p);
-			*q = ':';
-		} else if((q = strchr(p, '/'))) {
-			*q = 0;
-			connection->address = strdup(p);
-			*q = '/';
-		}
-		if(q && *q == ':') q = strchr(q, '/');
-		if(!q) {
-			err(EXIT_FAILURE, "expected '/' in URL!");
-		}
-		p = ++q;
-		connection->branch = strdup(p);
-		if(connection->job == SVN_CO) {
-			if(++a >= argc)
-				dst = basename(connection->branch);
-			else
-				dst = argv[a];
-			connection->path_target = strdup(dst);
+	if ((connection->state != POLL_CLOSED) && (server->protocol == HTTPS)) {
+		if (server->ctx == NULL) {
+			SSL_library_init();
+			SSL_load_error_strings();
+			server->ctx = SSL_CTX_new(SSLv23_client_method());
+			SSL_CTX_set_options(server->ctx, SSL_OP_ALL);
+			SSL_CTX_set_mode(server->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 		}
-	} else {
-		connection->path_target = strdup(argv[a]);
-	}
-	if(++a < argc) usage_svn(argv[0]);
 
-	if(connection->path_target) {
-		char buf[PATH_MAX];
-		snprintf(buf, sizeof buf, "%s/.svnup", connection->path_target);
-		connection->path_work = strdup(buf);
+		if ((connection->ssl = SSL_new(server->ctx)) == NULL)
+			job_err(EXIT_FAILURE, "poll_open: SSL_new");
+
+		SSL_set_tlsext_host_name(connection->ssl, server->address);
+		SSL_set_fd(connection->ssl, connection->descriptor);
 	}
 
-	connection->trim_tree = 1;
+	return (connection);
 }
 
-static void write_info_or_log(connector *connection) {
-	if(connection->job == SVN_LOG) {
-		char deco[73];
-		memset(deco, '-', 72);
-		deco[72] = 0;
-		fprintf(stdout, "%s\n", deco);
-		/* some broken svn repos have empty revisions, and svn log prints only a
-		   single line of decorations, e.g.
 
-		   user@~$ svn log -r 70 svn://repo.hu/genht/trunk
-		   ------------------------------------------------------------------------
-		   user@~$
+/*
+ * poll_close
+ *
+ * Procedure that closes a connection.  Requests still waiting for an answer are made
+ * again in the next round; they only count as failed if the connection never answered
+ * anything.
+ */
 
-		   in case of svn info, the last "good" rev is displayed as "Last Changed Rev"
+static void
+poll_close(poll_server *server, poll_connection *connection)
+{
+	poll_expect  *expect;
+	size_t        e;
 
-		   user@~$ svn info -r 70 svn://repo.hu/genht/trunk
-		   Path: trunk
-		   URL: svn://repo.hu/genht/trunk
-		   Relative URL: ^/trunk
-		   Repository Root: svn://repo.hu/genht
-		   Repository UUID: 050b73db-cdb7-47b8-9107-1ae054b27eea
-		   Revision: 70
-		   Node Kind: directory
-		   Last Changed Author: igor2
-		   Last Changed Rev: 69
-		   Last Changed Date: 2017-06-27 07:06:39 +0000 (Tue, 27 Jun 2017)
-		   user@~$
-		*/
-		if(connection->commit_author) {
-			fprintf(stdout, "r%u | %s | %s |\n\n", connection->revision, connection->commit_author, connection->commit_date);
-			fprintf(stdout, "%s\n%s\n", connection->commit_msg, deco);
-		}
-	} else if(connection->job == SVN_INFO) {
-		fprintf(stdout, "Revision: %u\n", connection->revision);
-		if(connection->commit_author) {
-			fprintf(stdout, "Last Changed Author: %s\n", connection->commit_author);
-			fprintf(stdout, "Last Changed Rev: %u\n", connection->revision);
-			fprintf(stdout, "Last Changed Date: %s +0000\n", connection->commit_date);
-		}
-	} else {
-		assert(0);
-	}
-}
+	for (e = 0; e < sblist_getsize(connection->expect); e++) {
+		expect = sblist_get(connection->expect, e);
 
-static const char* protocol_to_string(int proto) {
-	static const char proto_strmap[][6] = {
-		[SVN] = "svn", [HTTP] = "http", [HTTPS] = "https",
-	};
-	return proto >= SVN && proto <= HTTPS ? proto_strmap[proto] : NULL;
-}
+		if (expect->repo == NULL)
+			continue;
 
-static void save_revision_file(connector *connection, char *svn_version_path) {
-	FILE *f;
-	if (!(f = fopen(svn_version_path, "w")))
-		err(EXIT_FAILURE, "write file failure %s", svn_version_path);
-	const char *ps = protocol_to_string(connection->protocol);
-	fprintf(f, "rev=%u\n", connection->revision);
-	fprintf(f, "url=%s://%s/%s\n", ps, connection->address, connection->branch);
-	fprintf(f, "date=%s\n", connection->commit_date ? connection->commit_date : "");
-	fprintf(f, "author=%s\n", connection->commit_author ? connection->commit_author : "");
-	fprintf(f, "log=%s\n", connection->commit_msg ? connection->commit_msg : "");
-	fclose(f);
-	chmod(svn_version_path, 0644);
-}
+		expect->repo->requested = 0;
 
-static void read_revision_file(connector *connection, char *svn_version_path) {
-	FILE *f = fopen(svn_version_path, "r");
-	char buf[1024];
-	int in_log = 0;
-	if(!f) errx(EXIT_FAILURE, "couldn't open %s", svn_version_path);
-	while(fgets(buf, sizeof buf, f)) {
-		if(in_log) {
-			size_t l = strlen(connection->commit_msg);
-			connection->commit_msg = realloc(connection->commit_msg, l + 1 + sizeof buf);
-			if(l && connection->commit_msg[l-1] == '\n');
-			else { connection->commit_msg[l] = '\n'; ++l; }
-			char *p = strchr(buf, '\n');
-			if(p) *p = 0;
-			memcpy(connection->commit_msg+l, buf, strlen(buf)+1);
-		} else if(!strncmp(buf, "rev=", 4)) {
-			unsigned rev = atoi(buf+4);
-			if(connection->revision && connection->revision != rev)
-				errx(EXIT_FAILURE, "no local date for selected revision available, got %u", rev);
-			connection->revision = rev;
-		} else if(!strncmp(buf, "date=", 5)) {
-			char *p = strchr(buf+5, '\n');
-			if(!p) errx(EXIT_FAILURE, "malformed file %s", svn_version_path);
-			*p = 0;
-			p = buf + 5;
-			if(*p)
-				connection->commit_date = strdup(p);
-		} else if(!strncmp(buf, "author=", 7)) {
-			char *p = strchr(buf+7, '\n');
-			if(!p) errx(EXIT_FAILURE, "malformed file %s", svn_version_path);
-			*p = 0;
-			p = buf+7;
-			if(*p)
-				connection->commit_author = strdup(p);
-		} else if(!strncmp(buf, "log=", 4)) {
-			/* log entry may span multiple lines, therefore is last in file */
-			char *p = strchr(buf+4, '\n');
-			if(p) *p = 0;
-			connection->commit_msg = malloc(strlen(buf+4)+1);
-			memcpy(connection->commit_msg, buf+4, strlen(buf+4)+1);
-			in_log = 1;
-		}
+		if (!connection->answered)
+			expect->repo->errors++;
+
+		/* a repository still being looked for is looked for again from scratch */
+		if (expect->repo->root == NULL)
+			expect->repo->dead = 1;
 	}
-	fclose(f);
+
+	sblist_free(connection->expect);
+
+	if (connection->ssl)
+		SSL_free(connection->ssl);
+
+	if (connection->descriptor != -1)
+		close(connection->descriptor);
+
+	free(connection->in.data);
+	free(connection->out.data);
+
+	if (server->connection == connection)
+		server->connection = NULL;
+
+	free(connection);
 }
 
-static void load_known_files(connector *connection) {
-	struct stat local;
-	int fd;
-	char *md5, *value, *path;
-	size_t length;
-	struct tree_node *data;
 
-	length = strlen(connection->path_work) + MAXNAMLEN;
+/*
+ * poll_response_svn
+ *
+ * Function that handles the next complete svn item of a connection.  Returns the
+ * number of bytes used, 0 if the item is incomplete and -1 if the session failed.
+ */
 
-	connection->known_files_old = (char *)malloc(length);
-	connection->known_files_new = (char *)malloc(length);
+static ssize_t
+poll_response_svn(poll_connection *connection)
+{
+	svn_reader    reader = { .socket_descriptor = -1 };
+	poll_expect  *expect;
+	ssize_t       length;
+	int           success;
 
-	snprintf(connection->known_files_old, length, "%s/known_files", connection->path_work);
-	snprintf(connection->known_files_new, length, "%s/known_files.new", connection->path_work);
+	if ((length = svn_item_length(connection->in.data, connection->in.length)) <= 0)
+		return (length);
 
-	if (stat(connection->known_files_old, &local) != -1) {
-		connection->known_files_size = local.st_size;
+	expect = sblist_get(connection->expect, 0);
 
-		if ((connection->known_files = (char *)malloc(connection->known_files_size + 1)) == NULL)
-			err(EXIT_FAILURE, "connection.known_files malloc");
+	/* the item is complete, so the reader never has to go to the (absent) socket */
+	reader.buffer = connection->in.data;
+	reader.end = reader.capacity = length;
 
-		if ((fd = open(connection->known_files_old, O_RDONLY)) == -1)
-			err(EXIT_FAILURE, "open file (%s)", connection->known_files_old);
+	if (svn_reader_next(&reader) != SVN_TOKEN_OPEN)
+		return (-1);
 
-		if (read(fd, connection->known_files, connection->known_files_size) != connection->known_files_size)
-			err(EXIT_FAILURE, "read file error (%s)", connection->known_files_old);
+	success = (svn_reader_next(&reader) == SVN_TOKEN_WORD && svn_reader_word(&reader, "success"));
 
-		connection->known_files[connection->known_files_size] = '\0';
-		close(fd);
-		value = connection->known_files;
+	if (!success)
+		return (-1);
 
-		while (*value) {
-			md5 = value;
-			path = strchr(value, '\t') + 1;
-			value = strchr(path, '\n');
-			*value++ = '\0';
-			md5[32] = '\0';
-			data = (struct tree_node *)malloc(sizeof(struct tree_node));
-			data->path = strdup(path);
-			data->md5 = strdup(md5);
-			RB_INSERT(tree_known_files, &known_files, data);
-		}
+	if (expect->kind == POLL_REPOS_INFO) {
+		/* ( success ( uuid root-url ( capabilities ) ) ) */
+		svn_reader_expect(&reader, SVN_TOKEN_OPEN);
+		svn_reader_expect(&reader, SVN_TOKEN_STRING);
+		svn_reader_expect(&reader, SVN_TOKEN_STRING);
+
+		expect->repo->root = poll_url_path(reader.string, reader.length);
 	}
+
+	if (expect->kind == POLL_LATEST) {
+		svn_reader_expect(&reader, SVN_TOKEN_OPEN);
+		expect->repo->youngest = svn_reader_number(&reader);
+		expect->repo->requested = 0;
+		connection->answered = 1;
+	}
+
+	sblist_delete(connection->expect, 0);
+
+	return (length);
 }
 
+
 /*
- * main
+ * poll_response_http
  *
- * A lightweight, dependency-free program to pull source from an Apache Subversion server.
+ * Function that handles the next complete http response of a connection.  Returns the
+ * number of bytes used, 0 if the response is incomplete and -1 if the request failed.
  */
 
-int
-main(int argc, char **argv)
+static ssize_t
+poll_response_http(poll_connection *connection)
 {
-	connector connection = {
-		.response_blocks = 16,
-		.verbosity = 1,
-		.family = AF_UNSPEC,
-		.protocol = HTTPS,
-		.socket_descriptor = -1,
-	};
+	poll_expect  *expect;
+	char         *header, *end, *value, saved, buffer[PATH_MAX];
+	size_t        length, chunk;
+	int           chunked, success;
 
-	struct tree_node  *data, *found, *next;
-	file_node        **file;
+	header = connection->in.data;
 
-	char   command[COMMAND_BUFFER + 1], *end;
-	char  *md5, *path, *start, temp_buffer[BUFFER_UNIT], *value;
-	char   svn_version_path[255];
-	int    b;
-	int    c, command_count;
-	int    f, f0, fd, file_count, file_max, length;
+	if ((end = strstr(header, "\r\n\r\n")) == NULL)
+		return (0);
 
-	file = NULL;
+	end += 4;
+	length = end - header;
 
-	file_count = command_count = 0;
-	f = f0 = length = 0;
+	/* only look at the headers of this response, not at the ones pipelined after it */
+	saved = *end;
+	*end = '\0';
 
-	file_max = BUFFER_UNIT;
+	chunked = (http_extract_header_value(header, "Transfer-Encoding", buffer, sizeof(buffer)) && strcmp(buffer, "chunked") == 0);
 
-	if ((file = (file_node **)malloc(file_max * sizeof(file_node **))) == NULL)
-		err(EXIT_FAILURE, "process_directory source malloc");
+	if (http_extract_header_value(header, "Content-Length", buffer, sizeof(buffer)))
+		length += strtoul(buffer, NULL, 10);
 
-	command[0] = '\0';
+	expect = sblist_get(connection->expect, 0);
+	success = (strncmp(header, "HTTP/1.1 2", 10) == 0) && (http_extract_header_value(header, "SVN-Youngest-Rev", buffer, sizeof(buffer)) != NULL);
 
-	getopts_svn(argc, argv, &connection);
+	if (success)
+		expect->repo->youngest = strtoul(buffer, NULL, 10);
 
-	/* Create the destination directories if they doesn't exist. */
+	if ((success) && (expect->repo->root == NULL) && (http_extract_header_value(header, "SVN-Repository-Root", buffer, sizeof(buffer))))
+		expect->repo->root = poll_url_path(buffer, strlen(buffer));
 
-	if(connection.path_target) create_directory(connection.path_target);
-	if(connection.path_work) {
-		create_directory(connection.path_work);
-		snprintf(svn_version_path, sizeof(svn_version_path),
-			"%s/revision", connection.path_work);
-	} else svn_version_path[0] = 0;
+	*end = saved;
 
-	if(connection.protocol == NONE) {
-		read_revision_file(&connection, svn_version_path);
-		write_info_or_log(&connection);
-		return 0;
+	/* the body is of no interest, but has to be skipped */
+	if (chunked) {
+		do {
+			if ((length >= connection->in.length) || (memchr(header + length, '\n', connection->in.length - length) == NULL))
+				return (0);
+
+			chunk = strtoul(header + length, &value, 16);
+			length = strchr(value, '\n') - header + 1 + chunk + 2;
+		} while (chunk);
 	}
 
+	if (length > connection->in.length)
+		return (0);
 
-	/* Load the list of known files and MD5 signatures, if they exist. */
+	if (!success)
+		return (-1);
 
-	if(connection.path_work) {
-		load_known_files(&connection);
+	expect->repo->requested = 0;
+	connection->answered = 1;
+	sblist_delete(connection->expect, 0);
 
-		if ((connection.extra_files) || (connection.trim_tree))
-			find_local_files_and_directories(connection.path_target, "", 1);
-		else
-			find_local_files_and_directories(connection.path_target, "", 0);
-	}
+	return (length);
+}
 
-	/* Initialize connection with the server and get the latest revision number. */
 
-	if ((connection.response = (char *)malloc(connection.response_blocks * BUFFER_UNIT + 1)) == NULL)
-		err(EXIT_FAILURE, "main connection.response malloc");
+/*
+ * poll_step
+ *
+ * Function that moves a connection along as far as it can go without blocking: it
+ * finishes the connect and TLS handshake, writes what is queued and handles the
+ * responses that have arrived.  Returns 0 once the connection has to be closed.
+ */
 
-	reset_connection(&connection);
+static int
+poll_step(poll_server *server, poll_connection *connection)
+{
+	char       input[BUFFER_UNIT];
+	socklen_t  size;
+	ssize_t    bytes, used;
+	int        error;
 
-	/* Send initial response string. */
+	connection->events = 0;
 
-	if (connection.protocol == SVN) {
-		connection.response_groups = 1;
-		process_command_svn(&connection, "", 0);
+	if (connection->state == POLL_CONNECTING) {
+		size = sizeof(error);
 
-		snprintf(command,
-			COMMAND_BUFFER,
-			"( 2 ( edit-pipeline svndiff1 absent-entries commit-revprops depth log-revprops atomic-revprops partial-replay ) %ld:svn://%s/%s %ld:svnup-%s ( ) )\n",
-			strlen(connection.address) + strlen(connection.branch) + 7,
-			connection.address,
-			connection.branch,
-			strlen(SVNUP_VERSION) + 6,
-			SVNUP_VERSION);
+		if ((getsockopt(connection->descriptor, SOL_SOCKET, SO_ERROR, &error, &size) != 0) || (error)) {
+			warnx("%s: %s", server->address, strerror(error));
+			return (0);
+		}
 
-		process_command_svn(&connection, command, 0);
+		connection->state = (connection->ssl ? POLL_TLS : POLL_OPEN);
+	}
 
-		start = connection.response;
-		end = connection.response + connection.response_length;
-		if (check_command_success(connection.protocol, &start, &end))
-			exit(EXIT_FAILURE);
+	if (connection->state == POLL_TLS) {
+		if ((error = SSL_connect(connection->ssl)) != 1) {
+			error = SSL_get_error(connection->ssl, error);
 
-		/* Login anonymously. */
+			if ((error != SSL_ERROR_WANT_READ) && (error != SSL_ERROR_WANT_WRITE)) {
+				warnx("%s: TLS handshake failed", server->address);
+				return (0);
+			}
 
-		connection.response_groups = 2;
-		process_command_svn(&connection, "( ANONYMOUS ( 0: ) )\n", 0);
+			connection->events = (error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT);
+			return (1);
+		}
 
-		/* Get latest revision number. */
+		connection->state = POLL_OPEN;
+	}
 
-		if (connection.revision <= 0) {
-			process_command_svn(&connection, "( get-latest-rev ( ) )\n", 0);
+	while (connection->out_sent < connection->out.length) {
+		if (connection->ssl)
+			bytes = SSL_write(connection->ssl,
+				connection->out.data + connection->out_sent,
+				connection->out.length - connection->out_sent);
+		else
+			bytes = write(connection->descriptor,
+				connection->out.data + connection->out_sent,
+				connection->out.length - connection->out_sent);
 
-			start = connection.response;
-			end = connection.response + connection.response_length;
-			if (check_command_success(connection.protocol, &start, &end))
-				exit(EXIT_FAILURE);
+		if (bytes <= 0) {
+			if ((connection->ssl) && (SSL_get_error(connection->ssl, bytes) == SSL_ERROR_WANT_READ)) {
+				connection->events |= POLLIN;
+				break;
+			}
 
-			if ((start != NULL) && starts_with_lit(start, "( success ( ")) {
-				start += LIT_LEN("( success ( ");
-				value = start;
-				while (*start != ' ') start++;
-				*start = '\0';
+			if (((connection->ssl) && (SSL_get_error(connection->ssl, bytes) == SSL_ERROR_WANT_WRITE)) ||
+			    ((!connection->ssl) && ((errno == EAGAIN) || (errno == EINTR)))) {
+				connection->events |= POLLOUT;
+				break;
+			}
 
-				connection.revision = strtol(value, (char **)NULL, 10);
-			} else errx(EXIT_FAILURE, "Cannot retrieve latest revision.");
+			return (0);
 		}
 
-		/* Check to make sure client-supplied remote path is a directory. */
+		connection->out_sent += bytes;
+	}
 
-		snprintf(command,
-			COMMAND_BUFFER,
-			"( check-path ( 0: ( %d ) ) )\n",
-			connection.revision);
-		process_command_svn(&connection, command, 0);
+	if (connection->out_sent == connection->out.length)
+		connection->out_sent = connection->out.length = 0;
 
-		if ((strcmp(connection.response, "( success ( ( ) 0: ) )") != 0) &&
-		    (strcmp(connection.response + 23, "( success ( dir ) ) ") != 0))
-			errx(EXIT_FAILURE,
-				"Remote path %s is not a repository directory.\n%s",
-				connection.branch,
-				connection.response);
+	while (1) {
+		if (connection->ssl)
+			bytes = SSL_read(connection->ssl, input, sizeof(input));
+		else
+			bytes = read(connection->descriptor, input, sizeof(input));
 
-		process_log_svn(&connection);
-	}
+		if (bytes > 0) {
+			dump_buffer_add(&connection->in, input, bytes);
+			continue;
+		}
 
-	else if (connection.protocol >= HTTP) {
-		char url[512];
-		static const char *footer =
-			"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-			"<D:options xmlns:D=\"DAV:\">"
-			"<D:activity-collection-set></D:activity-collection-set>"
-			"</D:options>\r\n";
+		if ((connection->ssl) && (SSL_get_error(connection->ssl, bytes) == SSL_ERROR_WANT_READ))
+			break;
 
-		snprintf(url, sizeof url, "/%s", connection.branch);
-		craft_http_packet(connection.address, url, "OPTIONS", footer, command);
-		connection.response_groups = 2;
-		process_command_http(&connection, command);
+		if ((connection->ssl) && (SSL_get_error(connection->ssl, bytes) == SSL_ERROR_WANT_WRITE)) {
+			connection->events |= POLLOUT;
+			break;
+		}
 
-		/* Get the latest revision number. */
+		if ((!connection->ssl) && (bytes < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+			break;
 
-		if (connection.revision <= 0) {
-			if ((value = strstr(connection.response, "SVN-Youngest-Rev: ")) == NULL)
-				errx(EXIT_FAILURE, "Cannot find revision number.");
-			else
-				connection.revision = strtol(value + 18, (char **)NULL, 10);
-		}
+		/* the server hung up, what it sent before still counts */
+		connection->state = POLL_CLOSED;
+		break;
+	}
 
-		char buf[1024];
-		if(!http_extract_header_value(connection.response, "SVN-Repository-Root", buf, sizeof  buf)) {
-			errx(EXIT_FAILURE, "Cannot find SVN Repository Root.");
-		}
-		assert(buf[0] == '/');
-		connection.root = strdup(buf + 1 /* skip leading '/' */);
-		if ((path = strstr(connection.branch, connection.root))) {
-			if(strlen(connection.branch) == strlen(connection.root))
-				path = "";
-			else
-				path += strlen(connection.root) + 1;
-		}
-		else errx(EXIT_FAILURE, "Cannot find SVN Repository Trunk.");
+	while (sblist_getsize(connection->expect) && connection->in.length) {
+		if (server->protocol == SVN)
+			used = poll_response_svn(connection);
+		else
+			used = poll_response_http(connection);
 
-		connection.trunk = strdup(path);
+		if (used < 0)
+			return (0);
 
-		if(http_extract_header_value(connection.response, "SVN-Rev-Root-Stub", buf, sizeof  buf)) {
-			assert(buf[0] == '/');
-			connection.rev_root_stub = strdup(buf);
-		}
+		if (used == 0)
+			break;
 
-		if(connection.rev_root_stub) process_log_http(&connection);
+		memmove(connection->in.data, connection->in.data + used, connection->in.length - used + 1);
+		connection->in.length -= used;
 	}
 
-	if (connection.job == SVN_LOG || connection.job == SVN_INFO) {
-		write_info_or_log(&connection);
-		return 0;
-	}
+	if (connection->state == POLL_CLOSED)
+		return (0);
 
-	if (connection.verbosity)
-		printf("# Revision: %d\n", connection.revision);
+	if (sblist_getsize(connection->expect))
+		connection->events |= POLLIN;
 
-	if (connection.verbosity > 1) {
-		fprintf(stderr, "# Protocol: %s\n", protocol_to_string(connection.protocol));
-		fprintf(stderr, "# Address: %s\n", connection.address);
-		fprintf(stderr, "# Port: %d\n", connection.port);
-		fprintf(stderr, "# Branch: %s\n", connection.branch);
-		fprintf(stderr, "# Target: %s\n", connection.path_target);
-		fprintf(stderr, "# Trim tree: %s\n", connection.trim_tree ? "Yes" : "No");
-		fprintf(stderr, "# Show extra files: %s\n", connection.extra_files ? "Yes" : "No");
-		fprintf(stderr, "# Known files directory: %s\n", connection.path_work);
-	}
+	return (1);
+}
 
-	/* at this point, we're checking out a revision, so we request report(s) containing
-	   the names of all files and dirs in that revision, including some additional
-	   properties that vary among protocol and features of the server */
 
-	if (connection.protocol == SVN) {
-		connection.response_groups = 2;
+/*
+ * poll_request
+ *
+ * Procedure that queues the request for the youngest revision of a repository.  On
+ * svn:// a repository not found yet gets a session of its own, which tells its root
+ * as part of the handshake; on http(s):// it is asked for through the URL of the
+ * target that led to it.
+ */
 
-		snprintf(command,
-			COMMAND_BUFFER,
-			"( get-dir ( 0: ( %d ) false true ( kind size ) false ) )\n",
-			connection.revision);
+static void
+poll_request(poll_server *server, poll_repo *repo, poll_target *target)
+{
+	poll_connection  *connection;
+	poll_expect       expect = { .repo = repo };
+	char              command[COMMAND_BUFFER + 1], url[PATH_MAX];
+	const char       *path;
+
+	repo->requested = 1;
+	path = repo->root ? repo->root : target->path;
+
+	if (server->protocol == SVN) {
+		if (repo->connection == NULL) {
+			repo->connection = connection = poll_open(server);
+
+			snprintf(url, sizeof(url), "svn://%s/%s", server->host, path);
+			snprintf(command,
+				COMMAND_BUFFER,
+				"( 2 ( edit-pipeline svndiff1 absent-entries depth log-revprops ) %zu:%s %zu:svnup-%s ( ) )\n"
+				"( ANONYMOUS ( 0: ) )\n",
+				strlen(url),
+				url,
+				strlen(SVNUP_VERSION) + 6,
+				SVNUP_VERSION);
+
+			dump_buffer_add(&connection->out, command, strlen(command));
+
+			/* greeting, mechanisms, auth result, repository info */
+			expect.kind = POLL_SKIP;
+			sblist_add(connection->expect, &expect);
+			sblist_add(connection->expect, &expect);
+			sblist_add(connection->expect, &expect);
+			expect.kind = POLL_REPOS_INFO;
+			sblist_add(connection->expect, &expect);
+		}
 
-		process_report_svn(&connection, command, &file, &file_count, &file_max);
+		connection = repo->connection;
+		dump_buffer_add(&connection->out, "( get-latest-rev ( ) )\n", 23);
+
+		expect.kind = POLL_SKIP;
+		sblist_add(connection->expect, &expect);
+		expect.kind = POLL_LATEST;
+		sblist_add(connection->expect, &expect);
+	} else {
+		if (server->connection == NULL)
+			server->connection = poll_open(server);
+
+		connection = server->connection;
+
+		snprintf(url, sizeof(url), "/%s", path);
+		craft_http_packet(server->address, url, "OPTIONS", http_options_footer, command);
+		dump_buffer_add(&connection->out, command, strlen(command));
+
+		expect.kind = POLL_OPTIONS;
+		sblist_add(connection->expect, &expect);
 	}
+}
 
-	if (connection.protocol >= HTTP) {
-		process_report_http(&connection, &file, &file_count, &file_max);
 
-		start = connection.response;
-		end = connection.response + connection.response_length;
-		if (check_command_success(connection.protocol, &start, &end))
-			exit(EXIT_FAILURE);
+/*
+ * poll_sweep
+ *
+ * Procedure that finds the youngest revision of every target.  It goes in rounds: each
+ * round asks every server, all at once, for the repositories that are known and for
+ * one target per top level directory whose repository is not, until every target has
+ * an answer or has failed three times.
+ */
+
+static void
+poll_sweep(connector *connection, sblist *servers, sblist *targets)
+{
+	struct pollfd     *descriptors;
+	poll_connection  **active;
+	poll_server       *server;
+	poll_target       *target, *other;
+	poll_repo         *repo;
+	size_t             s, r, t, o, count, pending;
+	int                ready;
+
+	for (s = 0; s < sblist_getsize(servers); s++) {
+		server = *(poll_server **)sblist_get(servers, s);
+
+		for (r = 0; r < sblist_getsize(server->repos); r++) {
+			repo = *(poll_repo **)sblist_get(server->repos, r);
+			repo->youngest = 0;
+			repo->errors = 0;
+		}
 	}
 
-	/* if we have received the md5 checksum already, filter out the files that
-	   exist locally and have a matching checksum, so we don't need to download them,
-	   nor request additional properties about them. */
-	for (f = 0; f < file_count; ++f) {
-		check_md5(&connection, file[f]);
+	for (t = 0; t < sblist_getsize(targets); t++) {
+		target = sblist_get(targets, t);
+		target->youngest = 0;
+		target->errors = 0;
 	}
 
-	/* Get additional file information not contained in the first report and store the
-	   commands in a list. */
+	descriptors = NULL;
+	active = NULL;
 
-	stringlist *buffered_commands = stringlist_new(32);
+	while (1) {
+		pending = 0;
 
-	/* only retrieve additional information about files
-	   if we haven't received inline props already */
-	if (!connection.inline_props)
-	for (f = 0; f < file_count; f++) {
-		temp_buffer[0] = '\0';
+		for (t = 0; t < sblist_getsize(targets); t++) {
+			target = sblist_get(targets, t);
+			server = target->server;
 
-		if (connection.protocol == SVN)
-			snprintf(temp_buffer,
-				BUFFER_UNIT,
-				"( get-file ( %zd:%s ( %d ) true false false ) )\n",
-				strlen(file[f]->path),
-				file[f]->path,
-				connection.revision);
+			if ((target->youngest) || (target->errors >= 3))
+				continue;
 
-		if (connection.protocol >= HTTP) {
-			if (file[f]->download) {
-				snprintf(temp_buffer,
-					BUFFER_UNIT,
-					"PROPFIND %s HTTP/1.1\r\n"
-					"Depth: 1\r\n"
-					"Host: %s\r\n\r\n",
-					file[f]->href,
-					connection.address);
+			if ((repo = poll_repo_of(server, target->path)) != NULL) {
+				if (repo->errors >= 3) {
+					target->errors = repo->errors;
+					continue;
+				}
+
+				if (repo->youngest) {
+					target->youngest = repo->youngest;
+					continue;
+				}
+
+				if (!repo->requested)
+					poll_request(server, repo, target);
+
+				pending++;
+				continue;
 			}
-		}
 
-		if (temp_buffer[0] != '\0') {
-			stringlist_add_dup(buffered_commands, temp_buffer);
+			/* one lookup per top level directory and round, its root may cover the rest */
+			for (o = 0; o < t; o++) {
+				other = sblist_get(targets, o);
+
+				if ((other->server == server) && (other->looking) &&
+				    (strcspn(other->path, "/") == strcspn(target->path, "/")) &&
+				    (strncmp(other->path, target->path, strcspn(target->path, "/")) == 0))
+					break;
+			}
+
+			if (o < t) {
+				pending++;
+				continue;
+			}
+
+			if ((repo = calloc(1, sizeof(poll_repo))) == NULL)
+				job_err(EXIT_FAILURE, "poll_sweep calloc");
+
+			sblist_add(server->repos, &repo);
+			target->looking = repo;
+			poll_request(server, repo, target);
+			pending++;
 		}
-	}
 
-	/* Process the additional commands to retrieve extended attributes.
-	   In case of SVN, this includes the md5 checksum and special(i.e. symlink)
-	   and executable properties, for HTTP only the latter 2 plus filesize. */
+		if (pending == 0)
+			break;
 
-#define MAX_HTTP_REQUESTS_PER_PACKET 95
+		/* Run the round. */
 
-	char *chain;
-	size_t chain_count = connection.protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
-	f = f0 = 0;
-	while ((chain = concat_stringlist(buffered_commands, BUFFER_UNIT, &chain_count))) {
-		size_t chain_items = chain_count;
-		chain_count = connection.protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
-		connection.response_groups = chain_items * 2;
+		while (1) {
+			count = 0;
 
-		if (connection.protocol >= HTTP)
-			process_command_http(&connection, chain);
+			for (s = 0; s < sblist_getsize(servers); s++) {
+				server = *(poll_server **)sblist_get(servers, s);
 
-		if (connection.protocol == SVN)
-			process_command_svn(&connection, chain, 0);
+				for (r = 0; r <= sblist_getsize(server->repos); r++) {
+					poll_connection *c = (r < sblist_getsize(server->repos))
+						? (*(poll_repo **)sblist_get(server->repos, r))->connection
+						: server->connection;
 
-		free(chain);
+					if ((c == NULL) || ((c->state == POLL_OPEN) && (sblist_getsize(c->expect) == 0) && (c->out.length == 0)))
+						continue;
 
-		start = connection.response;
-		end = start + connection.response_length;
+					if (c->state == POLL_CLOSED || (c->events == 0 && !poll_step(server, c))) {
+						for (o = 0; o < sblist_getsize(server->repos); o++) {
+							repo = *(poll_repo **)sblist_get(server->repos, o);
+							if (repo->connection == c) repo->connection = NULL;
+						}
+						poll_close(server, c);
+						continue;
+					}
 
-		command[0] = '\0';
-		connection.response_groups = 0;
+					if (c->events == 0)
+						continue;
 
-		for (length = 0, c = 0; c < chain_items; c++) {
-			if (connection.protocol >= HTTP)
-			while (f < file_count && file[f]->download == 0) {
-				/* on http, skip files that already had their md5 checked,
-				   therefore no PROPFIND request was submitted,
-				   so they're not in the chain */
-				if (connection.verbosity > 1)
-					progress_indicator(&connection, file[f]->path, f, file_count);
+					if ((active = realloc(active, (count + 1) * sizeof(poll_connection *))) == NULL ||
+					    (descriptors = realloc(descriptors, (count + 1) * sizeof(struct pollfd))) == NULL)
+						job_err(EXIT_FAILURE, "poll_sweep realloc");
 
-				f++;
+					active[count] = c;
+					descriptors[count].fd = c->descriptor;
+					descriptors[count].events = c->events;
+					descriptors[count].revents = 0;
+					count++;
+				}
 			}
 
-			if (check_command_success(connection.protocol, &start, &end))
-				exit(EXIT_FAILURE);
+			if (count == 0)
+				break;
+
+			if ((ready = poll(descriptors, count, POLL_TIMEOUT * 1000)) < 0) {
+				if (errno == EINTR)
+					continue;
 
-			if (connection.protocol >= HTTP)
-				parse_response_group(&connection, &start, &end);
+				job_err(EXIT_FAILURE, "poll");
+			}
 
-			if (connection.protocol == SVN)
-				end = strchr(start, '\0');
+			/* a server that has not said anything for too long is given up on */
+			for (s = 0; s < count; s++) {
+				if ((ready == 0) || (descriptors[s].revents))
+					active[s]->events = 0;
 
-			parse_additional_attributes(&connection, start, end, file[f]);
+				if (ready == 0)
+					active[s]->state = POLL_CLOSED;
+			}
+		}
 
-			if (connection.verbosity > 1)
-				progress_indicator(&connection, file[f]->path, f, file_count);
+		for (t = 0; t < sblist_getsize(targets); t++) {
+			target = sblist_get(targets, t);
 
-			start = end + 1;
-			f++;
+			if ((target->looking) && (target->looking->dead || target->looking->root == NULL))
+				target->errors++;
+
+			target->looking = NULL;
 		}
 	}
-	stringlist_free(buffered_commands);
 
-	/* check md5 again for those still unchecked; in case we only retrieved
-	   the checked-in file's checksum right now via additional attributes. */
-	for (f = 0; f < file_count; ++f) {
-		check_md5(&connection, file[f]);
-	}
+	free(descriptors);
+	free(active);
 
-	buffered_commands = stringlist_new(64);
+	if (connection->verbosity > 1)
+		for (t = 0; t < sblist_getsize(targets); t++) {
+			target = sblist_get(targets, t);
+			fprintf(stderr, "# %s %u\n", target->url, target->youngest);
+		}
+}
 
-	for (f=0; f < file_count; ++f) {
-		if (file[f]->download) {
-			if (connection.protocol >= HTTP)
-				snprintf(temp_buffer,
-					BUFFER_UNIT,
-					"GET %s HTTP/1.1\r\n"
-					"Host: %s\r\n"
-					"Connection: Keep-Alive\r\n\r\n",
-					file[f]->href,
-					connection.address);
 
-			if (connection.protocol == SVN)
-				snprintf(temp_buffer,
-					BUFFER_UNIT,
-					"( get-file ( %zd:%s ( %d ) false true false ) )\n",
-					strlen(file[f]->path),
-					file[f]->path,
-					connection.revision);
+/*
+ * poll_state
+ *
+ * Procedure that loads (save == 0) or saves the last revision seen for every target.
+ */
+
+static void
+poll_state(connector *connection, sblist *targets, int save)
+{
+	poll_target  *target;
+	FILE         *state;
+	char         *line, *space, temp[PATH_MAX];
+	size_t        size, t;
+
+	if (save) {
+		snprintf(temp, sizeof(temp), "%s.new", connection->poll_state);
+
+		if ((state = fopen(temp, "w")) == NULL)
+			job_err(EXIT_FAILURE, "%s", temp);
 
-			stringlist_add_dup(buffered_commands, temp_buffer);
+		for (t = 0; t < sblist_getsize(targets); t++) {
+			target = sblist_get(targets, t);
+
+			if (target->revision)
+				fprintf(state, "%s %u\n", target->url, target->revision);
 		}
+
+		if (fclose(state) != 0)
+			job_err(EXIT_FAILURE, "%s", temp);
+
+		if (rename(temp, connection->poll_state) != 0)
+			job_err(EXIT_FAILURE, "Cannot rename %s", temp);
+
+		return;
 	}
 
-	/* download the actual files missing from tree */
-	chain_count = connection.protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
-	f = f0 = 0;
-	while ((chain = concat_stringlist(buffered_commands, BUFFER_UNIT, &chain_count))) {
-		size_t chain_items = chain_count;
-		size_t file_incs = 0;
-		chain_count = connection.protocol >= HTTP ? MAX_HTTP_REQUESTS_PER_PACKET : 0;
-		connection.response_groups = chain_items * 2;
+	if ((state = fopen(connection->poll_state, "r")) == NULL)
+		return;
 
-		while (f < file_count && file_incs < chain_items) {
-			if(file[f]->download != 0) ++file_incs;
-			++f;
-		}
-		get_files(&connection, chain, connection.path_target,
-				file, f0, f - 1);
+	line = NULL;
+	size = 0;
+
+	while (getline(&line, &size, state) != -1) {
+		if ((space = strrchr(line, ' ')) == NULL)
+			continue;
 
-		if ((connection.verbosity > 1) && (f < file_count))
-			progress_indicator(&connection, file[f]->path, f, file_count);
+		*space++ = '\0';
 
-		f0 = f;
-		free(chain);
+		for (t = 0; t < sblist_getsize(targets); t++) {
+			target = sblist_get(targets, t);
+
+			if (strcmp(target->url, line) == 0)
+				target->revision = strtoul(space, NULL, 10);
+		}
 	}
-	stringlist_free(buffered_commands);
 
-	save_known_file_list(&connection, file, file_count);
+	free(line);
+	fclose(state);
+}
 
-	/* Save details about the current revision */
-	save_revision_file(&connection, svn_version_path);
 
-	/* Any files left in the tree are safe to delete. */
+/*
+ * poll_svn
+ *
+ * Procedure that watches the youngest revision of every URL in the list file and prints
+ * "URL REVISION" for those that moved on since the last sweep.  With an interval it
+ * sweeps again and again, keeping its connections open in between.
+ */
 
-	for (data = RB_MIN(tree_known_files, &known_files); data != NULL; data = next) {
-		next = RB_NEXT(tree_known_files, head, data);
+static int
+poll_svn(connector *connection)
+{
+	struct timespec   begin, now;
+	connector         url;
+	poll_server      *server;
+	poll_target       target;
+	sblist           *servers, *targets;
+	FILE             *list;
+	char             *line, *host, *p, *q;
+	size_t            size, s, t;
+	long              wait;
+	int               failed;
+
+	if (strcmp(connection->poll_list, "-") == 0)
+		list = stdin;
+	else if ((list = fopen(connection->poll_list, "r")) == NULL)
+		job_err(EXIT_FAILURE, "%s", connection->poll_list);
+
+	servers = sblist_new(sizeof(poll_server *), 8);
+	targets = sblist_new(sizeof(poll_target), 64);
+	line = NULL;
+	size = 0;
+
+	while (getline(&line, &size, list) != -1) {
+		if ((p = strtok(line, " \t\r\n")) == NULL || *p == '#')
+			continue;
 
-		if ((found = RB_FIND(tree_local_files, &local_files, data)) != NULL)
-			tree_node_free(RB_REMOVE(tree_local_files, &local_files, found));
+		memset(&url, 0, sizeof(url));
+		memset(&target, 0, sizeof(target));
+		target.url = strdup(p);
 
-		if (strncmp(connection.path_work, data->path, strlen(connection.path_work)))
-			prune(&connection, data->path);
+		if (((q = protocol_check(p, &url)) == p) || (url.protocol == LOCAL)) {
+			warnx("%s: not an svn://, http:// or https:// URL", target.url);
+			free(target.url);
+			continue;
+		}
 
-		tree_node_free(RB_REMOVE(tree_known_files, &known_files, data));
-	}
+		/* host[:port]/path */
+		p = q + strcspn(q, "/");
+		host = strndup(q, p - q);
 
-	if (connection.verbosity > 1)
-		printf("\r\e[0K\r");
+		if ((q = strchr(host, ':')) != NULL)
+			url.port = strtoul(q + 1, NULL, 10);
 
-	/* Print/prune any local files left. */
+		url.address = strndup(host, strcspn(host, ":"));
+		target.path = poll_url_path(p, strlen(p));
 
-	for (data = RB_MIN(tree_local_files, &local_files); data != NULL; data = next) {
-		next = RB_NEXT(tree_local_files, head, data);
+		for (s = 0, server = NULL; s < sblist_getsize(servers); s++) {
+			server = *(poll_server **)sblist_get(servers, s);
 
-		if (connection.trim_tree) {
-			/* exempt .git/ from being removed, as it may be used by svn2git tool */
-			if(!strncmp(data->path, "/.git/", 6)) goto no_prune;
+			if ((server->protocol == url.protocol) && (strcmp(server->host, host) == 0))
+				break;
 
-			char buf[1024];
-			snprintf(buf, sizeof buf, "%s%s", connection.path_target, data->path);
-			if (strncmp(connection.path_work, buf, strlen(connection.path_work)))
-				prune(&connection, data->path);
+			server = NULL;
+		}
+
+		if (server == NULL) {
+			if ((server = calloc(1, sizeof(poll_server))) == NULL)
+				job_err(EXIT_FAILURE, "poll_svn calloc");
+
+			server->protocol = url.protocol;
+			server->port = url.port;
+			server->family = connection->family;
+			server->host = host;
+			server->address = url.address;
+			server->repos = sblist_new(sizeof(poll_repo *), 8);
+			sblist_add(servers, &server);
 		} else {
-			if (connection.extra_files)
-				fprintf(stderr, " * %s%s\n", connection.path_target, data->path);
+			free(url.address);
+			free(host);
 		}
 
-	no_prune:;
-		tree_node_free(RB_REMOVE(tree_local_files, &local_files, data));
+		target.server = server;
+		sblist_add(targets, &target);
 	}
 
-	/* Prune any empty local directories not found in the repository. */
+	free(line);
 
-	if (connection.verbosity > 1)
-		fprintf(stderr, "\e[0K\r");
+	if (list != stdin)
+		fclose(list);
 
-	for (data = RB_MAX(tree_local_directories, &local_directories); data != NULL; data = next) {
-		next = RB_PREV(tree_local_directories, head, data);
+	poll_state(connection, targets, 0);
 
-		char buf[1024];
-		snprintf(buf, sizeof buf, "%s/.git/", connection.path_target);
+	/* a server closing an idle connection shows up as a failed write */
+	signal(SIGPIPE, SIG_IGN);
 
-		if (strncmp(data->path, buf, strlen(buf)) && rmdir(data->path) == 0)
-			fprintf(stderr, " = %s\n", data->path);
+	while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &begin);
 
-		tree_node_free(RB_REMOVE(tree_local_directories, &local_directories, data));
-	}
+		poll_sweep(connection, servers, targets);
+		failed = 0;
 
-	/* Wrap it all up. */
+		for (t = 0; t < sblist_getsize(targets); t++) {
+			poll_target *polled = sblist_get(targets, t);
 
-	if (close(connection.socket_descriptor) != 0)
-		if (errno != EBADF)
-			err(EXIT_FAILURE, "close connection failed");
+			if (polled->youngest == 0) {
+				warnx("%s: no answer", polled->url);
+				failed++;
+			} else if (polled->youngest > polled->revision) {
+				printf("%s %u\n", polled->url, polled->youngest);
+				polled->revision = polled->youngest;
+			}
+		}
 
-	remove(connection.known_files_old);
+		fflush(stdout);
+		poll_state(connection, targets, 1);
 
-	if ((rename(connection.known_files_new, connection.known_files_old)) != 0)
-		err(EXIT_FAILURE, "Cannot rename %s", connection.known_files_old);
+		if (connection->interval <= 0)
+			break;
 
-	if (connection.address)
-		free(connection.address);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		wait = connection->interval * 1000L - ((now.tv_sec - begin.tv_sec) * 1000L + (now.tv_nsec - begin.tv_nsec) / 1000000);
 
-	if (connection.root)
-		free(connection.root);
+		if (wait > 0)
+			poll(NULL, 0, wait);
+	}
 
-	if (connection.trunk)
-		free(connection.trunk);
+	return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
 
-	if (connection.branch)
-		free(connection.branch);
 
-	if (connection.known_files)
-		free(connection.known_files);
+/*
+ * main
+ *
+ * A lightweight, dependency-free program to pull source from an Apache Subversion server.
+ */
 
-	if (connection.path_target)
-		free(connection.path_target);
+int
+main(int argc, char **argv)
+{
+	connector connection;
 
-	if (connection.path_work)
-		free(connection.path_work);
+	connector_init(&connection);
+	getopts_svn(argc, argv, &connection);
 
-	if (connection.ssl) {
-		SSL_shutdown(connection.ssl);
-		SSL_CTX_free(connection.ctx);
-		SSL_free(connection.ssl);
-	}
+	if (connection.manifest)
+		return (run_manifest(&connection));
 
-	free(connection.commit_author);
-	free(connection.commit_msg);
-	free(connection.commit_date);
+	if (connection.job == SVN_PROXY)
+		proxy_svn(&connection);
 
-	free(connection.known_files_old);
-	free(connection.known_files_new);
-	free(connection.response);
-	free(file);
+	if (connection.job == SVN_POLL)
+		return (poll_svn(&connection));
 
-	return (0);
+	return (run_job(&connection, 0, NULL));
 }
-
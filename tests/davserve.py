@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# davserve.py PORT : serves the repository model in model.py the way mod_dav_svn does,
+# enough of it for svn-lite.  PORT 0 picks a free port; the port is printed.
+# DAV_KEEPALIVE_MAX=N closes connections after N requests, DAV_INLINE=1 sends
+# properties inline in the update report, DAV_STALL=a,b stalls the a-th, b-th
+# response halfway through and DAV_LOG=FILE logs the requests.
+import socket, sys, threading, os, re, calendar, time as _t
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from model import REVS, md5, last_changed
+
+LOG = open(os.environ['DAV_LOG'], 'a', buffering=1) if os.environ.get('DAV_LOG') else None
+def log(line):
+    if LOG: LOG.write(line + '\n')
+KMAX = int(os.environ.get('DAV_KEEPALIVE_MAX', '0'))
+INLINE = os.environ.get('DAV_INLINE', '0') == '1'
+STATS = {'conns': 0}
+STALL = [[int(x) for x in os.environ.get('DAV_STALL', '0').split(',') if x != '0'], 0]
+
+def lc(path, rev): return last_changed(path, rev)
+def httpdate(path, rev):
+    d = REVS[lc(path, rev)]['date']
+    return _t.strftime('%a, %d %b %Y %H:%M:%S GMT', _t.gmtime(calendar.timegm(_t.strptime(d[:19], '%Y-%m-%dT%H:%M:%S'))))
+
+def resp(status, body, extra=''):
+    if isinstance(body, str): body = body.encode()
+    return (b'HTTP/1.1 %s\r\nServer: mock\r\n%sContent-Length: %d\r\n\r\n' % (status.encode(), extra.encode(), len(body))) + body
+
+def parse_rv(url):
+    mm = re.match(r'^/repo/!svn/(ver|rvr)/(\d+)(/.*)?$', url)
+    if not mm: return None
+    return int(mm.group(2)), (mm.group(3) or '').strip('/')
+
+def handle(c):
+    STATS['conns'] += 1
+    log('CONNECT')
+    buf = b''; served = 0
+    def more():
+        nonlocal buf
+        d = c.recv(65536)
+        if not d: raise EOFError
+        buf += d
+    try:
+        while True:
+            while b'\r\n\r\n' not in buf: more()
+            head, buf = buf.split(b'\r\n\r\n', 1)
+            lines = head.decode().split('\r\n')
+            verb, url, _ = lines[0].split(' ', 2)
+            hdr = {}
+            for l in lines[1:]:
+                k, v = l.split(':', 1); hdr[k.strip().lower()] = v.strip()
+            body = b''
+            if hdr.get('transfer-encoding') == 'chunked':
+                while True:
+                    while b'\r\n' not in buf: more()
+                    n, buf = buf.split(b'\r\n', 1); n = int(n, 16)
+                    while len(buf) < n + 2: more()
+                    body += buf[:n]; buf = buf[n+2:]
+                    if n == 0: break
+            elif 'content-length' in hdr:
+                n = int(hdr['content-length'])
+                while len(buf) < n: more()
+                body, buf = buf[:n], buf[n:]
+            log('%s %s' % (verb, url))
+            youngest = len(REVS) - 1
+            served += 1
+            close = KMAX and served >= KMAX
+            extra = 'Connection: close\r\n' if close else 'Keep-Alive: timeout=5, max=%d\r\n' % (KMAX - served if KMAX else 100)
+            if verb == 'OPTIONS':
+                out = resp('200 OK', '<?xml version="1.0" encoding="utf-8"?><D:options-response xmlns:D="DAV:"></D:options-response>\n',
+                    extra + 'SVN-Youngest-Rev: %d\r\nSVN-Repository-Root: /repo\r\nSVN-Rev-Root-Stub: /repo/!svn/rvr\r\nSVN-Me-Resource: /repo/!svn/me\r\n' % youngest +
+                    ('DAV: http://subversion.tigris.org/xmlns/dav/svn/inline-props\r\n' if INLINE else ''))
+            elif verb == 'REPORT' and b'log-report' in body:
+                r = int(re.search(rb'<S:start-revision>(\d+)', body).group(1)); R = REVS[r]
+                x = '<?xml version="1.0" encoding="utf-8"?><S:log-report xmlns:S="svn:" xmlns:D="DAV:"><S:log-item><D:version-name>%d</D:version-name><D:creator-displayname>%s</D:creator-displayname><S:date>%s</S:date><D:comment>%s</D:comment></S:log-item></S:log-report>\n' % (r, R['author'], R['date'], R['msg'])
+                out = resp('200 OK', x, extra)
+            elif verb == 'REPORT':
+                rev = int(re.search(rb'<S:target-revision>(\d+)', body).group(1))
+                src = re.search(rb'<S:src-path>/repo/?([^<]*)</S:src-path>', body).group(1).decode().strip('/')
+                tree = REVS[rev]['tree']; pre = src + '/' if src else ''
+                x = '<?xml version="1.0" encoding="utf-8"?><S:update-report xmlns:S="svn:" xmlns:V="http://subversion.tigris.org/xmlns/dav/" xmlns:D="DAV:" %s><S:target-revision rev="%d"/><S:open-directory rev="%d">' % ('inline-props="true"' if INLINE else '', rev, rev)
+                for k in sorted(tree):
+                    if not k.startswith(pre): continue
+                    n = tree[k]
+                    if n[0] == 'dir':
+                        x += '<S:add-directory name="%s"><D:checked-in><D:href>/repo/!svn/ver/%d/%s</D:href></D:checked-in></S:add-directory>' % (k.rsplit('/', 1)[-1], lc(k, rev), k)
+                for k in sorted(tree):
+                    if not k.startswith(pre): continue
+                    n = tree[k]
+                    if n[0] == 'file':
+                        props = ''
+                        if INLINE:
+                            for pk, pv in n[2].items(): props += '<S:set-prop name="%s">%s</S:set-prop>' % (pk, pv.decode())
+                        x += '<S:add-file name="%s"><D:checked-in><D:href>/repo/!svn/ver/%d/%s</D:href></D:checked-in>%s<S:prop><V:md5-checksum>%s</V:md5-checksum></S:prop></S:add-file>' % (k.rsplit('/', 1)[-1], lc(k, rev), k, props, md5(n[1]))
+                x += '</S:open-directory></S:update-report>\n'
+                out = resp('200 OK', x, extra)
+            elif verb in ('PROPFIND', 'GET'):
+                rv = parse_rv(url)
+                n = REVS[rv[0]]['tree'].get(rv[1]) if rv else None
+                if n is None or n[0] != 'file':
+                    out = resp('404 Not Found', '<?xml version="1.0" encoding="utf-8"?><D:error xmlns:D="DAV:" xmlns:m="http://apache.org/dav/xmlns"><m:human-readable errcode="160013">not found %s</m:human-readable></D:error>' % url, extra)
+                elif verb == 'GET':
+                    out = resp('200 OK', n[1], extra + 'ETag: "%d//%s"\r\nLast-Modified: %s\r\nCache-Control: max-age=604800\r\n' % (lc(rv[1], rv[0]), rv[1], httpdate(rv[1], rv[0])))
+                else:
+                    x = '<?xml version="1.0" encoding="utf-8"?><D:multistatus xmlns:D="DAV:" xmlns:S="http://subversion.tigris.org/xmlns/svn/" xmlns:lp1="DAV:"><D:response><D:href>%s</D:href><D:propstat><D:prop><lp1:getcontentlength>%d</lp1:getcontentlength><lp1:getlastmodified>%s</lp1:getlastmodified>%s%s</D:prop><D:status>HTTP/1.1 200 OK</D:status></D:propstat></D:response></D:multistatus>\n' % (url, len(n[1]), httpdate(rv[1], rv[0]), '<S:executable/>' if n[2].get('svn:executable') else '', '<S:special>*</S:special>' if n[2].get('svn:special') else '')
+                    out = resp('207 Multi-Status', x, extra)
+            else:
+                out = resp('405 Method Not Allowed', 'no', extra)
+            STALL[1] += 1
+            if STALL[0] and STALL[1] in STALL[0]:
+                c.sendall(out[:len(out)//2]); _t.sleep(3600)
+            c.sendall(out)
+            if close:
+                c.shutdown(socket.SHUT_RDWR); c.close(); return
+    except (EOFError, ConnectionResetError, BrokenPipeError):
+        return
+
+def main():
+    port = int(sys.argv[1])
+    ls = socket.socket(); ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ls.bind(('127.0.0.1', port)); ls.listen(50)
+    print(ls.getsockname()[1], flush=True)
+    while True:
+        c, _ = ls.accept()
+        threading.Thread(target=handle, args=(c,), daemon=True).start()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+# gendump.py OUT : writes the repository model as a dumpfile using Text-delta and
+# Prop-delta (svndiff1), with a sixth revision replacing a directory by a copy,
+# dropping a property through a delta and replacing a symlink.
+import sys, os, hashlib
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import model as m
+
+def pb(props, delta=False, old=None):
+    o = b''
+    for k, v in sorted(props.items()):
+        if delta and old and old.get(k) == v: continue
+        o += b'K %d\n%s\nV %d\n%s\n' % (len(k), k.encode(), len(v), v)
+    if delta and old:
+        for k in old:
+            if k not in props: o += b'D %d\n%s\n' % (len(k), k.encode())
+    return o + b'PROPS-END\n'
+out = open(sys.argv[1], 'wb')
+out.write(b'SVN-fs-dump-format-version: 3\n\nUUID: %s\n\n' % m.UUID.encode())
+def node(path, kind, action, props=None, text=None, base=b'', copy=None, pdelta=False, oldprops=None):
+    h = b'Node-path: %s\n' % path.encode()
+    if kind: h += b'Node-kind: %s\n' % kind.encode()
+    h += b'Node-action: %s\n' % action.encode()
+    if copy: h += b'Node-copyfrom-rev: %d\nNode-copyfrom-path: %s\n' % (copy[1], copy[0].encode())
+    body = b''
+    if props is not None:
+        p = pb(props, pdelta, oldprops)
+        if pdelta: h += b'Prop-delta: true\n'
+        h += b'Prop-content-length: %d\n' % len(p); body += p
+    if text is not None:
+        d = m.svndiff(base, text, 1)
+        h += b'Text-delta: true\nText-content-length: %d\nText-content-md5: %s\n' % (len(d), hashlib.md5(text).hexdigest().encode()); body += d
+    if body: h += b'Content-length: %d\n' % len(body)
+    out.write(h + b'\n' + body + b'\n\n')
+for r, R in enumerate(m.REVS):
+    rp = pb({'svn:author': R['author'].encode(), 'svn:date': R['date'].encode(), 'svn:log': R['msg'].encode()})
+    out.write(b'Revision-number: %d\nProp-content-length: %d\nContent-length: %d\n\n' % (r, len(rp), len(rp)) + rp + b'\n')
+    if r == 0: continue
+    prev = m.REVS[r-1]['tree']; tree = R['tree']
+    if r == 3:
+        node('trunk/src/f5.c', None, 'delete')
+        node('trunk/doc/moved.c', 'file', 'add', copy=('trunk/src/f6.c', 2))
+        node('trunk/src/f6.c', None, 'delete')
+    if r == 4:
+        node('trunk/doc2', 'dir', 'add', copy=('trunk/doc', 3))
+    for p in sorted(tree):
+        if p == '' or (r in (3,4) and (p.startswith('trunk/doc') )): continue
+        n = tree[p]; o = prev.get(p)
+        if o is None:
+            if n[0] == 'dir': node(p, 'dir', 'add', props=n[1])
+            else: node(p, 'file', 'add', props=n[2], text=n[1])
+        elif o != n and n[0] == 'file':
+            node(p, 'file', 'change', props=n[2] if n[2] != o[2] else None, text=n[1] if n[1] != o[1] else None, base=o[1], pdelta=True, oldprops=o[2])
+# rev 6: replace doc2 by a copy of src, make run.sh non-executable via prop delta, replace link
+rp = pb({'svn:author': b'x', 'svn:date': b'2021-03-01T00:00:00.000000Z', 'svn:log': b'r6'})
+out.write(b'Revision-number: 6\nProp-content-length: %d\nContent-length: %d\n\n' % (len(rp), len(rp)) + rp + b'\n')
+node('trunk/doc2', 'dir', 'replace', copy=('trunk/src', 5))
+node('trunk/run.sh', 'file', 'change', props={}, pdelta=True, oldprops={'svn:executable': b'*'})
+node('trunk/link', 'file', 'replace', props={'svn:special': b'*'}, text=b'link src')
+out.close()
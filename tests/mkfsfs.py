@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+# mkfsfs.py DIR FORMAT(6|7) SHARD PACK(0|1) SVNDIFF(0|1)
+# writes the repository model as an FSFS repository: FORMAT 7 is logically
+# addressed, SHARD 0 is a linear layout, PACK packs the full shards.
+import sys, os, hashlib
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from model import *
+import model as m
+
+out, fmt, shard, pack, sdv = sys.argv[1], int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4]), int(sys.argv[5])
+logical = fmt >= 7
+
+os.makedirs(out + '/db/revs', exist_ok=True); os.makedirs(out + '/db/revprops', exist_ok=True)
+open(out + '/format', 'w').write('5\n')
+open(out + '/db/format', 'w').write('%d\n%s%s' % (fmt, 'layout sharded %d\n' % shard if shard else 'layout linear\n', 'addressing logical\n' if logical else ('addressing physical\n' if fmt >= 7 else '')))
+open(out + '/db/uuid', 'w').write(m.UUID + '\n')
+youngest = len(m.REVS) - 1
+open(out + '/db/current', 'w').write('%d\n' % youngest)
+
+# per path: (rev, item, text_rep_ref, content) of latest noderev
+nodes = {}
+bodies = []   # per rev: (body bytes, items dict item->offset, root item)
+nid = [0]
+for r, R in enumerate(m.REVS):
+    tree = R['tree']
+    body = bytearray(); items = {}; nextitem = [3]
+    def additem(data, fixed=None):
+        if logical:
+            it = fixed if fixed is not None else nextitem[0]
+            if fixed is None: nextitem[0] += 1
+            items[it] = len(body)
+        else:
+            it = len(body)
+        body.extend(data); return it
+    def rep(content, base=None):
+        if base is not None:
+            d = svndiff(base[3], content, sdv)
+            hdr = b'DELTA %d %d %d\n' % (base[2][0], base[2][1], base[2][2])
+        elif r % 2 == 0 and len(content) > 10:
+            d = svndiff(b'', content, sdv); hdr = b'DELTA\n'
+        else:
+            d = content; hdr = b'PLAIN\n'
+        it = additem(hdr + d + b'ENDREP\n')
+        return (r, it, len(d), len(content), hashlib.md5(content).hexdigest())
+    def reptext(ref):
+        return b'%d %d %d %d %s' % (ref[0], ref[1], ref[2], ref[3] if ref[3] != ref[2] or True else 0, ref[4].encode())
+    def noderev(path, kind, text, props, fixed=None):
+        nid[0] += 1
+        s = b'id: %d-0.0.r%d/%s\ntype: %s\ncount: 0\n' % (nid[0], r, b'%ITEM%', kind.encode())
+        if text: s += b'text: ' + reptext(text) + b'\n'
+        if props: s += b'props: ' + reptext(props) + b'\n'
+        s += b'cpath: /' + path.encode() + b'\n\n'
+        if logical:
+            it = fixed if fixed is not None else nextitem[0]
+            if fixed is None: nextitem[0] += 1
+            s = s.replace(b'%ITEM%', str(it).encode())
+            items[it] = len(body); body.extend(s)
+        else:
+            it = len(body); s = s.replace(b'%ITEM%', str(it).encode()); body.extend(s)
+        return it
+    def build(path):
+        n = tree[path]
+        if n[0] == 'file':
+            old = nodes.get(path)
+            if old and old[4] == n:
+                return old
+            base = old if (old and r % 3 != 0 and old[3]) else None
+            text = rep(n[1], base) if (n[1] or r % 2 == 0) else None
+            props = rep(hashdump(n[2])) if n[2] else None
+            it = noderev(path, 'file', text, props)
+            v = (r, it, text, n[1], n); nodes[path] = v; return v
+        ents = {}
+        pre = path + '/' if path else ''
+        for k in sorted(tree):
+            if k.startswith(pre) and k != path and '/' not in k[len(pre):]:
+                c = build(k)
+                ents[k[len(pre):]] = (b'%s %d-0.0.r%d/%d' % (tree[k][0].encode(), 1, c[0], c[1]))
+        text = rep(hashdump(ents))
+        props = rep(hashdump(n[1])) if n[1] else None
+        it = noderev(path, 'dir', text, props, fixed=2 if path == '' else None)
+        v = (r, it, text, b'', n); return v
+    root = build('')
+    if logical:
+        items[1] = len(body); body.extend(b'\n')   # empty changes list
+        cp = items[1]
+    else:
+        cp = len(body); body.extend(b'\n')
+    bodies.append((bytes(body), items, root[1], cp))
+
+def l2p(first, revitems, page_size=4):
+    hdr = b'L2P-INDEX\n' + lvarint(first) + lvarint(len(revitems)) + lvarint(page_size)
+    pages = []; perrev = []
+    for items, base in revitems:
+        n = max(items) + 1 if items else 1
+        cnt = 0
+        for p0 in range(0, n, page_size):
+            ents = []
+            for i in range(p0, min(n, p0 + page_size)):
+                ents.append(items[i] + base + 1 if i in items else 0)
+            data = bytearray(); last = 0
+            for v in ents:
+                d = v - last; last = v
+                data += lvarint(2 * d if d >= 0 else -1 - 2 * d)
+            pages.append((bytes(data), len(ents))); cnt += 1
+        perrev.append(cnt)
+    hdr += lvarint(len(pages))
+    for c in perrev: hdr += lvarint(c)
+    for d, e in pages: hdr += lvarint(len(d)) + lvarint(e)
+    return hdr + b''.join(d for d, e in pages)
+
+def finish(first, parts):
+    # parts: list of (body, items, root, cp); returns full file bytes
+    data = bytearray(); revitems = []; offs = []
+    for body, items, root, cp in parts:
+        offs.append(len(data)); revitems.append((items, len(data))); data += body
+        if not logical and len(parts) == 1:
+            data += b'\n%d %d\n' % (root, cp)
+    if logical:
+        l2po = len(data); data += l2p(first, revitems)
+        p2lo = len(data); data += b'P2L-INDEX\n\x00'
+        f = b'%d %s %d %s' % (l2po, hashlib.md5(b'x').hexdigest().encode(), p2lo, hashlib.md5(b'y').hexdigest().encode())
+        data += f + bytes([len(f)])
+    return bytes(data), offs
+
+def physical_rev(i):
+    body, items, root, cp = bodies[i]
+    return body + b'\n%d %d\n' % (root, cp)
+
+minunpacked = 0
+if pack and shard:
+    minunpacked = ((youngest + 1) // shard) * shard
+open(out + '/db/min-unpacked-rev', 'w').write('%d\n' % minunpacked)
+for r in range(youngest + 1):
+    sd = out + '/db/revs' + ('/%d' % (r // shard) if shard else '')
+    rd = out + '/db/revprops' + ('/%d' % (r // shard) if shard else '')
+    os.makedirs(rd, exist_ok=True)
+    R = m.REVS[r]
+    open(rd + '/%d' % r, 'wb').write(hashdump({'svn:author': R['author'].encode(), 'svn:date': R['date'].encode(), 'svn:log': R['msg'].encode()}))
+    if r < minunpacked: continue
+    os.makedirs(sd, exist_ok=True)
+    if logical:
+        data, _ = finish(r, [bodies[r]])
+    else:
+        data = physical_rev(r)
+    open(sd + '/%d' % r, 'wb').write(data)
+for s0 in (range(0, minunpacked, shard) if shard else []):
+    pd = out + '/db/revs/%d.pack' % (s0 // shard); os.makedirs(pd, exist_ok=True)
+    if logical:
+        data, _ = finish(s0, [bodies[r] for r in range(s0, s0 + shard)])
+        open(pd + '/pack', 'wb').write(data)
+    else:
+        data = bytearray(); man = ''
+        for r in range(s0, s0 + shard):
+            man += '%d\n' % len(data); data += physical_rev(r)
+        open(pd + '/pack', 'wb').write(data); open(pd + '/manifest', 'w').write(man)
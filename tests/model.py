@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+# repository model shared by the svn-lite test servers, writers and checkers.
+# MOCK_REVS sets the number of revisions; MOCK_WIDE, MOCK_DEEP=DEPTH:FAN,
+# MOCK_DUPS and MOCK_MOVE add wide, deep, duplicate and moved content.
+import hashlib, os, random, time, zlib
+
+def md5(b): return hashlib.md5(b).hexdigest()
+
+# repository model: revs[i] = dict(tree=path->node, author, date, msg)
+# node: ('dir', props) or ('file', content, props)
+def build_repo(nrev=5, seed=1):
+    rnd = random.Random(seed)
+    revs = []
+    tree = {'': ('dir', {})}
+    revs.append(dict(tree=dict(tree), author='', date='2020-01-01T00:00:00.000000Z', msg='', changes=[]))
+    for r in range(1, nrev+1):
+        tree = dict(tree)
+        changes = []
+        if r == 1:
+            for d in ['trunk', 'trunk/src', 'trunk/src/deep', 'trunk/src/deep/er', 'trunk/doc', 'trunk/empty']:
+                tree[d] = ('dir', {}); changes.append(('/'+d, 'A', None, 'dir'))
+            for i in range(20):
+                p = 'trunk/src/f%d.c' % i
+                tree[p] = ('file', (b'int x%d;\n' % i) * (i*300+1), {}); changes.append(('/'+p, 'A', None, 'file'))
+            tree['trunk/src/deep/er/big.bin'] = ('file', bytes(rnd.getrandbits(8) for _ in range(50000)), {})
+            changes.append(('/trunk/src/deep/er/big.bin', 'A', None, 'file'))
+            tree['trunk/run.sh'] = ('file', b'#!/bin/sh\necho hi\n', {'svn:executable': b'*'})
+            changes.append(('/trunk/run.sh', 'A', None, 'file'))
+            tree['trunk/link'] = ('file', b'link run.sh', {'svn:special': b'*'})
+            changes.append(('/trunk/link', 'A', None, 'file'))
+            tree['trunk/LICENSE'] = ('file', b'license text\n', {})
+            tree['trunk/doc/LICENSE'] = ('file', b'license text\n', {})
+            tree['trunk/empty.txt'] = ('file', b'', {})
+            for i in range(int(os.environ.get('MOCK_WIDE', '0'))):
+                d = 'trunk/w/d%d' % (i // 50)
+                if 'trunk/w' not in tree: tree['trunk/w'] = ('dir', {})
+                if d not in tree: tree[d] = ('dir', {})
+                tree[d + '/file%d.txt' % i] = ('file', b'w%d\n' % (i % 97), {})
+            if os.environ.get('MOCK_DEEP'):
+                depth, fan = map(int, os.environ['MOCK_DEEP'].split(':'))
+                level = ['trunk/t']
+                tree['trunk/t'] = ('dir', {})
+                for _ in range(depth):
+                    nxt = []
+                    for d in level:
+                        tree[d + '/x.txt'] = ('file', (b'same content\n' * 300) if os.environ.get('MOCK_DUPS') else d.encode() + b'\n', {})
+                        for j in range(fan):
+                            tree[d + '/d%d' % j] = ('dir', {}); nxt.append(d + '/d%d' % j)
+                    level = nxt
+            changes += [('/trunk/LICENSE','A',None,'file'),('/trunk/doc/LICENSE','A',None,'file'),('/trunk/empty.txt','A',None,'file')]
+        else:
+            p = 'trunk/src/f%d.c' % (r % 20)
+            if p not in tree: p = 'trunk/src/f0.c'
+            tree[p] = ('file', tree[p][1] + b'// rev %d\n' % r, {}); changes.append(('/'+p, 'M', None, 'file'))
+            if r == 3:
+                del tree['trunk/src/f5.c']; changes.append(('/trunk/src/f5.c', 'D', None, 'file'))
+                tree['trunk/doc/moved.c'] = ('file', tree['trunk/src/f6.c'][1], {}); changes.append(('/trunk/doc/moved.c', 'A', ('/trunk/src/f6.c', 2), 'file'))
+                del tree['trunk/src/f6.c']; changes.append(('/trunk/src/f6.c', 'D', None, 'file'))
+            if r == 5 and os.environ.get('MOCK_MOVE'):
+                if 'trunk/lib' not in tree: tree['trunk/lib'] = ('dir', {})
+                for i in range(10, 20):
+                    k = 'trunk/src/f%d.c' % i
+                    if k in tree:
+                        tree['trunk/lib/g%d.c' % i] = tree.pop(k)
+                tree['trunk/src/f1.c'], tree['trunk/src/f2.c'] = tree['trunk/src/f2.c'], tree['trunk/src/f1.c']
+                tree['trunk/src/f3.copy'] = tree['trunk/src/f3.c']
+                tree['trunk/src/f3.c'] = ('file', b'rewritten\n', {})
+            if r == 4:
+                for k in list(tree):
+                    if k == 'trunk/doc' or k.startswith('trunk/doc/'):
+                        nk = 'trunk/doc2' + k[len('trunk/doc'):]
+                        tree[nk] = tree[k]
+                changes.append(('/trunk/doc2', 'A', ('/trunk/doc', 3), 'dir'))
+        revs.append(dict(tree=tree, author='user%d' % r, date=time.strftime('%Y-%m-%dT%H:%M:%S.123456Z', time.gmtime(1612174272 + r * 3671)), msg='commit (%d)\nline 2 )' % r, changes=changes))
+    return revs
+
+REVS = build_repo(int(os.environ.get('MOCK_REVS', '5')))
+UUID = '12345678-1234-1234-1234-123456789abc'
+
+def last_changed(path, rev):
+    # revision where node at path last changed
+    node = REVS[rev]['tree'].get(path)
+    r = rev
+    while r > 0 and REVS[r-1]['tree'].get(path) == node: r -= 1
+    return r
+
+# svndiff encoding (version 0 plain, version 1 zlib-compressed sections)
+def bvarint(n):
+    b = [n & 0x7f]; n >>= 7
+    while n: b.append(0x80 | (n & 0x7f)); n >>= 7
+    return bytes(reversed(b))
+
+def lvarint(n):
+    b = bytearray()
+    while n >= 0x80: b.append((n & 0x7f) | 0x80); n >>= 7
+    b.append(n); return bytes(b)
+
+def section(data, sdv):
+    if sdv == 0: return data
+    c = zlib.compress(data)
+    if len(c) < len(data): return bvarint(len(data)) + c
+    return bvarint(len(data)) + data
+
+def svndiff(src, tgt, sdv=0, W=1000):
+    out = b'SVN' + bytes([sdv])
+    for i in range(0, max(len(tgt), 1), W):
+        tv = tgt[i:i+W]; so = min(i, len(src)); sv = src[so:so+W]
+        ins = bytearray(); new = bytearray(); p = 0; lit = 0
+        seen = {}
+        def op(a, l, off=None):
+            ins.append((a << 6) | (l if l < 64 else 0))
+            if l >= 64: ins.extend(bvarint(l))
+            if off is not None: ins.extend(bvarint(off))
+        def flush():
+            nonlocal lit
+            if lit: op(2, lit); lit = 0
+        while p < len(tv):
+            # source match at same relative offset
+            n = 0
+            while p + n < len(tv) and p + n < len(sv) and tv[p+n] == sv[p+n]: n += 1
+            if n >= 4:
+                flush(); op(0, n, p); p += n; continue
+            key = bytes(tv[p:p+8])
+            if len(key) == 8 and key in seen:
+                q = seen[key]; n = 0
+                while p + n < len(tv) and tv[q+n] == tv[p+n]: n += 1
+                if n >= 8:
+                    flush(); op(1, n, q); p += n; continue
+            if len(key) == 8 and key not in seen: seen[key] = p
+            new.append(tv[p]); lit += 1; p += 1
+        flush()
+        si = section(bytes(ins), sdv); sn = section(bytes(new), sdv)
+        out += bvarint(so) + bvarint(len(sv)) + bvarint(len(tv)) + bvarint(len(si)) + bvarint(len(sn)) + si + sn
+        if not tgt: break
+    return out
+
+def hashdump(d):
+    o = b''
+    for k in sorted(d):
+        v = d[k]; k = k.encode() if isinstance(k, str) else k
+        o += b'K %d\n%s\nV %d\n%s\n' % (len(k), k, len(v), v)
+    return o + b'END\n'
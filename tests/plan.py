@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+# plan.py OLD NEW [PREFIX] : prints the counts a dry run of updating a working copy of
+# PREFIX (default: trunk) from OLD to NEW reports (OLD -1: a fresh checkout), taking
+# files whose content the working copy holds from there and downloading duplicates once.
+import sys, os
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import model as m
+
+old, new = int(sys.argv[1]), int(sys.argv[2]); prefix = sys.argv[3] if len(sys.argv) > 3 else 'trunk'
+
+def files(rev):
+    if rev < 0: return {}
+    return {k: n for k, n in m.REVS[rev]['tree'].items() if k.startswith(prefix + '/') and n[0] == 'file'}
+
+before, after = files(old), files(new)
+known = set(m.md5(n[1]) for n in before.values())
+download, relocated, duplicates, seen = 0, 0, 0, set()
+
+for k in sorted(after):
+    n = after[k]
+    if k in before and before[k][1] == n[1]: continue
+    special = n[2].get('svn:special')
+    if not special and m.md5(n[1]) in known: relocated += 1
+    elif not special and n[1] and m.md5(n[1]) in seen: duplicates += 1
+    else:
+        download += 1
+        seen.add(m.md5(n[1]))
+
+print('# download %d files' % download)
+print('# delete %d files' % len([k for k in before if k not in after]))
+print('# copy %d duplicate files locally' % duplicates)
+print('# move or copy %d files already in the working copy' % relocated)
@@ -0,0 +1,223 @@
+#!/bin/sh
+# run.sh [SVN] : runs the svn-lite tests against the binary SVN (default: ./svn).
+# The repositories are generated from the model in model.py, so the checkouts can
+# be compared with it file by file.
+
+SVN=$(cd "$(dirname "${1:-./svn}")" && pwd)/$(basename "${1:-./svn}")
+TESTS=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+FAILED=0
+SERVERS=
+
+trap 'kill $SERVERS 2> /dev/null; rm -rf "$WORK"' EXIT
+
+# check NAME COMMAND... : runs one test and reports it
+check() {
+	name=$1
+	shift
+
+	if "$@" > "$WORK/log" 2>&1; then
+		echo "ok    $name"
+	else
+		echo "FAIL  $name"
+		tail -20 "$WORK/log" | sed 's/^/      /'
+		FAILED=$((FAILED + 1))
+	fi
+}
+
+# serve SCRIPT [NAME=VALUE...] : starts one of the test servers on a free port, with
+# the model variables given, and sets PORT
+serve() {
+	script=$1
+	shift
+
+	rm -f "$WORK/port"
+	env "$@" python3 "$TESTS/$script" 0 > "$WORK/port" 2> /dev/null &
+	SERVERS="$SERVERS $!"
+
+	while [ ! -s "$WORK/port" ]; do
+		sleep 1
+	done
+
+	PORT=$(cat "$WORK/port")
+}
+
+# checkout URL REV [OPTIONS...] : checks out (or updates) $WORK/wc and verifies it
+checkout() {
+	url=$1
+	rev=$2
+	shift 2
+
+	"$SVN" co -r "$rev" "$@" "$url" "$WORK/wc" > /dev/null &&
+	python3 "$TESTS/verify.py" "$WORK/wc" "$rev" trunk
+}
+
+# snapshot DIR : lists every path below DIR with its mode, size, mtime and content
+snapshot() {
+	find "$1" -exec stat -c '%n %a %s %Y' {} + | sort
+	find "$1" -type f -exec md5sum {} + | sort
+}
+
+# planned FILE OLD NEW : checks that the dry run output in FILE reports the downloads,
+# deletions, duplicates and relocations an update from OLD to NEW takes
+planned() {
+	python3 "$TESTS/plan.py" "$2" "$3" > "$WORK/plan" &&
+	while read -r line; do
+		grep -qF "$line" "$1" || { echo "expected: $line"; cat "$1"; return 1; }
+	done < "$WORK/plan"
+}
+
+# dryrun URL : a dry run of updating r2 to r5 reports the model's changes and leaves
+# the working copy as it was
+dryrun() {
+	rm -rf "$WORK/wc"
+	checkout "$1" 2 &&
+	snapshot "$WORK/wc" > "$WORK/before" &&
+	"$SVN" co --dry-run -r 5 "$1" "$WORK/wc" > "$WORK/dry" &&
+	snapshot "$WORK/wc" > "$WORK/after" &&
+	cmp "$WORK/before" "$WORK/after" &&
+	python3 "$TESTS/verify.py" "$WORK/wc" 2 trunk &&
+	planned "$WORK/dry" 2 5
+}
+
+# adopt URL : a dry run of --adopt over an export whose modes are wrong reports the
+# files it would keep and leaves them as they were
+adopt() {
+	rm -rf "$WORK/wc"
+	"$SVN" export -r 5 "$1" "$WORK/wc" > /dev/null &&
+	chmod 600 "$WORK/wc/LICENSE" "$WORK/wc/run.sh" &&
+	snapshot "$WORK/wc" > "$WORK/before" &&
+	"$SVN" co --dry-run --adopt -r 5 "$1" "$WORK/wc" > "$WORK/dry" &&
+	grep -q "^# keep [1-9]" "$WORK/dry" &&
+	snapshot "$WORK/wc" > "$WORK/after" &&
+	cmp "$WORK/before" "$WORK/after"
+}
+
+# relocate URL : an update from r2 to r5 of a repository whose r5 moves, swaps and
+# copies files (MOCK_MOVE) takes them from the working copy
+relocate() (
+	export MOCK_MOVE=1
+
+	dryrun "$1" &&
+	checkout "$1" 5
+)
+
+# reference URL : a checkout with --reference to another working copy clones the
+# files from there and leaves that working copy as it was
+reference() {
+	rm -rf "$WORK/wc" "$WORK/wc2"
+	checkout "$1" 5 &&
+	snapshot "$WORK/wc" > "$WORK/before" &&
+	"$SVN" co --dry-run -r 5 --reference "$WORK/wc" "$1" "$WORK/wc2" > "$WORK/dry" &&
+	grep -q "^# clone [1-9]" "$WORK/dry" &&
+	"$SVN" co -r 5 --reference "$WORK/wc" "$1" "$WORK/wc2" > /dev/null &&
+	python3 "$TESTS/verify.py" "$WORK/wc2" 5 trunk &&
+	snapshot "$WORK/wc" > "$WORK/after" &&
+	cmp "$WORK/before" "$WORK/after"
+}
+
+# dedup MODE URL : a checkout with --dedup MODE makes the duplicates hard links
+# with hardlink and files of their own otherwise
+dedup() {
+	rm -rf "$WORK/wc"
+	checkout "$2" 5 --dedup "$1" &&
+	find "$WORK/wc" -type f -links +1 > "$WORK/linked" &&
+	if [ "$1" = hardlink ]; then
+		[ -s "$WORK/linked" ]
+	else
+		[ ! -s "$WORK/linked" ]
+	fi
+}
+
+# remote URL : checks out r2 of a served repository and updates it to r5
+remote() {
+	rm -rf "$WORK/wc"
+	checkout "$1" 2 &&
+	checkout "$1" 5
+}
+
+# faults URL SCHEDULE : checks out a served repository while --faults breaks the
+# transfer, which must be recovered from without a wrong byte
+faults() {
+	rm -rf "$WORK/wc"
+	"$SVN" co -r 5 --stats --faults "$2" "$1" "$WORK/wc" > "$WORK/stats" &&
+	python3 "$TESTS/verify.py" "$WORK/wc" 5 trunk &&
+	grep "reconnects" "$WORK/stats" | grep -qv " 0 reconnects"
+}
+
+# fsfs FORMAT SHARD PACK SVNDIFF : checks out and updates a file:// repository
+fsfs() {
+	rm -rf "$WORK/fs" "$WORK/wc"
+	python3 "$TESTS/mkfsfs.py" "$WORK/fs" "$@" &&
+	checkout "file://$WORK/fs/trunk" 2 &&
+	checkout "file://$WORK/fs/trunk" 5
+}
+
+# fsfs_svnadmin : round trips the model through a repository svnadmin created
+fsfs_svnadmin() {
+	rm -rf "$WORK/fs" "$WORK/wc"
+	python3 "$TESTS/gendump.py" "$WORK/model.dump" &&
+	svnadmin create "$WORK/fs" &&
+	svnadmin load -q "$WORK/fs" < "$WORK/model.dump" &&
+	checkout "file://$WORK/fs/trunk" 5
+}
+
+# siblings : a dumpfile where src.c sorts between src and src/a.c; deleting src
+# and copying src@1 must still find src/a.c
+siblings() {
+	rev() { printf 'Revision-number: %d\nProp-content-length: 10\nContent-length: 10\n\nPROPS-END\n\n' "$1"; }
+	dir() { printf 'Node-path: %s\nNode-kind: dir\nNode-action: add\n%s\n\n' "$1" "$2"; }
+	file() { printf 'Node-path: %s\nNode-kind: file\nNode-action: add\nProp-content-length: 10\nText-content-length: 2\nContent-length: 12\n\nPROPS-END\n%s\n\n\n' "$1" "$2"; }
+
+	rm -rf "$WORK/wc2" "$WORK/wc3"
+	{
+		printf 'SVN-fs-dump-format-version: 2\n\n'
+		rev 0
+		rev 1; dir src; file src.c c; dir src-old; file src/a.c a
+		rev 2; printf 'Node-path: src\nNode-action: delete\n\n\n'
+		rev 3; dir lib "$(printf 'Node-copyfrom-rev: 1\nNode-copyfrom-path: src')"
+	} > "$WORK/siblings.dump" &&
+	"$SVN" co "dump:$WORK/siblings.dump@2" "$WORK/wc2" > /dev/null &&
+	"$SVN" co "dump:$WORK/siblings.dump@3" "$WORK/wc3" > /dev/null &&
+	[ ! -e "$WORK/wc2/src" ] && [ -f "$WORK/wc2/src.c" ] && [ -d "$WORK/wc2/src-old" ] &&
+	[ "$(cat "$WORK/wc3/lib/a.c")" = a ] && [ ! -e "$WORK/wc3/src" ]
+}
+
+check "fsfs format 6, linear, plain" fsfs 6 0 0 0
+check "fsfs format 6, sharded, svndiff1" fsfs 6 2 0 1
+check "fsfs format 6, packed" fsfs 6 2 1 1
+check "fsfs format 7, logical addressing" fsfs 7 0 0 1
+check "fsfs format 7, packed" fsfs 7 2 1 1
+check "fsfs format 7, sharded, svndiff0" fsfs 7 3 0 0
+
+if command -v svnadmin > /dev/null; then
+	check "fsfs created by svnadmin" fsfs_svnadmin
+else
+	echo "skip  fsfs created by svnadmin (no svnadmin)"
+fi
+
+check "dumpfile subtree next to sorting siblings" siblings
+
+serve svnserve.py
+SVN_URL=svn://127.0.0.1:$PORT/trunk
+serve davserve.py
+DAV_URL=http://127.0.0.1:$PORT/repo/trunk
+serve svnserve.py MOCK_MOVE=1
+SVN_MOVE_URL=svn://127.0.0.1:$PORT/trunk
+serve davserve.py MOCK_MOVE=1
+DAV_MOVE_URL=http://127.0.0.1:$PORT/repo/trunk
+
+check "svn:// checkout and update" remote "$SVN_URL"
+check "http:// checkout and update" remote "$DAV_URL"
+check "svn:// dry run of an update" dryrun "$SVN_URL"
+check "http:// dry run of an update" dryrun "$DAV_URL"
+check "svn:// dry run of --adopt" adopt "$SVN_URL"
+check "svn:// update over moved and copied files" relocate "$SVN_MOVE_URL"
+check "http:// update over moved and copied files" relocate "$DAV_MOVE_URL"
+check "svn:// checkout with --reference" reference "$SVN_URL"
+check "svn:// checkout with --dedup hardlink" dedup hardlink "$SVN_URL"
+check "svn:// checkout with --dedup copy" dedup copy "$SVN_URL"
+check "svn:// checkout with injected faults" faults "$SVN_URL" 5:32768
+check "http:// checkout with injected faults" faults "$DAV_URL" 5:32768
+
+[ "$FAILED" -eq 0 ] || { echo "$FAILED failed"; exit 1; }
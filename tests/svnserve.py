@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+# svnserve.py PORT [BASE] : serves the repository model in model.py over svn://
+# (ra_svn), enough of it for svn-lite.  PORT 0 picks a free port; the port is printed.
+# MOCK_DELAY and MOCK_RTT delay each command or each read, MOCK_STALL=N stalls the
+# Nth response halfway through.
+import socket, sys, threading, os, time
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from model import REVS, UUID, md5, last_changed
+
+def s(b):
+    if isinstance(b, str): b = b.encode()
+    return b'%d:' % len(b) + b
+
+class Parser:
+    def __init__(self, conn):
+        self.c = conn; self.buf = b''
+    def more(self):
+        d = self.c.recv(65536)
+        if not d: raise EOFError
+        if RTT: time.sleep(RTT)
+        self.buf += d
+    def peek(self):
+        while True:
+            self.buf = self.buf.lstrip(b' \n')
+            if self.buf: return self.buf[0:1]
+            self.more()
+    def item(self):
+        ch = self.peek()
+        if ch == b'(':
+            self.buf = self.buf[1:]
+            l = []
+            while True:
+                ch = self.peek()
+                if ch == b')':
+                    self.buf = self.buf[1:]; return l
+                l.append(self.item())
+        # number / string / word
+        i = 0
+        while True:
+            while i >= len(self.buf): self.more()
+            c = self.buf[i:i+1]
+            if c in b' \n()' : break
+            if c == b':' and self.buf[:i].isdigit():
+                n = int(self.buf[:i])
+                while len(self.buf) < i+1+n: self.more()
+                v = self.buf[i+1:i+1+n]; self.buf = self.buf[i+1+n:]
+                return v
+            i += 1
+        tok = self.buf[:i]; self.buf = self.buf[i:]
+        if tok.isdigit(): return int(tok)
+        return ('w', tok.decode())
+
+def proplist(props):
+    return b'( ' + b''.join(b'( ' + s(k) + b' ' + s(v) + b' ) ' for k, v in sorted(props.items())) + b') '
+
+DELAY = float(os.environ.get('MOCK_DELAY', '0'))
+RTT = float(os.environ.get('MOCK_RTT', '0'))
+
+CHILDREN = {}
+def children(rev, pp):
+    if rev not in CHILDREN:
+        idx = {}
+        for k in sorted(REVS[rev]['tree']):
+            if k: idx.setdefault(k.rsplit('/', 1)[0] if '/' in k else '', []).append(k)
+        CHILDREN[rev] = idx
+    return CHILDREN[rev].get(pp, [])
+
+STALL = [int(os.environ.get('MOCK_STALL', '0')), 0]
+def stall_out(conn, b):
+    STALL[1] += 1
+    if STALL[0] and STALL[1] == STALL[0] and len(b) > 1:
+        conn.sendall(b[:len(b)//2]); time.sleep(3600)
+    conn.sendall(b)
+
+def handle(conn, base):
+    p = Parser(conn)
+    out = lambda b: stall_out(conn, b)
+    out(b'( success ( 2 2 ( ) ( edit-pipeline svndiff1 absent-entries depth inherited-props log-revprops ) ) ) ')
+    greet = p.item()
+    url = greet[2].decode()
+    path = url.split('/', 3)[3] if url.count('/') >= 3 else ''
+    path = path[len(base):].strip('/') if path.startswith(base) else path
+    out(b'( success ( ( ANONYMOUS ) 0: ) ) ')
+    p.item()
+    out(b'( success ( ) ) ( success ( ' + s(UUID) + b' ' + s('svn://localhost/' + base) + b' ( mergeinfo ) ) ) ')
+    youngest = len(REVS) - 1
+    while True:
+        try:
+            cmd = p.item()
+        except EOFError:
+            return
+        if DELAY: time.sleep(DELAY)
+        name = cmd[0][1]; args = cmd[1]
+        auth = b'( success ( ( ) 0: ) ) '
+        def rp(a):
+            a = a.decode().strip('/')
+            return '/'.join(x for x in [path, a] if x)
+        if name == 'get-latest-rev':
+            out(auth + b'( success ( %d ) ) ' % youngest)
+        elif name == 'reparent':
+            u = args[0].decode(); path = u.split('/', 3)[3] if u.count('/') >= 3 else ''
+            path = path[len(base):].strip('/') if path.startswith(base) else path
+            out(auth + b'( success ( ) ) ')
+        elif name == 'check-path':
+            rev = args[1][0] if args[1] else youngest
+            n = REVS[rev]['tree'].get(rp(args[0]))
+            out(auth + b'( success ( %s ) ) ' % (b'none' if n is None else n[0].encode()))
+        elif name == 'stat':
+            rev = args[1][0] if args[1] else youngest
+            pp = rp(args[0]); n = REVS[rev]['tree'].get(pp)
+            if n is None:
+                out(auth + b'( success ( ( ) ) ) ')
+            else:
+                lc = last_changed(pp, rev)
+                size = len(n[1]) if n[0] == 'file' else 0
+                out(auth + b'( success ( ( ( %s %d false %d ( %s ) ( %s ) ) ) ) ) ' % (n[0].encode(), size, lc, s(REVS[lc]['date']), s(REVS[lc]['author'])))
+        elif name == 'get-dir':
+            rev = args[1][0] if args[1] else youngest
+            pp = rp(args[0]); want_props = args[2] == ('w', 'true'); want_contents = args[3] == ('w', 'true')
+            n = REVS[rev]['tree'].get(pp)
+            if n is None or n[0] != 'dir':
+                out(auth + b'( failure ( ( 160013 ' + s("path not found") + b' 0: 0 ) ) ) ')
+                continue
+            ents = b''
+            pre = pp + '/' if pp else ''
+            for k in children(rev, pp):
+                if True:
+                    e = REVS[rev]['tree'][k]
+                    lc = last_changed(k, rev)
+                    size = len(e[1]) if e[0] == 'file' else 0
+                    ents += b'( ' + s(k[len(pre):]) + b' %s %d false %d ( %s ) ( %s ) ) ' % (e[0].encode(), size, lc, s(REVS[lc]['date']), s(REVS[lc]['author']))
+            out(auth + b'( success ( %d ' % rev + (proplist(n[1]) if want_props else b'( ) ') + b'( ' + ents + b') ) ) ')
+        elif name == 'get-file':
+            rev = args[1][0] if args[1] else youngest
+            pp = rp(args[0]); want_props = args[2] == ('w', 'true'); want_contents = args[3] == ('w', 'true')
+            n = REVS[rev]['tree'].get(pp)
+            if n is None or n[0] != 'file':
+                out(auth + b'( failure ( ( 160013 ' + s("path not found " + pp) + b' 0: 0 ) ) ) ')
+                continue
+            props = dict(n[2]) if want_props else {}
+            if want_props:
+                lc = last_changed(pp, rev)
+                props['svn:entry:committed-date'] = REVS[lc]['date'].encode()
+                props['svn:entry:committed-rev'] = str(lc).encode()
+            resp = auth + b'( success ( ( ' + s(md5(n[1])) + b' ) %d ' % rev + proplist(props) + b') ) '
+            if want_contents:
+                c = n[1]
+                for i in range(0, len(c), 4096):
+                    resp += s(c[i:i+4096]) + b' '
+                resp += b'0: ( success ( ) ) '
+            out(resp)
+        elif name == 'rev-proplist':
+            R = REVS[args[0]]
+            props = {'svn:date': R['date'].encode()}
+            if args[0]: props.update({'svn:author': R['author'].encode(), 'svn:log': R['msg'].encode(), 'custom:prop': b'x ( y'})
+            out(auth + b'( success ( ' + proplist(props) + b') ) ')
+        elif name == 'log':
+            paths = args[0]; start = args[1][0]; end = args[2][0]
+            changed = args[3] == ('w', 'true')
+            resp = auth
+            step = 1 if end >= start else -1
+            for r in range(start, end + step, step):
+                R = REVS[r]
+                cp = b''
+                if changed:
+                    for (cpath, act, cf, kind) in R['changes']:
+                        cfs = b'( ' + s(cf[0]) + b' %d ) ' % cf[1] if cf else b'( ) '
+                        cp += b'( ' + s(cpath) + b' ' + act.encode() + b' ' + cfs + b'( ' + kind.encode() + b' true false ) ) '
+                resp += b'( ( ' + cp + b') %d ( ' % r + s(R['author']) + b' ) ( ' + s(R['date']) + b' ) ( ' + s(R['msg']) + b' ) false false 0 ( ) false ) '
+            resp += b'done ( success ( ) ) '
+            out(resp)
+        else:
+            out(auth + b'( failure ( ( 210001 ' + s("unknown command " + name) + b' 0: 0 ) ) ) ')
+
+def serve(conn, base):
+    try:
+        handle(conn, base)
+    except OSError:
+        pass
+    conn.close()
+
+def main():
+    port = int(sys.argv[1]); base = sys.argv[2] if len(sys.argv) > 2 else 'repo'
+    ls = socket.socket(); ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ls.bind(('127.0.0.1', port)); ls.listen(50)
+    print(ls.getsockname()[1], flush=True)
+    while True:
+        c, _ = ls.accept()
+        threading.Thread(target=serve, args=(c, base), daemon=True).start()
+
+if __name__ == '__main__':
+    main()
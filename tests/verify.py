@@ -0,0 +1,24 @@
+#!/usr/bin/env python3
+# verify.py WC REV [PREFIX] : compares a working copy with the model's tree
+import sys, os
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import model as m
+wc, rev = sys.argv[1], int(sys.argv[2]); prefix = sys.argv[3] if len(sys.argv) > 3 else 'trunk'
+tree = m.REVS[rev]['tree']; bad = 0; seen = set()
+for k, n in tree.items():
+    if not (k.startswith(prefix + '/')): continue
+    rel = k[len(prefix)+1:]; p = os.path.join(wc, rel); seen.add(rel)
+    if n[0] == 'dir':
+        if not os.path.isdir(p): print('missing dir', rel); bad += 1
+    elif n[2].get('svn:special'):
+        if not os.path.islink(p) or os.readlink(p) != n[1][5:].decode(): print('bad link', rel); bad += 1
+    else:
+        if not os.path.isfile(p) or open(p,'rb').read() != n[1]: print('bad file', rel); bad += 1
+        elif bool(os.stat(p).st_mode & 0o100) != bool(n[2].get('svn:executable')): print('bad mode', rel); bad += 1
+for root, dirs, files in os.walk(wc):
+    if '.svnup' in dirs: dirs.remove('.svnup')
+    for f in files + dirs:
+        rel = os.path.relpath(os.path.join(root, f), wc)
+        if rel not in seen: print('extra', rel); bad += 1
+print('OK' if not bad else 'FAIL %d' % bad)
+sys.exit(1 if bad else 0)